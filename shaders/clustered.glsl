@@ -0,0 +1,39 @@
+// Shared between light_cull.comp and simple.frag, must match src/lighting.h
+
+const uint CLUSTER_GRID_X = 16;
+const uint CLUSTER_GRID_Y = 9;
+const uint CLUSTER_GRID_Z = 24;
+const uint CLUSTER_COUNT = CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z;
+const uint MAX_LIGHTS_PER_CLUSTER = 127;
+const uint CLUSTER_STRIDE = MAX_LIGHTS_PER_CLUSTER + 1;
+
+struct PointLight {
+    vec4 positionRadius;
+    vec4 color;
+};
+
+layout(std430, binding = 1) readonly buffer LightBuffer {
+    PointLight lights[];
+};
+
+layout(push_constant) uniform ClusterParams {
+    uint lightCount;
+    float zNear;
+    float zFar;
+    float screenWidth;
+    float screenHeight;
+} params;
+
+// exponential depth slicing, keeps froxels roughly cubic along the view direction
+uint depthSlice(float viewDepth) {
+    float slice = log(viewDepth / params.zNear) / log(params.zFar / params.zNear) * float(CLUSTER_GRID_Z);
+    return uint(clamp(slice, 0.0, float(CLUSTER_GRID_Z - 1)));
+}
+
+float sliceDepth(uint slice) {
+    return params.zNear * pow(params.zFar / params.zNear, float(slice) / float(CLUSTER_GRID_Z));
+}
+
+uint clusterIndex(uvec3 cluster) {
+    return cluster.x + CLUSTER_GRID_X * (cluster.y + CLUSTER_GRID_Y * cluster.z);
+}
@@ -1,2 +1,34 @@
-glslc simple.vert -o bin/vert.spv
-glslc simple.frag -o bin/frag.spv
\ No newline at end of file
+# compiler and packer can be overridden, the build runs this with both set
+set -e
+GLSLC=${GLSLC:-glslc}
+mkdir -p bin
+
+"$GLSLC" simple.vert -o bin/vert.spv
+"$GLSLC" simple.frag -o bin/frag.spv
+"$GLSLC" fallback.frag -o bin/fallback_frag.spv
+"$GLSLC" light_cull.comp -o bin/light_cull.spv
+"$GLSLC" text.vert -o bin/text_vert.spv
+"$GLSLC" text.frag -o bin/text_frag.spv
+"$GLSLC" particle_reset.comp -o bin/particle_reset.spv
+"$GLSLC" particle_emit.comp -o bin/particle_emit.spv
+"$GLSLC" particle_prepare.comp -o bin/particle_prepare.spv
+"$GLSLC" particle_simulate.comp -o bin/particle_simulate.spv
+"$GLSLC" particle_finalize.comp -o bin/particle_finalize.spv
+"$GLSLC" particle_sort.comp -o bin/particle_sort.spv
+"$GLSLC" particle.vert -o bin/particle_vert.spv
+"$GLSLC" particle.frag -o bin/particle_frag.spv
+"$GLSLC" shadow.vert -o bin/shadow_vert.spv
+"$GLSLC" post_bloom.comp -o bin/post_bloom.spv
+"$GLSLC" post_resolve.comp -o bin/post_resolve.spv
+"$GLSLC" -DOUTPUT_WITHOUT_FORMAT post_resolve.comp -o bin/post_resolve_direct.spv
+"$GLSLC" meshlet_cull.comp -o bin/meshlet_cull.spv
+"$GLSLC" meshlet.vert -o bin/meshlet_vert.spv
+# mesh shaders need SPIR-V 1.4
+"$GLSLC" --target-spv=spv1.4 meshlet.task -o bin/meshlet_task.spv
+"$GLSLC" --target-spv=spv1.4 meshlet.mesh -o bin/meshlet_mesh.spv
+
+# pack for a single mapped read at startup, path of the packer can be overridden
+PACK=${PACK:-../build/pons2_pack}
+if [ -x "$PACK" ]; then
+    "$PACK" bin/shaders.pak bin
+fi
@@ -0,0 +1,37 @@
+// Meshlet data shared by culling and drawing, must match src/meshlets.h and src/meshlets.cpp
+
+const uint MESHLET_MAX_VERTICES = 64;
+const uint MESHLET_MAX_TRIANGLES = 124;
+const uint MESHLET_CULL_GROUP_SIZE = 64;
+const uint MESHLET_TASK_GROUP_SIZE = 32;
+
+struct Meshlet {
+    vec4 sphere; // xyz - center, w - radius
+    vec4 cone;   // xyz - axis, w - cutoff
+    uint firstIndex;
+    uint indexCount;
+    uint vertexOffset;
+    uint vertexCount;
+    uint triangleOffset;
+    uint triangleCount;
+};
+
+struct MeshletInstance {
+    mat4 model;
+    uint firstMeshlet;
+    uint meshletCount;
+};
+
+// surviving meshlets of one task workgroup
+struct MeshletTaskPayload {
+    uint instance;
+    uint meshlets[MESHLET_TASK_GROUP_SIZE];
+};
+
+layout(std430, set = 1, binding = 0) readonly buffer MeshletInstances {
+    MeshletInstance instances[];
+};
+
+layout(std430, set = 1, binding = 1) readonly buffer Meshlets {
+    Meshlet meshlets[];
+};
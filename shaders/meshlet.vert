@@ -0,0 +1,26 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+#include "meshlet.glsl"
+
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 view;
+    mat4 proj;
+} ubo;
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inColor;
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec3 fragWorldPos;
+layout(location = 2) out float fragViewDepth;
+
+void main() {
+    // culling stores the instance as firstInstance of every draw
+    vec4 worldPos = instances[gl_InstanceIndex].model * vec4(inPosition, 1.0);
+    vec4 viewPos = ubo.view * worldPos;
+    gl_Position = ubo.proj * viewPos;
+    fragColor = inColor;
+    fragWorldPos = worldPos.xyz;
+    fragViewDepth = -viewPos.z;
+}
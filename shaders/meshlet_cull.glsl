@@ -0,0 +1,33 @@
+// Push constants and visibility test of meshlet culling, must match MeshletCullParams in src/meshlets.h
+
+layout(push_constant) uniform MeshletCullParams {
+    layout(offset = 32) mat4 viewProj;
+    vec4 cameraPosition;
+    uint instanceCount;
+    uint maxDraws;
+} cull;
+
+layout(std430, set = 1, binding = 3) buffer MeshletDrawCount {
+    uint drawCount;
+};
+
+bool isMeshletVisible(Meshlet meshlet, mat4 model) {
+    vec3 center = (model * vec4(meshlet.sphere.xyz, 1.0)).xyz;
+    float scale = max(length(model[0].xyz), max(length(model[1].xyz), length(model[2].xyz)));
+    float radius = meshlet.sphere.w * scale;
+
+    // frustum planes are sums and differences of the view projection rows, depth is zero to one
+    mat4 rows = transpose(cull.viewProj);
+    vec4 planes[6] = vec4[6](rows[3] + rows[0], rows[3] - rows[0], rows[3] + rows[1], rows[3] - rows[1], rows[2],
+                             rows[3] - rows[2]);
+    for (int i = 0; i < 6; ++i) {
+        if (dot(planes[i].xyz, center) + planes[i].w < -radius * length(planes[i].xyz)) {
+            return false;
+        }
+    }
+
+    // backfacing when the whole sphere is seen from inside the region where every triangle of the cone faces away
+    vec3 axis = normalize(mat3(model) * meshlet.cone.xyz);
+    vec3 toCenter = center - cull.cameraPosition.xyz;
+    return dot(toCenter, axis) < meshlet.cone.w * length(toCenter) + radius;
+}
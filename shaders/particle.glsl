@@ -0,0 +1,49 @@
+// Shared between the particle shaders, must match src/particles.h
+
+const uint MAX_PARTICLES = 1u << 20;
+const uint PARTICLE_GROUP_SIZE = 256;
+const uint PARTICLE_SORT_BLOCK = 1024;
+const uint PARTICLE_SORT_LEVELS = 11;
+
+// sort modes
+const uint SORT_BLOCKS = 0;
+const uint SORT_MERGE_GLOBAL = 1;
+const uint SORT_MERGE_BLOCKS = 2;
+
+// layout of the argument buffer in uints
+const uint SIMULATE_ARGS = 0;
+const uint DRAW_ARGS = 4;
+const uint SORT_ARGS = 8;
+
+struct Particle {
+    vec4 positionLife;
+    vec4 velocitySize;
+    vec4 color;
+};
+
+layout(std430, binding = 0) buffer Particles {
+    Particle particles[];
+};
+
+layout(std430, binding = 1) buffer DeadList {
+    uint deadList[];
+};
+
+// two lists of MAX_PARTICLES, simulation reads one and appends survivors to the other
+layout(std430, binding = 2) buffer AliveLists {
+    uint aliveList[];
+};
+
+// x - view distance bits, larger is farther, y - particle index
+layout(std430, binding = 3) buffer SortList {
+    uvec2 sortList[];
+};
+
+layout(std430, binding = 4) buffer Counters {
+    int deadCount;
+    uint aliveCount[2];
+};
+
+layout(std430, binding = 5) buffer Arguments {
+    uint arguments[];
+};
@@ -0,0 +1,39 @@
+#version 450
+
+// Particle and SortList as in particle.glsl, read only since vertex stores aren't enabled
+struct Particle {
+    vec4 positionLife;
+    vec4 velocitySize;
+    vec4 color;
+};
+
+layout(std430, binding = 0) readonly buffer Particles {
+    Particle particles[];
+};
+
+layout(std430, binding = 3) readonly buffer SortList {
+    uvec2 sortList[];
+};
+
+layout(push_constant) uniform ParticleDrawParams {
+    mat4 viewProj;
+    vec4 cameraRight;
+    vec4 cameraUp;
+} params;
+
+layout(location = 0) out vec2 fragCorner;
+layout(location = 1) out vec4 fragColor;
+
+const vec2 CORNERS[6] = vec2[](vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(1.0, 1.0),
+                               vec2(-1.0, -1.0), vec2(1.0, 1.0), vec2(-1.0, 1.0));
+
+void main() {
+    // six vertices per particle in sorted order, no vertex or index buffers
+    Particle particle = particles[sortList[gl_VertexIndex / 6].y];
+    vec2 corner = CORNERS[gl_VertexIndex % 6];
+    vec3 offset = params.cameraRight.xyz * corner.x + params.cameraUp.xyz * corner.y;
+    vec3 position = particle.positionLife.xyz + offset * particle.velocitySize.w;
+    gl_Position = params.viewProj * vec4(position, 1.0);
+    fragCorner = corner;
+    fragColor = particle.color;
+}
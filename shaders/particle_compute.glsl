@@ -0,0 +1,24 @@
+// Push constants of the particle compute passes, must match ParticleParams in src/particles.h
+
+layout(push_constant) uniform ParticleParams {
+    vec4 emitterPosition; // w - spawn radius
+    vec4 cameraPosition;  // w - delta time
+    uint emitCount;
+    uint seed;
+    uint current;
+    uint sortMode;
+    uint sortK;
+    uint sortJ;
+} params;
+
+uint pcgHash(uint value) {
+    uint state = value * 747796405u + 2891336453u;
+    uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+// uniform in [0, 1), advances `state`
+float random(inout uint state) {
+    state = pcgHash(state);
+    return float(state >> 8) / 16777216.0;
+}
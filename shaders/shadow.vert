@@ -0,0 +1,13 @@
+#version 450
+
+// ShadowPushConstants in src/shadows.cpp
+layout(push_constant) uniform ShadowPushConstants {
+    mat4 viewProj;
+    mat4 model;
+} caster;
+
+layout(location = 0) in vec3 inPosition;
+
+void main() {
+    gl_Position = caster.viewProj * caster.model * vec4(inPosition, 1.0);
+}
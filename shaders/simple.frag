@@ -1,9 +1,68 @@
 #version 450
+#extension GL_GOOGLE_include_directive : require
+
+#include "clustered.glsl"
+
+layout(std430, binding = 2) readonly buffer ClusterLights {
+    uint clusterLights[];
+};
+
+// ShadowUniforms in src/shadows.h
+const uint SHADOW_CASCADE_COUNT = 4;
+
+layout(binding = 3) uniform sampler2DArrayShadow shadowMap;
+
+layout(binding = 4) uniform ShadowData {
+    mat4 cascadeViewProj[SHADOW_CASCADE_COUNT];
+    vec4 cascadeSplits;
+    vec4 lightDirection;
+} shadow;
 
 layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec3 fragWorldPos;
+layout(location = 2) in float fragViewDepth;
 
 layout(location = 0) out vec4 outColor;
 
+const vec3 AMBIENT = vec3(0.05);
+const vec3 SUN_COLOR = vec3(0.6, 0.55, 0.5);
+const float SHADOW_BIAS = 0.002; // in light clip depth, scaled up at grazing angles
+
+float sampleShadow(vec3 normal) {
+    uint cascade = 0;
+    for (uint i = 0; i < SHADOW_CASCADE_COUNT - 1; ++i) {
+        if (fragViewDepth > shadow.cascadeSplits[i]) {
+            cascade = i + 1;
+        }
+    }
+    vec4 lightPos = shadow.cascadeViewProj[cascade] * vec4(fragWorldPos, 1.0);
+    vec2 uv = lightPos.xy * 0.5 + 0.5;
+    float slope = 1.0 - abs(dot(normal, shadow.lightDirection.xyz));
+    float bias = SHADOW_BIAS * (1.0 + 4.0 * slope);
+    // compare sampler returns the filtered fraction of texels not closer to the light
+    return texture(shadowMap, vec4(uv, float(cascade), lightPos.z - bias));
+}
+
 void main() {
-    outColor = vec4(fragColor, 1.0);
-}
\ No newline at end of file
+    // geometry has no normals yet, derive the face normal from screen-space derivatives
+    vec3 normal = normalize(cross(dFdx(fragWorldPos), dFdy(fragWorldPos)));
+    uvec2 tile = uvec2(gl_FragCoord.xy / vec2(params.screenWidth, params.screenHeight) *
+                       vec2(CLUSTER_GRID_X, CLUSTER_GRID_Y));
+    tile = min(tile, uvec2(CLUSTER_GRID_X - 1, CLUSTER_GRID_Y - 1));
+    uint base = clusterIndex(uvec3(tile, depthSlice(fragViewDepth))) * CLUSTER_STRIDE;
+
+    vec3 lighting = AMBIENT;
+    float sun = abs(dot(normal, shadow.lightDirection.xyz));
+    lighting += SUN_COLOR * sun * sampleShadow(normal);
+    uint count = clusterLights[base];
+    for (uint i = 0; i < count; ++i) {
+        PointLight light = lights[clusterLights[base + 1 + i]];
+        vec3 toLight = light.positionRadius.xyz - fragWorldPos;
+        float distance = length(toLight);
+        float falloff = clamp(1.0 - pow(distance / light.positionRadius.w, 2.0), 0.0, 1.0);
+        // orientation of the derived normal depends on winding, light both sides
+        float diffuse = abs(dot(normal, toLight / max(distance, 1e-4)));
+        lighting += light.color.rgb * light.color.a * diffuse * falloff * falloff;
+    }
+    outColor = vec4(fragColor * lighting, 1.0);
+}
@@ -1,17 +1,26 @@
 #version 450
 
 layout(binding = 0) uniform UniformBufferObject {
-    mat4 model;
     mat4 view;
     mat4 proj;
 } ubo;
 
+layout(push_constant) uniform ObjectPushConstants {
+    layout(offset = 32) mat4 model;
+} object;
+
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inColor;
 
 layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec3 fragWorldPos;
+layout(location = 2) out float fragViewDepth;
 
 void main() {
-    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
+    vec4 worldPos = object.model * vec4(inPosition, 1.0);
+    vec4 viewPos = ubo.view * worldPos;
+    gl_Position = ubo.proj * viewPos;
     fragColor = inColor;
-}
\ No newline at end of file
+    fragWorldPos = worldPos.xyz;
+    fragViewDepth = -viewPos.z;
+}
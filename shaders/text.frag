@@ -0,0 +1,19 @@
+#version 450
+
+layout(binding = 0) uniform sampler2D atlas;
+
+layout(location = 0) in vec2 fragUv;
+layout(location = 1) in vec4 fragColor;
+
+layout(location = 0) out vec4 outColor;
+
+// FreeType stores the outline at 128, inside is brighter
+const float EDGE = 128.0 / 255.0;
+
+void main() {
+    float distance = texture(atlas, fragUv).r;
+    // antialias over one screen pixel regardless of text scale
+    float width = max(fwidth(distance), 1e-4);
+    float coverage = smoothstep(EDGE - width, EDGE + width, distance);
+    outColor = vec4(fragColor.rgb, fragColor.a * coverage);
+}
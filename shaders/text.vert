@@ -0,0 +1,19 @@
+#version 450
+
+layout(push_constant) uniform TextPushConstants {
+    vec2 invExtent;
+} params;
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec2 inUv;
+layout(location = 2) in vec4 inColor;
+
+layout(location = 0) out vec2 fragUv;
+layout(location = 1) out vec4 fragColor;
+
+void main() {
+    // pixels with the origin in the top left corner, which matches vulkan clip space orientation
+    gl_Position = vec4(inPosition * params.invExtent * 2.0 - 1.0, 0.0, 1.0);
+    fragUv = inUv;
+    fragColor = inColor;
+}
@@ -0,0 +1,228 @@
+#include "archive.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef PONS_HAS_ZLIB
+#include <zlib.h>
+#endif
+
+namespace pons {
+
+uint64_t hashBytes(std::span<const std::byte> bytes) {
+    uint64_t hash = FNV_OFFSET_BASIS;
+    for (std::byte b : bytes) {
+        hash = (hash ^ static_cast<uint8_t>(b)) * FNV_PRIME;
+    }
+    return hash;
+}
+
+bool verifyContents(const ArchiveEntry &entry, std::span<const std::byte> contents) {
+#ifdef NDEBUG
+    (void)entry;
+    (void)contents;
+    return true;
+#else
+    return contents.size() == entry.size && hashBytes(contents) == entry.contentHash;
+#endif
+}
+
+bool isCompressionSupported() {
+#ifdef PONS_HAS_ZLIB
+    return true;
+#else
+    return false;
+#endif
+}
+
+Archive::~Archive() { close(); }
+
+Archive::Archive(Archive &&other) noexcept { moveFrom(other); }
+
+Archive &Archive::operator=(Archive &&other) noexcept {
+    if (this != &other) {
+        close();
+        moveFrom(other);
+    }
+    return *this;
+}
+
+void Archive::moveFrom(Archive &other) {
+    path = std::move(other.path);
+    pData = std::exchange(other.pData, nullptr);
+    fileSize = std::exchange(other.fileSize, 0);
+#ifdef _WIN32
+    fileHandle = std::exchange(other.fileHandle, nullptr);
+    mappingHandle = std::exchange(other.mappingHandle, nullptr);
+#else
+    fileDescriptor = std::exchange(other.fileDescriptor, -1);
+#endif
+    entries = std::exchange(other.entries, {});
+    names = std::exchange(other.names, {});
+}
+
+void Archive::open(const std::string &archivePath) {
+    close();
+    path = archivePath;
+#ifdef _WIN32
+    fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                             FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (fileHandle == INVALID_HANDLE_VALUE) {
+        fileHandle = nullptr;
+        throw std::runtime_error("failed to open archive " + path);
+    }
+    LARGE_INTEGER size;
+    GetFileSizeEx(fileHandle, &size);
+    fileSize = static_cast<size_t>(size.QuadPart);
+    mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mappingHandle) {
+        pData = static_cast<const std::byte *>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+    }
+#else
+    fileDescriptor = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fileDescriptor < 0) {
+        throw std::runtime_error("failed to open archive " + path);
+    }
+    struct stat fileStat {};
+    if (fstat(fileDescriptor, &fileStat) == 0) {
+        fileSize = static_cast<size_t>(fileStat.st_size);
+        void *pMapping = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fileDescriptor, 0);
+        if (pMapping != MAP_FAILED) {
+            pData = static_cast<const std::byte *>(pMapping);
+            // assets are read in load order, not sequentially
+            madvise(pMapping, fileSize, MADV_RANDOM);
+        }
+    }
+#endif
+    if (!pData) {
+        close();
+        throw std::runtime_error("failed to map archive " + archivePath);
+    }
+
+    ArchiveHeader header;
+    if (fileSize < sizeof(header)) {
+        close();
+        throw std::runtime_error("archive is truncated: " + archivePath);
+    }
+    std::memcpy(&header, pData, sizeof(header));
+    uint64_t tocSize = uint64_t{header.entryCount} * sizeof(ArchiveEntry);
+    if (std::memcmp(header.magic, ARCHIVE_MAGIC, sizeof(header.magic)) != 0 || header.version != ARCHIVE_VERSION ||
+        header.tocOffset % alignof(ArchiveEntry) != 0 || header.tocOffset + tocSize + header.namesSize > fileSize) {
+        close();
+        throw std::runtime_error("archive header is invalid: " + archivePath);
+    }
+    entries = {reinterpret_cast<const ArchiveEntry *>(pData + header.tocOffset), header.entryCount};
+    names = {reinterpret_cast<const char *>(pData + header.tocOffset + tocSize), header.namesSize};
+    for (const ArchiveEntry &entry : entries) {
+        if (entry.offset + entry.storedSize > header.tocOffset || entry.nameOffset >= header.namesSize ||
+            (entry.compression == EntryCompression::None && entry.storedSize != entry.size)) {
+            close();
+            throw std::runtime_error("archive table of contents is invalid: " + archivePath);
+        }
+    }
+}
+
+void Archive::close() {
+#ifdef _WIN32
+    if (pData) {
+        UnmapViewOfFile(pData);
+    }
+    if (mappingHandle) {
+        CloseHandle(mappingHandle);
+    }
+    if (fileHandle) {
+        CloseHandle(fileHandle);
+    }
+    fileHandle = nullptr;
+    mappingHandle = nullptr;
+#else
+    if (pData) {
+        munmap(const_cast<std::byte *>(pData), fileSize);
+    }
+    if (fileDescriptor >= 0) {
+        ::close(fileDescriptor);
+    }
+    fileDescriptor = -1;
+#endif
+    pData = nullptr;
+    fileSize = 0;
+    entries = {};
+    names = {};
+}
+
+const ArchiveEntry *Archive::find(std::string_view name) const {
+    uint64_t nameHash = hashName(name);
+    auto it = std::lower_bound(entries.begin(), entries.end(), nameHash,
+                               [](const ArchiveEntry &entry, uint64_t hash) { return entry.nameHash < hash; });
+    // names are compared too, so a hash collision can't return the wrong asset
+    for (; it != entries.end() && it->nameHash == nameHash; ++it) {
+        if (getName(*it) == name) {
+            return &*it;
+        }
+    }
+    return nullptr;
+}
+
+std::string_view Archive::getName(const ArchiveEntry &entry) const {
+    std::string_view tail = names.substr(entry.nameOffset);
+    return tail.substr(0, tail.find('\0'));
+}
+
+std::span<const std::byte> Archive::view(const ArchiveEntry &entry) const {
+    return {pData + entry.offset, static_cast<size_t>(entry.storedSize)};
+}
+
+void Archive::read(const ArchiveEntry &entry, std::byte *pDst) const {
+    decode(entry, pDst);
+    if (!verifyContents(entry, {pDst, static_cast<size_t>(entry.size)})) {
+        throw std::runtime_error("contents of " + std::string(getName(entry)) + " don't match the hash in " + path);
+    }
+}
+
+void Archive::decode(const ArchiveEntry &entry, std::byte *pDst) const {
+    std::span<const std::byte> stored = view(entry);
+    switch (entry.compression) {
+    case EntryCompression::None:
+        std::memcpy(pDst, stored.data(), stored.size());
+        return;
+    case EntryCompression::Zlib: {
+#ifdef PONS_HAS_ZLIB
+        uLongf decodedSize = static_cast<uLongf>(entry.size);
+        int result = uncompress(reinterpret_cast<Bytef *>(pDst), &decodedSize,
+                                reinterpret_cast<const Bytef *>(stored.data()), static_cast<uLong>(stored.size()));
+        if (result != Z_OK || decodedSize != entry.size) {
+            throw std::runtime_error("failed to decompress " + std::string(getName(entry)) + " from " + path);
+        }
+        return;
+#else
+        throw std::runtime_error("built without zlib, can't decompress " + std::string(getName(entry)));
+#endif
+    }
+    }
+    throw std::runtime_error("unknown entry compression in " + path);
+}
+
+std::vector<char> Archive::read(std::string_view name) const {
+    const ArchiveEntry *pEntry = find(name);
+    if (!pEntry) {
+        throw std::runtime_error("asset " + std::string(name) + " not found in " + path);
+    }
+    std::vector<char> buffer(static_cast<size_t>(pEntry->size));
+    read(*pEntry, reinterpret_cast<std::byte *>(buffer.data()));
+    return buffer;
+}
+
+} // namespace pons
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace pons {
+
+// Packed asset archive, see tools/pack_assets.cpp. Layout (little endian):
+//   ArchiveHeader | entry data, each aligned to ARCHIVE_ALIGNMENT | ArchiveEntry[entryCount] sorted by nameHash | names
+// Every entry is stored whole and compressed as a whole, aligned data keeps mapped views page aligned.
+constexpr char ARCHIVE_MAGIC[4] = {'P', 'A', 'K', '1'};
+constexpr uint32_t ARCHIVE_VERSION = 1;
+constexpr uint64_t ARCHIVE_ALIGNMENT = 4096;
+
+enum class EntryCompression : uint32_t { None, Zlib };
+
+struct ArchiveHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t namesSize;
+    uint64_t tocOffset;
+};
+static_assert(sizeof(ArchiveHeader) == 24);
+
+struct ArchiveEntry {
+    uint64_t nameHash;
+    uint64_t offset;
+    uint64_t storedSize; // bytes in the archive, smaller than size for compressed entries
+    uint64_t size;
+    uint64_t contentHash; // of the decoded bytes
+    uint32_t nameOffset;  // into the names blob, null terminated
+    EntryCompression compression;
+};
+static_assert(sizeof(ArchiveEntry) == 48);
+
+// 64-bit FNV-1a.
+constexpr uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325ull;
+constexpr uint64_t FNV_PRIME = 0x100000001b3ull;
+
+constexpr uint64_t hashName(std::string_view name) {
+    uint64_t hash = FNV_OFFSET_BASIS;
+    for (char c : name) {
+        hash = (hash ^ static_cast<uint8_t>(c)) * FNV_PRIME;
+    }
+    return hash;
+}
+
+uint64_t hashBytes(std::span<const std::byte> bytes);
+// Compares decoded contents with the entry's stored hash in debug builds, release builds trust the archive.
+bool verifyContents(const ArchiveEntry &entry, std::span<const std::byte> contents);
+
+// Whether zlib compressed entries can be decoded, i.e. the build found zlib.
+bool isCompressionSupported();
+
+// Read-only memory mapped archive. Lookups and views are safe from any thread.
+class Archive {
+public:
+    Archive() = default;
+    ~Archive();
+    Archive(Archive &&other) noexcept;
+    Archive &operator=(Archive &&other) noexcept;
+    Archive(const Archive &) = delete;
+    Archive &operator=(const Archive &) = delete;
+
+    // Throws runtime_error when the file is missing or malformed.
+    void open(const std::string &path);
+    void close();
+    bool isOpen() const { return pData != nullptr; }
+
+    const ArchiveEntry *find(std::string_view name) const;
+    std::span<const ArchiveEntry> getEntries() const { return entries; }
+    std::string_view getName(const ArchiveEntry &entry) const;
+
+    // Zero-copy view of the stored bytes, valid until the archive is closed. Equals the contents for uncompressed
+    // entries, compressed ones have to go through read().
+    std::span<const std::byte> view(const ArchiveEntry &entry) const;
+    // Decodes the entry into `pDst`, which must hold entry.size bytes. Throws runtime_error when decoding fails or, in
+    // debug builds, when the contents don't match the stored hash.
+    void read(const ArchiveEntry &entry, std::byte *pDst) const;
+    std::vector<char> read(std::string_view name) const;
+
+#ifndef _WIN32
+    // For readers that bypass the mapping, e.g. AsyncReader's io_uring reads.
+    int getFileDescriptor() const { return fileDescriptor; }
+#endif
+
+private:
+    void moveFrom(Archive &other);
+    void decode(const ArchiveEntry &entry, std::byte *pDst) const;
+
+    std::string path;
+    const std::byte *pData = nullptr;
+    size_t fileSize = 0;
+#ifdef _WIN32
+    void *fileHandle = nullptr;
+    void *mappingHandle = nullptr;
+#else
+    int fileDescriptor = -1;
+#endif
+    std::span<const ArchiveEntry> entries;
+    std::string_view names;
+};
+
+} // namespace pons
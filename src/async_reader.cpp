@@ -0,0 +1,187 @@
+#include "async_reader.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+
+#ifdef PONS_HAS_IO_URING
+#include <liburing.h>
+#endif
+
+namespace pons {
+
+namespace {
+
+// single read size limit, io_uring takes 32-bit lengths
+[[maybe_unused]] const uint64_t MAX_READ_SIZE = 1ull << 30;
+
+} // namespace
+
+struct AsyncReader::Request {
+    const ArchiveEntry *pEntry;
+    std::byte *pDst;
+    Callback onComplete;
+    uint64_t bytesRead;
+};
+
+#ifdef PONS_HAS_IO_URING
+struct AsyncReader::Ring {
+    io_uring ring;
+};
+#else
+struct AsyncReader::Ring {};
+#endif
+
+AsyncReader::AsyncReader(const Archive &archive, ThreadPool &threadPool, uint32_t queueDepth)
+    : archive(archive), threadPool(threadPool), queueDepth(queueDepth) {
+#ifdef PONS_HAS_IO_URING
+    auto ring = std::make_unique<Ring>();
+    // older kernels or seccomp profiles may refuse, reads then fall back to the pool
+    if (io_uring_queue_init(queueDepth, &ring->ring, 0) == 0) {
+        pRing = std::move(ring);
+        completionThread = std::thread([this] { completionLoop(); });
+    }
+#endif
+}
+
+AsyncReader::~AsyncReader() {
+    wait();
+#ifdef PONS_HAS_IO_URING
+    if (pRing) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            // a failed completion thread already returned
+            if (!bRingFailed) {
+                io_uring_sqe *pSqe = io_uring_get_sqe(&pRing->ring);
+                // the queue is drained, so a slot is free; a null user data nop stops the completion thread
+                io_uring_prep_nop(pSqe);
+                io_uring_sqe_set_data(pSqe, nullptr);
+                io_uring_submit(&pRing->ring);
+            }
+        }
+        completionThread.join();
+        io_uring_queue_exit(&pRing->ring);
+    }
+#endif
+}
+
+void AsyncReader::read(const ArchiveEntry &entry, std::byte *pDst, Callback onComplete) {
+    auto *pRequest = new Request{&entry, pDst, std::move(onComplete), 0};
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        ++pendingRequests;
+        if (pRing && entry.compression == EntryCompression::None) {
+            requestDone.wait(lock, [this] { return bRingFailed || ringRequests.size() < queueDepth; });
+            if (!bRingFailed) {
+                ringRequests.insert(pRequest);
+                submitRead(pRequest);
+                return;
+            }
+        }
+    }
+    readOnPool(pRequest);
+}
+
+void AsyncReader::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    requestDone.wait(lock, [this] { return pendingRequests == 0; });
+}
+
+void AsyncReader::complete(Request *pRequest, bool bSuccess) {
+    if (pRequest->onComplete) {
+        pRequest->onComplete(bSuccess);
+    }
+    delete pRequest;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        --pendingRequests;
+    }
+    requestDone.notify_all();
+}
+
+void AsyncReader::readOnPool(Request *pRequest) {
+    threadPool.submit([this, pRequest] {
+        bool bSuccess = true;
+        try {
+            // checks the contents against the stored hash in debug builds
+            archive.read(*pRequest->pEntry, pRequest->pDst);
+        } catch (const std::exception &) {
+            bSuccess = false;
+        }
+        complete(pRequest, bSuccess);
+    });
+}
+
+void AsyncReader::submitRead(Request *pRequest) {
+#ifdef PONS_HAS_IO_URING
+    // called with `mutex` held
+    const ArchiveEntry &entry = *pRequest->pEntry;
+    uint64_t remaining = entry.size - pRequest->bytesRead;
+    io_uring_sqe *pSqe = io_uring_get_sqe(&pRing->ring);
+    // ringRequests keeps us within the submission queue, so a slot is always available
+    io_uring_prep_read(pSqe, archive.getFileDescriptor(), pRequest->pDst + pRequest->bytesRead,
+                       static_cast<unsigned>(std::min(remaining, MAX_READ_SIZE)), entry.offset + pRequest->bytesRead);
+    io_uring_sqe_set_data(pSqe, pRequest);
+    io_uring_submit(&pRing->ring);
+#else
+    (void)pRequest;
+#endif
+}
+
+void AsyncReader::failRing() {
+    std::unordered_set<Request *> failed;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        bRingFailed = true;
+        failed.swap(ringRequests);
+    }
+    // reads waiting for a ring slot go to the pool instead
+    requestDone.notify_all();
+    for (Request *pRequest : failed) {
+        complete(pRequest, false);
+    }
+}
+
+void AsyncReader::completionLoop() {
+#ifdef PONS_HAS_IO_URING
+    while (true) {
+        io_uring_cqe *pCqe = nullptr;
+        int result = io_uring_wait_cqe(&pRing->ring, &pCqe);
+        if (result == -EINTR || result == -EAGAIN) {
+            continue;
+        }
+        if (result < 0) {
+            // nothing can be reaped anymore, an exception would end the process from this thread
+            failRing();
+            return;
+        }
+        auto *pRequest = static_cast<Request *>(io_uring_cqe_get_data(pCqe));
+        int bytes = pCqe->res;
+        io_uring_cqe_seen(&pRing->ring, pCqe);
+        if (!pRequest) {
+            return;
+        }
+
+        bool bResubmit = bytes == -EAGAIN || bytes == -EINTR;
+        if (bytes > 0) {
+            pRequest->bytesRead += static_cast<uint64_t>(bytes);
+            // short read, queue the remainder
+            bResubmit = pRequest->bytesRead < pRequest->pEntry->size;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (bResubmit) {
+                submitRead(pRequest);
+                continue;
+            }
+            ringRequests.erase(pRequest);
+        }
+        const ArchiveEntry &entry = *pRequest->pEntry;
+        bool bSuccess = bytes >= 0 && pRequest->bytesRead == entry.size &&
+                        verifyContents(entry, {pRequest->pDst, static_cast<size_t>(entry.size)});
+        complete(pRequest, bSuccess);
+    }
+#endif
+}
+
+} // namespace pons
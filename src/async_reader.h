@@ -0,0 +1,59 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+
+#include "archive.h"
+#include "thread_pool.h"
+
+namespace pons {
+
+// Streams archive entries into caller owned memory, typically mapped staging buffers. Uncompressed entries are read
+// with io_uring on Linux when the build found liburing; compressed entries, and everything when io_uring isn't
+// available, are decoded from the archive mapping on the thread pool.
+class AsyncReader {
+public:
+    // Runs on a reader thread and must not throw, `bSuccess` is false when the read failed or the contents don't
+    // match the stored hash.
+    using Callback = std::function<void(bool bSuccess)>;
+
+    AsyncReader(const Archive &archive, ThreadPool &threadPool, uint32_t queueDepth = 64);
+    ~AsyncReader();
+    AsyncReader(const AsyncReader &) = delete;
+    AsyncReader &operator=(const AsyncReader &) = delete;
+
+    // `pDst` must hold entry.size bytes and stay valid until the callback ran.
+    void read(const ArchiveEntry &entry, std::byte *pDst, Callback onComplete);
+    // Blocks until every issued read completed.
+    void wait();
+    bool usesIoUring() const { return static_cast<bool>(pRing); }
+
+private:
+    struct Request;
+    struct Ring;
+
+    void complete(Request *pRequest, bool bSuccess);
+    void readOnPool(Request *pRequest);
+    void submitRead(Request *pRequest);
+    void failRing();
+    void completionLoop();
+
+    const Archive &archive;
+    ThreadPool &threadPool;
+    uint32_t queueDepth;
+    std::unique_ptr<Ring> pRing;
+    std::thread completionThread;
+    std::mutex mutex; // also serializes ring submissions
+    std::condition_variable requestDone;
+    uint32_t pendingRequests = 0;
+    std::unordered_set<Request *> ringRequests; // in flight on the ring, at most queueDepth
+    bool bRingFailed = false;                   // reaping failed, later reads go to the pool
+};
+
+} // namespace pons
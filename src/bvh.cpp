@@ -0,0 +1,531 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <future>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PONS_BVH_SSE 1
+#include <emmintrin.h>
+#endif
+
+namespace pons {
+
+namespace {
+
+const uint32_t SAH_BIN_COUNT = 16;
+const uint32_t MAX_LEAF_SIZE = 4;
+const uint32_t FORCED_SPLIT_SIZE = 16;    // never keep leaves larger than this even if SAH says so
+const uint32_t PARALLEL_BUILD_SIZE = 4096; // subtrees with more objects are built on their own thread
+const float TRAVERSAL_COST = 1.0f;         // relative to a single object test
+const float REBUILD_COST_RATIO = 2.0f;
+const uint32_t TRAVERSAL_STACK_SIZE = 64;
+
+void storeBounds(const Aabb &box, float (&boundsMin)[3], float (&boundsMax)[3]) {
+    for (int i = 0; i < 3; ++i) {
+        boundsMin[i] = box.min[i];
+        boundsMax[i] = box.max[i];
+    }
+}
+
+float boxSurfaceArea(const float (&boundsMin)[3], const float (&boundsMax)[3]) {
+    float dx = boundsMax[0] - boundsMin[0];
+    float dy = boundsMax[1] - boundsMin[1];
+    float dz = boundsMax[2] - boundsMin[2];
+    return 2.0f * (dx * dy + dy * dz + dz * dx);
+}
+
+enum class Containment { Outside, Intersecting, Inside };
+
+// Planes in structure-of-arrays form, padded to two SSE batches with planes that accept everything.
+struct FrustumPlanes {
+    alignas(16) float nx[8];
+    alignas(16) float ny[8];
+    alignas(16) float nz[8];
+    alignas(16) float d[8];
+
+    explicit FrustumPlanes(const Frustum &frustum) {
+        for (size_t i = 0; i < 8; ++i) {
+            glm::vec4 plane = i < frustum.planes.size() ? frustum.planes[i] : glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+            nx[i] = plane.x;
+            ny[i] = plane.y;
+            nz[i] = plane.z;
+            d[i] = plane.w;
+        }
+    }
+
+    Containment classify(const float (&boundsMin)[3], const float (&boundsMax)[3]) const {
+        float cx = (boundsMin[0] + boundsMax[0]) * 0.5f;
+        float cy = (boundsMin[1] + boundsMax[1]) * 0.5f;
+        float cz = (boundsMin[2] + boundsMax[2]) * 0.5f;
+        float ex = (boundsMax[0] - boundsMin[0]) * 0.5f;
+        float ey = (boundsMax[1] - boundsMin[1]) * 0.5f;
+        float ez = (boundsMax[2] - boundsMin[2]) * 0.5f;
+#ifdef PONS_BVH_SSE
+        const __m128 signMask = _mm_set1_ps(-0.0f);
+        const __m128 zero = _mm_setzero_ps();
+        __m128 centerX = _mm_set1_ps(cx), centerY = _mm_set1_ps(cy), centerZ = _mm_set1_ps(cz);
+        __m128 extentX = _mm_set1_ps(ex), extentY = _mm_set1_ps(ey), extentZ = _mm_set1_ps(ez);
+        int outside = 0;
+        int intersecting = 0;
+        for (size_t batch = 0; batch < 8; batch += 4) {
+            __m128 planeX = _mm_load_ps(nx + batch);
+            __m128 planeY = _mm_load_ps(ny + batch);
+            __m128 planeZ = _mm_load_ps(nz + batch);
+            // signed distance of the box center and projected radius of the box onto each plane normal
+            __m128 distance = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(planeX, centerX), _mm_mul_ps(planeY, centerY)),
+                _mm_add_ps(_mm_mul_ps(planeZ, centerZ), _mm_load_ps(d + batch)));
+            __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(signMask, planeX), extentX),
+                                                  _mm_mul_ps(_mm_andnot_ps(signMask, planeY), extentY)),
+                                       _mm_mul_ps(_mm_andnot_ps(signMask, planeZ), extentZ));
+            outside |= _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(distance, radius), zero));
+            intersecting |= _mm_movemask_ps(_mm_cmplt_ps(_mm_sub_ps(distance, radius), zero));
+        }
+#else
+        bool outside = false;
+        bool intersecting = false;
+        for (size_t i = 0; i < 8; ++i) {
+            float distance = nx[i] * cx + ny[i] * cy + nz[i] * cz + d[i];
+            float radius = std::abs(nx[i]) * ex + std::abs(ny[i]) * ey + std::abs(nz[i]) * ez;
+            outside = outside || distance + radius < 0.0f;
+            intersecting = intersecting || distance - radius < 0.0f;
+        }
+#endif
+        if (outside) {
+            return Containment::Outside;
+        }
+        return intersecting ? Containment::Intersecting : Containment::Inside;
+    }
+};
+
+bool rayBoxDistance(const glm::vec3 &origin, const glm::vec3 &invDirection, const float (&boundsMin)[3],
+                    const float (&boundsMax)[3], float maxDistance, float &outDistance) {
+    float tMin = 0.0f;
+    float tMax = maxDistance;
+    for (int i = 0; i < 3; ++i) {
+        float t0 = (boundsMin[i] - origin[i]) * invDirection[i];
+        float t1 = (boundsMax[i] - origin[i]) * invDirection[i];
+        tMin = std::max(tMin, std::min(t0, t1));
+        tMax = std::min(tMax, std::max(t0, t1));
+    }
+    outDistance = tMin;
+    return tMin <= tMax;
+}
+
+// Nodes waiting to be visited. A depth-first walk defers at most one sibling per level, so `treeDepth + 1` entries
+// always suffice, trees too deep for the inline array spill to the heap.
+class TraversalStack {
+public:
+    explicit TraversalStack(uint32_t treeDepth) {
+        if (treeDepth + 1 > TRAVERSAL_STACK_SIZE) {
+            spilled.resize(treeDepth + 1);
+            pEntries = spilled.data();
+            capacity = treeDepth + 1;
+        }
+    }
+    TraversalStack(const TraversalStack &) = delete;
+    TraversalStack &operator=(const TraversalStack &) = delete;
+
+    void push(uint32_t node) {
+        assert(size < capacity);
+        pEntries[size++] = node;
+    }
+    uint32_t pop() { return pEntries[--size]; }
+    bool empty() const { return size == 0; }
+
+private:
+    uint32_t entries[TRAVERSAL_STACK_SIZE];
+    std::vector<uint32_t> spilled;
+    uint32_t *pEntries = entries;
+    uint32_t capacity = TRAVERSAL_STACK_SIZE;
+    uint32_t size = 0;
+};
+
+} // namespace
+
+Aabb Aabb::fromPoints(const glm::vec3 *points, size_t count) {
+    Aabb box;
+    for (size_t i = 0; i < count; ++i) {
+        box.grow(points[i]);
+    }
+    return box;
+}
+
+float Aabb::surfaceArea() const {
+    glm::vec3 size = max - min;
+    return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+void Aabb::grow(const glm::vec3 &point) {
+    min = glm::min(min, point);
+    max = glm::max(max, point);
+}
+
+void Aabb::grow(const Aabb &other) {
+    min = glm::min(min, other.min);
+    max = glm::max(max, other.max);
+}
+
+bool Aabb::overlaps(const Aabb &other) const {
+    return min.x <= other.max.x && max.x >= other.min.x && min.y <= other.max.y && max.y >= other.min.y &&
+           min.z <= other.max.z && max.z >= other.min.z;
+}
+
+Aabb Aabb::transformed(const glm::mat4 &transform) const {
+    // Arvo's method, transform center and accumulate absolute contribution of each axis to the extent
+    glm::vec3 newCenter = glm::vec3(transform * glm::vec4(center(), 1.0f));
+    glm::vec3 oldExtent = extent();
+    glm::vec3 newExtent{0.0f};
+    for (int column = 0; column < 3; ++column) {
+        newExtent += glm::abs(glm::vec3(transform[column])) * oldExtent[column];
+    }
+    Aabb box;
+    box.min = newCenter - newExtent;
+    box.max = newCenter + newExtent;
+    return box;
+}
+
+Frustum Frustum::fromMatrix(const glm::mat4 &viewProj) {
+    glm::vec4 row0{viewProj[0][0], viewProj[1][0], viewProj[2][0], viewProj[3][0]};
+    glm::vec4 row1{viewProj[0][1], viewProj[1][1], viewProj[2][1], viewProj[3][1]};
+    glm::vec4 row2{viewProj[0][2], viewProj[1][2], viewProj[2][2], viewProj[3][2]};
+    glm::vec4 row3{viewProj[0][3], viewProj[1][3], viewProj[2][3], viewProj[3][3]};
+    Frustum frustum{{row3 + row0, row3 - row0, row3 + row1, row3 - row1, row2, row3 - row2}};
+    for (glm::vec4 &plane : frustum.planes) {
+        plane /= glm::length(glm::vec3(plane));
+    }
+    return frustum;
+}
+
+struct Bvh::BuildNode {
+    Aabb bounds;
+    uint32_t begin = 0;
+    uint32_t end = 0;
+    std::unique_ptr<BuildNode> left;
+    std::unique_ptr<BuildNode> right;
+};
+
+struct Bvh::BuildInput {
+    const std::vector<Aabb> &bounds;
+    std::vector<glm::vec3> centroids;
+    // subtrees partition disjoint ranges of this array, so workers never touch the same elements
+    std::vector<uint32_t> &indices;
+};
+
+std::unique_ptr<Bvh::BuildNode> Bvh::buildSubtree(const BuildInput &input, uint32_t begin, uint32_t end) {
+    auto node = std::make_unique<BuildNode>();
+    node->begin = begin;
+    node->end = end;
+    Aabb centroidBounds;
+    for (uint32_t i = begin; i < end; ++i) {
+        node->bounds.grow(input.bounds[input.indices[i]]);
+        centroidBounds.grow(input.centroids[input.indices[i]]);
+    }
+    uint32_t count = end - begin;
+    if (count <= MAX_LEAF_SIZE) {
+        return node;
+    }
+
+    glm::vec3 centroidSize = centroidBounds.max - centroidBounds.min;
+    int axis = 0;
+    if (centroidSize.y > centroidSize[axis]) {
+        axis = 1;
+    }
+    if (centroidSize.z > centroidSize[axis]) {
+        axis = 2;
+    }
+
+    auto first = input.indices.begin() + static_cast<std::ptrdiff_t>(begin);
+    auto last = input.indices.begin() + static_cast<std::ptrdiff_t>(end);
+    uint32_t mid = begin + count / 2;
+    if (centroidSize[axis] > 0.0f) {
+        struct Bin {
+            Aabb bounds;
+            uint32_t count = 0;
+        };
+        std::array<Bin, SAH_BIN_COUNT> bins{};
+        float binScale = static_cast<float>(SAH_BIN_COUNT) / centroidSize[axis];
+        auto binIndex = [&](uint32_t object) {
+            float offset = (input.centroids[object][axis] - centroidBounds.min[axis]) * binScale;
+            return std::min(static_cast<uint32_t>(offset), SAH_BIN_COUNT - 1);
+        };
+        for (uint32_t i = begin; i < end; ++i) {
+            Bin &bin = bins[binIndex(input.indices[i])];
+            bin.bounds.grow(input.bounds[input.indices[i]]);
+            ++bin.count;
+        }
+
+        // sweep from the right to get cost of every right side, then from the left to evaluate split planes
+        std::array<float, SAH_BIN_COUNT> rightCost{};
+        Aabb rightBounds;
+        uint32_t rightCount = 0;
+        for (uint32_t i = SAH_BIN_COUNT - 1; i > 0; --i) {
+            rightBounds.grow(bins[i].bounds);
+            rightCount += bins[i].count;
+            rightCost[i] = rightCount > 0 ? rightBounds.surfaceArea() * static_cast<float>(rightCount) : 0.0f;
+        }
+        Aabb leftBounds;
+        uint32_t leftCount = 0;
+        float bestCost = std::numeric_limits<float>::max();
+        uint32_t bestSplit = 0;
+        for (uint32_t i = 0; i < SAH_BIN_COUNT - 1; ++i) {
+            leftBounds.grow(bins[i].bounds);
+            leftCount += bins[i].count;
+            float cost = (leftCount > 0 ? leftBounds.surfaceArea() * static_cast<float>(leftCount) : 0.0f) +
+                         rightCost[i + 1];
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestSplit = i;
+            }
+        }
+
+        float splitCost = TRAVERSAL_COST + bestCost / node->bounds.surfaceArea();
+        if (splitCost >= static_cast<float>(count) && count <= FORCED_SPLIT_SIZE) {
+            return node;
+        }
+        auto split = std::partition(first, last, [&](uint32_t object) { return binIndex(object) <= bestSplit; });
+        mid = begin + static_cast<uint32_t>(split - first);
+    }
+    if (mid == begin || mid == end) {
+        // degenerate centroids, fall back to a median split
+        mid = begin + count / 2;
+        std::nth_element(first, first + static_cast<std::ptrdiff_t>(count / 2), last, [&](uint32_t a, uint32_t b) {
+            return input.centroids[a][axis] < input.centroids[b][axis];
+        });
+    }
+
+    if (count > PARALLEL_BUILD_SIZE) {
+        auto leftFuture = std::async(std::launch::async, buildSubtree, std::cref(input), begin, mid);
+        node->right = buildSubtree(input, mid, end);
+        node->left = leftFuture.get();
+    } else {
+        node->left = buildSubtree(input, begin, mid);
+        node->right = buildSubtree(input, mid, end);
+    }
+    return node;
+}
+
+uint32_t Bvh::flatten(const BuildNode &buildNode, uint32_t depth) {
+    uint32_t index = static_cast<uint32_t>(nodes.size());
+    treeDepth = std::max(treeDepth, depth);
+    nodes.emplace_back();
+    storeBounds(buildNode.bounds, nodes[index].boundsMin, nodes[index].boundsMax);
+    if (!buildNode.left) {
+        nodes[index].offset = buildNode.begin;
+        nodes[index].count = buildNode.end - buildNode.begin;
+        return index;
+    }
+    flatten(*buildNode.left, depth + 1);
+    uint32_t right = flatten(*buildNode.right, depth + 1);
+    nodes[index].offset = right;
+    nodes[index].count = 0;
+    return index;
+}
+
+void Bvh::build(const std::vector<Aabb> &objectBounds) {
+    nodes.clear();
+    treeDepth = 0;
+    bounds = objectBounds;
+    objectIndices.resize(bounds.size());
+    for (uint32_t i = 0; i < objectIndices.size(); ++i) {
+        objectIndices[i] = i;
+    }
+    if (bounds.empty()) {
+        builtCost = 0.0f;
+        return;
+    }
+
+    BuildInput input{bounds, {}, objectIndices};
+    input.centroids.reserve(bounds.size());
+    for (const Aabb &box : bounds) {
+        input.centroids.push_back(box.center());
+    }
+    std::unique_ptr<BuildNode> root = buildSubtree(input, 0, static_cast<uint32_t>(objectIndices.size()));
+    nodes.reserve(2 * bounds.size());
+    flatten(*root, 0);
+    builtCost = sahCost();
+}
+
+void Bvh::refit(const std::vector<Aabb> &objectBounds) {
+    bounds = objectBounds;
+    // children are always stored after their parent, so a reverse sweep visits them first
+    for (size_t i = nodes.size(); i-- > 0;) {
+        Node &node = nodes[i];
+        Aabb box;
+        if (node.count > 0) {
+            for (uint32_t k = 0; k < node.count; ++k) {
+                box.grow(bounds[objectIndices[node.offset + k]]);
+            }
+        } else {
+            const Node &left = nodes[i + 1];
+            const Node &right = nodes[node.offset];
+            for (int axis = 0; axis < 3; ++axis) {
+                box.min[axis] = std::min(left.boundsMin[axis], right.boundsMin[axis]);
+                box.max[axis] = std::max(left.boundsMax[axis], right.boundsMax[axis]);
+            }
+        }
+        storeBounds(box, node.boundsMin, node.boundsMax);
+    }
+}
+
+float Bvh::sahCost() const {
+    if (nodes.empty()) {
+        return 0.0f;
+    }
+    float cost = 0.0f;
+    for (const Node &node : nodes) {
+        float area = boxSurfaceArea(node.boundsMin, node.boundsMax);
+        cost += node.count > 0 ? area * static_cast<float>(node.count) : area * TRAVERSAL_COST;
+    }
+    return cost / std::max(boxSurfaceArea(nodes[0].boundsMin, nodes[0].boundsMax), std::numeric_limits<float>::min());
+}
+
+bool Bvh::isDegraded() const { return !nodes.empty() && sahCost() > builtCost * REBUILD_COST_RATIO; }
+
+void Bvh::appendSubtree(uint32_t node, std::vector<uint32_t> &outObjects) const {
+    // subtree of a depth-first layout ends right before the first node that isn't its descendant,
+    // its leaves reference one contiguous range of object indices
+    uint32_t first = node;
+    while (nodes[first].count == 0) {
+        first = first + 1;
+    }
+    uint32_t last = node;
+    while (nodes[last].count == 0) {
+        last = nodes[last].offset;
+    }
+    outObjects.insert(outObjects.end(), objectIndices.begin() + static_cast<std::ptrdiff_t>(nodes[first].offset),
+                      objectIndices.begin() + static_cast<std::ptrdiff_t>(nodes[last].offset + nodes[last].count));
+}
+
+void Bvh::queryFrustum(const Frustum &frustum, std::vector<uint32_t> &outObjects) const {
+    if (nodes.empty()) {
+        return;
+    }
+    FrustumPlanes planes{frustum};
+    TraversalStack stack(treeDepth);
+    stack.push(0);
+    while (!stack.empty()) {
+        uint32_t index = stack.pop();
+        const Node &node = nodes[index];
+        Containment containment = planes.classify(node.boundsMin, node.boundsMax);
+        if (containment == Containment::Outside) {
+            continue;
+        }
+        if (containment == Containment::Inside) {
+            appendSubtree(index, outObjects);
+            continue;
+        }
+        if (node.count > 0) {
+            for (uint32_t k = 0; k < node.count; ++k) {
+                uint32_t object = objectIndices[node.offset + k];
+                float objectMin[3] = {bounds[object].min.x, bounds[object].min.y, bounds[object].min.z};
+                float objectMax[3] = {bounds[object].max.x, bounds[object].max.y, bounds[object].max.z};
+                if (planes.classify(objectMin, objectMax) != Containment::Outside) {
+                    outObjects.push_back(object);
+                }
+            }
+            continue;
+        }
+        stack.push(node.offset);
+        stack.push(index + 1);
+    }
+}
+
+void Bvh::queryAabb(const Aabb &box, std::vector<uint32_t> &outObjects) const {
+    if (nodes.empty()) {
+        return;
+    }
+    TraversalStack stack(treeDepth);
+    stack.push(0);
+    while (!stack.empty()) {
+        uint32_t index = stack.pop();
+        const Node &node = nodes[index];
+        Aabb nodeBounds;
+        nodeBounds.min = glm::vec3(node.boundsMin[0], node.boundsMin[1], node.boundsMin[2]);
+        nodeBounds.max = glm::vec3(node.boundsMax[0], node.boundsMax[1], node.boundsMax[2]);
+        if (!nodeBounds.overlaps(box)) {
+            continue;
+        }
+        if (node.count > 0) {
+            for (uint32_t k = 0; k < node.count; ++k) {
+                uint32_t object = objectIndices[node.offset + k];
+                if (bounds[object].overlaps(box)) {
+                    outObjects.push_back(object);
+                }
+            }
+            continue;
+        }
+        stack.push(node.offset);
+        stack.push(index + 1);
+    }
+}
+
+void Bvh::querySphere(const glm::vec3 &center, float radius, std::vector<uint32_t> &outObjects) const {
+    Aabb sphereBounds;
+    sphereBounds.min = center - glm::vec3(radius);
+    sphereBounds.max = center + glm::vec3(radius);
+    size_t firstCandidate = outObjects.size();
+    queryAabb(sphereBounds, outObjects);
+    auto outside = [&](uint32_t object) {
+        glm::vec3 closest = glm::clamp(center, bounds[object].min, bounds[object].max);
+        glm::vec3 delta = closest - center;
+        return glm::dot(delta, delta) > radius * radius;
+    };
+    outObjects.erase(std::remove_if(outObjects.begin() + static_cast<std::ptrdiff_t>(firstCandidate),
+                                    outObjects.end(), outside),
+                     outObjects.end());
+}
+
+std::optional<RayHit> Bvh::raycast(const Ray &ray, float maxDistance) const {
+    if (nodes.empty()) {
+        return std::nullopt;
+    }
+    glm::vec3 invDirection = 1.0f / ray.direction;
+    std::optional<RayHit> closestHit;
+    float closestDistance = maxDistance;
+    TraversalStack stack(treeDepth);
+    float rootDistance;
+    if (!rayBoxDistance(ray.origin, invDirection, nodes[0].boundsMin, nodes[0].boundsMax, closestDistance,
+                        rootDistance)) {
+        return std::nullopt;
+    }
+    stack.push(0);
+    while (!stack.empty()) {
+        const Node &node = nodes[stack.pop()];
+        if (node.count > 0) {
+            for (uint32_t k = 0; k < node.count; ++k) {
+                uint32_t object = objectIndices[node.offset + k];
+                float objectMin[3] = {bounds[object].min.x, bounds[object].min.y, bounds[object].min.z};
+                float objectMax[3] = {bounds[object].max.x, bounds[object].max.y, bounds[object].max.z};
+                float distance;
+                if (rayBoxDistance(ray.origin, invDirection, objectMin, objectMax, closestDistance, distance)) {
+                    closestDistance = distance;
+                    closestHit = RayHit{object, distance};
+                }
+            }
+            continue;
+        }
+        // visit the nearer child first so the farther one is more likely to be rejected by `closestDistance`
+        uint32_t leftChild = static_cast<uint32_t>(&node - nodes.data()) + 1;
+        uint32_t rightChild = node.offset;
+        float leftDistance, rightDistance;
+        bool leftHit = rayBoxDistance(ray.origin, invDirection, nodes[leftChild].boundsMin,
+                                      nodes[leftChild].boundsMax, closestDistance, leftDistance);
+        bool rightHit = rayBoxDistance(ray.origin, invDirection, nodes[rightChild].boundsMin,
+                                       nodes[rightChild].boundsMax, closestDistance, rightDistance);
+        if (leftHit && rightHit) {
+            bool leftFirst = leftDistance <= rightDistance;
+            stack.push(leftFirst ? rightChild : leftChild);
+            stack.push(leftFirst ? leftChild : rightChild);
+        } else if (leftHit) {
+            stack.push(leftChild);
+        } else if (rightHit) {
+            stack.push(rightChild);
+        }
+    }
+    return closestHit;
+}
+
+} // namespace pons
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <vector>
+
+namespace pons {
+
+struct Aabb {
+    glm::vec3 min{std::numeric_limits<float>::max()};
+    glm::vec3 max{std::numeric_limits<float>::lowest()};
+
+    static Aabb fromPoints(const glm::vec3 *points, size_t count);
+
+    bool valid() const { return min.x <= max.x && min.y <= max.y && min.z <= max.z; }
+    glm::vec3 center() const { return (min + max) * 0.5f; }
+    glm::vec3 extent() const { return (max - min) * 0.5f; }
+    float surfaceArea() const;
+    void grow(const glm::vec3 &point);
+    void grow(const Aabb &other);
+    bool overlaps(const Aabb &other) const;
+    // Bounds of this box after an affine transform, still axis aligned.
+    Aabb transformed(const glm::mat4 &transform) const;
+};
+
+// Six planes facing inwards, extracted from a Vulkan style (0..1 depth) view-projection matrix.
+struct Frustum {
+    std::array<glm::vec4, 6> planes;
+
+    static Frustum fromMatrix(const glm::mat4 &viewProj);
+};
+
+struct Ray {
+    glm::vec3 origin;
+    glm::vec3 direction;
+};
+
+struct RayHit {
+    uint32_t object;
+    float distance;
+};
+
+// Flattened bounding volume hierarchy over object bounds, used for culling, picking and range queries on the CPU.
+// Nodes are laid out depth-first, so the left child always directly follows its parent and a node is 32 bytes.
+class Bvh {
+public:
+    // Full rebuild with binned SAH, large subtrees are built on worker threads.
+    void build(const std::vector<Aabb> &objectBounds);
+    // Updates node bounds for moved objects keeping the topology, much cheaper than `build`.
+    void refit(const std::vector<Aabb> &objectBounds);
+    // True when refits have inflated the tree enough that a rebuild pays off.
+    bool isDegraded() const;
+
+    bool empty() const { return nodes.empty(); }
+    size_t nodeCount() const { return nodes.size(); }
+
+    void queryFrustum(const Frustum &frustum, std::vector<uint32_t> &outObjects) const;
+    void queryAabb(const Aabb &bounds, std::vector<uint32_t> &outObjects) const;
+    void querySphere(const glm::vec3 &center, float radius, std::vector<uint32_t> &outObjects) const;
+    // Closest object whose bounds are hit by the ray, `direction` doesn't need to be normalized.
+    std::optional<RayHit> raycast(const Ray &ray, float maxDistance = std::numeric_limits<float>::max()) const;
+
+private:
+    struct Node {
+        float boundsMin[3];
+        uint32_t offset; // right child for inner nodes, first entry of `objectIndices` for leaves
+        float boundsMax[3];
+        uint32_t count; // 0 for inner nodes
+    };
+    static_assert(sizeof(Node) == 32, "two nodes per cache line");
+    struct BuildNode;
+    struct BuildInput;
+
+    static std::unique_ptr<BuildNode> buildSubtree(const BuildInput &input, uint32_t begin, uint32_t end);
+    uint32_t flatten(const BuildNode &buildNode, uint32_t depth);
+    float sahCost() const;
+    void appendSubtree(uint32_t node, std::vector<uint32_t> &outObjects) const;
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> objectIndices;
+    std::vector<Aabb> bounds;
+    float builtCost = 0.0f;
+    uint32_t treeDepth = 0; // edges on the longest root to leaf path, refits keep the topology so only build sets it
+};
+
+} // namespace pons
@@ -0,0 +1,53 @@
+#include "camera.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace pons {
+
+OrbitCamera::OrbitCamera(glm::vec3 target, glm::vec3 position) : target(target) {
+    glm::vec3 offset = position - target;
+    distance = std::clamp(glm::length(offset), CAMERA_MIN_DISTANCE, CAMERA_MAX_DISTANCE);
+    yaw = std::atan2(offset.y, offset.x);
+    pitch = std::clamp(std::asin(offset.z / glm::length(offset)), -CAMERA_MAX_PITCH, CAMERA_MAX_PITCH);
+}
+
+void OrbitCamera::addMotion(glm::vec2 pixels) {
+    // dragging right turns the scene right, dragging down looks from higher up
+    glm::vec2 radians = glm::vec2(-pixels.x, pixels.y) * CAMERA_ORBIT_SPEED;
+    float clampedPitch = std::clamp(pitch + radians.y, -CAMERA_MAX_PITCH, CAMERA_MAX_PITCH);
+    radians.y = clampedPitch - pitch;
+    yaw += radians.x;
+    pitch = clampedPitch;
+    sampleMotion += radians;
+}
+
+void OrbitCamera::addZoom(float notches) {
+    distance = std::clamp(distance * std::pow(CAMERA_ZOOM_STEP, notches), CAMERA_MIN_DISTANCE, CAMERA_MAX_DISTANCE);
+}
+
+void OrbitCamera::endSample(Clock::time_point time) {
+    float seconds = std::chrono::duration<float>(time - sampleTime).count();
+    if (seconds <= 0.0f) {
+        return;
+    }
+    velocity = glm::mix(velocity, sampleMotion / seconds, CAMERA_VELOCITY_SMOOTHING);
+    sampleMotion = glm::vec2(0.0f);
+    sampleTime = time;
+}
+
+glm::vec3 OrbitCamera::getPosition(float predictSeconds) const {
+    glm::vec2 angles = glm::vec2(yaw, pitch) + velocity * std::clamp(predictSeconds, 0.0f, CAMERA_MAX_PREDICTION);
+    angles.y = std::clamp(angles.y, -CAMERA_MAX_PITCH, CAMERA_MAX_PITCH);
+    glm::vec3 direction{std::cos(angles.y) * std::cos(angles.x), std::cos(angles.y) * std::sin(angles.x),
+                        std::sin(angles.y)};
+    return target + direction * distance;
+}
+
+glm::mat4 OrbitCamera::getViewMatrix(float predictSeconds) const {
+    return glm::lookAt(getPosition(predictSeconds), target, glm::vec3(0.0f, 0.0f, 1.0f));
+}
+
+} // namespace pons
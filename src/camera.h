@@ -0,0 +1,44 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <chrono>
+
+namespace pons {
+
+const float CAMERA_ORBIT_SPEED = 0.005f; // radians per pixel of mouse motion
+const float CAMERA_ZOOM_STEP = 0.9f;     // distance factor per wheel notch
+const float CAMERA_MIN_DISTANCE = 1.0f;
+const float CAMERA_MAX_DISTANCE = 8.0f;
+const float CAMERA_MAX_PITCH = 1.5f;          // radians, keeps the view off the poles
+const float CAMERA_VELOCITY_SMOOTHING = 0.5f; // weight of the newest velocity estimate
+const float CAMERA_MAX_PREDICTION = 0.05f;    // seconds
+
+// Orbit camera around a target, z up. Input is gathered in samples stamped with a high resolution clock, the
+// angular velocity between samples lets the view be extrapolated to when the frame is expected on screen.
+class OrbitCamera {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    OrbitCamera(glm::vec3 target, glm::vec3 position);
+
+    void addMotion(glm::vec2 pixels);
+    void addZoom(float notches);
+    // Closes the sample of input gathered up to `time` and updates the velocity estimate.
+    void endSample(Clock::time_point time);
+
+    // `predictSeconds` ahead at the current angular velocity, clamped to CAMERA_MAX_PREDICTION.
+    glm::mat4 getViewMatrix(float predictSeconds = 0.0f) const;
+    glm::vec3 getPosition(float predictSeconds = 0.0f) const;
+
+private:
+    glm::vec3 target;
+    float distance;
+    float yaw;
+    float pitch;
+    glm::vec2 velocity{0.0f};      // yaw and pitch, radians per second
+    glm::vec2 sampleMotion{0.0f}; // radians gathered since the last sample
+    Clock::time_point sampleTime = Clock::now();
+};
+
+} // namespace pons
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <array>
+#include <cstdint>
 #include <glm/glm.hpp>
 
 #include <vulkan/vulkan.hpp>
@@ -28,7 +29,13 @@ struct Vertex {
 };
 
 struct UniformBufferObject {
-    alignas(16) glm::mat4 model;
     alignas(16) glm::mat4 view;
     alignas(16) glm::mat4 proj;
+};
+
+// Per draw data, placed after the lighting push constants (see simple.vert)
+struct ObjectPushConstants {
+    static constexpr uint32_t OFFSET = 32;
+
+    alignas(16) glm::mat4 model;
 };
\ No newline at end of file
@@ -0,0 +1,25 @@
+#include "dispatch.h"
+
+#if VULKAN_HPP_DISPATCH_LOADER_DYNAMIC
+VULKAN_HPP_DEFAULT_DISPATCH_LOADER_DYNAMIC_STORAGE
+#endif
+
+namespace pons {
+
+vk::DispatchLoaderDynamic &dispatcher() {
+#if VULKAN_HPP_DISPATCH_LOADER_DYNAMIC
+    return VULKAN_HPP_DEFAULT_DISPATCHER;
+#else
+    static vk::DispatchLoaderDynamic dispatchLoader;
+    return dispatchLoader;
+#endif
+}
+
+void initDispatch() { dispatcher().init(vkGetInstanceProcAddr); }
+
+void initDispatch(vk::Instance instance) { dispatcher().init(instance); }
+
+// device level pointers skip the per call dispatch through the instance the loader otherwise does
+void initDispatch(vk::Device device) { dispatcher().init(device); }
+
+} // namespace pons
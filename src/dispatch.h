@@ -0,0 +1,18 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+namespace pons {
+
+// Function pointer table behind vulkan-hpp. With VULKAN_HPP_DISPATCH_LOADER_DYNAMIC (PONS_DYNAMIC_DISPATCH in cmake)
+// this is the default dispatcher, so once initDispatch(device) ran every command buffer and queue call goes straight
+// to the driver instead of through the loader trampolines. With static dispatch only extension entry points that the
+// loader doesn't export are called through it.
+vk::DispatchLoaderDynamic &dispatcher();
+
+// Call in order: before creating the instance, after creating it, after creating the logical device.
+void initDispatch();
+void initDispatch(vk::Instance instance);
+void initDispatch(vk::Device device);
+
+} // namespace pons
@@ -0,0 +1,185 @@
+#include "dynamic_resolution.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace pons {
+
+namespace {
+
+// relative distance from the target that is left alone
+const float RESOLUTION_DEADBAND = 0.05f;
+const float RESOLUTION_MAX_STEP_DOWN = 0.1f;
+const float RESOLUTION_MAX_STEP_UP = 0.05f;
+
+} // namespace
+
+void GpuTimer::create(const GpuContext &gpu, uint32_t framesInFlight, uint32_t timestampValidBits) {
+    device = gpu.device;
+    vk::PhysicalDeviceLimits limits = gpu.physicalDevice.getProperties().limits;
+    if (timestampValidBits == 0 || !limits.timestampComputeAndGraphics) {
+        return;
+    }
+    timestampPeriod = limits.timestampPeriod;
+    timestampMask = timestampValidBits >= 64 ? ~0ull : (1ull << timestampValidBits) - 1;
+    queryPool = device.createQueryPoolUnique(
+        vk::QueryPoolCreateInfo{vk::QueryPoolCreateFlags{}, vk::QueryType::eTimestamp, 2 * framesInFlight});
+    bWritten.assign(framesInFlight, false);
+}
+
+void GpuTimer::recordBegin(vk::CommandBuffer commandBuffer, uint32_t frame) {
+    if (!queryPool) {
+        return;
+    }
+    commandBuffer.resetQueryPool(queryPool.get(), 2 * frame, 2);
+    commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, queryPool.get(), 2 * frame);
+}
+
+void GpuTimer::recordEnd(vk::CommandBuffer commandBuffer, uint32_t frame) {
+    if (!queryPool) {
+        return;
+    }
+    commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, queryPool.get(), 2 * frame + 1);
+    bWritten.at(frame) = true;
+}
+
+std::optional<float> GpuTimer::read(uint32_t frame) {
+    if (!queryPool || !bWritten.at(frame)) {
+        return std::nullopt;
+    }
+    std::array<uint64_t, 2> timestamps;
+    vk::Result result = device.getQueryPoolResults(queryPool.get(), 2 * frame, 2, sizeof(timestamps),
+                                                   timestamps.data(), sizeof(uint64_t), vk::QueryResultFlagBits::e64);
+    if (result != vk::Result::eSuccess) {
+        return std::nullopt;
+    }
+    uint64_t ticks = (timestamps[1] - timestamps[0]) & timestampMask;
+    return static_cast<float>(static_cast<double>(ticks) * timestampPeriod * 1e-6);
+}
+
+void ResolutionController::addSample(float gpuMs) {
+    sampleSum += gpuMs;
+    if (++sampleCount < RESOLUTION_ADJUST_INTERVAL) {
+        return;
+    }
+    float averageMs = sampleSum / static_cast<float>(sampleCount);
+    sampleSum = 0.0f;
+    sampleCount = 0;
+    if (averageMs <= 0.0f || std::abs(averageMs - targetMs) < targetMs * RESOLUTION_DEADBAND) {
+        return;
+    }
+    // gpu time is roughly proportional to the pixel count, i.e. to scale squared
+    float desired = scale * std::sqrt(targetMs / averageMs);
+    float step = std::clamp(desired - scale, -RESOLUTION_MAX_STEP_DOWN, RESOLUTION_MAX_STEP_UP);
+    scale = std::clamp(scale + step, RESOLUTION_MIN_SCALE, RESOLUTION_MAX_SCALE);
+}
+
+vk::Extent2D ResolutionController::scaleExtent(vk::Extent2D maxExtent) const {
+    auto scaleDimension = [this](uint32_t size) {
+        return std::clamp(static_cast<uint32_t>(std::lround(static_cast<float>(size) * scale)), 1u, size);
+    };
+    return vk::Extent2D{scaleDimension(maxExtent.width), scaleDimension(maxExtent.height)};
+}
+
+vk::SampleCountFlagBits chooseSampleCount(vk::PhysicalDevice physicalDevice, uint32_t maxSamples) {
+    vk::SampleCountFlags supported = physicalDevice.getProperties().limits.framebufferColorSampleCounts;
+    for (uint32_t count = 64; count > 1; count /= 2) {
+        auto bit = static_cast<vk::SampleCountFlagBits>(count);
+        if (count <= maxSamples && (supported & bit)) {
+            return bit;
+        }
+    }
+    return vk::SampleCountFlagBits::e1;
+}
+
+void SceneTarget::create(const GpuContext &gpu, vk::SampleCountFlagBits samples) {
+    this->gpu = gpu;
+    this->samples = samples;
+    bool bMultisample = samples != vk::SampleCountFlagBits::e1;
+
+    vk::AttachmentDescription colorAttachment{
+        vk::AttachmentDescriptionFlags{}, SCENE_COLOR_FORMAT,            vk::SampleCountFlagBits::e1,
+        vk::AttachmentLoadOp::eClear,     vk::AttachmentStoreOp::eStore, vk::AttachmentLoadOp::eDontCare,
+        vk::AttachmentStoreOp::eDontCare, vk::ImageLayout::eUndefined,   vk::ImageLayout::eShaderReadOnlyOptimal};
+    // samples are resolved by the subpass and never stored
+    vk::AttachmentDescription multisampleAttachment{
+        vk::AttachmentDescriptionFlags{}, SCENE_COLOR_FORMAT,               samples,
+        vk::AttachmentLoadOp::eClear,     vk::AttachmentStoreOp::eDontCare, vk::AttachmentLoadOp::eDontCare,
+        vk::AttachmentStoreOp::eDontCare, vk::ImageLayout::eUndefined,      vk::ImageLayout::eColorAttachmentOptimal};
+    // the cleared attachment comes first either way, so the pass takes a single clear value
+    std::vector<vk::AttachmentDescription> attachments{bMultisample ? multisampleAttachment : colorAttachment};
+    vk::AttachmentReference colorAttachmentRef{/*attachment*/ 0, vk::ImageLayout::eColorAttachmentOptimal};
+    vk::AttachmentReference resolveAttachmentRef{/*attachment*/ 1, vk::ImageLayout::eColorAttachmentOptimal};
+    if (bMultisample) {
+        colorAttachment.loadOp = vk::AttachmentLoadOp::eDontCare; // fully overwritten by the resolve
+        attachments.push_back(colorAttachment);
+    }
+    vk::SubpassDescription subpass{vk::SubpassDescriptionFlags{}, vk::PipelineBindPoint::eGraphics,
+                                   /*inputAttachments*/ nullptr, colorAttachmentRef};
+    if (bMultisample) {
+        subpass.setResolveAttachments(resolveAttachmentRef);
+    }
+    std::array<vk::SubpassDependency, 2> dependencies{
+        {// previous frame's post processing has to finish reading before the target is cleared
+         {VK_SUBPASS_EXTERNAL, /*dstSubpass*/ 0,
+          vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eColorAttachmentOutput,
+          vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::AccessFlags{},
+          vk::AccessFlagBits::eColorAttachmentWrite},
+         // post processing samples the result
+         {/*srcSubpass*/ 0, VK_SUBPASS_EXTERNAL, vk::PipelineStageFlagBits::eColorAttachmentOutput,
+          vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eColorAttachmentWrite,
+          vk::AccessFlagBits::eShaderRead}}};
+    sceneRenderPass = gpu.device.createRenderPassUnique(
+        vk::RenderPassCreateInfo{vk::RenderPassCreateFlags{}, attachments, subpass, dependencies});
+}
+
+void SceneTarget::createTarget(vk::Extent2D extent) {
+    maxExtent = extent;
+    framebuffer.reset();
+    imageView.reset();
+    image.reset();
+    imageMemory.reset();
+    multisampleView.reset();
+    multisampleImage.reset();
+    multisampleMemory.reset();
+
+    vk::ImageCreateInfo imageInfo{vk::ImageCreateFlags{},
+                                  vk::ImageType::e2D,
+                                  SCENE_COLOR_FORMAT,
+                                  vk::Extent3D{extent.width, extent.height, 1},
+                                  /*mipLevels*/ 1,
+                                  /*arrayLayers*/ 1,
+                                  vk::SampleCountFlagBits::e1,
+                                  vk::ImageTiling::eOptimal,
+                                  vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled};
+    std::tie(image, imageMemory) = createImage(gpu, imageInfo, vk::MemoryPropertyFlagBits::eDeviceLocal);
+    vk::ImageViewCreateInfo viewInfo{vk::ImageViewCreateFlags{}, image.get(), vk::ImageViewType::e2D,
+                                     SCENE_COLOR_FORMAT, vk::ComponentMapping{},
+                                     vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1}};
+    imageView = gpu.device.createImageViewUnique(viewInfo);
+    std::vector<vk::ImageView> attachments{imageView.get()};
+
+    if (samples != vk::SampleCountFlagBits::e1) {
+        imageInfo.samples = samples;
+        imageInfo.usage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransientAttachment;
+        multisampleImage = gpu.device.createImageUnique(imageInfo);
+        vk::MemoryRequirements requirements = gpu.device.getImageMemoryRequirements(multisampleImage.get());
+        // desktop gpus usually have no lazily allocated memory, the image is then an ordinary one
+        vk::MemoryPropertyFlags lazyProperties =
+            vk::MemoryPropertyFlagBits::eDeviceLocal | vk::MemoryPropertyFlagBits::eLazilyAllocated;
+        bMultisampleLazy =
+            findMemoryTypeIndex(gpu.physicalDevice, requirements.memoryTypeBits, lazyProperties).has_value();
+        multisampleMemory = allocateMemory(
+            gpu, requirements, bMultisampleLazy ? lazyProperties : vk::MemoryPropertyFlagBits::eDeviceLocal,
+            MemoryCategory::Image);
+        gpu.device.bindImageMemory(multisampleImage.get(), multisampleMemory.get(), 0);
+        viewInfo.image = multisampleImage.get();
+        multisampleView = gpu.device.createImageViewUnique(viewInfo);
+        attachments.insert(attachments.begin(), multisampleView.get());
+    }
+    framebuffer = gpu.device.createFramebufferUnique(vk::FramebufferCreateInfo{
+        vk::FramebufferCreateFlags{}, sceneRenderPass.get(), attachments, extent.width, extent.height, /*layers*/ 1});
+}
+
+} // namespace pons
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "gpu.h"
+
+namespace pons {
+
+const vk::Format SCENE_COLOR_FORMAT = vk::Format::eR16G16B16A16Sfloat; // linear hdr, tonemapped by post processing
+const uint32_t RESOLUTION_ADJUST_INTERVAL = 8; // frames of gpu time averaged per adjustment
+const float RESOLUTION_MIN_SCALE = 0.5f;
+const float RESOLUTION_MAX_SCALE = 1.0f;
+
+// Per frame in flight pair of timestamps around the whole command buffer.
+class GpuTimer {
+public:
+    // `timestampValidBits` of the queue family the timer is used on, 0 disables the timer.
+    void create(const GpuContext &gpu, uint32_t framesInFlight, uint32_t timestampValidBits);
+    bool isSupported() const { return static_cast<bool>(queryPool); }
+
+    // Must be recorded outside of render pass.
+    void recordBegin(vk::CommandBuffer commandBuffer, uint32_t frame);
+    void recordEnd(vk::CommandBuffer commandBuffer, uint32_t frame);
+    // Milliseconds measured by the last submission of `frame`, call after waiting for its fence.
+    std::optional<float> read(uint32_t frame);
+
+private:
+    vk::Device device;
+    vk::UniqueQueryPool queryPool;
+    float timestampPeriod = 1.0f; // nanoseconds per tick
+    uint64_t timestampMask = ~0ull;
+    std::vector<bool> bWritten;
+};
+
+// Picks the render scale that keeps measured gpu time under the target. Scale drops quickly when over budget and
+// recovers slowly, the deadband keeps it from oscillating around the target.
+class ResolutionController {
+public:
+    explicit ResolutionController(float targetMs) : targetMs(targetMs) {}
+
+    void addSample(float gpuMs);
+    void reset() { scale = RESOLUTION_MAX_SCALE; }
+    float getScale() const { return scale; }
+    vk::Extent2D scaleExtent(vk::Extent2D maxExtent) const;
+
+private:
+    float targetMs;
+    float scale = RESOLUTION_MAX_SCALE;
+    float sampleSum = 0.0f;
+    uint32_t sampleCount = 0;
+};
+
+// Highest sample count up to `maxSamples` the device renders color attachments with.
+vk::SampleCountFlagBits chooseSampleCount(vk::PhysicalDevice physicalDevice, uint32_t maxSamples);
+
+// Offscreen scene target allocated at full swapchain size and rendered into a scaled viewport, so scale changes
+// never reallocate. Post processing upscales the rendered region into the swapchain.
+// With multisampling the scene renders into a transient image that's resolved into the sampled one at the end of the
+// subpass, so on tiled gpus the samples never leave tile memory.
+class SceneTarget {
+public:
+    void create(const GpuContext &gpu, vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1);
+    // Called again on swapchain resize.
+    void createTarget(vk::Extent2D maxExtent);
+
+    vk::SampleCountFlagBits getSamples() const { return samples; }
+    // Whether the multisampled image got lazily allocated memory, i.e. likely has no backing storage.
+    bool isMultisampleLazy() const { return bMultisampleLazy; }
+    vk::RenderPass getRenderPass() const { return sceneRenderPass.get(); }
+    vk::Framebuffer getFramebuffer() const { return framebuffer.get(); }
+    vk::ImageView getImageView() const { return imageView.get(); }
+    vk::Extent2D getMaxExtent() const { return maxExtent; }
+
+private:
+    GpuContext gpu;
+    vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1;
+    bool bMultisampleLazy = false;
+    vk::Extent2D maxExtent;
+    vk::UniqueRenderPass sceneRenderPass;
+    vk::UniqueImage multisampleImage;
+    TrackedMemory multisampleMemory;
+    vk::UniqueImageView multisampleView;
+    vk::UniqueImage image;
+    TrackedMemory imageMemory;
+    vk::UniqueImageView imageView;
+    vk::UniqueFramebuffer framebuffer;
+};
+
+} // namespace pons
@@ -0,0 +1,76 @@
+#include "frame_arena.h"
+
+#include <bit>
+#include <cstdlib>
+#include <new>
+
+namespace pons {
+
+namespace {
+
+#ifndef NDEBUG
+thread_local uint64_t tHeapAllocationCount = 0;
+#endif
+
+} // namespace
+
+FrameArena::FrameArena(size_t capacity) : buffer(std::make_unique<std::byte[]>(capacity)), capacity(capacity) {}
+
+void FrameArena::reset() {
+    if (overflowBytes > 0) {
+        // alignment padding of the spilled allocations is covered by rounding up
+        capacity = std::bit_ceil(offset + overflowBytes);
+        buffer = std::make_unique<std::byte[]>(capacity);
+    }
+    overflow.release();
+    offset = 0;
+    overflowBytes = 0;
+}
+
+void *FrameArena::do_allocate(size_t bytes, size_t alignment) {
+    auto base = reinterpret_cast<uintptr_t>(buffer.get());
+    size_t aligned = ((base + offset + alignment - 1) & ~(uintptr_t{alignment} - 1)) - base;
+    if (aligned + bytes <= capacity) {
+        offset = aligned + bytes;
+        return buffer.get() + aligned;
+    }
+    overflowBytes += bytes + alignment;
+    return overflow.allocate(bytes, alignment);
+}
+
+void FrameArena::do_deallocate(void *pData, size_t bytes, size_t alignment) {
+    // released by reset
+    (void)pData;
+    (void)bytes;
+    (void)alignment;
+}
+
+uint64_t getThreadHeapAllocationCount() {
+#ifdef NDEBUG
+    return 0;
+#else
+    return tHeapAllocationCount;
+#endif
+}
+
+} // namespace pons
+
+#ifndef NDEBUG
+// Counting replacements of the global allocation functions, array and nothrow forms forward to these.
+void *operator new(std::size_t size) {
+    ++pons::tHeapAllocationCount;
+    if (void *pData = std::malloc(size == 0 ? 1 : size)) {
+        return pData;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *pData) noexcept {
+    std::free(pData);
+}
+
+void operator delete(void *pData, std::size_t size) noexcept {
+    (void)size;
+    std::free(pData);
+}
+#endif
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+
+namespace pons {
+
+const size_t FRAME_ARENA_CAPACITY = 256 * 1024;
+
+// Linear allocator for data that lives for one frame in flight, used through std::pmr containers. Deallocation is
+// a no-op, everything is released at once by reset. Allocations past the capacity come from the heap for that frame
+// and the next reset grows the buffer to the peak, so a steady state frame never touches the heap.
+class FrameArena final : public std::pmr::memory_resource {
+public:
+    explicit FrameArena(size_t capacity = FRAME_ARENA_CAPACITY);
+    FrameArena(const FrameArena &) = delete;
+    FrameArena &operator=(const FrameArena &) = delete;
+
+    // Call once the frame's fence has signaled, containers allocated from the arena must be gone by then.
+    void reset();
+    size_t getUsed() const { return offset + overflowBytes; }
+    size_t getCapacity() const { return capacity; }
+
+private:
+    void *do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void *pData, size_t bytes, size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override { return this == &other; }
+
+    std::unique_ptr<std::byte[]> buffer;
+    size_t capacity;
+    size_t offset = 0;
+    size_t overflowBytes = 0;
+    std::pmr::monotonic_buffer_resource overflow{std::pmr::new_delete_resource()};
+};
+
+// Global operator new calls made by the calling thread, counted in debug builds only and always 0 with NDEBUG.
+uint64_t getThreadHeapAllocationCount();
+
+} // namespace pons
@@ -0,0 +1,275 @@
+#include "gpu.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+
+namespace pons {
+
+std::vector<char> readFile(const std::string &filename) {
+    std::ifstream file(filename, std::ios::ate | std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("failed to open file!");
+    }
+    size_t fileSize = static_cast<size_t>(file.tellg());
+    std::vector<char> buffer(fileSize);
+    file.seekg(0);
+    file.read(buffer.data(), static_cast<std::streamsize>(fileSize));
+    file.close();
+
+    return buffer;
+}
+
+namespace {
+
+const Archive *shaderArchive() {
+    static const Archive archive = [] {
+        Archive shaders;
+        if (std::filesystem::exists(SHADER_DIR + SHADER_ARCHIVE)) {
+            shaders.open(SHADER_DIR + SHADER_ARCHIVE);
+        }
+        return shaders;
+    }();
+    return archive.isOpen() ? &archive : nullptr;
+}
+
+// keyed by names in the archive, set once by preloadShaders and never changed after, so views into it stay valid
+using PreloadedShaders = std::unordered_map<std::string_view, std::vector<char>>;
+std::mutex preloadMutex;
+std::unique_ptr<const PreloadedShaders> pPreloadedShaders;
+
+} // namespace
+
+ShaderCode readShader(const std::string &name) {
+    ShaderCode code;
+    {
+        std::lock_guard<std::mutex> lock(preloadMutex);
+        if (pPreloadedShaders) {
+            auto it = pPreloadedShaders->find(name);
+            if (it != pPreloadedShaders->end()) {
+                code.bytes = it->second;
+                return code;
+            }
+        }
+    }
+    const Archive *pArchive = shaderArchive();
+    const ArchiveEntry *pEntry = pArchive ? pArchive->find(name) : nullptr;
+    if (pEntry && pEntry->compression == EntryCompression::None) {
+        // entries are page aligned in the mapping, that satisfies SPIR-V's word alignment
+        std::span<const std::byte> stored = pArchive->view(*pEntry);
+        if (!verifyContents(*pEntry, stored)) {
+            throw std::runtime_error("shader " + name + " doesn't match its hash in " + SHADER_ARCHIVE);
+        }
+        code.bytes = {reinterpret_cast<const char *>(stored.data()), stored.size()};
+        return code;
+    }
+    code.owned = pEntry ? pArchive->read(name) : readFile(SHADER_DIR + name);
+    code.bytes = code.owned; // moving the vector keeps its storage, the span stays valid
+    return code;
+}
+
+void preloadShaders(ThreadPool &pool) {
+    const Archive *pArchive = shaderArchive();
+    if (!pArchive) {
+        return;
+    }
+    std::span<const ArchiveEntry> entries = pArchive->getEntries();
+    auto pShaders = std::make_unique<PreloadedShaders>();
+    pShaders->reserve(entries.size());
+    // one flag per entry, each callback writes only its own
+    auto bLoaded = std::make_unique<bool[]>(entries.size());
+    {
+        AsyncReader reader(*pArchive, pool);
+        for (size_t i = 0; i < entries.size(); ++i) {
+            std::vector<char> &code = (*pShaders)[pArchive->getName(entries[i])];
+            code.resize(static_cast<size_t>(entries[i].size));
+            reader.read(entries[i], reinterpret_cast<std::byte *>(code.data()),
+                        [&bLoaded, i](bool bSuccess) { bLoaded[i] = bSuccess; });
+        }
+        reader.wait();
+    }
+    // failed ones are read from the archive again on use, which reports the error
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (!bLoaded[i]) {
+            pShaders->erase(pArchive->getName(entries[i]));
+        }
+    }
+    std::lock_guard<std::mutex> lock(preloadMutex);
+    pPreloadedShaders = std::move(pShaders);
+}
+
+vk::UniqueShaderModule createShaderModule(vk::Device device, std::span<const char> code) {
+    vk::ShaderModuleCreateInfo createInfo{vk::ShaderModuleCreateFlags{}, code.size(),
+                                          reinterpret_cast<const uint32_t *>(code.data())};
+    return device.createShaderModuleUnique(createInfo);
+}
+
+std::optional<uint32_t> findMemoryTypeIndex(vk::PhysicalDevice physicalDevice, uint32_t typeFilter,
+                                            vk::MemoryPropertyFlags properties) {
+    vk::PhysicalDeviceMemoryProperties memProperties = physicalDevice.getMemoryProperties();
+    for (uint32_t i = 0; i < memProperties.memoryTypeCount; ++i) {
+        if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+            return i;
+        }
+    }
+    return std::nullopt;
+}
+
+uint32_t findMemoryType(vk::PhysicalDevice physicalDevice, uint32_t typeFilter, vk::MemoryPropertyFlags properties) {
+    std::optional<uint32_t> typeIndex = findMemoryTypeIndex(physicalDevice, typeFilter, properties);
+    if (!typeIndex) {
+        throw std::runtime_error("failed to find suitable memory type");
+    }
+    return typeIndex.value();
+}
+
+TrackedMemory allocateMemory(const GpuContext &gpu, const vk::MemoryRequirements &requirements,
+                             vk::MemoryPropertyFlags properties, MemoryCategory category) {
+    uint32_t typeIndex = findMemoryType(gpu.physicalDevice, requirements.memoryTypeBits, properties);
+    MemoryBudget *pBudget = gpu.pMemoryBudget;
+    if (!pBudget) {
+        vk::MemoryAllocateInfo allocInfo{requirements.size, typeIndex};
+        return TrackedMemory{gpu.device.allocateMemoryUnique(allocInfo), nullptr, 0, requirements.size, category};
+    }
+
+    // plain device local resources still work from host memory, just slower
+    std::optional<uint32_t> demotedTypeIndex;
+    if (properties == vk::MemoryPropertyFlagBits::eDeviceLocal) {
+        demotedTypeIndex =
+            findMemoryTypeIndex(gpu.physicalDevice, requirements.memoryTypeBits,
+                                vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+    }
+    std::vector<uint32_t> candidates{typeIndex};
+    if (demotedTypeIndex && pBudget->heapOfType(*demotedTypeIndex) != pBudget->heapOfType(typeIndex)) {
+        candidates.push_back(*demotedTypeIndex);
+    }
+    for (uint32_t candidate : candidates) {
+        if (!pBudget->reserve(candidate, requirements.size)) {
+            continue;
+        }
+        vk::MemoryAllocateInfo allocInfo{requirements.size, candidate};
+        try {
+            return TrackedMemory{gpu.device.allocateMemoryUnique(allocInfo), pBudget, pBudget->heapOfType(candidate),
+                                 requirements.size, category};
+        } catch (const vk::OutOfDeviceMemoryError &) {
+            // the driver ran out before the budget did, e.g. other processes grew meanwhile
+            continue;
+        }
+    }
+    throw std::runtime_error("device memory budget exceeded (" + std::to_string(requirements.size) +
+                             " bytes requested): " + pBudget->formatStats());
+}
+
+std::tuple<vk::UniqueBuffer, TrackedMemory> createBuffer(const GpuContext &gpu, vk::DeviceSize size,
+                                                         vk::BufferUsageFlags usage,
+                                                         vk::MemoryPropertyFlags properties,
+                                                         MemoryCategory category) {
+    vk::BufferCreateInfo bufferInfo{vk::BufferCreateFlags{}, size, usage, vk::SharingMode::eExclusive};
+    vk::UniqueBuffer buffer = gpu.device.createBufferUnique(bufferInfo);
+
+    vk::MemoryRequirements memRequirements = gpu.device.getBufferMemoryRequirements(buffer.get());
+    TrackedMemory bufferMemory = allocateMemory(gpu, memRequirements, properties, category);
+    gpu.device.bindBufferMemory(buffer.get(), bufferMemory.get(), 0);
+    return std::forward_as_tuple(std::move(buffer), std::move(bufferMemory));
+}
+
+std::tuple<vk::UniqueImage, TrackedMemory> createImage(const GpuContext &gpu, const vk::ImageCreateInfo &imageInfo,
+                                                       vk::MemoryPropertyFlags properties, MemoryCategory category) {
+    vk::UniqueImage image = gpu.device.createImageUnique(imageInfo);
+    vk::MemoryRequirements memRequirements = gpu.device.getImageMemoryRequirements(image.get());
+    TrackedMemory imageMemory = allocateMemory(gpu, memRequirements, properties, category);
+    gpu.device.bindImageMemory(image.get(), imageMemory.get(), 0);
+    return std::forward_as_tuple(std::move(image), std::move(imageMemory));
+}
+
+void copyBuffer(const GpuContext &gpu, vk::Buffer srcBuffer, vk::Buffer dstBuffer, vk::DeviceSize size) {
+    std::unique_lock<std::mutex> lock =
+        gpu.pQueueMutex ? std::unique_lock<std::mutex>(*gpu.pQueueMutex) : std::unique_lock<std::mutex>();
+    vk::CommandBufferAllocateInfo allocInfo{gpu.commandPool, vk::CommandBufferLevel::ePrimary,
+                                            /*commandBufferCount*/ 1};
+    vk::UniqueCommandBuffer commandBuffer = std::move(gpu.device.allocateCommandBuffersUnique(allocInfo)[0]);
+    vk::CommandBufferBeginInfo beginInfo{vk::CommandBufferUsageFlagBits::eOneTimeSubmit};
+    commandBuffer->begin(beginInfo);
+    vk::BufferCopy copyRegion{/*srcOffset*/ 0,
+                              /*dstOffset*/ 0, size};
+    commandBuffer->copyBuffer(srcBuffer, dstBuffer, 1, &copyRegion);
+    commandBuffer->end();
+    vk::SubmitInfo submitInfo{
+        /*waitSemaphoreCount*/ 0,
+        /*pWaitSemaphores*/ nullptr,
+        /*pWaitDstStageMask*/ nullptr,
+        /*commandBufferCount*/ 1,      &commandBuffer.get(),
+    };
+    vk::UniqueFence fence = gpu.device.createFenceUnique(vk::FenceCreateInfo{});
+    gpu.graphicsQueue.submit(submitInfo, fence.get());
+    if (lock.mutex()) {
+        lock.unlock();
+    }
+    if (gpu.device.waitForFences(fence.get(), true, UINT64_MAX) != vk::Result::eSuccess) {
+        throw std::runtime_error("error while waiting for buffer copy");
+    }
+    if (lock.mutex()) {
+        lock.lock(); // the command buffer goes back to the pool on return
+    }
+}
+
+std::tuple<vk::UniqueBuffer, TrackedMemory> createDeviceLocalBuffer(const GpuContext &gpu, const void *data,
+                                                                    vk::DeviceSize size, vk::BufferUsageFlags usage) {
+    auto [stagingBuffer, stagingBufferMemory] =
+        createBuffer(gpu, size, vk::BufferUsageFlagBits::eTransferSrc,
+                     vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+                     MemoryCategory::Staging);
+    void *mapped;
+    vk::Result result = gpu.device.mapMemory(stagingBufferMemory.get(), 0, size, vk::MemoryMapFlags{}, &mapped);
+    if (result != vk::Result::eSuccess) {
+        throw std::runtime_error("failed to map stagingBuffer memory");
+    }
+    memcpy(mapped, data, static_cast<size_t>(size));
+    gpu.device.unmapMemory(stagingBufferMemory.get());
+    auto [buffer, bufferMemory] = createBuffer(gpu, size, vk::BufferUsageFlagBits::eTransferDst | usage,
+                                               vk::MemoryPropertyFlagBits::eDeviceLocal);
+    copyBuffer(gpu, stagingBuffer.get(), buffer.get(), size);
+    return std::forward_as_tuple(std::move(buffer), std::move(bufferMemory));
+}
+
+std::tuple<vk::UniqueBuffer, TrackedMemory> createDeviceLocalBuffer(const GpuContext &gpu, AsyncReader &reader,
+                                                                    const ArchiveEntry &entry,
+                                                                    vk::BufferUsageFlags usage) {
+    vk::DeviceSize size = entry.size;
+    auto [stagingBuffer, stagingBufferMemory] =
+        createBuffer(gpu, size, vk::BufferUsageFlagBits::eTransferSrc,
+                     vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+                     MemoryCategory::Staging);
+    void *mapped;
+    vk::Result result = gpu.device.mapMemory(stagingBufferMemory.get(), 0, size, vk::MemoryMapFlags{}, &mapped);
+    if (result != vk::Result::eSuccess) {
+        throw std::runtime_error("failed to map stagingBuffer memory");
+    }
+    std::promise<bool> readDone;
+    std::future<bool> readResult = readDone.get_future();
+    reader.read(entry, static_cast<std::byte *>(mapped), [&readDone](bool bSuccess) { readDone.set_value(bSuccess); });
+    // allocate the destination while the read is in flight
+    vk::UniqueBuffer buffer;
+    TrackedMemory bufferMemory;
+    try {
+        std::tie(buffer, bufferMemory) = createBuffer(gpu, size, vk::BufferUsageFlagBits::eTransferDst | usage,
+                                                      vk::MemoryPropertyFlagBits::eDeviceLocal);
+    } catch (...) {
+        readResult.wait(); // the reader still writes into the staging memory
+        throw;
+    }
+    bool bSuccess = readResult.get();
+    gpu.device.unmapMemory(stagingBufferMemory.get());
+    if (!bSuccess) {
+        throw std::runtime_error("failed to read asset into staging buffer");
+    }
+    copyBuffer(gpu, stagingBuffer.get(), buffer.get(), size);
+    return std::forward_as_tuple(std::move(buffer), std::move(bufferMemory));
+}
+
+} // namespace pons
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+#include <vulkan/vulkan_enums.hpp>
+#include <vulkan/vulkan_handles.hpp>
+#include <vulkan/vulkan_structs.hpp>
+
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "async_reader.h"
+#include "memory_budget.h"
+
+namespace pons {
+
+// FIXME: find a better way to handle relative paths hell during debug
+const std::string SHADER_DIR = "/home/modbrin/projects/pons2/shaders/bin/";
+// packed by compile_shaders.sh, loose files in SHADER_DIR are used when it's missing
+const std::string SHADER_ARCHIVE = "shaders.pak";
+
+// Non-owning view of the device objects shared between subsystems.
+struct GpuContext {
+    vk::PhysicalDevice physicalDevice;
+    vk::Device device;
+    vk::Queue graphicsQueue;
+    vk::CommandPool commandPool;
+    MemoryBudget *pMemoryBudget = nullptr; // allocations are untracked when null
+    std::mutex *pQueueMutex = nullptr;     // guards the queue and command pool when uploads run on several threads
+};
+
+std::vector<char> readFile(const std::string &filename);
+
+// SPIR-V of a shader, viewed in place when it's stored uncompressed in the mapped shader archive, read into `owned`
+// otherwise. Converts to the bytes, so it can go straight into createShaderModule.
+struct ShaderCode {
+    std::vector<char> owned;
+    std::span<const char> bytes;
+
+    operator std::span<const char>() const { return bytes; }
+};
+
+ShaderCode readShader(const std::string &name);
+// Streams every shader of the archive into memory through an AsyncReader on `pool` and blocks until they arrived,
+// readShader serves them from there afterwards. Meant to overlap with startup, shaders read before it's done come
+// from the archive as usual.
+void preloadShaders(ThreadPool &pool);
+
+vk::UniqueShaderModule createShaderModule(vk::Device device, std::span<const char> code);
+
+std::optional<uint32_t> findMemoryTypeIndex(vk::PhysicalDevice physicalDevice, uint32_t typeFilter,
+                                            vk::MemoryPropertyFlags properties);
+uint32_t findMemoryType(vk::PhysicalDevice physicalDevice, uint32_t typeFilter, vk::MemoryPropertyFlags properties);
+
+// Allocates within the memory budget. Device local requests that don't fit are demoted to host visible memory when
+// the resource allows it, otherwise a runtime_error describing the budget is thrown.
+TrackedMemory allocateMemory(const GpuContext &gpu, const vk::MemoryRequirements &requirements,
+                             vk::MemoryPropertyFlags properties, MemoryCategory category);
+
+std::tuple<vk::UniqueBuffer, TrackedMemory> createBuffer(const GpuContext &gpu, vk::DeviceSize size,
+                                                         vk::BufferUsageFlags usage,
+                                                         vk::MemoryPropertyFlags properties,
+                                                         MemoryCategory category = MemoryCategory::Buffer);
+
+std::tuple<vk::UniqueImage, TrackedMemory> createImage(const GpuContext &gpu, const vk::ImageCreateInfo &imageInfo,
+                                                       vk::MemoryPropertyFlags properties,
+                                                       MemoryCategory category = MemoryCategory::Image);
+
+// Waits for this copy only, other threads can record and submit meanwhile.
+void copyBuffer(const GpuContext &gpu, vk::Buffer srcBuffer, vk::Buffer dstBuffer, vk::DeviceSize size);
+
+// Uploads `size` bytes into a new device local buffer through a temporary staging buffer.
+std::tuple<vk::UniqueBuffer, TrackedMemory> createDeviceLocalBuffer(const GpuContext &gpu, const void *data,
+                                                                    vk::DeviceSize size, vk::BufferUsageFlags usage);
+// Same, but the archive entry is streamed straight into the mapped staging buffer.
+std::tuple<vk::UniqueBuffer, TrackedMemory> createDeviceLocalBuffer(const GpuContext &gpu, AsyncReader &reader,
+                                                                    const ArchiveEntry &entry,
+                                                                    vk::BufferUsageFlags usage);
+
+} // namespace pons
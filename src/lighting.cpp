@@ -0,0 +1,91 @@
+#include "lighting.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace pons {
+
+std::array<vk::DescriptorSetLayoutBinding, 2> ClusteredLighting::getDescriptorSetLayoutBindings() {
+    vk::ShaderStageFlags stages = vk::ShaderStageFlagBits::eCompute | vk::ShaderStageFlagBits::eFragment;
+    return {{{/*binding*/ 1, vk::DescriptorType::eStorageBuffer, /*descriptorCount*/ 1, stages, nullptr},
+             {/*binding*/ 2, vk::DescriptorType::eStorageBuffer, /*descriptorCount*/ 1, stages, nullptr}}};
+}
+
+vk::PushConstantRange ClusteredLighting::getPushConstantRange() {
+    return vk::PushConstantRange{vk::ShaderStageFlagBits::eCompute | vk::ShaderStageFlagBits::eFragment,
+                                 /*offset*/ 0, sizeof(ClusterParams)};
+}
+
+void ClusteredLighting::create(const GpuContext &gpu, vk::DescriptorSetLayout frameSetLayout, uint32_t framesInFlight,
+                               uint32_t viewCount) {
+    vk::DeviceSize lightBufferSize = sizeof(PointLight) * MAX_LIGHTS;
+    vk::DeviceSize clusterBufferSize = sizeof(uint32_t) * CLUSTER_COUNT * (MAX_LIGHTS_PER_CLUSTER + 1);
+    for (uint32_t i = 0; i < framesInFlight; ++i) {
+        auto [lightBuffer, lightBufferMemory] =
+            createBuffer(gpu, lightBufferSize, vk::BufferUsageFlagBits::eStorageBuffer,
+                         vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+        void *data;
+        vk::Result result =
+            gpu.device.mapMemory(lightBufferMemory.get(), 0, lightBufferSize, vk::MemoryMapFlags{}, &data);
+        if (result != vk::Result::eSuccess) {
+            throw std::runtime_error("failed to map memory of light buffer");
+        }
+        lightBuffers.emplace_back(std::move(lightBuffer));
+        lightBuffersMemory.emplace_back(std::move(lightBufferMemory));
+        lightBuffersMapped.push_back(data);
+    }
+    for (uint32_t i = 0; i < framesInFlight * viewCount; ++i) {
+        auto [clusterBuffer, clusterBufferMemory] = createBuffer(
+            gpu, clusterBufferSize, vk::BufferUsageFlagBits::eStorageBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal);
+        clusterBuffers.emplace_back(std::move(clusterBuffer));
+        clusterBuffersMemory.emplace_back(std::move(clusterBufferMemory));
+    }
+
+    vk::UniqueShaderModule cullShaderModule = createShaderModule(gpu.device, readShader("light_cull.spv"));
+    vk::PipelineShaderStageCreateInfo cullShaderStageInfo{
+        vk::PipelineShaderStageCreateFlags{}, vk::ShaderStageFlagBits::eCompute, cullShaderModule.get(), "main"};
+    vk::PushConstantRange pushConstantRange = getPushConstantRange();
+    vk::PipelineLayoutCreateInfo pipelineLayoutInfo{vk::PipelineLayoutCreateFlags{}, frameSetLayout,
+                                                    pushConstantRange};
+    cullPipelineLayout = gpu.device.createPipelineLayoutUnique(pipelineLayoutInfo);
+    vk::ComputePipelineCreateInfo pipelineInfo{vk::PipelineCreateFlags{}, cullShaderStageInfo,
+                                               cullPipelineLayout.get()};
+    cullPipeline = gpu.device.createComputePipelineUnique(nullptr, pipelineInfo).value;
+}
+
+void ClusteredLighting::writeDescriptorSet(vk::Device device, vk::DescriptorSet set, uint32_t frame,
+                                           uint32_t view) const {
+    size_t cluster = view * lightBuffers.size() + frame;
+    vk::DescriptorBufferInfo lightBufferInfo{lightBuffers.at(frame).get(), /*offset*/ 0, VK_WHOLE_SIZE};
+    vk::DescriptorBufferInfo clusterBufferInfo{clusterBuffers.at(cluster).get(), /*offset*/ 0, VK_WHOLE_SIZE};
+    std::array<vk::WriteDescriptorSet, 2> descriptorWrites{
+        {{set, /*dstBinding*/ 1, /*dstArrayElement*/ 0, /*descriptorCount*/ 1, vk::DescriptorType::eStorageBuffer,
+          nullptr, &lightBufferInfo, nullptr},
+         {set, /*dstBinding*/ 2, /*dstArrayElement*/ 0, /*descriptorCount*/ 1, vk::DescriptorType::eStorageBuffer,
+          nullptr, &clusterBufferInfo, nullptr}}};
+    device.updateDescriptorSets(descriptorWrites, nullptr);
+}
+
+uint32_t ClusteredLighting::uploadLights(uint32_t frame) {
+    uint32_t lightCount = static_cast<uint32_t>(std::min<size_t>(lights.size(), MAX_LIGHTS));
+    memcpy(lightBuffersMapped.at(frame), lights.data(), sizeof(PointLight) * lightCount);
+    return lightCount;
+}
+
+void ClusteredLighting::recordCulling(vk::CommandBuffer commandBuffer, vk::DescriptorSet frameSet,
+                                      const ClusterParams &params) const {
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, cullPipeline.get());
+    commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, cullPipelineLayout.get(), 0, frameSet, nullptr);
+    commandBuffer.pushConstants(cullPipelineLayout.get(), getPushConstantRange().stageFlags, 0, sizeof(params),
+                                &params);
+    commandBuffer.dispatch((CLUSTER_COUNT + LIGHT_CULL_GROUP_SIZE - 1) / LIGHT_CULL_GROUP_SIZE, 1, 1);
+
+    // cluster lists are consumed by fragment shading of the same frame
+    vk::MemoryBarrier barrier{vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead};
+    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                                  vk::PipelineStageFlagBits::eFragmentShader, vk::DependencyFlags{}, barrier, nullptr,
+                                  nullptr);
+}
+
+} // namespace pons
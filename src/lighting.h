@@ -0,0 +1,65 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "gpu.h"
+
+namespace pons {
+
+// Must match shaders/clustered.glsl
+const uint32_t CLUSTER_GRID_X = 16;
+const uint32_t CLUSTER_GRID_Y = 9;
+const uint32_t CLUSTER_GRID_Z = 24;
+const uint32_t CLUSTER_COUNT = CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z;
+const uint32_t MAX_LIGHTS_PER_CLUSTER = 127; // one extra slot per cluster holds the count
+const uint32_t MAX_LIGHTS = 4096;
+const uint32_t LIGHT_CULL_GROUP_SIZE = 128;
+
+struct PointLight {
+    alignas(16) glm::vec4 positionRadius; // xyz - world position, w - radius of influence
+    alignas(16) glm::vec4 color;          // rgb - color, a - intensity
+};
+
+struct ClusterParams {
+    uint32_t lightCount;
+    float zNear;
+    float zFar;
+    float screenWidth;
+    float screenHeight;
+};
+
+// Clustered forward lighting: a compute pass bins the light list into a froxel grid each frame, fragment shader then
+// only iterates over lights of its own cluster. Buffers are duplicated per frame in flight so binning of the next frame
+// never races with shading of the previous one. Cluster lists depend on the camera and are kept per view as well.
+class ClusteredLighting {
+public:
+    // Bindings 1 and 2 of the frame descriptor set, binding 0 is the camera uniform buffer.
+    static std::array<vk::DescriptorSetLayoutBinding, 2> getDescriptorSetLayoutBindings();
+    static vk::PushConstantRange getPushConstantRange();
+
+    void create(const GpuContext &gpu, vk::DescriptorSetLayout frameSetLayout, uint32_t framesInFlight,
+                uint32_t viewCount = 1);
+    void writeDescriptorSet(vk::Device device, vk::DescriptorSet set, uint32_t frame, uint32_t view = 0) const;
+
+    std::vector<PointLight> &getLights() { return lights; }
+    // Copies the light list into persistently mapped memory of given frame, returns number of uploaded lights.
+    uint32_t uploadLights(uint32_t frame);
+    // Records light binning into the cluster lists of `frameSet`, must be called outside of render pass.
+    void recordCulling(vk::CommandBuffer commandBuffer, vk::DescriptorSet frameSet, const ClusterParams &params) const;
+
+private:
+    std::vector<PointLight> lights;
+    std::vector<vk::UniqueBuffer> lightBuffers;
+    std::vector<TrackedMemory> lightBuffersMemory;
+    std::vector<void *> lightBuffersMapped;
+    std::vector<vk::UniqueBuffer> clusterBuffers; // view major
+    std::vector<TrackedMemory> clusterBuffersMemory;
+    vk::UniquePipelineLayout cullPipelineLayout;
+    vk::UniquePipeline cullPipeline;
+};
+
+} // namespace pons
@@ -1,9 +1,7 @@
-#define GLM_FORCE_RADIANS
-#define GLM_FORCE_DEFAULT_ALIGNED_GENTYPES
-#define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_video.h>
 #include <SDL2/SDL_vulkan.h>
+#include <glm/gtc/constants.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/mat4x4.hpp>
 #include <glm/vec4.hpp>
@@ -13,34 +11,93 @@
 #include <vulkan/vulkan_handles.hpp>
 #include <vulkan/vulkan_structs.hpp>
 
+#include <algorithm>
+#include <array>
+#include <cassert>
 #include <chrono>
+#include <cmath>
 #include <cstdint>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
-#include <fstream>
 #include <iostream>
+#include <limits>
+#include <memory_resource>
 #include <optional>
 #include <set>
+#include <span>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <tuple>
-#include <unordered_map>
 #include <vector>
 
+#include "bvh.h"
+#include "camera.h"
 #include "common.h"
+#include "dispatch.h"
+#include "dynamic_resolution.h"
+#include "frame_arena.h"
+#include "gpu.h"
 #include "helpers.hpp"
+#include "lighting.h"
+#include "meshlets.h"
 #include "mock.h"
+#include "particles.h"
+#include "pipeline_registry.h"
+#include "post_process.h"
+#include "shadows.h"
+#include "swapchain.h"
+#include "task_graph.h"
+#include "text.h"
 
 // CONSTANTS
 
 const uint32_t DEFAULT_WIDTH = 1024;
 const uint32_t DEFAULT_HEIGHT = 768;
 const uint32_t MAX_FRAMES_IN_FLIGHT = 2;
+const float CAMERA_NEAR = 0.1f;
+const float CAMERA_FAR = 10.0f;
+const uint32_t DEMO_LIGHT_COUNT = 1024;
+const int DEMO_GRID_HALF_SIZE = 3;  // mock mesh is instanced on a (2n+1)^2 grid
+const uint32_t TERRAIN_QUADS = 128; // per side of the ground mesh, drawn meshlet by meshlet
+const float TERRAIN_EXTENT = 24.0f; // world units per side
+const float TERRAIN_HEIGHT = 0.25f; // of the hills, the ground stays below the grid
+const vk::DeviceSize DEVICE_MEMORY_ENVELOPE = 0; // caps device local usage below the driver budget, 0 to disable
+const uint32_t STATS_TITLE_INTERVAL_MS = 1000;
+const uint32_t IDLE_WAIT_MS = 250;               // longest block on events, keeps the stats title ticking
+const uint32_t UNFOCUSED_FRAME_INTERVAL_MS = 100; // frame rate cap while another window has focus
+const float MAX_SCENE_STEP = 0.1f;               // seconds, the first frame after idling doesn't jump ahead
+// FIXME: ship a font with the assets
+const std::string FONT_PATH = "/usr/share/fonts/TTF/DejaVuSans.ttf";
+const float OVERLAY_TEXT_SIZE = 16.0f;
+const glm::vec3 PARTICLE_EMITTER_POSITION{0.0f, 0.0f, 0.2f};
+const float GPU_FRAME_BUDGET_MS = 15.0f; // dynamic resolution target, leaves headroom under 60 Hz
+const uint32_t SCENE_MAX_SAMPLES = 4;    // msaa of the scene pass, lowered to what the device supports, 1 disables
+const size_t LATE_LATCH_EVENT_BATCH = 64;
+const uint32_t MAX_VIEWS = 4;
+// transfer source so the buffers can be demoted into host memory, mesh shaders fetch vertices as storage
+const vk::BufferUsageFlags VERTEX_BUFFER_USAGE = vk::BufferUsageFlagBits::eVertexBuffer |
+                                                 vk::BufferUsageFlagBits::eStorageBuffer |
+                                                 vk::BufferUsageFlagBits::eTransferSrc;
+const vk::BufferUsageFlags INDEX_BUFFER_USAGE =
+    vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferSrc;
+const uint64_t HEAP_CHECK_WARMUP_FRAMES = 300; // caches and containers settle before heap use is checked
+const glm::vec3 SUN_DIRECTION = glm::normalize(glm::vec3(0.4f, 0.3f, -1.0f)); // direction sunlight travels
 
 const std::vector<const char *> gValidationLayers = {"VK_LAYER_KHRONOS_validation"};
 
 const std::vector<const char *> gDeviceExtensions = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
 
+// enabled when available
+const std::vector<const char *> gOptionalDeviceExtensions = {VK_EXT_MEMORY_BUDGET_EXTENSION_NAME,
+                                                             VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME,
+                                                             VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME,
+                                                             VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME,
+                                                             VK_KHR_SPIRV_1_4_EXTENSION_NAME,
+                                                             VK_KHR_SHADER_FLOAT_CONTROLS_EXTENSION_NAME,
+                                                             VK_EXT_MESH_SHADER_EXTENSION_NAME};
+
 #ifdef NDEBUG
 static constexpr bool gEnableValidationLayers = false;
 #else
@@ -51,63 +108,6 @@ static constexpr bool gEnableValidationLayers = true;
 
 #define UNUSED(expr) (void)(expr)
 
-// DEBUG DEFINITIONS
-
-std::unordered_map<VkInstance, PFN_vkCreateDebugUtilsMessengerEXT> CreateDebugUtilsMessengerEXTDispatchTable;
-std::unordered_map<VkInstance, PFN_vkDestroyDebugUtilsMessengerEXT> DestroyDebugUtilsMessengerEXTDispatchTable;
-std::unordered_map<VkInstance, PFN_vkSubmitDebugUtilsMessageEXT> SubmitDebugUtilsMessageEXTDispatchTable;
-
-void loadDebugUtilsCommands(VkInstance instance) {
-    PFN_vkVoidFunction temp_fp;
-
-    temp_fp = vkGetInstanceProcAddr(instance, "vkCreateDebugUtilsMessengerEXT");
-    if (!temp_fp) {
-        throw "Failed to load vkCreateDebugUtilsMessengerEXT"; // check shouldn't be necessary (based on spec)
-    }
-    CreateDebugUtilsMessengerEXTDispatchTable[instance] = reinterpret_cast<PFN_vkCreateDebugUtilsMessengerEXT>(temp_fp);
-
-    temp_fp = vkGetInstanceProcAddr(instance, "vkDestroyDebugUtilsMessengerEXT");
-    if (!temp_fp) {
-        throw "Failed to load vkDestroyDebugUtilsMessengerEXT"; // check shouldn't be necessary (based on spec)
-    }
-    DestroyDebugUtilsMessengerEXTDispatchTable[instance] =
-        reinterpret_cast<PFN_vkDestroyDebugUtilsMessengerEXT>(temp_fp);
-
-    temp_fp = vkGetInstanceProcAddr(instance, "vkSubmitDebugUtilsMessageEXT");
-    if (!temp_fp) {
-        throw "Failed to load vkSubmitDebugUtilsMessageEXT"; // check shouldn't be necessary (based on spec)
-    }
-    SubmitDebugUtilsMessageEXTDispatchTable[instance] = reinterpret_cast<PFN_vkSubmitDebugUtilsMessageEXT>(temp_fp);
-}
-
-void unloadDebugUtilsCommands(VkInstance instance) {
-    CreateDebugUtilsMessengerEXTDispatchTable.erase(instance);
-    DestroyDebugUtilsMessengerEXTDispatchTable.erase(instance);
-    SubmitDebugUtilsMessageEXTDispatchTable.erase(instance);
-}
-
-VKAPI_ATTR VkResult VKAPI_CALL vkCreateDebugUtilsMessengerEXT(VkInstance instance,
-                                                              const VkDebugUtilsMessengerCreateInfoEXT *pCreateInfo,
-                                                              const VkAllocationCallbacks *pAllocator,
-                                                              VkDebugUtilsMessengerEXT *pMessenger) {
-    auto dispatched_cmd = CreateDebugUtilsMessengerEXTDispatchTable.at(instance);
-    return dispatched_cmd(instance, pCreateInfo, pAllocator, pMessenger);
-}
-
-VKAPI_ATTR void VKAPI_CALL vkDestroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUtilsMessengerEXT messenger,
-                                                           const VkAllocationCallbacks *pAllocator) {
-    auto dispatched_cmd = DestroyDebugUtilsMessengerEXTDispatchTable.at(instance);
-    return dispatched_cmd(instance, messenger, pAllocator);
-}
-
-VKAPI_ATTR void VKAPI_CALL vkSubmitDebugUtilsMessageEXT(VkInstance instance,
-                                                        VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
-                                                        VkDebugUtilsMessageTypeFlagsEXT messageTypes,
-                                                        const VkDebugUtilsMessengerCallbackDataEXT *pCallbackData) {
-    auto dispatched_cmd = SubmitDebugUtilsMessageEXTDispatchTable.at(instance);
-    return dispatched_cmd(instance, messageSeverity, messageTypes, pCallbackData);
-}
-
 // CORE DEFINITIONS
 
 static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
@@ -135,8 +135,92 @@ struct SwapChainSupportDetails {
     std::vector<vk::PresentModeKHR> presentModes;
 };
 
+struct SceneObject {
+    pons::Aabb localBounds;
+    glm::mat4 transform;
+    glm::vec3 position;
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    bool bStatic;                                // never moves, casts into the cached shadow maps
+    uint32_t meshletMesh = pons::NO_MESHLET_MESH; // drawn by the meshlet renderer when it's available
+};
+
+struct DrawItem {
+    glm::mat4 transform;
+    uint32_t firstIndex;
+    uint32_t indexCount;
+};
+
+// What one view draws, meshlet instances only go to the first view.
+struct ViewLists {
+    explicit ViewLists(std::pmr::memory_resource *pResource) : drawList(pResource), meshletInstances(pResource) {}
+
+    std::pmr::vector<DrawItem> drawList;
+    std::pmr::vector<pons::MeshletInstance> meshletInstances;
+};
+
+// Lists built and consumed within one frame, allocated from that frame's arena.
+struct FrameLists {
+    explicit FrameLists(std::pmr::memory_resource *pResource) : views(pResource), dynamicCasters(pResource) {}
+
+    std::pmr::vector<ViewLists> views; // one per view, empty for views left out of the frame
+    std::pmr::vector<pons::ShadowCaster> dynamicCasters;
+};
+
+// A camera into the shared scene presenting to its own window.
+// Device, pipelines, geometry, lights and shadow maps are shared, the scene target, post processing, camera uniforms
+// and light clusters are per view.
+struct View {
+    SDL_Window *pWindow = nullptr;
+    vk::UniqueSurfaceKHR surface;
+    pons::Swapchain swapchain;
+    pons::SceneTarget sceneTarget;
+    pons::PostProcessChain post;
+    pons::OrbitCamera camera{glm::vec3(0.0f), glm::vec3(2.0f)};
+    glm::mat4 viewMatrix{1.0f}; // as of updateScene, the uniform buffer gets a later one
+    glm::mat4 projMatrix{1.0f};
+    std::vector<vk::UniqueBuffer> uniformBuffers;
+    std::vector<pons::TrackedMemory> uniformBuffersMemory;
+    std::vector<void *> uniformBuffersMapped;
+    std::vector<vk::DescriptorSet> descriptorSets; // freed with descriptorPool
+    bool bResized = false;
+    bool bMinimized = false;
+    bool bHidden = false;
+    bool bInFrame = false; // drawn by the frame being recorded, once it got an image
+
+    bool isVisible() const { return !bMinimized && !bHidden; }
+    vk::Extent2D getExtent() const { return swapchain.getExtent(); }
+};
+
+// Parsed from `--views N`, one window per display as far as there are displays.
+struct LaunchOptions {
+    uint32_t windowCount = 1;
+};
+
+LaunchOptions parseLaunchOptions(int argc, char *argv[]) {
+    LaunchOptions options;
+    for (int i = 1; i < argc; i += 2) {
+        std::string_view option = argv[i];
+        if (i + 1 == argc) {
+            throw std::runtime_error("missing value of " + std::string(option));
+        }
+        auto value = static_cast<uint32_t>(std::stoul(argv[i + 1]));
+        if (option == "--views") {
+            options.windowCount = value;
+        } else {
+            throw std::runtime_error("unknown option " + std::string(option));
+        }
+    }
+    if (options.windowCount == 0 || options.windowCount > MAX_VIEWS) {
+        throw std::runtime_error("between 1 and " + std::to_string(MAX_VIEWS) + " views are supported");
+    }
+    return options;
+}
+
 class HelloTriangleApplication {
 public:
+    explicit HelloTriangleApplication(const LaunchOptions &options) : launchOptions(options) {}
+
     void run() {
         if (!initWindow()) {
             throw std::runtime_error("Failed to init window");
@@ -145,7 +229,13 @@ public:
         mainLoop();
     }
 
-    ~HelloTriangleApplication() { SDL_DestroyWindow(pWindow); }
+    ~HelloTriangleApplication() {
+        for (View &view : views) {
+            if (view.pWindow) {
+                SDL_DestroyWindow(view.pWindow);
+            }
+        }
+    }
 
 private:
     bool initWindow() {
@@ -154,44 +244,104 @@ private:
             std::cout << "SDL2 Error: " << SDL_GetError() << "\n";
             return false;
         }
-        pWindow = SDL_CreateWindow("Vulkan Window", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-                                   static_cast<int>(screenWidth), static_cast<int>(screenHeight),
-                                   SDL_WINDOW_VULKAN | SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
-        if (!pWindow) {
-            std::cout << "Failed to create window\n";
-            std::cout << "SDL2 Error: " << SDL_GetError() << "\n";
-            return false;
+        // views are never added or removed later, their addresses stay put
+        views.resize(launchOptions.windowCount);
+        int displayCount = std::max(SDL_GetNumVideoDisplays(), 1);
+        for (uint32_t i = 0; i < views.size(); ++i) {
+            // every view starts out looking from another side
+            glm::mat4 turn = glm::rotate(glm::mat4(1.0f), glm::half_pi<float>() * static_cast<float>(i),
+                                         glm::vec3(0.0f, 0.0f, 1.0f));
+            glm::vec3 position = glm::vec3(turn * glm::vec4(2.0f, 2.0f, 2.0f, 1.0f));
+            views[i].camera = pons::OrbitCamera(glm::vec3(0.0f), position);
+            int display = static_cast<int>(i) % displayCount;
+            views[i].pWindow = SDL_CreateWindow(
+                "Vulkan Window", SDL_WINDOWPOS_CENTERED_DISPLAY(display), SDL_WINDOWPOS_CENTERED_DISPLAY(display),
+                static_cast<int>(screenWidth), static_cast<int>(screenHeight),
+                SDL_WINDOW_VULKAN | SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
+            if (!views[i].pWindow) {
+                std::cout << "Failed to create window\n";
+                std::cout << "SDL2 Error: " << SDL_GetError() << "\n";
+                return false;
+            }
         }
         return true;
     }
+    // Startup as a task graph, independent stages run on a temporary pool while SDL bound calls stay on this thread.
+    // Pipeline compiles keep going in the background past the first frame, drawing with fallbacks until then.
     bool initVulkan() {
-        createInstance();
-        setupDebugMessenger();
-        createSurface();
-        pickPhysicalDevice();
-        createLogicalDevice();
-        createSwapChain();
-        createImageViews();
-        createRenderPass();
-        createDescriptorSetLayout();
-        createGraphicsPipeline();
-        createFramebuffers();
-        createCommandPool();
-        createVertexBuffer();
-        createIndexBuffer();
-        createUniformBuffers();
-        createDescriptorPool();
-        createDescriptorSets();
-        createCommandBuffers();
-        createSyncObjects();
-
+        using pons::TaskThread;
+        pons::TaskGraph graph;
+        // the registry isn't thread safe to register with, its users are chained
+        pons::TaskId instanceTask = graph.add("instance", [this] { createInstance(); }, {}, TaskThread::Main);
+        graph.add("debug messenger", [this] { setupDebugMessenger(); }, {instanceTask});
+        pons::TaskId surfaceTask =
+            graph.add("surfaces", [this] { createSurfaces(); }, {instanceTask}, TaskThread::Main);
+        pons::TaskId deviceTask = graph.add(
+            "device",
+            [this] {
+                pickPhysicalDevice();
+                createLogicalDevice();
+            },
+            {surfaceTask});
+        // everything using gpuContext() depends on this one
+        pons::TaskId gpuTask = graph.add(
+            "gpu context",
+            [this] {
+                createMemoryBudget();
+                createCommandPool();
+            },
+            {deviceTask});
+        pons::TaskId swapChainTask =
+            graph.add("swapchains", [this] { createSwapChains(); }, {deviceTask}, TaskThread::Main);
+        pons::TaskId sceneTargetTask =
+            graph.add("dynamic resolution", [this] { createDynamicResolution(); }, {gpuTask, swapChainTask});
+        graph.add("post process", [this] { createPostProcess(); }, {sceneTargetTask});
+        pons::TaskId layoutTask = graph.add("descriptor layout", [this] { createDescriptorSetLayout(); }, {deviceTask});
+        pons::TaskId pipelinesTask =
+            graph.add("pipelines", [this] { createGraphicsPipeline(); }, {layoutTask, sceneTargetTask, gpuTask});
+        pons::TaskId particlesTask = graph.add("particles", [this] { createParticles(); }, {pipelinesTask});
+        pons::TaskId shadowsTask = graph.add("shadows", [this] { createShadows(); }, {particlesTask});
+        pons::TaskId geometryTask = graph.add("scene geometry", [this] { createSceneGeometry(); });
+        // streams in while the device comes up, later pipeline compiles read shaders from memory
+        graph.add("shader preload", [this] { pons::preloadShaders(workerPool); });
+        pons::TaskId vertexBufferTask =
+            graph.add("vertex buffer", [this] { createVertexBuffer(); }, {gpuTask, geometryTask});
+        graph.add("index buffer", [this] { createIndexBuffer(); }, {gpuTask, geometryTask});
+        graph.add("scene", [this] { createScene(); }, {geometryTask});
+        pons::TaskId meshletsTask = graph.add("meshlets", [this] { createMeshlets(); },
+                                              {shadowsTask, vertexBufferTask, layoutTask, sceneTargetTask});
+        graph.add("prewarm pipelines", [this] { prewarmPipelines(); }, {meshletsTask});
+        pons::TaskId uniformsTask = graph.add("uniform buffers", [this] { createUniformBuffers(); }, {gpuTask});
+        pons::TaskId lightingTask = graph.add("lighting", [this] { createLighting(); }, {layoutTask, gpuTask});
+        graph.add("text", [this] { createText(); }, {swapChainTask, gpuTask});
+        pons::TaskId poolTask = graph.add("descriptor pool", [this] { createDescriptorPool(); }, {deviceTask});
+        graph.add("descriptor sets", [this] { createDescriptorSets(); },
+                  {poolTask, uniformsTask, lightingTask, shadowsTask});
+        graph.add("command buffers", [this] { createCommandBuffers(); }, {gpuTask});
+        graph.add("sync objects", [this] { createSyncObjects(); }, {deviceTask});
+
+        pons::ThreadPool startupPool;
+        graph.run(startupPool);
+        std::cout << "startup stages:\n" << graph.formatTimings();
+        // from here on only this thread allocates, so eviction can't pull buffers from under startup tasks
+        registerSceneResidents();
         return true;
     }
 
-    void framebufferResized(int width, int height) {
-        UNUSED(width);
-        UNUSED(height);
-        bFramebufferResized = true;
+    // The view showing `windowId`, null for windows that aren't ours.
+    View *findView(uint32_t windowId) {
+        for (View &view : views) {
+            if (view.pWindow && SDL_GetWindowID(view.pWindow) == windowId) {
+                return &view;
+            }
+        }
+        return nullptr;
+    }
+
+    static vk::Extent2D getDrawableExtent(SDL_Window *pWindow) {
+        int width, height;
+        SDL_GL_GetDrawableSize(pWindow, &width, &height);
+        return vk::Extent2D{static_cast<uint32_t>(width), static_cast<uint32_t>(height)};
     }
 
     void populateDebugMessengerCreateInfo(vk::DebugUtilsMessengerCreateInfoEXT &createInfo) {
@@ -210,12 +360,10 @@ private:
         if (!gEnableValidationLayers)
             return;
 
-        auto dldi = vk::DispatchLoaderDynamic(instance.get(), vkGetInstanceProcAddr);
-
         vk::DebugUtilsMessengerCreateInfoEXT createInfo{};
         populateDebugMessengerCreateInfo(createInfo);
 
-        instance->createDebugUtilsMessengerEXTUnique(createInfo);
+        debugMessenger = instance->createDebugUtilsMessengerEXTUnique(createInfo, nullptr, pons::dispatcher());
     }
 
     bool checkValidationLayerSupport() {
@@ -241,31 +389,28 @@ private:
 
     tl::expected<std::vector<const char *>, std::string> getRequiredExtensions() {
         uint32_t sdlExtensionCount = 0;
-        if (!SDL_Vulkan_GetInstanceExtensions(pWindow, &sdlExtensionCount, nullptr)) {
+        if (!SDL_Vulkan_GetInstanceExtensions(views.front().pWindow, &sdlExtensionCount, nullptr)) {
             return tl::unexpected(std::string("Can't query instance extension count\n"));
         }
         std::vector<const char *> sdlExtensionNames(sdlExtensionCount);
-        if (!SDL_Vulkan_GetInstanceExtensions(pWindow, &sdlExtensionCount, sdlExtensionNames.data())) {
+        if (!SDL_Vulkan_GetInstanceExtensions(views.front().pWindow, &sdlExtensionCount,
+                                              sdlExtensionNames.data())) {
             return tl::unexpected(std::string("Can't query instance extension names\n"));
         }
 
         sdlExtensionNames.emplace_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
         ++sdlExtensionCount;
-        std::cout << "required extensions:\n";
-        for (const auto &extensionName : sdlExtensionNames) {
-            std::cout << '\t' << extensionName << '\n';
-        }
-
-        std::vector<vk::ExtensionProperties> extensions = vk::enumerateInstanceExtensionProperties(nullptr);
-        std::cout << "available extensions:\n";
-        for (const auto &extension : extensions) {
-            std::cout << '\t' << extension.extensionName << '\n';
+        if (gEnableValidationLayers) {
+            std::cout << "required extensions:\n";
+            for (const auto &extensionName : sdlExtensionNames) {
+                std::cout << '\t' << extensionName << '\n';
+            }
         }
-
         return sdlExtensionNames;
     }
 
     void createInstance() {
+        pons::initDispatch();
         if (gEnableValidationLayers && !checkValidationLayerSupport()) {
             throw std::runtime_error("validation layers requested, but not available!");
         }
@@ -275,7 +420,7 @@ private:
         appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
         appInfo.pEngineName = "PONS2";
         appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-        appInfo.apiVersion = VK_API_VERSION_1_0;
+        appInfo.apiVersion = VK_API_VERSION_1_1;
 
         vk::InstanceCreateInfo createInfo{};
         createInfo.sType = vk::StructureType::eInstanceCreateInfo;
@@ -297,8 +442,7 @@ private:
         }
 
         instance = vk::createInstanceUnique(createInfo);
-
-        loadDebugUtilsCommands(instance.get());
+        pons::initDispatch(instance.get());
     }
 
     vk::Bool32 presentSupport = false;
@@ -311,12 +455,13 @@ private:
             if (queueFamily.queueFlags & vk::QueueFlagBits::eGraphics) {
                 indices.graphicsFamily = i;
             }
-            vk::Result res = device.getSurfaceSupportKHR(i, surface.get(), &presentSupport);
+            // the other windows are checked against the chosen family when their swapchains are created
+            vk::Result res = device.getSurfaceSupportKHR(i, views.front().surface.get(), &presentSupport);
             if (res != vk::Result::eSuccess) {
                 throw std::runtime_error("can't get surface support value");
             }
             if (presentSupport) {
-                indices.presentFamily = presentSupport;
+                indices.presentFamily = i;
             }
             if (indices.isComplete()) {
                 break;
@@ -387,15 +532,70 @@ private:
             queueCreateInfos.push_back(queueCreateInfo);
         }
 
+        vk::PhysicalDeviceFeatures supportedFeatures = physicalDevice.getFeatures();
         vk::PhysicalDeviceFeatures deviceFeatures{};
+        // lets post processing store into swapchain formats that have no shader format qualifier
+        bStorageWithoutFormat = supportedFeatures.shaderStorageImageWriteWithoutFormat;
+        deviceFeatures.shaderStorageImageWriteWithoutFormat = bStorageWithoutFormat;
+        // meshlet culling writes an indirect draw per meshlet, the instance rides in firstInstance
+        bMeshletDraws = supportedFeatures.multiDrawIndirect && supportedFeatures.drawIndirectFirstInstance;
+        deviceFeatures.multiDrawIndirect = bMeshletDraws;
+        deviceFeatures.drawIndirectFirstInstance = bMeshletDraws;
 
         vk::DeviceCreateInfo createInfo{};
         createInfo.sType = vk::StructureType::eDeviceCreateInfo;
         createInfo.pQueueCreateInfos = queueCreateInfos.data();
         createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
         createInfo.pEnabledFeatures = &deviceFeatures;
-        createInfo.enabledExtensionCount = static_cast<uint32_t>(gDeviceExtensions.size());
-        createInfo.ppEnabledExtensionNames = gDeviceExtensions.data();
+        enabledDeviceExtensions = gDeviceExtensions;
+        std::vector<vk::ExtensionProperties> availableExtensions = physicalDevice.enumerateDeviceExtensionProperties();
+        for (const char *optionalExtension : gOptionalDeviceExtensions) {
+            for (const auto &extension : availableExtensions) {
+                if (std::string(extension.extensionName.data()) == optionalExtension) {
+                    enabledDeviceExtensions.push_back(optionalExtension);
+                    break;
+                }
+            }
+        }
+        void *pFeatureChain = nullptr;
+        vk::PhysicalDeviceGraphicsPipelineLibraryFeaturesEXT pipelineLibraryFeatures{};
+        if (isDeviceExtensionEnabled(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME)) {
+            auto features = physicalDevice.getFeatures2<vk::PhysicalDeviceFeatures2,
+                                                        vk::PhysicalDeviceGraphicsPipelineLibraryFeaturesEXT>();
+            if (features.get<vk::PhysicalDeviceGraphicsPipelineLibraryFeaturesEXT>().graphicsPipelineLibrary) {
+                pipelineLibraryFeatures.graphicsPipelineLibrary = true;
+                pipelineLibraryFeatures.pNext = pFeatureChain;
+                pFeatureChain = &pipelineLibraryFeatures;
+            } else {
+                std::erase_if(enabledDeviceExtensions, [](const char *pName) {
+                    return std::string_view(pName) == VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME;
+                });
+            }
+        }
+        // mesh shaders need spir-v 1.4 on a 1.1 instance, which in turn needs float controls
+        vk::PhysicalDeviceMeshShaderFeaturesEXT meshShaderFeatures{};
+        if (isDeviceExtensionEnabled(VK_EXT_MESH_SHADER_EXTENSION_NAME)) {
+            auto features =
+                physicalDevice.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceMeshShaderFeaturesEXT>();
+            const auto &supported = features.get<vk::PhysicalDeviceMeshShaderFeaturesEXT>();
+            bMeshShader = bMeshletDraws && supported.taskShader && supported.meshShader &&
+                          isDeviceExtensionEnabled(VK_KHR_SPIRV_1_4_EXTENSION_NAME) &&
+                          isDeviceExtensionEnabled(VK_KHR_SHADER_FLOAT_CONTROLS_EXTENSION_NAME);
+            if (bMeshShader) {
+                meshShaderFeatures.taskShader = true;
+                meshShaderFeatures.meshShader = true;
+                meshShaderFeatures.pNext = pFeatureChain;
+                pFeatureChain = &meshShaderFeatures;
+            } else {
+                std::erase_if(enabledDeviceExtensions, [](const char *pName) {
+                    return std::string_view(pName) == VK_EXT_MESH_SHADER_EXTENSION_NAME;
+                });
+            }
+        }
+        bDrawIndirectCount = isDeviceExtensionEnabled(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+        createInfo.pNext = pFeatureChain;
+        createInfo.enabledExtensionCount = static_cast<uint32_t>(enabledDeviceExtensions.size());
+        createInfo.ppEnabledExtensionNames = enabledDeviceExtensions.data();
 
         if (gEnableValidationLayers) {
             createInfo.enabledLayerCount = static_cast<uint32_t>(gValidationLayers.size());
@@ -405,290 +605,97 @@ private:
         }
 
         device = physicalDevice.createDeviceUnique(createInfo);
+        pons::initDispatch(device.get());
         graphicsQueue = device->getQueue(indices.graphicsFamily.value(), 0);
         presentQueue = device->getQueue(indices.presentFamily.value(), 0);
     }
 
-    void createSurface() {
-        VkSurfaceKHR sdlSurface;
-        SDL_bool state = SDL_Vulkan_CreateSurface(pWindow, instance.get(), &sdlSurface);
-        if (!state) {
-            throw std::runtime_error("failed to create window surface");
+    void createSurfaces() {
+        for (View &view : views) {
+            VkSurfaceKHR sdlSurface;
+            SDL_bool state = SDL_Vulkan_CreateSurface(view.pWindow, instance.get(), &sdlSurface);
+            if (!state) {
+                throw std::runtime_error("failed to create window surface");
+            }
+            view.surface = vk::UniqueSurfaceKHR{sdlSurface, instance.get()};
         }
-        surface = vk::UniqueSurfaceKHR{sdlSurface, instance.get()};
     }
 
     SwapChainSupportDetails querySwapChainSupport(vk::PhysicalDevice device) {
-        vk::SurfaceCapabilitiesKHR capabilities = device.getSurfaceCapabilitiesKHR(surface.get());
-        std::vector<vk::SurfaceFormatKHR> formats = device.getSurfaceFormatsKHR(surface.get());
-        std::vector<vk::PresentModeKHR> surfacePresentModes = device.getSurfacePresentModesKHR(surface.get());
+        vk::SurfaceKHR surface = views.front().surface.get();
+        vk::SurfaceCapabilitiesKHR capabilities = device.getSurfaceCapabilitiesKHR(surface);
+        std::vector<vk::SurfaceFormatKHR> formats = device.getSurfaceFormatsKHR(surface);
+        std::vector<vk::PresentModeKHR> surfacePresentModes = device.getSurfacePresentModesKHR(surface);
 
         return SwapChainSupportDetails{capabilities, formats, surfacePresentModes};
     }
 
-    vk::SurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<vk::SurfaceFormatKHR> &availableFormats) {
-        for (const auto &availableFormat : availableFormats) {
-            if (availableFormat.format == vk::Format::eB8G8R8A8Srgb &&
-                availableFormat.colorSpace == vk::ColorSpaceKHR::eSrgbNonlinear) {
-                return availableFormat;
-            }
-        }
-
-        // default
-        return availableFormats.at(0);
-    }
-
-    vk::PresentModeKHR chooseSwapPresentMode(const std::vector<vk::PresentModeKHR> &availablePresentModes) {
-        for (const auto &presentMode : availablePresentModes) {
-            if (presentMode == vk::PresentModeKHR::eMailbox) {
-                return presentMode;
-            }
-        }
-
-        // default
-        return vk::PresentModeKHR::eFifo;
-    }
-
-    vk::Extent2D chooseSwapExtent(const vk::SurfaceCapabilitiesKHR &capabilities) {
-        if (capabilities.currentExtent.width != std::numeric_limits<uint32_t>::max()) {
-            return capabilities.currentExtent;
-        } else {
-            int width, height;
-            SDL_GL_GetDrawableSize(pWindow, &width, &height);
-
-            vk::Extent2D actualExtent = {
-                static_cast<uint32_t>(width),
-                static_cast<uint32_t>(height),
-            };
-
-            actualExtent.width =
-                std::clamp(actualExtent.width, capabilities.minImageExtent.width, capabilities.maxImageExtent.width);
-            actualExtent.height =
-                std::clamp(actualExtent.height, capabilities.minImageExtent.height, capabilities.maxImageExtent.height);
-
-            return actualExtent;
-        }
-    }
-
-    void createSwapChain() {
-        SwapChainSupportDetails swapChainSupport = querySwapChainSupport(physicalDevice);
-
-        vk::SurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
-        vk::PresentModeKHR presentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
-        vk::Extent2D extent = chooseSwapExtent(swapChainSupport.capabilities);
-
-        uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
-        if (swapChainSupport.capabilities.maxImageCount > 0 &&
-            imageCount > swapChainSupport.capabilities.maxImageCount) {
-            imageCount = swapChainSupport.capabilities.maxImageCount;
-        }
-
-        vk::SwapchainCreateInfoKHR createInfo{};
-        createInfo.sType = vk::StructureType::eSwapchainCreateInfoKHR;
-        createInfo.surface = surface.get();
-        createInfo.minImageCount = imageCount;
-        createInfo.imageFormat = surfaceFormat.format;
-        createInfo.imageColorSpace = surfaceFormat.colorSpace;
-        createInfo.imageExtent = extent;
-        createInfo.imageArrayLayers = 1;
-        createInfo.imageUsage = vk::ImageUsageFlagBits::eColorAttachment;
-
+    // Every window gets its own swapchain on the shared device, they all present from the same queue.
+    void createSwapChains() {
         QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
-        uint32_t queueFamilyIndices[] = {indices.graphicsFamily.value(), indices.presentFamily.value()};
-
-        if (indices.graphicsFamily != indices.presentFamily) {
-            createInfo.imageSharingMode = vk::SharingMode::eConcurrent;
-            createInfo.queueFamilyIndexCount = 2;
-            createInfo.pQueueFamilyIndices = queueFamilyIndices;
-        } else {
-            createInfo.imageSharingMode = vk::SharingMode::eExclusive;
-            createInfo.queueFamilyIndexCount = 0;
-            createInfo.pQueueFamilyIndices = nullptr;
-        }
-        createInfo.preTransform = swapChainSupport.capabilities.currentTransform;
-        createInfo.compositeAlpha = vk::CompositeAlphaFlagBitsKHR::eOpaque;
-        createInfo.presentMode = presentMode;
-        createInfo.clipped = VK_TRUE;
-        createInfo.oldSwapchain = nullptr;
-
-        swapChain = device->createSwapchainKHRUnique(createInfo);
-        swapChainImages = device->getSwapchainImagesKHR(swapChain.get());
-        swapChainImageFormat = surfaceFormat.format;
-        swapChainExtent = extent;
-    }
-
-    void createImageViews() {
-        swapChainImageViews.reserve(swapChainImages.size());
-        for (auto image : swapChainImages) {
-            vk::ImageViewCreateInfo imageViewCreateInfo(
-                vk::ImageViewCreateFlags{}, image, vk::ImageViewType::e2D, swapChainImageFormat,
-                vk::ComponentMapping{vk::ComponentSwizzle::eR, vk::ComponentSwizzle::eG, vk::ComponentSwizzle::eB,
-                                     vk::ComponentSwizzle::eA},
-                vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1});
-            swapChainImageViews.push_back(device->createImageViewUnique(imageViewCreateInfo));
+        for (View &view : views) {
+            vk::Bool32 bSupported = physicalDevice.getSurfaceSupportKHR(indices.presentFamily.value(),
+                                                                        view.surface.get());
+            if (!bSupported) {
+                throw std::runtime_error("a window can't be presented from the present queue");
+            }
+            pons::Swapchain::Config config{view.surface.get(), indices.graphicsFamily.value(),
+                                           indices.presentFamily.value(), bStorageWithoutFormat};
+            // only device handles are used, the rest of the gpu context is still being set up
+            pons::GpuContext deviceContext{.physicalDevice = physicalDevice, .device = device.get()};
+            view.swapchain.create(deviceContext, config, getDrawableExtent(view.pWindow), MAX_FRAMES_IN_FLIGHT);
         }
     }
 
     void createDescriptorSetLayout() {
-        vk::DescriptorSetLayoutBinding uboLayoutBinding{/*binding*/ 0, vk::DescriptorType::eUniformBuffer,
-                                                        /*descriptorCount*/ 1, vk::ShaderStageFlagBits::eVertex,
-                                                        nullptr};
-        vk::DescriptorSetLayoutCreateInfo layoutInfo{vk::DescriptorSetLayoutCreateFlags{},
-                                                     /*bindingCount*/ 1, &uboLayoutBinding};
+        auto lightingBindings = pons::ClusteredLighting::getDescriptorSetLayoutBindings();
+        auto shadowBindings = pons::CascadedShadows::getDescriptorSetLayoutBindings();
+        // mesh shaders transform meshlet vertices with the camera themselves
+        vk::ShaderStageFlags uniformStages = vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eCompute;
+        if (bMeshShader) {
+            uniformStages |= vk::ShaderStageFlagBits::eMeshEXT;
+        }
+        std::array<vk::DescriptorSetLayoutBinding, 5> bindings{
+            vk::DescriptorSetLayoutBinding{/*binding*/ 0, vk::DescriptorType::eUniformBuffer,
+                                           /*descriptorCount*/ 1, uniformStages, nullptr},
+            lightingBindings[0], lightingBindings[1], shadowBindings[0], shadowBindings[1]};
+        vk::DescriptorSetLayoutCreateInfo layoutInfo{vk::DescriptorSetLayoutCreateFlags{}, bindings};
         descriptorSetLayout = device->createDescriptorSetLayoutUnique(layoutInfo);
     }
 
+    // Material pipelines come from the registry, the scene pipeline compiles in the background and draws with an
+    // unlit fallback until it's ready.
     void createGraphicsPipeline() {
-        std::vector<char> vertShaderCode =
-            readFile("/home/modbrin/projects/pons2/shaders/bin/vert.spv"); // FIXME: find a better way to handle
-                                                                           // relative paths hell during debug
-        std::vector<char> fragShaderCode = readFile("/home/modbrin/projects/pons2/shaders/bin/frag.spv");
-        vk::UniqueShaderModule vertShaderModule = createShaderModule(vertShaderCode);
-        vk::UniqueShaderModule fragShaderModule = createShaderModule(fragShaderCode);
-        vk::PipelineShaderStageCreateInfo vertShaderStageInfo{
-            vk::PipelineShaderStageCreateFlags{}, vk::ShaderStageFlagBits::eVertex, vertShaderModule.get(), "main"};
-        vk::PipelineShaderStageCreateInfo fragShaderStageInfo{
-            vk::PipelineShaderStageCreateFlags{}, vk::ShaderStageFlagBits::eFragment, fragShaderModule.get(), "main"};
-        vk::PipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
-
-        auto bindingDescription = Vertex::getBindingDescription();
-        auto attributeDescription = Vertex::getAttributeDescriptions();
-
-        vk::PipelineVertexInputStateCreateInfo vertexInputInfo{vk::PipelineVertexInputStateCreateFlags{},
-                                                               bindingDescription, attributeDescription};
-        vk::PipelineInputAssemblyStateCreateInfo inputAssembly{vk::PipelineInputAssemblyStateCreateFlags{},
-                                                               vk::PrimitiveTopology::eTriangleList, false};
-        vk::Viewport viewport{
-            0.0f, 0.0f, static_cast<float>(swapChainExtent.width), static_cast<float>(swapChainExtent.height),
-            0.0f, 1.0f};
-        vk::Rect2D scissor{{0, 0}, swapChainExtent};
-        vk::PipelineViewportStateCreateInfo viewportState{vk::PipelineViewportStateCreateFlags{}, 1, &viewport, 1,
-                                                          &scissor};
-        vk::PipelineRasterizationStateCreateInfo rasterizer{vk::PipelineRasterizationStateCreateFlags{},
-                                                            /*depthClamp*/ false,
-                                                            /*rasterizeDiscard*/ false,
-                                                            vk::PolygonMode::eFill,
-                                                            vk::CullModeFlagBits::eBack,
-                                                            vk::FrontFace::eCounterClockwise,
-                                                            /*depthBias*/ false,
-                                                            /*depthBiasConstantFactor*/ 0.0f,
-                                                            /*depthBiasClamp*/ 0.0f,
-                                                            /*depthBiasSlopeFactor*/ 0.0f,
-                                                            /*lineWidth*/ 1.0f};
-        vk::PipelineMultisampleStateCreateInfo multisampling{
-            vk::PipelineMultisampleStateCreateFlags{},
-            vk::SampleCountFlagBits::e1,
-            /*sampleShadingEnable*/ false,
-            1.0f,
-            /*pSampleMask*/ nullptr,
-            /*alphaToCoverageEnable*/ false,
-            /*alphaToOneEnable*/ false,
-        };
-        vk::PipelineColorBlendAttachmentState colorBlendAttachment{
-            /*blend*/ false,
-            vk::BlendFactor::eOne,
-            vk::BlendFactor::eZero,
-            vk::BlendOp::eAdd,
-            vk::BlendFactor::eOne,
-            vk::BlendFactor::eZero,
-            vk::BlendOp::eAdd,
-            vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB |
-                vk::ColorComponentFlagBits::eA};
-        vk::PipelineColorBlendStateCreateInfo colorBlending{vk::PipelineColorBlendStateCreateFlags{},
-                                                            /*logicOpEnable*/ false,
-                                                            vk::LogicOp::eCopy,
-                                                            /*attachmentCount*/ 1,
-                                                            &colorBlendAttachment,
-                                                            {0.0f, 0.0f, 0.0f, 0.0f}};
-        std::vector<vk::DynamicState> dynamicStates = {vk::DynamicState::eViewport, vk::DynamicState::eLineWidth};
-        vk::PipelineDynamicStateCreateInfo dynamicState{
-            vk::PipelineDynamicStateCreateFlags{}, static_cast<uint32_t>(dynamicStates.size()), dynamicStates.data()};
-
-        vk::PipelineLayoutCreateInfo pipelineLayoutInfo{vk::PipelineLayoutCreateFlags{}, descriptorSetLayout.get(), {}};
+        std::array<vk::PushConstantRange, 2> pushConstantRanges{
+            pons::ClusteredLighting::getPushConstantRange(),
+            vk::PushConstantRange{vk::ShaderStageFlagBits::eVertex, ObjectPushConstants::OFFSET,
+                                  sizeof(ObjectPushConstants)}};
+        vk::PipelineLayoutCreateInfo pipelineLayoutInfo{vk::PipelineLayoutCreateFlags{}, descriptorSetLayout.get(),
+                                                        pushConstantRanges};
         pipelineLayout = device->createPipelineLayoutUnique(pipelineLayoutInfo);
 
-        vk::GraphicsPipelineCreateInfo pipelineInfo{vk::PipelineCreateFlags{},
-                                                    /*stageCount*/ 2,
-                                                    shaderStages,
-                                                    &vertexInputInfo,
-                                                    &inputAssembly,
-                                                    /*pTessellationState*/ nullptr,
-                                                    &viewportState,
-                                                    &rasterizer,
-                                                    &multisampling,
-                                                    /*pDepthStencilState*/ nullptr,
-                                                    &colorBlending,
-                                                    /*pDynamicState*/ nullptr,
-                                                    pipelineLayout.get(),
-                                                    renderPass.get(),
-                                                    /*subpass*/ 0,
-                                                    /*basePipelineHandle*/ nullptr,
-                                                    /*basePipelineIndex*/ -1};
-        graphicsPipeline = device->createGraphicsPipelineUnique(nullptr, pipelineInfo).value;
-    }
-
-    vk::UniqueShaderModule createShaderModule(const std::vector<char> &code) {
-        vk::ShaderModuleCreateInfo createInfo{vk::ShaderModuleCreateFlags{}, code.size(),
-                                              reinterpret_cast<const uint32_t *>(code.data())};
-        vk::UniqueShaderModule shaderModule = device->createShaderModuleUnique(createInfo);
-        return shaderModule;
-    }
-
-    static std::vector<char> readFile(const std::string &filename) {
-        std::ifstream file(filename, std::ios::ate | std::ios::binary);
-        if (!file.is_open()) {
-            throw std::runtime_error("failed to open file!");
-        }
-        size_t fileSize = static_cast<size_t>(file.tellg());
-        std::vector<char> buffer(fileSize);
-        file.seekg(0);
-        file.read(buffer.data(), static_cast<std::streamsize>(fileSize));
-        file.close();
-
-        return buffer;
-    }
-
-    void createRenderPass() {
-        vk::AttachmentDescription colorAttachment{
-            vk::AttachmentDescriptionFlags{}, swapChainImageFormat,          vk::SampleCountFlagBits::e1,
-            vk::AttachmentLoadOp::eClear,     vk::AttachmentStoreOp::eStore, vk::AttachmentLoadOp::eDontCare,
-            vk::AttachmentStoreOp::eDontCare, vk::ImageLayout::eUndefined,   vk::ImageLayout::ePresentSrcKHR};
-        vk::AttachmentReference colorAttachmentRef{/*attachment*/ 0, vk::ImageLayout::eColorAttachmentOptimal};
-        vk::SubpassDescription subpass{
-            vk::SubpassDescriptionFlags{}, vk::PipelineBindPoint::eGraphics,
-            /*inputAttachmentCount*/ 0,
-            /*pInputAttachments*/ nullptr,
-            /*colorAttachmentCount*/ 1,    &colorAttachmentRef,
-        };
-        vk::SubpassDependency dependency{
-            VK_SUBPASS_EXTERNAL,
-            /*dstSubpass*/ 0,
-            vk::PipelineStageFlagBits::eColorAttachmentOutput,
-            vk::PipelineStageFlagBits::eColorAttachmentOutput,
-            vk::AccessFlags{},
-            vk::AccessFlagBits::eColorAttachmentWrite,
-
-        };
-        vk::RenderPassCreateInfo renderPassInfo{vk::RenderPassCreateFlags{},
-                                                /*attachmentCount*/ 1,       &colorAttachment,
-                                                /*subpassCount*/ 1,          &subpass,
-                                                /*dependencyCount*/ 1,       &dependency};
-        renderPass = device->createRenderPassUnique(renderPassInfo);
-    }
-
-    void createFramebuffers() {
-        swapChainFramebuffers.reserve(swapChainImageViews.size());
-        for (const auto &imageView : swapChainImageViews) {
-            vk::ImageView attachments[] = {imageView.get()};
-            vk::FramebufferCreateInfo framebufferInfo{vk::FramebufferCreateFlags{},
-                                                      renderPass.get(),
-                                                      /*attachmentCount*/ 1,
-                                                      attachments,
-                                                      swapChainExtent.width,
-                                                      swapChainExtent.height,
-                                                      /*layers*/ 1};
-            swapChainFramebuffers.emplace_back(device->createFramebufferUnique(framebufferInfo));
-        }
+        pipelines.create(gpuContext(), workerPool,
+                         isDeviceExtensionEnabled(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME));
+        auto attributeDescriptions = Vertex::getAttributeDescriptions();
+        pons::VertexLayout meshLayout{{Vertex::getBindingDescription()},
+                                      {attributeDescriptions.begin(), attributeDescriptions.end()}};
+        pipelines.addVertexLayout("mesh", std::move(meshLayout));
+        pipelines.addPipelineLayout("scene", pipelineLayout.get());
+        // the scene render pass outlives swapchain recreation, so do the pipelines, the other views' passes are
+        // compatible with the first one's
+        const pons::SceneTarget &sceneTarget = views.front().sceneTarget;
+        pipelines.addRenderPass("scene", sceneTarget.getRenderPass(), /*colorAttachmentCount*/ 1,
+                                sceneTarget.getSamples());
+
+        pons::PipelineKey sceneKey{.vertexShader = "vert.spv",
+                                   .fragmentShader = "frag.spv",
+                                   .vertexLayout = "mesh",
+                                   .pipelineLayout = "scene",
+                                   .renderPass = "scene"};
+        pons::PipelineKey fallbackKey = sceneKey;
+        fallbackKey.fragmentShader = "fallback_frag.spv";
+        pons::PipelineHandle fallback = pipelines.compile(fallbackKey);
+        scenePipeline = pipelines.request(sceneKey, fallback);
     }
 
     void createCommandPool() {
@@ -699,348 +706,970 @@ private:
     }
 
     void createCommandBuffers() {
+        std::lock_guard<std::mutex> lock(queueMutex); // uploads allocate from the pool concurrently during startup
         vk::CommandBufferAllocateInfo allocInfo{commandPool.get(), vk::CommandBufferLevel::ePrimary,
                                                 /*commandBufferCount*/ MAX_FRAMES_IN_FLIGHT};
         commandBuffers = device->allocateCommandBuffersUnique(allocInfo);
     }
 
-    void recordCommandBuffer(vk::CommandBuffer commandBuffer, uint32_t imageIndex) {
+    // Work shared by the views is recorded once, then every view of the frame goes through its own scene pass, post
+    // processing and overlay.
+    void recordCommandBuffer(vk::CommandBuffer commandBuffer) {
         vk::CommandBufferBeginInfo beginInfo{vk::CommandBufferUsageFlags{},
                                              /*pInheritanceInfo*/ nullptr};
         commandBuffer.begin(beginInfo);
+        gpuTimer.recordBegin(commandBuffer, currentFrame);
+        text.recordUploads(commandBuffer, currentFrame);
+        particles.recordUpdate(commandBuffer, sceneDeltaTime, PARTICLE_EMITTER_POSITION,
+                               glm::vec3(glm::inverse(views.front().viewMatrix)[3]));
+        shadows.recordRender(commandBuffer, vertexBuffer.get(), indexBuffer.get(), staticCasters,
+                             frameLists->dynamicCasters);
+        if (bMeshletDraws) {
+            const View &view = views.front();
+            meshletRenderer.recordCulling(commandBuffer, currentFrame, frameLists->views.front().meshletInstances,
+                                          view.projMatrix * view.viewMatrix,
+                                          glm::vec3(glm::inverse(view.viewMatrix)[3]));
+        }
+        for (size_t i = 0; i < views.size(); ++i) {
+            if (views[i].bInFrame) {
+                recordView(commandBuffer, views[i], static_cast<uint32_t>(i), frameLists->views[i]);
+            }
+        }
+        gpuTimer.recordEnd(commandBuffer, currentFrame);
+        commandBuffer.end();
+    }
+
+    void recordView(vk::CommandBuffer commandBuffer, const View &view, uint32_t viewIndex, const ViewLists &lists) {
+        // the first view carries the meshlets and the overlay
+        bool bFirst = viewIndex == 0;
+        vk::DescriptorSet frameSet = view.descriptorSets.at(currentFrame);
+        // scene is rendered into the top left part of the full size offscreen target
+        vk::Extent2D renderExtent = bDynamicResolution ? resolution.scaleExtent(view.getExtent()) : view.getExtent();
+        pons::ClusterParams clusterParams{activeLightCount, CAMERA_NEAR, CAMERA_FAR,
+                                          static_cast<float>(renderExtent.width),
+                                          static_cast<float>(renderExtent.height)};
+        lighting.recordCulling(commandBuffer, frameSet, clusterParams);
         vk::ClearColorValue clearColorValue{};
         clearColorValue.setFloat32({0.0f, 0.0f, 0.0f, 0.0f});
         vk::ClearValue clearColor{clearColorValue};
-        vk::RenderPassBeginInfo renderPassInfo{renderPass.get(), swapChainFramebuffers.at(imageIndex).get(),
-                                               vk::Rect2D{{0, 0}, swapChainExtent},
+        vk::RenderPassBeginInfo renderPassInfo{view.sceneTarget.getRenderPass(), view.sceneTarget.getFramebuffer(),
+                                               vk::Rect2D{{0, 0}, renderExtent},
                                                /*clearValueCount*/ 1, &clearColor};
         commandBuffer.beginRenderPass(renderPassInfo, vk::SubpassContents::eInline);
-        commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, graphicsPipeline.get());
+        // scene targets of all views have compatible render passes, so they share the pipelines
+        commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipelines.get(scenePipeline));
+        vk::Viewport viewport{0.0f, 0.0f, static_cast<float>(renderExtent.width),
+                              static_cast<float>(renderExtent.height), 0.0f, 1.0f};
+        commandBuffer.setViewport(0, viewport);
+        commandBuffer.setScissor(0, vk::Rect2D{{0, 0}, renderExtent});
         vk::Buffer vertexBuffers[] = {vertexBuffer.get()};
         vk::DeviceSize offsets[] = {0};
         commandBuffer.bindVertexBuffers(0, 1, vertexBuffers, offsets);
         commandBuffer.bindIndexBuffer(indexBuffer.get(), 0, vk::IndexType::eUint16);
-        commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout.get(), 0, 1,
-                                         &descriptorSets.at(currentFrame), 0, nullptr);
-        commandBuffer.drawIndexed(static_cast<uint32_t>(mockIndices.size()), 1, 0, 0, 0);
+        commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout.get(), 0, 1, &frameSet, 0,
+                                         nullptr);
+        commandBuffer.pushConstants(pipelineLayout.get(), pons::ClusteredLighting::getPushConstantRange().stageFlags,
+                                    0, sizeof(clusterParams), &clusterParams);
+        for (const DrawItem &item : lists.drawList) {
+            ObjectPushConstants objectConstants{item.transform};
+            commandBuffer.pushConstants(pipelineLayout.get(), vk::ShaderStageFlagBits::eVertex,
+                                        ObjectPushConstants::OFFSET, sizeof(objectConstants), &objectConstants);
+            commandBuffer.drawIndexed(item.indexCount, 1, item.firstIndex, 0, 0);
+        }
+        if (bFirst && bMeshletDraws) {
+            meshletRenderer.recordDraw(commandBuffer, currentFrame, frameSet, clusterParams, vertexBuffer.get(),
+                                       indexBuffer.get(), vk::IndexType::eUint16);
+        }
+        // transparent, after opaque geometry
+        particles.recordDraw(commandBuffer, view.viewMatrix, view.projMatrix);
+        commandBuffer.endRenderPass();
+        if (bFirst && bMeshletDraws) {
+            meshletRenderer.recordReadback(commandBuffer);
+        }
+
+        // upscale, effects and overlay at native resolution
+        uint32_t imageIndex = view.swapchain.getImageIndex();
+        view.post.recordPost(commandBuffer, imageIndex, renderExtent);
+        // also moves the image into present layout when there's nothing to draw
+        vk::RenderPassBeginInfo presentPassInfo{view.swapchain.getRenderPass(),
+                                                view.swapchain.getFramebuffer(imageIndex),
+                                                vk::Rect2D{{0, 0}, view.swapchain.getExtent()}};
+        commandBuffer.beginRenderPass(presentPassInfo, vk::SubpassContents::eInline);
+        if (bFirst) {
+            text.recordDraw(commandBuffer, currentFrame, view.swapchain.getExtent());
+        }
         commandBuffer.endRenderPass();
-        commandBuffer.end();
     }
 
+    // Image available semaphores belong to the swapchains, one submit signals a single semaphore all presents wait on.
     void createSyncObjects() {
-        imageAvailableSemaphores.reserve(MAX_FRAMES_IN_FLIGHT);
         renderFinishedSemaphores.reserve(MAX_FRAMES_IN_FLIGHT);
         inFlightFences.reserve(MAX_FRAMES_IN_FLIGHT);
 
         vk::SemaphoreCreateInfo semaphoreInfo{vk::SemaphoreCreateFlags{}};
         vk::FenceCreateInfo fenceInfo{vk::FenceCreateFlagBits::eSignaled};
         for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
-            imageAvailableSemaphores.emplace_back(device->createSemaphoreUnique(semaphoreInfo));
             renderFinishedSemaphores.emplace_back(device->createSemaphoreUnique(semaphoreInfo));
             inFlightFences.emplace_back(device->createFenceUnique(fenceInfo));
         }
     }
 
-    void cleanupSwapChain() {
-        for (auto &framebuffer : swapChainFramebuffers) {
-            device->destroyFramebuffer(framebuffer.release());
-        }
-        swapChainFramebuffers.clear();
-        device->destroyPipeline(graphicsPipeline.release());
-        device->destroyPipelineLayout(pipelineLayout.release());
-        device->destroyRenderPass(renderPass.release());
-        for (auto &imageView : swapChainImageViews) {
-            device->destroyImageView(imageView.release());
-        }
-        swapChainImageViews.clear();
-        device->destroySwapchainKHR(swapChain.release());
-
-        // TODO: is this necessary?
-        // for (auto &buffer : uniformBuffers) {
-        //     device->destroyBuffer(buffer.release());
-        // }
-        // uniformBuffers.clear();
-        // for (auto &bufferMemory : uniformBuffersMemory) {
-        //     device->freeMemory(bufferMemory.release());
-        // }
-        // uniformBuffersMemory.clear();
-    }
-
-    void recreateSwapChain() {
-        int width, height;
-        SDL_GL_GetDrawableSize(pWindow, &width, &height);
-        while (width == 0 || height == 0) {
+    void recreateSwapChain(View &view) {
+        vk::Extent2D drawableExtent = getDrawableExtent(view.pWindow);
+        while (drawableExtent.width == 0 || drawableExtent.height == 0) {
             // TODO: investigate, this should be probably done differently in sdl
-            SDL_GL_GetDrawableSize(pWindow, &width, &height);
             SDL_WaitEvent(nullptr);
+            drawableExtent = getDrawableExtent(view.pWindow);
         }
         device->waitIdle();
 
-        cleanupSwapChain();
-        createSwapChain();
-        createImageViews();
-        createRenderPass();
-        createGraphicsPipeline();
-        createFramebuffers();
-
-        // TODO: is this necessary?
-        // createUniformBuffers();
-        // createCommandBuffers();
-        // createDescriptorPool();
-        // createDescriptorSets();
+        view.swapchain.recreate(drawableExtent);
+        view.sceneTarget.createTarget(view.swapchain.getExtent());
+        createPostTargets(view);
+        if (&view == &views.front()) {
+            text.createPipeline(view.swapchain.getRenderPass());
+        }
+    }
+
+    bool isDeviceExtensionEnabled(const std::string &name) const {
+        return std::find(enabledDeviceExtensions.begin(), enabledDeviceExtensions.end(), name) !=
+               enabledDeviceExtensions.end();
     }
 
-    std::tuple<vk::UniqueBuffer, vk::UniqueDeviceMemory> createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage,
-                                                                      vk::MemoryPropertyFlags properties) {
-        vk::BufferCreateInfo bufferInfo{vk::BufferCreateFlags{}, size, usage, vk::SharingMode::eExclusive};
-        vk::UniqueBuffer buffer = device->createBufferUnique(bufferInfo);
-
-        vk::MemoryRequirements memRequirements = device->getBufferMemoryRequirements(buffer.get());
-        vk::MemoryAllocateInfo allocInfo{memRequirements.size,
-                                         findMemoryType(memRequirements.memoryTypeBits, properties)};
-        vk::UniqueDeviceMemory bufferMemory = device->allocateMemoryUnique(allocInfo);
-        device->bindBufferMemory(buffer.get(), bufferMemory.get(), 0);
-        return std::forward_as_tuple(std::move(buffer), std::move(bufferMemory));
+    void createMemoryBudget() {
+        memoryBudget.init(physicalDevice, device.get(), &queueMutex,
+                          isDeviceExtensionEnabled(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME), DEVICE_MEMORY_ENVELOPE);
+    }
+
+    void createDynamicResolution() {
+        vk::SampleCountFlagBits samples = pons::chooseSampleCount(physicalDevice, SCENE_MAX_SAMPLES);
+        for (View &view : views) {
+            view.sceneTarget.create(gpuContext(), samples);
+            view.sceneTarget.createTarget(view.getExtent());
+        }
+        const pons::SceneTarget &sceneTarget = views.front().sceneTarget;
+        if (sceneTarget.getSamples() != vk::SampleCountFlagBits::e1) {
+            std::cout << "scene msaa " << static_cast<uint32_t>(sceneTarget.getSamples()) << "x"
+                      << (sceneTarget.isMultisampleLazy() ? ", lazily allocated" : "") << "\n";
+        }
+        QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+        uint32_t timestampValidBits =
+            physicalDevice.getQueueFamilyProperties().at(indices.graphicsFamily.value()).timestampValidBits;
+        gpuTimer.create(gpuContext(), MAX_FRAMES_IN_FLIGHT, timestampValidBits);
+        bDynamicResolution = gpuTimer.isSupported();
+    }
+
+    void createPostProcess() {
+        for (View &view : views) {
+            view.post.create(gpuContext());
+            createPostTargets(view);
+        }
+    }
+
+    void createPostTargets(View &view) {
+        const pons::Swapchain &swapchain = view.swapchain;
+        view.post.createTargets(view.sceneTarget.getImageView(), view.sceneTarget.getMaxExtent(),
+                                swapchain.getImages(), swapchain.getImageViews(), swapchain.getFormat(),
+                                swapchain.getExtent(), swapchain.isDirectOutput());
+    }
+
+    pons::GpuContext gpuContext() {
+        return pons::GpuContext{physicalDevice, device.get(), graphicsQueue, commandPool.get(), &memoryBudget,
+                                &queueMutex};
+    }
+
+    // The mock quad followed by a hilly terrain grid, whose triangles are stored meshlet by meshlet.
+    void createSceneGeometry() {
+        sceneVertices = mockVertices;
+        sceneIndices = mockIndices;
+
+        uint32_t baseVertex = static_cast<uint32_t>(sceneVertices.size());
+        const uint32_t rowLength = TERRAIN_QUADS + 1;
+        std::vector<glm::vec3> positions;
+        positions.reserve(rowLength * rowLength);
+        for (uint32_t y = 0; y < rowLength; ++y) {
+            for (uint32_t x = 0; x < rowLength; ++x) {
+                float u = static_cast<float>(x) / static_cast<float>(TERRAIN_QUADS) - 0.5f;
+                float v = static_cast<float>(y) / static_cast<float>(TERRAIN_QUADS) - 0.5f;
+                float height = TERRAIN_HEIGHT * std::sin(u * 19.0f) * std::cos(v * 13.0f);
+                glm::vec3 position{u * TERRAIN_EXTENT, v * TERRAIN_EXTENT, height};
+                float shade = 0.5f + 0.5f * height / TERRAIN_HEIGHT;
+                positions.push_back(position);
+                sceneVertices.push_back(Vertex{position, glm::vec3(0.2f + 0.4f * shade, 0.5f, 0.2f)});
+            }
+        }
+        std::vector<uint32_t> gridIndices;
+        gridIndices.reserve(TERRAIN_QUADS * TERRAIN_QUADS * 6);
+        for (uint32_t y = 0; y < TERRAIN_QUADS; ++y) {
+            for (uint32_t x = 0; x < TERRAIN_QUADS; ++x) {
+                uint32_t corner = y * rowLength + x;
+                // counter clockwise seen from above
+                for (uint32_t index : {corner, corner + 1, corner + rowLength + 1, corner + rowLength + 1,
+                                       corner + rowLength, corner}) {
+                    gridIndices.push_back(index);
+                }
+            }
+        }
+        if (baseVertex + positions.size() > std::numeric_limits<uint16_t>::max()) {
+            throw std::runtime_error("terrain doesn't fit 16 bit indices");
+        }
+
+        terrainMeshlets = pons::buildMeshlets(positions, gridIndices);
+        terrainSource = pons::MeshletSource{&terrainMeshlets, static_cast<uint32_t>(sceneIndices.size()), baseVertex};
+        for (uint32_t index : terrainMeshlets.indices) {
+            sceneIndices.push_back(static_cast<uint16_t>(baseVertex + index));
+        }
+        std::cout << "terrain: " << gridIndices.size() / 3 << " triangles in " << terrainMeshlets.meshlets.size()
+                  << " meshlets\n";
     }
 
     void createVertexBuffer() {
-        vk::DeviceSize bufferSize = sizeof(mockVertices[0]) * mockVertices.size();
-        auto [stagingBuffer, stagingBufferMemory] =
-            createBuffer(bufferSize, vk::BufferUsageFlagBits::eTransferSrc,
-                         vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-        void *data;
-        vk::Result result = device->mapMemory(stagingBufferMemory.get(), 0, bufferSize, vk::MemoryMapFlags{}, &data);
-        if (result != vk::Result::eSuccess) {
-            throw std::runtime_error("failed to map stagingBuffer memory");
-        }
-        memcpy(data, mockVertices.data(), static_cast<size_t>(bufferSize));
-        device->unmapMemory(stagingBufferMemory.get());
+        vk::DeviceSize bufferSize = sizeof(sceneVertices[0]) * sceneVertices.size();
         std::tie(vertexBuffer, vertexBufferMemory) =
-            createBuffer(bufferSize, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eVertexBuffer,
-                         vk::MemoryPropertyFlagBits::eDeviceLocal);
-        copyBuffer(stagingBuffer.get(), vertexBuffer.get(), bufferSize);
+            pons::createDeviceLocalBuffer(gpuContext(), sceneVertices.data(), bufferSize, VERTEX_BUFFER_USAGE);
     }
 
     void createIndexBuffer() {
-        vk::DeviceSize bufferSize = sizeof(mockIndices[0]) * mockIndices.size();
-        auto [stagingBuffer, stagingBufferMemory] =
-            createBuffer(bufferSize, vk::BufferUsageFlagBits::eTransferSrc,
-                         vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-        void *data;
-        vk::Result result = device->mapMemory(stagingBufferMemory.get(), 0, bufferSize, vk::MemoryMapFlags{}, &data);
-        if (result != vk::Result::eSuccess) {
-            throw std::runtime_error("failed to map stagingBuffer memory");
-        }
-        memcpy(data, mockIndices.data(), static_cast<size_t>(bufferSize));
-        device->unmapMemory(stagingBufferMemory.get());
+        vk::DeviceSize bufferSize = sizeof(sceneIndices[0]) * sceneIndices.size();
         std::tie(indexBuffer, indexBufferMemory) =
-            createBuffer(bufferSize, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eIndexBuffer,
-                         vk::MemoryPropertyFlagBits::eDeviceLocal);
-        copyBuffer(stagingBuffer.get(), indexBuffer.get(), bufferSize);
+            pons::createDeviceLocalBuffer(gpuContext(), sceneIndices.data(), bufferSize, INDEX_BUFFER_USAGE);
     }
 
-    void copyBuffer(vk::Buffer srcBuffer, vk::Buffer dstBuffer, vk::DeviceSize size) {
-        vk::CommandBufferAllocateInfo allocInfo{commandPool.get(), vk::CommandBufferLevel::ePrimary,
-                                                /*commandBufferCount*/ 1};
-        vk::UniqueCommandBuffer commandBuffer = std::move(device->allocateCommandBuffersUnique(allocInfo)[0]);
-        vk::CommandBufferBeginInfo beginInfo{vk::CommandBufferUsageFlagBits::eOneTimeSubmit};
-        commandBuffer->begin(beginInfo);
-        vk::BufferCopy copyRegion{/*srcOffset*/ 0,
-                                  /*dstOffset*/ 0, size};
-        commandBuffer->copyBuffer(srcBuffer, dstBuffer, 1, &copyRegion);
-        commandBuffer->end();
-        vk::SubmitInfo submitInfo{
-            /*waitSemaphoreCount*/ 0,
-            /*pWaitSemaphores*/ nullptr,
-            /*pWaitDstStageMask*/ nullptr,
-            /*commandBufferCount*/ 1,      &commandBuffer.get(),
+    // Scene geometry gives its memory back when a heap runs over budget. Demotion moves it into host memory,
+    // eviction drops it until ensureSceneBuffers uploads it again. Either way the handles change.
+    void registerSceneResidents() {
+        vertexBufferResident =
+            registerSceneBuffer(vertexBuffer, vertexBufferMemory, sizeof(sceneVertices[0]) * sceneVertices.size(),
+                                VERTEX_BUFFER_USAGE);
+        indexBufferResident = registerSceneBuffer(indexBuffer, indexBufferMemory,
+                                                  sizeof(sceneIndices[0]) * sceneIndices.size(), INDEX_BUFFER_USAGE);
+    }
+
+    pons::MemoryBudget::ResidentId registerSceneBuffer(vk::UniqueBuffer &buffer, pons::TrackedMemory &memory,
+                                                       vk::DeviceSize size, vk::BufferUsageFlags usage) {
+        // the budget waits for the device before either callback runs
+        auto evict = [this, &buffer, &memory] {
+            buffer.reset();
+            memory.reset();
+            bSceneBuffersMoved = true;
         };
-        graphicsQueue.submit(submitInfo, nullptr);
-        graphicsQueue.waitIdle();
+        auto demote = [this, &buffer, &memory, size, usage] {
+            vk::MemoryRequirements requirements = device->getBufferMemoryRequirements(buffer.get());
+            std::optional<uint32_t> hostType = pons::findMemoryTypeIndex(
+                physicalDevice, requirements.memoryTypeBits,
+                vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+            // nothing to gain when host memory lives on the same heap
+            if (!hostType || memoryBudget.heapOfType(*hostType) == memory.getHeapIndex()) {
+                return false;
+            }
+            try {
+                auto [hostBuffer, hostMemory] = pons::createBuffer(
+                    gpuContext(), size, usage | vk::BufferUsageFlagBits::eTransferDst,
+                    vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+                pons::copyBuffer(gpuContext(), buffer.get(), hostBuffer.get(), size);
+                buffer = std::move(hostBuffer);
+                memory = std::move(hostMemory);
+            } catch (const std::runtime_error &) {
+                return false; // no room in host memory either, evicted instead
+            }
+            bSceneBuffersMoved = true;
+            return true;
+        };
+        return memoryBudget.registerResident(memory.getHeapIndex(), memory.getSize(), pons::RESIDENT_PRIORITY_GEOMETRY,
+                                             evict, demote);
     }
 
-    uint32_t findMemoryType(uint32_t typeFilter, vk::MemoryPropertyFlags properties) {
-        vk::PhysicalDeviceMemoryProperties memProperties = physicalDevice.getMemoryProperties();
-        for (uint32_t i = 0; i < memProperties.memoryTypeCount; ++i) {
-            if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-                return i;
+    // Uploads geometry evicted since the last frame again and points the meshlet sets at buffers that moved. Called
+    // before anything is recorded and again after allocations made while preparing the frame, the budget's callbacks
+    // ran with the device idle and nothing was submitted since.
+    void ensureSceneBuffers() {
+        if (bSceneBuffersMoved) {
+            bSceneBuffersMoved = false;
+            // unregistered during the uploads, so making room for one can't evict the other
+            memoryBudget.unregisterResident(vertexBufferResident);
+            memoryBudget.unregisterResident(indexBufferResident);
+            if (!vertexBuffer) {
+                createVertexBuffer();
+            }
+            if (!indexBuffer) {
+                createIndexBuffer();
+            }
+            registerSceneResidents();
+            if (bMeshletDraws) {
+                meshletRenderer.setVertexBuffer(vertexBuffer.get());
             }
         }
-        throw std::runtime_error("failed to find suitable memory type");
+        memoryBudget.touch(vertexBufferResident);
+        memoryBudget.touch(indexBufferResident);
+    }
+
+    void createMeshlets() {
+        if (!bMeshletDraws) {
+            std::cout << "meshlets: no multi draw indirect, the terrain is drawn whole\n";
+            return;
+        }
+        // culls for the first view only, the others draw the terrain whole
+        const pons::SceneTarget &sceneTarget = views.front().sceneTarget;
+        meshletRenderer.create(gpuContext(), pipelines, "scene", sceneTarget.getRenderPass(), sceneTarget.getSamples(),
+                               descriptorSetLayout.get(), MAX_FRAMES_IN_FLIGHT, std::span(&terrainSource, 1),
+                               vertexBuffer.get(), {bDrawIndirectCount, bMeshShader});
+        std::cout << "meshlets: " << (bDrawIndirectCount ? "indirect count" : "zeroed indirect draws")
+                  << (meshletRenderer.hasMeshShader() ? ", mesh shaders" : "") << "\n";
     }
 
     void createUniformBuffers() {
         vk::DeviceSize bufferSize = sizeof(UniformBufferObject);
-        uniformBuffers.reserve(MAX_FRAMES_IN_FLIGHT);
-        uniformBuffersMemory.reserve(MAX_FRAMES_IN_FLIGHT);
-        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
-            auto [buffer, bufferMemory] =
-                createBuffer(bufferSize, vk::BufferUsageFlagBits::eUniformBuffer,
-                             vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-            uniformBuffers.emplace_back(std::move(buffer));
-            uniformBuffersMemory.emplace_back(std::move(bufferMemory));
+        for (View &view : views) {
+            view.uniformBuffers.reserve(MAX_FRAMES_IN_FLIGHT);
+            view.uniformBuffersMemory.reserve(MAX_FRAMES_IN_FLIGHT);
+            for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+                auto [buffer, bufferMemory] = pons::createBuffer(
+                    gpuContext(), bufferSize, vk::BufferUsageFlagBits::eUniformBuffer,
+                    vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+                // persistently mapped, the camera is latched into it right before submit
+                void *data;
+                vk::Result result =
+                    device->mapMemory(bufferMemory.get(), 0, bufferSize, vk::MemoryMapFlags{}, &data);
+                if (result != vk::Result::eSuccess) {
+                    throw std::runtime_error("failed to map memory of uniform buffer");
+                }
+                view.uniformBuffers.emplace_back(std::move(buffer));
+                view.uniformBuffersMemory.emplace_back(std::move(bufferMemory));
+                view.uniformBuffersMapped.push_back(data);
+            }
         }
     }
 
-    void updateUniformBuffer(uint32_t currentImage) {
-        static auto startTime = std::chrono::high_resolution_clock::now();
-        auto currentTime = std::chrono::high_resolution_clock::now();
-        float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
-
-        UniformBufferObject ubo{
-            .model = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f)),
-            .view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f)),
-            .proj = glm::perspective(glm::radians(45.0f),
-                                     swapChainExtent.width / static_cast<float>(swapChainExtent.height), 0.1f, 10.0f)};
-        ubo.proj[1][1] *= -1.0f; // flip Y coordinate
-        void *data;
-        vk::Result result =
-            device->mapMemory(uniformBuffersMemory[currentImage].get(), 0, sizeof(ubo), vk::MemoryMapFlags{}, &data);
-        if (result != vk::Result::eSuccess) {
-            throw std::runtime_error("failed to map memory of uniform buffer");
-        }
-        memcpy(data, &ubo, sizeof(ubo));
-        device->unmapMemory(uniformBuffersMemory[currentImage].get());
+    void createScene() {
+        pons::Aabb meshBounds;
+        for (const Vertex &vertex : mockVertices) {
+            meshBounds.grow(vertex.pos);
+        }
+        for (int y = -DEMO_GRID_HALF_SIZE; y <= DEMO_GRID_HALF_SIZE; ++y) {
+            for (int x = -DEMO_GRID_HALF_SIZE; x <= DEMO_GRID_HALF_SIZE; ++x) {
+                glm::vec3 position{static_cast<float>(x), static_cast<float>(y), 0.0f};
+                sceneObjects.push_back(SceneObject{meshBounds, glm::translate(glm::mat4(1.0f), position), position,
+                                                   /*firstIndex*/ 0, static_cast<uint32_t>(mockIndices.size()),
+                                                   /*bStatic*/ false});
+            }
+        }
+        // static terrain below the grid and a row of upright panels
+        pons::Aabb terrainBounds;
+        for (size_t i = terrainSource.baseVertex; i < sceneVertices.size(); ++i) {
+            terrainBounds.grow(sceneVertices[i].pos);
+        }
+        glm::mat4 ground = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -0.5f));
+        SceneObject terrain{terrainBounds, ground, glm::vec3(ground[3]), terrainSource.firstIndex,
+                            static_cast<uint32_t>(terrainMeshlets.indices.size()), /*bStatic*/ true};
+        terrain.meshletMesh = 0;
+        sceneObjects.push_back(terrain);
+        for (float x : {-2.0f, 0.0f, 2.0f}) {
+            glm::vec3 position{x, -3.5f, 0.0f};
+            glm::mat4 panel = glm::rotate(glm::translate(glm::mat4(1.0f), position), glm::radians(-90.0f),
+                                          glm::vec3(1.0f, 0.0f, 0.0f));
+            sceneObjects.push_back(SceneObject{meshBounds, panel, position, /*firstIndex*/ 0,
+                                               static_cast<uint32_t>(mockIndices.size()), /*bStatic*/ true});
+        }
+        for (const SceneObject &object : sceneObjects) {
+            if (object.bStatic) {
+                staticCasters.push_back(pons::ShadowCaster{object.transform, object.firstIndex, object.indexCount});
+            }
+        }
+        sceneBounds.resize(sceneObjects.size());
+        for (size_t i = 0; i < sceneObjects.size(); ++i) {
+            sceneBounds[i] = sceneObjects[i].localBounds.transformed(sceneObjects[i].transform);
+        }
+        sceneBvh.build(sceneBounds);
+    }
+
+    // Animates the scene, updates the spatial index and collects the draw lists of the views in the coming frame.
+    void updateScene() {
+        auto currentTime = std::chrono::steady_clock::now();
+        float elapsed = std::chrono::duration<float>(currentTime - lastSceneUpdateTime).count();
+        lastSceneUpdateTime = currentTime;
+        sceneDeltaTime = bAnimate ? std::min(elapsed, MAX_SCENE_STEP) : 0.0f;
+        sceneTime += sceneDeltaTime;
+        float time = sceneTime;
+
+        for (View &view : views) {
+            vk::Extent2D extent = view.getExtent();
+            view.viewMatrix = view.camera.getViewMatrix();
+            view.projMatrix = glm::perspective(glm::radians(45.0f),
+                                               static_cast<float>(extent.width) / static_cast<float>(extent.height),
+                                               CAMERA_NEAR, CAMERA_FAR);
+            view.projMatrix[1][1] *= -1.0f; // flip Y coordinate
+        }
+
+        FrameLists &lists = *frameLists;
+        lists.dynamicCasters.reserve(sceneObjects.size());
+        for (size_t i = 0; i < sceneObjects.size(); ++i) {
+            SceneObject &object = sceneObjects[i];
+            if (object.bStatic) {
+                continue;
+            }
+            object.transform = glm::rotate(glm::translate(glm::mat4(1.0f), object.position),
+                                           time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+            sceneBounds[i] = object.localBounds.transformed(object.transform);
+            // casters outside the view still throw shadows into it, so these aren't culled
+            lists.dynamicCasters.push_back(pons::ShadowCaster{object.transform, object.firstIndex, object.indexCount});
+        }
+        if (sceneBvh.isDegraded()) {
+            sceneBvh.build(sceneBounds);
+        } else {
+            sceneBvh.refit(sceneBounds);
+        }
+
+        lists.views.reserve(views.size());
+        for (size_t i = 0; i < views.size(); ++i) {
+            ViewLists &viewLists = lists.views.emplace_back(lists.views.get_allocator().resource());
+            const View &view = views[i];
+            if (!view.bInFrame) {
+                continue;
+            }
+            visibleObjects.clear();
+            sceneBvh.queryFrustum(pons::Frustum::fromMatrix(view.projMatrix * view.viewMatrix), visibleObjects);
+            viewLists.drawList.reserve(visibleObjects.size());
+            bool bMeshlets = bMeshletDraws && i == 0;
+            for (uint32_t objectIndex : visibleObjects) {
+                const SceneObject &object = sceneObjects[objectIndex];
+                if (object.meshletMesh != pons::NO_MESHLET_MESH && bMeshlets) {
+                    viewLists.meshletInstances.push_back(pons::MeshletInstance{object.transform, object.meshletMesh});
+                } else {
+                    viewLists.drawList.push_back(DrawItem{object.transform, object.firstIndex, object.indexCount});
+                }
+            }
+        }
+    }
+
+    // Casts a ray through the cursor position, window coordinates are in screen points.
+    void pickObject(const View &view, int x, int y) {
+        int width, height;
+        SDL_GetWindowSize(view.pWindow, &width, &height);
+        glm::vec2 ndc{2.0f * static_cast<float>(x) / static_cast<float>(width) - 1.0f,
+                      2.0f * static_cast<float>(y) / static_cast<float>(height) - 1.0f};
+        glm::mat4 invViewProj = glm::inverse(view.projMatrix * view.viewMatrix);
+        glm::vec4 nearPoint = invViewProj * glm::vec4(ndc.x, ndc.y, 0.0f, 1.0f);
+        glm::vec4 farPoint = invViewProj * glm::vec4(ndc.x, ndc.y, 1.0f, 1.0f);
+        glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+        glm::vec3 direction = glm::vec3(farPoint) / farPoint.w - origin;
+        std::optional<pons::RayHit> hit = sceneBvh.raycast(pons::Ray{origin, direction});
+        if (hit) {
+            std::cout << "picked object " << hit->object << '\n';
+        }
+    }
+
+    // Drains mouse input that arrived while the frame was recorded and writes the freshest views right before
+    // submit. Only the scene's uniform buffers see it, culling, shadows and particles keep the views of updateScene.
+    void latchCameras(uint32_t currentImage) {
+        SDL_PumpEvents();
+        std::array<SDL_Event, LATE_LATCH_EVENT_BATCH> events;
+        // one type at a time, the range between them holds button events that must wait for the next frame
+        for (SDL_EventType type : {SDL_MOUSEMOTION, SDL_MOUSEWHEEL}) {
+            int count;
+            while ((count = SDL_PeepEvents(events.data(), static_cast<int>(events.size()), SDL_GETEVENT, type,
+                                           type)) > 0) {
+                for (int i = 0; i < count; ++i) {
+                    handleMouseEvent(events[static_cast<size_t>(i)]);
+                }
+            }
+        }
+        // the frame is on screen roughly once the gpu is done with it, last frame's gpu time is the estimate
+        float predictSeconds = bCameraPrediction ? lastGpuMs * 1e-3f : 0.0f;
+        auto now = pons::OrbitCamera::Clock::now();
+        for (View &view : views) {
+            view.camera.endSample(now);
+            UniformBufferObject ubo{.view = view.camera.getViewMatrix(predictSeconds), .proj = view.projMatrix};
+            memcpy(view.uniformBuffersMapped[currentImage], &ubo, sizeof(ubo));
+        }
+    }
+
+    void createLighting() {
+        lighting.create(gpuContext(), descriptorSetLayout.get(), MAX_FRAMES_IN_FLIGHT,
+                        static_cast<uint32_t>(views.size()));
+        std::vector<pons::PointLight> &lights = lighting.getLights();
+        lights.resize(DEMO_LIGHT_COUNT);
+        for (uint32_t i = 0; i < DEMO_LIGHT_COUNT; ++i) {
+            float hue = static_cast<float>(i) / static_cast<float>(DEMO_LIGHT_COUNT);
+            glm::vec3 rgb = glm::abs(glm::fract(glm::vec3(hue) + glm::vec3(0.0f, 0.33f, 0.67f)) * 2.0f - 1.0f);
+            lights[i].color = glm::vec4(rgb, /*intensity*/ 0.5f);
+        }
+    }
+
+    // Lights orbit around the origin on a few rings, just enough motion to exercise per-frame binning.
+    void updateLights(uint32_t currentImage) {
+        std::vector<pons::PointLight> &lights = lighting.getLights();
+        for (size_t i = 0; i < lights.size(); ++i) {
+            float t = static_cast<float>(i) / static_cast<float>(lights.size());
+            float ring = 0.2f + 1.8f * glm::fract(t * 7.0f);
+            float angle = t * glm::two_pi<float>() * 13.0f + sceneTime * (0.2f + 0.3f * glm::fract(t * 3.0f));
+            float height = glm::sin(angle * 3.0f + t * 50.0f) * 0.5f;
+            lights[i].positionRadius = glm::vec4(ring * glm::cos(angle), ring * glm::sin(angle), height, 0.35f);
+        }
+        activeLightCount = lighting.uploadLights(currentImage);
     }
 
     void createDescriptorPool() {
-        vk::DescriptorPoolSize poolSize{vk::DescriptorType::eUniformBuffer,
-                                        /*descriptorCount*/ static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT)};
-        vk::DescriptorPoolCreateInfo poolInfo{vk::DescriptorPoolCreateFlags{},
-                                              /*maxSets*/ static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT), poolSize};
+        uint32_t setCount = static_cast<uint32_t>(views.size()) * MAX_FRAMES_IN_FLIGHT;
+        std::array<vk::DescriptorPoolSize, 3> poolSizes{
+            {{vk::DescriptorType::eUniformBuffer, /*descriptorCount*/ 2 * setCount},
+             {vk::DescriptorType::eStorageBuffer, /*descriptorCount*/ 2 * setCount},
+             {vk::DescriptorType::eCombinedImageSampler, /*descriptorCount*/ setCount}}};
+        vk::DescriptorPoolCreateInfo poolInfo{vk::DescriptorPoolCreateFlags{}, /*maxSets*/ setCount, poolSizes};
         descriptorPool = device->createDescriptorPoolUnique(poolInfo);
     }
 
+    // Every view has its own frame sets, they differ in the camera and the light clusters.
     void createDescriptorSets() {
         std::vector<vk::DescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, descriptorSetLayout.get());
         vk::DescriptorSetAllocateInfo allocInfo{descriptorPool.get(), layouts};
-        descriptorSets = device->allocateDescriptorSets(allocInfo);
-        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-            vk::DescriptorBufferInfo bufferInfo{uniformBuffers[i].get(),
-                                                /*offset*/ 0, sizeof(UniformBufferObject)};
-            vk::WriteDescriptorSet descriptorWrite{
-                descriptorSets[i],
-                /*dstBinding*/ 0,
-                /*dstArrayElement*/ 0,
-                /*descriptorCount*/ 1, vk::DescriptorType::eUniformBuffer, nullptr, &bufferInfo, nullptr};
-            device->updateDescriptorSets(1, &descriptorWrite, 0, nullptr);
+        for (size_t viewIndex = 0; viewIndex < views.size(); ++viewIndex) {
+            View &view = views[viewIndex];
+            view.descriptorSets = device->allocateDescriptorSets(allocInfo);
+            for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+                vk::DescriptorBufferInfo bufferInfo{view.uniformBuffers[i].get(),
+                                                    /*offset*/ 0, sizeof(UniformBufferObject)};
+                vk::WriteDescriptorSet descriptorWrite{
+                    view.descriptorSets[i],
+                    /*dstBinding*/ 0,
+                    /*dstArrayElement*/ 0,
+                    /*descriptorCount*/ 1, vk::DescriptorType::eUniformBuffer, nullptr, &bufferInfo, nullptr};
+                device->updateDescriptorSets(1, &descriptorWrite, 0, nullptr);
+                lighting.writeDescriptorSet(device.get(), view.descriptorSets[i], static_cast<uint32_t>(i),
+                                            static_cast<uint32_t>(viewIndex));
+                shadows.writeDescriptorSet(device.get(), view.descriptorSets[i], static_cast<uint32_t>(i));
+            }
         }
     }
 
-    void handleEvents() {
+    // Blocks up to `waitMs` for the first event, whatever else is queued is drained without waiting.
+    void handleEvents(uint32_t waitMs) {
         SDL_Event event;
-        while (SDL_PollEvent(&event) > 0) {
+        int pending = waitMs > 0 ? SDL_WaitEventTimeout(&event, static_cast<int>(waitMs)) : SDL_PollEvent(&event);
+        for (; pending > 0; pending = SDL_PollEvent(&event)) {
             switch (event.type) {
             case SDL_QUIT:
                 bKeepWindowOpen = false;
                 break;
             case SDL_WINDOWEVENT:
-                switch (event.window.event) {
-                case SDL_WINDOWEVENT_SIZE_CHANGED:
-                    framebufferResized(event.window.data1, event.window.data2);
-                    break;
-                case SDL_WINDOWEVENT_RESTORED:
-                    bIsWindowMinimized = false;
-                    break;
-                case SDL_WINDOWEVENT_MINIMIZED:
-                    bIsWindowMinimized = true;
-                    break;
+                handleWindowEvent(event.window);
+                break;
+            case SDL_KEYDOWN:
+                if (event.key.keysym.sym == SDLK_r && gpuTimer.isSupported()) {
+                    bDynamicResolution = !bDynamicResolution;
+                    resolution.reset();
+                } else if (event.key.keysym.sym == SDLK_p) {
+                    bCameraPrediction = !bCameraPrediction;
+                } else if (event.key.keysym.sym == SDLK_SPACE) {
+                    bAnimate = !bAnimate;
+                } else if (event.key.keysym.sym == SDLK_u) {
+                    bThrottleUnfocused = !bThrottleUnfocused;
+                } else if (event.key.keysym.sym == SDLK_m && meshletRenderer.hasMeshShader()) {
+                    meshletRenderer.setUseMeshShader(!meshletRenderer.usesMeshShader());
                 }
+                requestRedraw(); // the overlay shows the toggles
+                break;
+            case SDL_MOUSEMOTION:
+            case SDL_MOUSEBUTTONDOWN:
+            case SDL_MOUSEWHEEL:
+                handleMouseEvent(event);
                 break;
             }
         }
+        auto now = pons::OrbitCamera::Clock::now();
+        for (View &view : views) {
+            view.camera.endSample(now);
+        }
+    }
+
+    // Closing the first window quits, the others are only hidden. Focus is tracked across all windows.
+    void handleWindowEvent(const SDL_WindowEvent &windowEvent) {
+        switch (windowEvent.event) {
+        case SDL_WINDOWEVENT_FOCUS_GAINED:
+            bHasFocus = true;
+            return;
+        case SDL_WINDOWEVENT_FOCUS_LOST:
+            bHasFocus = false;
+            return;
+        }
+        View *pView = findView(windowEvent.windowID);
+        if (!pView) {
+            return;
+        }
+        switch (windowEvent.event) {
+        case SDL_WINDOWEVENT_SIZE_CHANGED:
+            pView->bResized = true;
+            requestRedraw();
+            break;
+        case SDL_WINDOWEVENT_RESTORED:
+            pView->bMinimized = false;
+            requestRedraw();
+            break;
+        case SDL_WINDOWEVENT_MINIMIZED:
+            pView->bMinimized = true;
+            break;
+        case SDL_WINDOWEVENT_SHOWN:
+            pView->bHidden = false;
+            requestRedraw();
+            break;
+        case SDL_WINDOWEVENT_HIDDEN:
+            pView->bHidden = true;
+            break;
+        case SDL_WINDOWEVENT_EXPOSED:
+            requestRedraw();
+            break;
+        case SDL_WINDOWEVENT_CLOSE:
+            if (pView == &views.front()) {
+                bKeepWindowOpen = false;
+            } else {
+                SDL_HideWindow(pView->pWindow);
+            }
+            break;
+        }
     }
 
+    // Left click picks, right drag orbits the camera, the wheel zooms. Input goes to the view of the window under it.
+    void handleMouseEvent(const SDL_Event &event) {
+        switch (event.type) {
+        case SDL_MOUSEMOTION:
+            if (View *pView = findView(event.motion.windowID); pView && event.motion.state & SDL_BUTTON_RMASK) {
+                glm::vec2 motion{static_cast<float>(event.motion.xrel), static_cast<float>(event.motion.yrel)};
+                pView->camera.addMotion(motion);
+                requestRedraw();
+            }
+            break;
+        case SDL_MOUSEBUTTONDOWN:
+            if (View *pView = findView(event.button.windowID); pView && event.button.button == SDL_BUTTON_LEFT) {
+                pickObject(*pView, event.button.x, event.button.y);
+            }
+            break;
+        case SDL_MOUSEWHEEL:
+            if (View *pView = findView(event.wheel.windowID)) {
+                pView->camera.addZoom(static_cast<float>(event.wheel.y));
+                requestRedraw();
+            }
+            break;
+        }
+    }
+
+    // Every view goes into one submit that waits for all acquired images, one present then covers all swapchains.
     void drawFrame() {
         auto waitResult = device->waitForFences(inFlightFences[currentFrame].get(), true, UINT64_MAX);
         if (waitResult != vk::Result::eSuccess) {
             throw std::runtime_error("error while waiting for inFlightFence");
         }
 
-        vk::ResultValue<uint32_t> acquireImageResult = device->acquireNextImageKHR(
-            swapChain.get(), UINT64_MAX, imageAvailableSemaphores[currentFrame].get(), nullptr);
-        if (acquireImageResult.result == vk::Result::eErrorOutOfDateKHR) {
-            recreateSwapChain();
+        bool bAnyAcquired = false;
+        for (View &view : views) {
+            view.bInFrame = false;
+            if (!view.isVisible()) {
+                continue;
+            }
+            vk::Result acquireResult = view.swapchain.acquire(currentFrame);
+            if (acquireResult == vk::Result::eErrorOutOfDateKHR) {
+                recreateSwapChain(view);
+                continue;
+            }
+            view.bInFrame = true;
+            bAnyAcquired = true;
+        }
+        if (!bAnyAcquired) {
+            requestRedraw(); // retried with the recreated swapchains
             return;
-        } else if (acquireImageResult.result != vk::Result::eSuccess &&
-                   acquireImageResult.result != vk::Result::eSuboptimalKHR) {
-            throw std::runtime_error("failed to acquire swap chain image");
         }
         device->resetFences(inFlightFences[currentFrame].get());
+        // input latched into this frame requests another one, culling and shadows only catch up with it then
+        bRedrawRequested = false;
+        lastDrawTicks = SDL_GetTicks();
+        // the lists still alive belong to the previous frame and its arena
+        frameLists.reset();
+        pons::FrameArena &arena = frameArenas[currentFrame];
+        arena.reset();
+        frameLists.emplace(&arena);
+        ensureSceneBuffers(); // re-uploads allocate, which is fine for the rare frame after an eviction
+        uint64_t heapAllocationsAtStart = pons::getThreadHeapAllocationCount();
+        memoryBudget.update(frameIndex);
+        if (std::optional<float> gpuMs = gpuTimer.read(currentFrame)) {
+            lastGpuMs = *gpuMs;
+            if (bDynamicResolution) {
+                resolution.addSample(*gpuMs);
+            }
+        }
+        if (bMeshletDraws) {
+            meshletsDrawn = meshletRenderer.readDrawnCount(currentFrame);
+            meshletsTested = meshletRenderer.getTestedCount(currentFrame);
+        }
 
         vk::CommandBuffer commandBuffer = commandBuffers[currentFrame].get();
         commandBuffer.reset(vk::CommandBufferResetFlags{});
-        recordCommandBuffer(commandBuffer, acquireImageResult.value);
-        std::vector<vk::Semaphore> waitSemaphores = {imageAvailableSemaphores[currentFrame].get()};
-        std::vector<vk::Semaphore> signalSemaphores = {renderFinishedSemaphores[currentFrame].get()};
-        vk::PipelineStageFlags waitStages = {vk::PipelineStageFlagBits::eColorAttachmentOutput};
-        updateUniformBuffer(currentFrame);
+        updateScene();
+        updateLights(currentFrame);
+        // cascades are fit to the first view only, the others sample the same maps
+        const View &primaryView = views.front();
+        shadows.update(primaryView.viewMatrix, primaryView.projMatrix, CAMERA_NEAR, CAMERA_FAR, currentFrame);
+        updateOverlay();
+        // a new atlas page can push geometry out of the budget, it has to be back before it's recorded
+        if (text.createPendingPages()) {
+            ensureSceneBuffers();
+        }
+        recordCommandBuffer(commandBuffer);
+
+        std::pmr::vector<vk::Semaphore> waitSemaphores(&arena);
+        std::pmr::vector<vk::PipelineStageFlags> waitStages(&arena);
+        std::pmr::vector<vk::SwapchainKHR> presentSwapchains(&arena);
+        std::pmr::vector<uint32_t> presentImageIndices(&arena);
+        std::pmr::vector<View *> presentViews(&arena);
+        for (View &view : views) {
+            if (!view.bInFrame) {
+                continue;
+            }
+            waitSemaphores.push_back(view.swapchain.getImageAvailable(currentFrame));
+            // post processing writes the swapchain image before the overlay pass
+            waitStages.push_back(vk::PipelineStageFlagBits::eColorAttachmentOutput |
+                                 (view.swapchain.isDirectOutput() ? vk::PipelineStageFlagBits::eComputeShader
+                                                                  : vk::PipelineStageFlagBits::eTransfer));
+            presentSwapchains.push_back(view.swapchain.get());
+            presentImageIndices.push_back(view.swapchain.getImageIndex());
+            presentViews.push_back(&view);
+        }
+        std::pmr::vector<vk::Result> presentResults(presentSwapchains.size(), vk::Result::eSuccess, &arena);
+        std::pmr::vector<vk::Semaphore> signalSemaphores({renderFinishedSemaphores[currentFrame].get()}, &arena);
         vk::SubmitInfo submitInfo{waitSemaphores, waitStages, commandBuffer, signalSemaphores};
+        latchCameras(currentFrame);
         graphicsQueue.submit(submitInfo, inFlightFences[currentFrame].get());
-        vk::SwapchainKHR swapChains = {swapChain.get()};
-        vk::PresentInfoKHR presentInfo{signalSemaphores, swapChains, acquireImageResult.value, nullptr};
-        vk::Result presentResult = presentQueue.presentKHR(presentInfo);
-        if (presentResult == vk::Result::eErrorOutOfDateKHR || presentResult == vk::Result::eSuboptimalKHR ||
-            bFramebufferResized) {
-            bFramebufferResized = false;
-            recreateSwapChain();
-        } else if (presentResult != vk::Result::eSuccess) {
+        // once warmed up, everything transient between fence and submit has to come from the arena
+        uint64_t frameHeapAllocations = pons::getThreadHeapAllocationCount() - heapAllocationsAtStart;
+        assert(frameIndex < HEAP_CHECK_WARMUP_FRAMES || pipelines.getPendingCount() > 0 || frameHeapAllocations == 0);
+        UNUSED(frameHeapAllocations);
+        vk::PresentInfoKHR presentInfo{signalSemaphores, presentSwapchains, presentImageIndices, presentResults};
+        // the pointer overload doesn't throw on out of date, each swapchain's own result is checked below
+        vk::Result presentResult = presentQueue.presentKHR(&presentInfo);
+        if (presentResult != vk::Result::eSuccess && presentResult != vk::Result::eSuboptimalKHR &&
+            presentResult != vk::Result::eErrorOutOfDateKHR) {
             throw std::runtime_error("failed to invoke presentKHR");
         }
+        for (size_t i = 0; i < presentViews.size(); ++i) {
+            View &view = *presentViews[i];
+            if (presentResults[i] == vk::Result::eErrorOutOfDateKHR ||
+                presentResults[i] == vk::Result::eSuboptimalKHR || view.bResized) {
+                view.bResized = false;
+                recreateSwapChain(view);
+            } else if (presentResults[i] != vk::Result::eSuccess) {
+                throw std::runtime_error("failed to invoke presentKHR");
+            }
+        }
+        if (pipelines.getPendingCount() > 0) {
+            requestRedraw(); // placeholders are swapped for compiled pipelines as they finish
+        }
+        if (frameIndex == 0) {
+            auto sinceLaunch = std::chrono::steady_clock::now() - launchTime;
+            float launchMs = std::chrono::duration<float, std::milli>(sinceLaunch).count();
+            std::cout << "first frame presented " << launchMs << " ms after launch\n";
+        }
         currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+        ++frameIndex;
+    }
+
+    void requestRedraw() { bRedrawRequested = true; }
+
+    bool needsRedraw() const { return bRedrawRequested || bAnimate; }
+
+    // Milliseconds until the next frame is due. Nothing is drawn while every window is minimized or hidden, or when
+    // nothing changed, the loop then just waits on events. Unfocused windows are optionally capped to a lower frame
+    // rate.
+    uint32_t getFrameDelayMs() const {
+        bool bAnyVisible = std::any_of(views.begin(), views.end(), [](const View &view) { return view.isVisible(); });
+        if (!bAnyVisible || !needsRedraw()) {
+            return IDLE_WAIT_MS;
+        }
+        if (bThrottleUnfocused && !bHasFocus) {
+            uint32_t sinceLastDraw = SDL_GetTicks() - lastDrawTicks;
+            return sinceLastDraw < UNFOCUSED_FRAME_INTERVAL_MS ? UNFOCUSED_FRAME_INTERVAL_MS - sinceLastDraw : 0;
+        }
+        return 0;
+    }
+
+    void updateStatsTitle() {
+        uint32_t now = SDL_GetTicks();
+        if (now - lastStatsTitleTicks < STATS_TITLE_INTERVAL_MS) {
+            return;
+        }
+        lastStatsTitleTicks = now;
+        memoryStatsText = memoryBudget.formatStats();
+        for (size_t i = 0; i < views.size(); ++i) {
+            std::string title = "Vulkan Window";
+            if (i > 0) {
+                title += " " + std::to_string(i + 1);
+            }
+            title += " | " + memoryStatsText;
+            SDL_SetWindowTitle(views[i].pWindow, title.c_str());
+        }
+    }
+
+    // Writable per user directory for caches, empty when SDL can't provide one.
+    static std::string getPrefPath() {
+        char *pPrefPath = SDL_GetPrefPath("modbrin", "pons2");
+        std::string prefPath = pPrefPath ? pPrefPath : "";
+        SDL_free(pPrefPath);
+        return prefPath;
+    }
+
+    void createParticles() { particles.create(gpuContext(), pipelines, "scene"); }
+
+    void createShadows() {
+        shadows.create(gpuContext(), pipelines, MAX_FRAMES_IN_FLIGHT);
+        shadows.setLightDirection(SUN_DIRECTION);
+    }
+
+    // After every subsystem registered its layouts, recorded keys naming unknown ones are skipped.
+    void prewarmPipelines() { pipelines.prewarm(getPrefPath() + "pipelines.txt"); }
+
+    void createText() {
+        text.create(gpuContext(), views.front().swapchain.getRenderPass(), MAX_FRAMES_IN_FLIGHT, FONT_PATH,
+                    getPrefPath() + "font_atlas.cache");
+    }
+
+    // Drawn over the first view, the counts are of its lists.
+    void updateOverlay() {
+        auto now = std::chrono::steady_clock::now();
+        float frameMs = std::chrono::duration<float, std::milli>(now - lastFrameTime).count();
+        lastFrameTime = now;
+        // gaps from idling say nothing about the frame cost
+        if (frameMs < static_cast<float>(IDLE_WAIT_MS)) {
+            smoothedFrameMs += (frameMs - smoothedFrameMs) * 0.05f;
+        }
+        char frameStats[128];
+        std::snprintf(frameStats, sizeof(frameStats),
+                      "%.2f ms | gpu %.2f ms | scale %.0f%%%s | %zu/%zu objects | %u lights\n",
+                      static_cast<double>(smoothedFrameMs), static_cast<double>(lastGpuMs),
+                      static_cast<double>(bDynamicResolution ? resolution.getScale() * 100.0f : 100.0f),
+                      bDynamicResolution ? "" : " (fixed)",
+                      frameLists->views.front().drawList.size() + frameLists->views.front().meshletInstances.size(),
+                      sceneObjects.size(), activeLightCount);
+        std::pmr::string overlay(&frameArenas[currentFrame]);
+        overlay += frameStats;
+        overlay += memoryStatsText;
+        // lines with numbers are formatted on the stack, temporary std::strings would hit the heap every frame
+        char line[64];
+        if (uint32_t redrawnCascades = shadows.getStaticRedrawCount()) {
+            std::snprintf(line, sizeof(line), "\nshadow cache redrew %u cascades", redrawnCascades);
+            overlay += line;
+        }
+        if (views.size() > 1) {
+            std::snprintf(line, sizeof(line), "\n%zu views", views.size());
+            overlay += line;
+        }
+        if (bCameraPrediction) {
+            overlay += "\ncamera prediction on";
+        }
+        if (!bAnimate) {
+            overlay += "\nanimation paused";
+        }
+        if (meshletsTested > 0) {
+            std::snprintf(line, sizeof(line), "\nmeshlets %u/%u", meshletsDrawn, meshletsTested);
+            overlay += line;
+            if (meshletRenderer.usesMeshShader()) {
+                overlay += " (mesh shaders)";
+            }
+        }
+        if (uint32_t pendingPipelines = pipelines.getPendingCount()) {
+            std::snprintf(line, sizeof(line), "\ncompiling %u pipelines", pendingPipelines);
+            overlay += line;
+        }
+        text.addText(overlay, {8.0f, 8.0f}, OVERLAY_TEXT_SIZE);
     }
 
     void mainLoop() {
         while (bKeepWindowOpen) {
-            handleEvents();
-            drawFrame();
+            handleEvents(getFrameDelayMs());
+            if (getFrameDelayMs() == 0) {
+                drawFrame();
+            }
+            updateStatsTitle();
         }
         device->waitIdle();
+        text.saveCache();
+        pipelines.saveKeys(getPrefPath() + "pipelines.txt");
     }
 
 private:
     uint32_t currentFrame = 0;
+    uint64_t frameIndex = 0;
+    uint32_t lastStatsTitleTicks = 0;
+    std::string memoryStatsText;
+    std::chrono::steady_clock::time_point launchTime = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point lastFrameTime = std::chrono::steady_clock::now();
+    float smoothedFrameMs = 0.0f;
+    float lastGpuMs = 0.0f;
+    uint32_t meshletsDrawn = 0; // by the last completed submission
+    uint32_t meshletsTested = 0;
+    bool bDynamicResolution = false;
+    bool bStorageWithoutFormat = false; // shaderStorageImageWriteWithoutFormat is enabled
+    bool bMeshletDraws = false;         // multiDrawIndirect and drawIndirectFirstInstance are enabled
+    bool bMeshShader = false;           // task and mesh shaders are enabled
+    bool bDrawIndirectCount = false;    // VK_KHR_draw_indirect_count is enabled
     bool bKeepWindowOpen = true;
-    bool bFramebufferResized = false;
-    bool bIsWindowMinimized = false;
+    bool bHasFocus = true;
+    bool bThrottleUnfocused = true;
+    bool bAnimate = true;
+    bool bRedrawRequested = true; // something on screen changed since the last frame was drawn
+    uint32_t lastDrawTicks = 0;
     unsigned int screenWidth = DEFAULT_WIDTH, screenHeight = DEFAULT_HEIGHT;
-    SDL_Window *pWindow;
+    LaunchOptions launchOptions;
     vk::UniqueInstance instance;
-    vk::DebugUtilsMessengerEXT debugMessenger;
+    vk::UniqueHandle<vk::DebugUtilsMessengerEXT, vk::DispatchLoaderDynamic> debugMessenger;
     vk::PhysicalDevice physicalDevice;
     vk::UniqueDevice device;
-    vk::UniqueSurfaceKHR surface;
+    std::vector<const char *> enabledDeviceExtensions;
+    pons::MemoryBudget memoryBudget; // outlives every TrackedMemory below
+    std::vector<View> views;         // windows first, the first one is the primary view
     vk::Queue graphicsQueue;
+    std::mutex queueMutex; // only contended by startup tasks, the render loop submits from a single thread
     vk::Queue presentQueue;
-    vk::UniqueSwapchainKHR swapChain;
-    std::vector<vk::Image> swapChainImages;
-    vk::Format swapChainImageFormat;
-    vk::Extent2D swapChainExtent;
-    std::vector<vk::UniqueImageView> swapChainImageViews;
-    std::vector<vk::UniqueSemaphore> imageAvailableSemaphores;
     std::vector<vk::UniqueSemaphore> renderFinishedSemaphores;
     std::vector<vk::UniqueFence> inFlightFences;
-    vk::UniqueRenderPass renderPass;
+    pons::GpuTimer gpuTimer;
+    pons::ResolutionController resolution{GPU_FRAME_BUDGET_MS};
     vk::UniqueDescriptorSetLayout descriptorSetLayout;
     vk::UniquePipelineLayout pipelineLayout;
-    vk::UniquePipeline graphicsPipeline;
-    std::vector<vk::UniqueFramebuffer> swapChainFramebuffers;
+    pons::ThreadPool workerPool;
+    pons::PipelineRegistry pipelines; // waits for its compile jobs before workerPool goes away
+    pons::PipelineHandle scenePipeline = pons::INVALID_PIPELINE;
     vk::UniqueCommandPool commandPool;
     std::vector<vk::UniqueCommandBuffer> commandBuffers;
-    vk::UniqueDeviceMemory vertexBufferMemory;
+    std::vector<Vertex> sceneVertices;
+    std::vector<uint16_t> sceneIndices;
+    pons::MeshletMesh terrainMeshlets;
+    pons::MeshletSource terrainSource{};
+    pons::MeshletRenderer meshletRenderer;
+    pons::TrackedMemory vertexBufferMemory;
     vk::UniqueBuffer vertexBuffer;
-    vk::UniqueDeviceMemory indexBufferMemory;
+    pons::TrackedMemory indexBufferMemory;
     vk::UniqueBuffer indexBuffer;
-    std::vector<vk::UniqueBuffer> uniformBuffers;
-    std::vector<vk::UniqueDeviceMemory> uniformBuffersMemory;
-    std::vector<vk::DescriptorSet> descriptorSets; // freed with descriptorPool
+    pons::MemoryBudget::ResidentId vertexBufferResident = pons::MemoryBudget::NO_RESIDENT;
+    pons::MemoryBudget::ResidentId indexBufferResident = pons::MemoryBudget::NO_RESIDENT;
+    bool bSceneBuffersMoved = false; // evicted or demoted since the last frame
     vk::UniqueDescriptorPool descriptorPool;
+    pons::ClusteredLighting lighting;
+    pons::TextRenderer text;
+    pons::ParticleSystem particles;
+    pons::CascadedShadows shadows;
+    uint32_t activeLightCount = 0;
+    bool bCameraPrediction = false;
+    float sceneTime = 0.0f; // advances only while animating
+    std::chrono::steady_clock::time_point lastSceneUpdateTime = std::chrono::steady_clock::now();
+    float sceneDeltaTime = 0.0f;
+    std::vector<SceneObject> sceneObjects;
+    std::vector<pons::Aabb> sceneBounds;
+    pons::Bvh sceneBvh;
+    std::vector<uint32_t> visibleObjects;
+    std::vector<pons::ShadowCaster> staticCasters;
+    std::array<pons::FrameArena, MAX_FRAMES_IN_FLIGHT> frameArenas;
+    std::optional<FrameLists> frameLists; // of the frame being built
 };
 
-int main() {
-    HelloTriangleApplication app;
-
+int main(int argc, char *argv[]) {
     try {
+        HelloTriangleApplication app(parseLaunchOptions(argc, argv));
         app.run();
     } catch (const std::exception &e) {
         std::cerr << e.what() << std::endl;
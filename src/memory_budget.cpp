@@ -0,0 +1,265 @@
+#include "memory_budget.h"
+
+#include <algorithm>
+#include <sstream>
+
+namespace pons {
+
+namespace {
+
+// Without VK_EXT_memory_budget leave headroom for other processes and driver internal allocations.
+const double FALLBACK_BUDGET_FRACTION = 0.8;
+const vk::DeviceSize MEBIBYTE = 1024 * 1024;
+
+} // namespace
+
+void MemoryBudget::init(vk::PhysicalDevice physicalDevice, vk::Device device, std::mutex *pQueueMutex,
+                        bool bMemoryBudgetExtension, vk::DeviceSize envelope) {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->physicalDevice = physicalDevice;
+    this->device = device;
+    this->pQueueMutex = pQueueMutex;
+    this->envelope = envelope;
+    // core vkGetPhysicalDeviceMemoryProperties2 needs a 1.1 device
+    bDriverBudget = bMemoryBudgetExtension && physicalDevice.getProperties().apiVersion >= VK_API_VERSION_1_1;
+    memoryProperties = physicalDevice.getMemoryProperties();
+
+    heaps.resize(memoryProperties.memoryHeapCount);
+    trackedAtQuery.assign(memoryProperties.memoryHeapCount, 0);
+    for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; ++i) {
+        const vk::MemoryHeap &heap = memoryProperties.memoryHeaps[i];
+        HeapStats &stats = heaps[i];
+        stats.size = heap.size;
+        stats.bDeviceLocal = static_cast<bool>(heap.flags & vk::MemoryHeapFlagBits::eDeviceLocal);
+        stats.budget = static_cast<vk::DeviceSize>(static_cast<double>(heap.size) * FALLBACK_BUDGET_FRACTION);
+        if (stats.bDeviceLocal && envelope > 0) {
+            stats.budget = std::min(stats.budget, envelope);
+        }
+        stats.usage = 0;
+        stats.tracked = 0;
+    }
+    queryDriverBudget();
+}
+
+void MemoryBudget::queryDriverBudget() {
+    if (!bDriverBudget) {
+        return;
+    }
+    auto chain = physicalDevice.getMemoryProperties2<vk::PhysicalDeviceMemoryProperties2,
+                                                     vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+    const auto &driverBudget = chain.get<vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+    for (size_t i = 0; i < heaps.size(); ++i) {
+        HeapStats &stats = heaps[i];
+        stats.budget = driverBudget.heapBudget[i];
+        if (stats.bDeviceLocal && envelope > 0) {
+            stats.budget = std::min(stats.budget, envelope);
+        }
+        stats.usage = driverBudget.heapUsage[i];
+        trackedAtQuery[i] = stats.tracked;
+    }
+}
+
+void MemoryBudget::update(uint64_t frameIndex) {
+    std::lock_guard<std::mutex> lock(mutex);
+    currentFrame = frameIndex;
+    queryDriverBudget();
+}
+
+uint32_t MemoryBudget::heapOfType(uint32_t memoryTypeIndex) const {
+    return memoryProperties.memoryTypes[memoryTypeIndex].heapIndex;
+}
+
+bool MemoryBudget::fitsLocked(uint32_t heapIndex, vk::DeviceSize size) const {
+    const HeapStats &stats = heaps.at(heapIndex);
+    // driver usage lags behind our own allocations until the next query
+    vk::DeviceSize usage = stats.tracked;
+    if (bDriverBudget) {
+        usage = stats.usage + stats.tracked - std::min(stats.tracked, trackedAtQuery[heapIndex]);
+    }
+    return usage + size <= stats.budget;
+}
+
+bool MemoryBudget::fits(uint32_t heapIndex, vk::DeviceSize size) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return fitsLocked(heapIndex, size);
+}
+
+bool MemoryBudget::reserve(uint32_t memoryTypeIndex, vk::DeviceSize size) {
+    uint32_t heapIndex = heapOfType(memoryTypeIndex);
+    bool bDeviceIdle = false;
+    while (true) {
+        Resident victim;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (fitsLocked(heapIndex, size)) {
+                return true;
+            }
+            auto candidate = residents.end();
+            for (auto it = residents.begin(); it != residents.end(); ++it) {
+                if (!it->bActive || it->heapIndex != heapIndex) {
+                    continue;
+                }
+                if (candidate == residents.end() || it->priority < candidate->priority ||
+                    (it->priority == candidate->priority && it->lastUsedFrame < candidate->lastUsedFrame)) {
+                    candidate = it;
+                }
+            }
+            if (candidate == residents.end()) {
+                return false;
+            }
+            victim.evict = std::move(candidate->evict);
+            victim.demote = std::move(candidate->demote);
+            releaseLocked(*candidate);
+        }
+
+        // callbacks free memory that may still be referenced by frames in flight
+        if (!bDeviceIdle) {
+            // vkDeviceWaitIdle counts as access to every queue, startup uploads submit from worker threads
+            std::unique_lock<std::mutex> queueLock =
+                pQueueMutex ? std::unique_lock<std::mutex>(*pQueueMutex) : std::unique_lock<std::mutex>();
+            device.waitIdle();
+            bDeviceIdle = true;
+        }
+        if (victim.demote && victim.demote()) {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++demotions;
+        } else if (victim.evict) {
+            victim.evict();
+            std::lock_guard<std::mutex> lock(mutex);
+            ++evictions;
+        }
+    }
+}
+
+void MemoryBudget::onAllocate(uint32_t heapIndex, vk::DeviceSize size, MemoryCategory category) {
+    std::lock_guard<std::mutex> lock(mutex);
+    heaps.at(heapIndex).tracked += size;
+    categoryBytes[static_cast<size_t>(category)] += size;
+    ++categoryAllocations[static_cast<size_t>(category)];
+}
+
+void MemoryBudget::onFree(uint32_t heapIndex, vk::DeviceSize size, MemoryCategory category) {
+    std::lock_guard<std::mutex> lock(mutex);
+    heaps.at(heapIndex).tracked -= size;
+    categoryBytes[static_cast<size_t>(category)] -= size;
+    --categoryAllocations[static_cast<size_t>(category)];
+}
+
+MemoryBudget::Resident *MemoryBudget::findLocked(ResidentId id) {
+    auto slot = static_cast<size_t>(id & 0xffffffffu);
+    auto generation = static_cast<uint32_t>(id >> 32);
+    if (slot >= residents.size() || !residents[slot].bActive || residents[slot].generation != generation) {
+        return nullptr;
+    }
+    return &residents[slot];
+}
+
+void MemoryBudget::releaseLocked(Resident &resident) {
+    resident.bActive = false;
+    resident.evict = {};
+    resident.demote = {};
+    resident.generation = resident.generation == UINT32_MAX ? 1 : resident.generation + 1;
+}
+
+MemoryBudget::ResidentId MemoryBudget::registerResident(uint32_t heapIndex, vk::DeviceSize size, int priority,
+                                                        std::function<void()> evict, std::function<bool()> demote) {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t slot = 0;
+    while (slot < residents.size() && residents[slot].bActive) {
+        ++slot;
+    }
+    if (slot == residents.size()) {
+        residents.push_back(Resident{.generation = 1});
+    }
+    Resident &resident = residents[slot];
+    resident.heapIndex = heapIndex;
+    resident.size = size;
+    resident.priority = priority;
+    resident.lastUsedFrame = currentFrame;
+    resident.evict = std::move(evict);
+    resident.demote = std::move(demote);
+    resident.bActive = true;
+    return static_cast<ResidentId>(resident.generation) << 32 | static_cast<ResidentId>(slot);
+}
+
+void MemoryBudget::unregisterResident(ResidentId id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (Resident *pResident = findLocked(id)) {
+        releaseLocked(*pResident);
+    }
+}
+
+void MemoryBudget::touch(ResidentId id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (Resident *pResident = findLocked(id)) {
+        pResident->lastUsedFrame = currentFrame;
+    }
+}
+
+MemoryStats MemoryBudget::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    MemoryStats stats{heaps, categoryBytes, categoryAllocations, evictions, demotions, bDriverBudget};
+    if (!bDriverBudget) {
+        for (HeapStats &heap : stats.heaps) {
+            heap.usage = heap.tracked;
+        }
+    }
+    return stats;
+}
+
+std::string MemoryBudget::formatStats() const {
+    MemoryStats stats = getStats();
+    vk::DeviceSize localUsage = 0;
+    vk::DeviceSize localBudget = 0;
+    for (const HeapStats &heap : stats.heaps) {
+        if (heap.bDeviceLocal) {
+            localUsage += heap.usage;
+            localBudget += heap.budget;
+        }
+    }
+    std::ostringstream out;
+    out << "VRAM " << localUsage / MEBIBYTE << "/" << localBudget / MEBIBYTE << " MiB"
+        << (stats.bDriverBudget ? "" : " (tracked)") << " | buffers "
+        << stats.categoryBytes[static_cast<size_t>(MemoryCategory::Buffer)] / MEBIBYTE << " MiB, images "
+        << stats.categoryBytes[static_cast<size_t>(MemoryCategory::Image)] / MEBIBYTE << " MiB, staging "
+        << stats.categoryBytes[static_cast<size_t>(MemoryCategory::Staging)] / MEBIBYTE << " MiB | evicted "
+        << stats.evictions << ", demoted " << stats.demotions;
+    return out.str();
+}
+
+TrackedMemory::TrackedMemory(vk::UniqueDeviceMemory memory, MemoryBudget *pBudget, uint32_t heapIndex,
+                             vk::DeviceSize size, MemoryCategory category)
+    : memory(std::move(memory)), pBudget(pBudget), heapIndex(heapIndex), size(size), category(category) {
+    if (pBudget) {
+        pBudget->onAllocate(heapIndex, size, category);
+    }
+}
+
+TrackedMemory::TrackedMemory(TrackedMemory &&other) noexcept
+    : memory(std::move(other.memory)), pBudget(other.pBudget), heapIndex(other.heapIndex), size(other.size),
+      category(other.category) {
+    other.pBudget = nullptr;
+}
+
+TrackedMemory &TrackedMemory::operator=(TrackedMemory &&other) noexcept {
+    if (this != &other) {
+        reset();
+        memory = std::move(other.memory);
+        pBudget = other.pBudget;
+        heapIndex = other.heapIndex;
+        size = other.size;
+        category = other.category;
+        other.pBudget = nullptr;
+    }
+    return *this;
+}
+
+void TrackedMemory::reset() {
+    if (memory && pBudget) {
+        pBudget->onFree(heapIndex, size, category);
+    }
+    memory.reset();
+    pBudget = nullptr;
+}
+
+} // namespace pons
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace pons {
+
+enum class MemoryCategory : uint32_t { Buffer, Image, Staging, Count };
+
+// Eviction priorities of resident resources, lower ones go first.
+const int RESIDENT_PRIORITY_CACHE = 0;     // only costs time to rebuild
+const int RESIDENT_PRIORITY_GEOMETRY = 10; // has to be uploaded again
+
+struct HeapStats {
+    vk::DeviceSize size;
+    vk::DeviceSize budget;  // what we may use, from VK_EXT_memory_budget or a fraction of the heap size
+    vk::DeviceSize usage;   // process wide usage as reported by the driver, or tracked usage as fallback
+    vk::DeviceSize tracked; // bytes allocated through the budget
+    bool bDeviceLocal;
+};
+
+struct MemoryStats {
+    std::vector<HeapStats> heaps;
+    std::array<vk::DeviceSize, static_cast<size_t>(MemoryCategory::Count)> categoryBytes;
+    std::array<uint32_t, static_cast<size_t>(MemoryCategory::Count)> categoryAllocations;
+    uint64_t evictions;
+    uint64_t demotions;
+    bool bDriverBudget;
+};
+
+// Device memory accounting per heap and per category. Keeps allocations under the heap budget by evicting or demoting
+// registered resident resources, lowest priority and least recently used first. Safe to use from several threads.
+class MemoryBudget {
+public:
+    // Slot index in the low half, the slot's generation in the high half. Ids of residents that were evicted,
+    // demoted or unregistered go stale and are ignored, even once their slot is reused.
+    using ResidentId = uint64_t;
+    static constexpr ResidentId NO_RESIDENT = 0;
+
+    // `envelope` additionally caps every device local heap, 0 means the driver budget is the only limit.
+    // `pQueueMutex` is held while waiting for the device, like GpuContext::pQueueMutex.
+    void init(vk::PhysicalDevice physicalDevice, vk::Device device, std::mutex *pQueueMutex,
+              bool bMemoryBudgetExtension, vk::DeviceSize envelope = 0);
+    // Re-queries driver budgets, cheap enough to call once per frame.
+    void update(uint64_t frameIndex);
+
+    uint32_t heapOfType(uint32_t memoryTypeIndex) const;
+    bool fits(uint32_t heapIndex, vk::DeviceSize size) const;
+    // Evicts and demotes residents on the heap until `size` more bytes fit. Waits for the device to go idle before
+    // invoking any eviction callback, so it must not be called with the queue mutex held. Returns false when the heap
+    // can't make room.
+    bool reserve(uint32_t memoryTypeIndex, vk::DeviceSize size);
+
+    void onAllocate(uint32_t heapIndex, vk::DeviceSize size, MemoryCategory category);
+    void onFree(uint32_t heapIndex, vk::DeviceSize size, MemoryCategory category);
+
+    // Resident resources can give their memory back when the heap runs over budget. `demote` moves the resource to
+    // slower memory and returns whether it succeeded, `evict` drops it entirely (owner recreates it on demand).
+    // Either callback may be empty. Residents are unregistered automatically after being evicted or demoted, so
+    // owners may unregister or touch ids that went stale meanwhile.
+    ResidentId registerResident(uint32_t heapIndex, vk::DeviceSize size, int priority, std::function<void()> evict,
+                                std::function<bool()> demote = {});
+    void unregisterResident(ResidentId id);
+    // Marks resident as used this frame, recently used residents are evicted last.
+    void touch(ResidentId id);
+
+    MemoryStats getStats() const;
+    std::string formatStats() const;
+
+private:
+    struct Resident {
+        uint32_t heapIndex;
+        vk::DeviceSize size;
+        int priority;
+        uint64_t lastUsedFrame;
+        std::function<void()> evict;
+        std::function<bool()> demote;
+        bool bActive;
+        uint32_t generation; // bumped whenever the slot is freed, never 0
+    };
+
+    void queryDriverBudget();
+    bool fitsLocked(uint32_t heapIndex, vk::DeviceSize size) const;
+    Resident *findLocked(ResidentId id);
+    static void releaseLocked(Resident &resident);
+
+    mutable std::mutex mutex;
+    vk::PhysicalDevice physicalDevice;
+    vk::Device device;
+    std::mutex *pQueueMutex = nullptr;
+    vk::PhysicalDeviceMemoryProperties memoryProperties;
+    bool bDriverBudget = false;
+    vk::DeviceSize envelope = 0;
+    std::vector<HeapStats> heaps;
+    std::vector<vk::DeviceSize> trackedAtQuery; // tracked bytes when driver usage was last sampled
+    std::array<vk::DeviceSize, static_cast<size_t>(MemoryCategory::Count)> categoryBytes{};
+    std::array<uint32_t, static_cast<size_t>(MemoryCategory::Count)> categoryAllocations{};
+    std::vector<Resident> residents;
+    uint64_t currentFrame = 0;
+    uint64_t evictions = 0;
+    uint64_t demotions = 0;
+};
+
+// Owning device memory handle that reports its lifetime to a MemoryBudget.
+class TrackedMemory {
+public:
+    TrackedMemory() = default;
+    TrackedMemory(vk::UniqueDeviceMemory memory, MemoryBudget *pBudget, uint32_t heapIndex, vk::DeviceSize size,
+                  MemoryCategory category);
+    TrackedMemory(TrackedMemory &&other) noexcept;
+    TrackedMemory &operator=(TrackedMemory &&other) noexcept;
+    TrackedMemory(const TrackedMemory &) = delete;
+    TrackedMemory &operator=(const TrackedMemory &) = delete;
+    ~TrackedMemory() { reset(); }
+
+    vk::DeviceMemory get() const { return memory.get(); }
+    uint32_t getHeapIndex() const { return heapIndex; }
+    vk::DeviceSize getSize() const { return size; }
+    explicit operator bool() const { return static_cast<bool>(memory); }
+    void reset();
+
+private:
+    vk::UniqueDeviceMemory memory;
+    MemoryBudget *pBudget = nullptr;
+    uint32_t heapIndex = 0;
+    vk::DeviceSize size = 0;
+    MemoryCategory category = MemoryCategory::Buffer;
+};
+
+} // namespace pons
@@ -0,0 +1,557 @@
+#include "meshlets.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <tuple>
+
+#include "common.h"
+#include "dispatch.h"
+
+namespace pons {
+
+namespace {
+
+const uint8_t NO_LOCAL_VERTEX = 0xff;
+const uint32_t NO_TRIANGLE = ~0u;
+// normal cones reaching this close to a right angle would hardly ever cull, they are made to never cull instead
+const float CONE_MIN_DOT = 0.1f;
+
+const uint32_t BUFFER_BINDING_COUNT = 7;
+// bindings of the meshlet descriptor set, must match shaders/meshlet.glsl
+const uint32_t INSTANCES_BINDING = 0;
+const uint32_t MESHLETS_BINDING = 1;
+const uint32_t DRAWS_BINDING = 2;
+const uint32_t COUNT_BINDING = 3;
+const uint32_t MESHLET_VERTICES_BINDING = 4;
+const uint32_t MESHLET_INDICES_BINDING = 5;
+const uint32_t VERTICES_BINDING = 6;
+
+// std430 layouts of shaders/meshlet.glsl
+struct GpuMeshlet {
+    alignas(16) glm::vec4 sphere; // xyz - center, w - radius
+    alignas(16) glm::vec4 cone;   // xyz - axis, w - cutoff
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    uint32_t vertexOffset;
+    uint32_t vertexCount;
+    uint32_t triangleOffset;
+    uint32_t triangleCount;
+};
+static_assert(sizeof(GpuMeshlet) == 64);
+
+struct GpuInstance {
+    alignas(16) glm::mat4 model;
+    uint32_t firstMeshlet;
+    uint32_t meshletCount;
+};
+static_assert(sizeof(GpuInstance) == 80);
+
+uint32_t groupCount(uint32_t invocations, uint32_t groupSize) {
+    return (invocations + groupSize - 1) / groupSize;
+}
+
+// Ritter's sphere, within a few percent of the minimal one for meshlet sized point sets.
+void computeSphere(Meshlet &meshlet, std::span<const glm::vec3> positions, const uint32_t *pVertices) {
+    auto farthestFrom = [&](glm::vec3 point) {
+        glm::vec3 farthest = point;
+        float farthestDistance = -1.0f;
+        for (uint32_t i = 0; i < meshlet.vertexCount; ++i) {
+            glm::vec3 candidate = positions[pVertices[i]];
+            float distance = glm::dot(candidate - point, candidate - point);
+            if (distance > farthestDistance) {
+                farthest = candidate;
+                farthestDistance = distance;
+            }
+        }
+        return farthest;
+    };
+    glm::vec3 a = farthestFrom(positions[pVertices[0]]);
+    glm::vec3 b = farthestFrom(a);
+    glm::vec3 center = (a + b) * 0.5f;
+    float radius = glm::length(b - a) * 0.5f;
+    for (uint32_t i = 0; i < meshlet.vertexCount; ++i) {
+        glm::vec3 point = positions[pVertices[i]];
+        float distance = glm::length(point - center);
+        if (distance > radius) {
+            // move the far side of the sphere just enough to take the point in
+            float grownRadius = (radius + distance) * 0.5f;
+            center += (point - center) * ((grownRadius - radius) / distance);
+            radius = grownRadius;
+        }
+    }
+    meshlet.center = center;
+    meshlet.radius = radius;
+}
+
+void computeCone(Meshlet &meshlet, std::span<const glm::vec3> positions, const uint32_t *pIndices) {
+    std::array<glm::vec3, MESHLET_MAX_TRIANGLES> normals;
+    uint32_t normalCount = 0;
+    glm::vec3 axis{0.0f};
+    for (uint32_t i = 0; i < meshlet.triangleCount; ++i) {
+        glm::vec3 a = positions[pIndices[3 * i]];
+        glm::vec3 normal = glm::cross(positions[pIndices[3 * i + 1]] - a, positions[pIndices[3 * i + 2]] - a);
+        float length = glm::length(normal);
+        if (length > 0.0f) {
+            normals[normalCount++] = normal / length;
+            axis += normal / length;
+        }
+    }
+    float axisLength = glm::length(axis);
+    meshlet.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+    meshlet.coneCutoff = 1.0f;
+    if (axisLength <= 0.0f) {
+        return;
+    }
+    axis /= axisLength;
+    float minDot = 1.0f;
+    for (uint32_t i = 0; i < normalCount; ++i) {
+        minDot = std::min(minDot, glm::dot(normals[i], axis));
+    }
+    meshlet.coneAxis = axis;
+    if (minDot > CONE_MIN_DOT) {
+        // view directions within 90 degrees minus the cone's half angle of the axis see every triangle's back
+        meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+    }
+}
+
+} // namespace
+
+MeshletMesh buildMeshlets(std::span<const glm::vec3> positions, std::span<const uint32_t> indices) {
+    size_t vertexCount = positions.size();
+    size_t triangleCount = indices.size() / 3;
+
+    // triangles around every vertex
+    std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+    for (size_t i = 0; i < triangleCount * 3; ++i) {
+        ++adjacencyOffsets.at(indices[i] + 1);
+    }
+    for (size_t i = 0; i < vertexCount; ++i) {
+        adjacencyOffsets[i + 1] += adjacencyOffsets[i];
+    }
+    std::vector<uint32_t> adjacency(triangleCount * 3);
+    std::vector<uint32_t> adjacencyFill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+    for (size_t i = 0; i < triangleCount * 3; ++i) {
+        adjacency[adjacencyFill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+
+    MeshletMesh mesh;
+    std::vector<bool> bEmitted(triangleCount, false);
+    std::vector<uint8_t> localVertex(vertexCount, NO_LOCAL_VERTEX);
+    Meshlet meshlet{};
+    glm::vec3 centroidSum{0.0f};
+    size_t seed = 0;
+
+    auto finishMeshlet = [&] {
+        if (meshlet.triangleCount == 0) {
+            return;
+        }
+        const uint32_t *pVertices = mesh.vertices.data() + meshlet.vertexOffset;
+        computeSphere(meshlet, positions, pVertices);
+        computeCone(meshlet, positions, mesh.indices.data() + 3 * meshlet.triangleOffset);
+        for (uint32_t i = 0; i < meshlet.vertexCount; ++i) {
+            localVertex[pVertices[i]] = NO_LOCAL_VERTEX;
+        }
+        mesh.meshlets.push_back(meshlet);
+        meshlet = Meshlet{};
+        meshlet.vertexOffset = static_cast<uint32_t>(mesh.vertices.size());
+        meshlet.triangleOffset = static_cast<uint32_t>(mesh.indices.size() / 3);
+        centroidSum = glm::vec3(0.0f);
+    };
+
+    while (true) {
+        uint32_t best = NO_TRIANGLE;
+        uint32_t bestNewVertices = std::numeric_limits<uint32_t>::max();
+        float bestDistance = std::numeric_limits<float>::max();
+        glm::vec3 centroid = centroidSum / std::max(static_cast<float>(meshlet.vertexCount), 1.0f);
+        for (uint32_t i = 0; i < meshlet.vertexCount; ++i) {
+            uint32_t vertex = mesh.vertices[meshlet.vertexOffset + i];
+            for (uint32_t a = adjacencyOffsets[vertex]; a < adjacencyOffsets[vertex + 1]; ++a) {
+                uint32_t triangle = adjacency[a];
+                if (bEmitted[triangle]) {
+                    continue;
+                }
+                uint32_t newVertices = 0;
+                glm::vec3 triangleCenter{0.0f};
+                for (uint32_t corner = 0; corner < 3; ++corner) {
+                    uint32_t cornerVertex = indices[3 * triangle + corner];
+                    newVertices += localVertex[cornerVertex] == NO_LOCAL_VERTEX ? 1u : 0u;
+                    triangleCenter += positions[cornerVertex] / 3.0f;
+                }
+                if (meshlet.vertexCount + newVertices > MESHLET_MAX_VERTICES) {
+                    continue;
+                }
+                float distance = glm::dot(triangleCenter - centroid, triangleCenter - centroid);
+                if (newVertices < bestNewVertices || (newVertices == bestNewVertices && distance < bestDistance)) {
+                    best = triangle;
+                    bestNewVertices = newVertices;
+                    bestDistance = distance;
+                }
+            }
+        }
+        if (best == NO_TRIANGLE) {
+            if (meshlet.triangleCount > 0) {
+                // full or cut off from the rest of the mesh
+                finishMeshlet();
+                continue;
+            }
+            while (seed < triangleCount && bEmitted[seed]) {
+                ++seed;
+            }
+            if (seed == triangleCount) {
+                break;
+            }
+            best = static_cast<uint32_t>(seed);
+        }
+
+        bEmitted[best] = true;
+        for (uint32_t corner = 0; corner < 3; ++corner) {
+            uint32_t vertex = indices[3 * best + corner];
+            if (localVertex[vertex] == NO_LOCAL_VERTEX) {
+                localVertex[vertex] = static_cast<uint8_t>(meshlet.vertexCount++);
+                mesh.vertices.push_back(vertex);
+                centroidSum += positions[vertex];
+            }
+            mesh.localIndices.push_back(localVertex[vertex]);
+            mesh.indices.push_back(vertex);
+        }
+        if (++meshlet.triangleCount == MESHLET_MAX_TRIANGLES) {
+            finishMeshlet();
+        }
+    }
+    finishMeshlet();
+    return mesh;
+}
+
+void MeshletRenderer::create(const GpuContext &gpu, PipelineRegistry &pipelines, const std::string &renderPassName,
+                             vk::RenderPass renderPass, vk::SampleCountFlagBits samples,
+                             vk::DescriptorSetLayout frameSetLayout, uint32_t framesInFlight,
+                             std::span<const MeshletSource> sources, vk::Buffer vertexBuffer, Features features) {
+    this->gpu = gpu;
+    pPipelines = &pipelines;
+    bDrawIndirectCount = features.bDrawIndirectCount;
+
+    // meshlets of all sources in one buffer, offsets made global
+    std::vector<GpuMeshlet> gpuMeshlets;
+    std::vector<uint32_t> meshletVertices;
+    std::vector<uint8_t> meshletIndices;
+    for (const MeshletSource &source : sources) {
+        const MeshletMesh &mesh = *source.pMesh;
+        meshFirstMeshlet.push_back(static_cast<uint32_t>(gpuMeshlets.size()));
+        meshMeshletCount.push_back(static_cast<uint32_t>(mesh.meshlets.size()));
+        auto vertexOffset = static_cast<uint32_t>(meshletVertices.size());
+        auto triangleOffset = static_cast<uint32_t>(meshletIndices.size() / 3);
+        for (const Meshlet &meshlet : mesh.meshlets) {
+            gpuMeshlets.push_back(GpuMeshlet{glm::vec4(meshlet.center, meshlet.radius),
+                                             glm::vec4(meshlet.coneAxis, meshlet.coneCutoff),
+                                             source.firstIndex + 3 * meshlet.triangleOffset,
+                                             3 * meshlet.triangleCount,
+                                             vertexOffset + meshlet.vertexOffset,
+                                             meshlet.vertexCount,
+                                             triangleOffset + meshlet.triangleOffset,
+                                             meshlet.triangleCount});
+        }
+        for (uint32_t vertex : mesh.vertices) {
+            meshletVertices.push_back(source.baseVertex + vertex);
+        }
+        meshletIndices.insert(meshletIndices.end(), mesh.localIndices.begin(), mesh.localIndices.end());
+    }
+    if (gpuMeshlets.empty()) {
+        throw std::runtime_error("meshlet renderer needs at least one meshlet");
+    }
+    meshletIndices.resize((meshletIndices.size() + 3) / 4 * 4); // read as 32 bit words
+    std::tie(meshletBuffer, meshletBufferMemory) =
+        createDeviceLocalBuffer(gpu, gpuMeshlets.data(), sizeof(GpuMeshlet) * gpuMeshlets.size(),
+                                vk::BufferUsageFlagBits::eStorageBuffer);
+    std::tie(meshletVertexBuffer, meshletVertexBufferMemory) =
+        createDeviceLocalBuffer(gpu, meshletVertices.data(), sizeof(uint32_t) * meshletVertices.size(),
+                                vk::BufferUsageFlagBits::eStorageBuffer);
+    std::tie(meshletIndexBuffer, meshletIndexBufferMemory) = createDeviceLocalBuffer(
+        gpu, meshletIndices.data(), meshletIndices.size(), vk::BufferUsageFlagBits::eStorageBuffer);
+
+    vk::ShaderStageFlags stages = vk::ShaderStageFlagBits::eCompute | vk::ShaderStageFlagBits::eVertex;
+    if (features.bMeshShader) {
+        stages |= vk::ShaderStageFlagBits::eTaskEXT | vk::ShaderStageFlagBits::eMeshEXT;
+    }
+    std::array<vk::DescriptorSetLayoutBinding, BUFFER_BINDING_COUNT> bindings;
+    for (uint32_t i = 0; i < BUFFER_BINDING_COUNT; ++i) {
+        bindings[i] = vk::DescriptorSetLayoutBinding{i, vk::DescriptorType::eStorageBuffer, /*descriptorCount*/ 1,
+                                                     stages, nullptr};
+    }
+    descriptorSetLayout = gpu.device.createDescriptorSetLayoutUnique({vk::DescriptorSetLayoutCreateFlags{}, bindings});
+    vk::DescriptorPoolSize poolSize{vk::DescriptorType::eStorageBuffer, BUFFER_BINDING_COUNT * framesInFlight};
+    descriptorPool =
+        gpu.device.createDescriptorPoolUnique({vk::DescriptorPoolCreateFlags{}, /*maxSets*/ framesInFlight, poolSize});
+    std::vector<vk::DescriptorSetLayout> setLayouts(framesInFlight, descriptorSetLayout.get());
+    std::vector<vk::DescriptorSet> descriptorSets =
+        gpu.device.allocateDescriptorSets({descriptorPool.get(), setLayouts});
+
+    frames.resize(framesInFlight);
+    for (uint32_t frame = 0; frame < framesInFlight; ++frame) {
+        FrameResources &resources = frames[frame];
+        auto createMapped = [&gpu](vk::DeviceSize size, vk::BufferUsageFlags usage, void *&pMapped) {
+            auto [buffer, memory] =
+                createBuffer(gpu, size, usage,
+                             vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+            if (gpu.device.mapMemory(memory.get(), 0, size, vk::MemoryMapFlags{}, &pMapped) !=
+                vk::Result::eSuccess) {
+                throw std::runtime_error("failed to map memory of meshlet buffer");
+            }
+            return std::make_tuple(std::move(buffer), std::move(memory));
+        };
+        std::tie(resources.instanceBuffer, resources.instanceBufferMemory) =
+            createMapped(sizeof(GpuInstance) * MAX_MESHLET_INSTANCES, vk::BufferUsageFlagBits::eStorageBuffer,
+                         resources.pInstances);
+        std::tie(resources.countBuffer, resources.countBufferMemory) = createMapped(
+            sizeof(uint32_t),
+            vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer |
+                vk::BufferUsageFlagBits::eTransferDst,
+            resources.pCount);
+        std::memset(resources.pCount, 0, sizeof(uint32_t));
+        std::tie(resources.drawBuffer, resources.drawBufferMemory) =
+            createBuffer(gpu, sizeof(vk::DrawIndexedIndirectCommand) * MAX_MESHLET_DRAWS,
+                         vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer |
+                             vk::BufferUsageFlagBits::eTransferDst,
+                         vk::MemoryPropertyFlagBits::eDeviceLocal);
+        resources.descriptorSet = descriptorSets[frame];
+
+        std::array<vk::Buffer, BUFFER_BINDING_COUNT> buffers;
+        buffers[INSTANCES_BINDING] = resources.instanceBuffer.get();
+        buffers[MESHLETS_BINDING] = meshletBuffer.get();
+        buffers[DRAWS_BINDING] = resources.drawBuffer.get();
+        buffers[COUNT_BINDING] = resources.countBuffer.get();
+        buffers[MESHLET_VERTICES_BINDING] = meshletVertexBuffer.get();
+        buffers[MESHLET_INDICES_BINDING] = meshletIndexBuffer.get();
+        buffers[VERTICES_BINDING] = vertexBuffer;
+        std::array<vk::DescriptorBufferInfo, BUFFER_BINDING_COUNT> bufferInfos;
+        std::array<vk::WriteDescriptorSet, BUFFER_BINDING_COUNT> descriptorWrites;
+        for (uint32_t i = 0; i < BUFFER_BINDING_COUNT; ++i) {
+            bufferInfos[i] = vk::DescriptorBufferInfo{buffers[i], /*offset*/ 0, VK_WHOLE_SIZE};
+            descriptorWrites[i] = vk::WriteDescriptorSet{
+                resources.descriptorSet, /*dstBinding*/ i, /*dstArrayElement*/ 0, /*descriptorCount*/ 1,
+                vk::DescriptorType::eStorageBuffer, nullptr, &bufferInfos[i], nullptr};
+        }
+        gpu.device.updateDescriptorSets(descriptorWrites, nullptr);
+    }
+
+    // the meshlet set is set 1 everywhere, set 0 is the frame set of the scene
+    std::array<vk::DescriptorSetLayout, 2> layouts{frameSetLayout, descriptorSetLayout.get()};
+    vk::PushConstantRange cullPushConstants{vk::ShaderStageFlagBits::eCompute, MeshletCullParams::OFFSET,
+                                            sizeof(MeshletCullParams)};
+    cullPipelineLayout = gpu.device.createPipelineLayoutUnique(
+        vk::PipelineLayoutCreateInfo{vk::PipelineLayoutCreateFlags{}, layouts, cullPushConstants});
+    vk::PushConstantRange lightingPushConstants = ClusteredLighting::getPushConstantRange();
+    drawPipelineLayout = gpu.device.createPipelineLayoutUnique(
+        vk::PipelineLayoutCreateInfo{vk::PipelineLayoutCreateFlags{}, layouts, lightingPushConstants});
+
+    vk::UniqueShaderModule cullShader = createShaderModule(gpu.device, readShader("meshlet_cull.spv"));
+    vk::PipelineShaderStageCreateInfo cullStage{vk::PipelineShaderStageCreateFlags{},
+                                                vk::ShaderStageFlagBits::eCompute, cullShader.get(), "main"};
+    vk::ComputePipelineCreateInfo cullPipelineInfo{vk::PipelineCreateFlags{}, cullStage, cullPipelineLayout.get()};
+    cullPipeline = gpu.device.createComputePipelineUnique(nullptr, cullPipelineInfo).value;
+
+    // same vertex format and shading as the scene, the model matrix comes from the instance of the draw
+    pipelines.addPipelineLayout("meshlets", drawPipelineLayout.get());
+    PipelineKey key{.vertexShader = "meshlet_vert.spv",
+                    .fragmentShader = "frag.spv",
+                    .vertexLayout = "mesh",
+                    .pipelineLayout = "meshlets",
+                    .renderPass = renderPassName};
+    PipelineKey fallbackKey = key;
+    fallbackKey.fragmentShader = "fallback_frag.spv";
+    drawPipeline = pipelines.request(key, pipelines.compile(fallbackKey));
+
+    if (features.bMeshShader) {
+        std::array<vk::PushConstantRange, 2> meshPushConstants{
+            lightingPushConstants,
+            vk::PushConstantRange{vk::ShaderStageFlagBits::eTaskEXT | vk::ShaderStageFlagBits::eMeshEXT,
+                                  MeshletCullParams::OFFSET, sizeof(MeshletCullParams)}};
+        meshPipelineLayout = gpu.device.createPipelineLayoutUnique(
+            vk::PipelineLayoutCreateInfo{vk::PipelineLayoutCreateFlags{}, layouts, meshPushConstants});
+        createMeshPipeline(renderPass, samples);
+        bUseMeshShader = true;
+    }
+}
+
+void MeshletRenderer::setVertexBuffer(vk::Buffer vertexBuffer) {
+    for (const FrameResources &resources : frames) {
+        vk::DescriptorBufferInfo bufferInfo{vertexBuffer, /*offset*/ 0, VK_WHOLE_SIZE};
+        vk::WriteDescriptorSet descriptorWrite{resources.descriptorSet,
+                                               /*dstBinding*/ VERTICES_BINDING,
+                                               /*dstArrayElement*/ 0,
+                                               /*descriptorCount*/ 1,
+                                               vk::DescriptorType::eStorageBuffer,
+                                               nullptr,
+                                               &bufferInfo,
+                                               nullptr};
+        gpu.device.updateDescriptorSets(descriptorWrite, nullptr);
+    }
+}
+
+void MeshletRenderer::createMeshPipeline(vk::RenderPass renderPass, vk::SampleCountFlagBits samples) {
+    vk::UniqueShaderModule taskShader = createShaderModule(gpu.device, readShader("meshlet_task.spv"));
+    vk::UniqueShaderModule meshShader = createShaderModule(gpu.device, readShader("meshlet_mesh.spv"));
+    vk::UniqueShaderModule fragmentShader = createShaderModule(gpu.device, readShader("frag.spv"));
+    // mesh shaders fetch Vertex as floats
+    std::array<uint32_t, 2> vertexLayout{static_cast<uint32_t>(sizeof(Vertex) / sizeof(float)),
+                                         static_cast<uint32_t>(offsetof(Vertex, color) / sizeof(float))};
+    std::array<vk::SpecializationMapEntry, 2> vertexLayoutEntries{
+        {{/*constantID*/ 0, /*offset*/ 0, sizeof(uint32_t)}, {/*constantID*/ 1, sizeof(uint32_t), sizeof(uint32_t)}}};
+    vk::SpecializationInfo meshSpecialization{static_cast<uint32_t>(vertexLayoutEntries.size()),
+                                              vertexLayoutEntries.data(), sizeof(vertexLayout), vertexLayout.data()};
+    std::array<vk::PipelineShaderStageCreateInfo, 3> stages{
+        {{vk::PipelineShaderStageCreateFlags{}, vk::ShaderStageFlagBits::eTaskEXT, taskShader.get(), "main"},
+         {vk::PipelineShaderStageCreateFlags{}, vk::ShaderStageFlagBits::eMeshEXT, meshShader.get(), "main",
+          &meshSpecialization},
+         {vk::PipelineShaderStageCreateFlags{}, vk::ShaderStageFlagBits::eFragment, fragmentShader.get(), "main"}}};
+    // fixed function state matches the scene pipelines of the registry
+    vk::PipelineViewportStateCreateInfo viewport{vk::PipelineViewportStateCreateFlags{}, 1, nullptr, 1, nullptr};
+    vk::PipelineRasterizationStateCreateInfo rasterization{vk::PipelineRasterizationStateCreateFlags{},
+                                                           /*depthClamp*/ false,
+                                                           /*rasterizeDiscard*/ false,
+                                                           vk::PolygonMode::eFill,
+                                                           vk::CullModeFlagBits::eBack,
+                                                           vk::FrontFace::eCounterClockwise,
+                                                           /*depthBias*/ false,
+                                                           /*depthBiasConstantFactor*/ 0.0f,
+                                                           /*depthBiasClamp*/ 0.0f,
+                                                           /*depthBiasSlopeFactor*/ 0.0f,
+                                                           /*lineWidth*/ 1.0f};
+    vk::PipelineMultisampleStateCreateInfo multisample{vk::PipelineMultisampleStateCreateFlags{}, samples};
+    vk::PipelineDepthStencilStateCreateInfo depthStencil{};
+    vk::PipelineColorBlendAttachmentState blendAttachment{};
+    blendAttachment.colorWriteMask = vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
+                                     vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
+    vk::PipelineColorBlendStateCreateInfo colorBlend{vk::PipelineColorBlendStateCreateFlags{},
+                                                     /*logicOpEnable*/ false, vk::LogicOp::eCopy, blendAttachment};
+    std::array<vk::DynamicState, 2> dynamicStates{vk::DynamicState::eViewport, vk::DynamicState::eScissor};
+    vk::PipelineDynamicStateCreateInfo dynamicState{vk::PipelineDynamicStateCreateFlags{}, dynamicStates};
+
+    vk::GraphicsPipelineCreateInfo pipelineInfo{};
+    pipelineInfo.setStages(stages);
+    pipelineInfo.pViewportState = &viewport;
+    pipelineInfo.pRasterizationState = &rasterization;
+    pipelineInfo.pMultisampleState = &multisample;
+    pipelineInfo.pDepthStencilState = &depthStencil;
+    pipelineInfo.pColorBlendState = &colorBlend;
+    pipelineInfo.pDynamicState = &dynamicState;
+    pipelineInfo.layout = meshPipelineLayout.get();
+    pipelineInfo.renderPass = renderPass;
+    meshPipeline = gpu.device.createGraphicsPipelineUnique(nullptr, pipelineInfo).value;
+}
+
+void MeshletRenderer::recordCulling(vk::CommandBuffer commandBuffer, uint32_t frame,
+                                    std::span<const MeshletInstance> instances, const glm::mat4 &viewProj,
+                                    glm::vec3 cameraPosition) {
+    FrameResources &resources = frames.at(frame);
+    auto instanceCount = static_cast<uint32_t>(std::min<size_t>(instances.size(), MAX_MESHLET_INSTANCES));
+    auto *pInstances = static_cast<GpuInstance *>(resources.pInstances);
+    resources.maxMeshletCount = 0;
+    resources.testedCount = 0;
+    for (uint32_t i = 0; i < instanceCount; ++i) {
+        uint32_t mesh = instances[i].mesh;
+        pInstances[i] = GpuInstance{instances[i].transform, meshFirstMeshlet.at(mesh), meshMeshletCount.at(mesh)};
+        resources.maxMeshletCount = std::max(resources.maxMeshletCount, meshMeshletCount[mesh]);
+        resources.testedCount += meshMeshletCount[mesh];
+    }
+    resources.params = MeshletCullParams{viewProj, glm::vec4(cameraPosition, 1.0f), instanceCount,
+                                         std::min(resources.testedCount, MAX_MESHLET_DRAWS)};
+
+    // draws of this frame's previous submission are done, its fence was waited on
+    commandBuffer.fillBuffer(resources.countBuffer.get(), 0, sizeof(uint32_t), 0);
+    if (!bDrawIndirectCount && resources.params.maxDraws > 0) {
+        // without a gpu side count culled slots have to be empty draws
+        commandBuffer.fillBuffer(resources.drawBuffer.get(), 0,
+                                 sizeof(vk::DrawIndexedIndirectCommand) * resources.params.maxDraws, 0);
+    }
+    vk::PipelineStageFlags cullStage =
+        bUseMeshShader ? vk::PipelineStageFlagBits::eTaskShaderEXT : vk::PipelineStageFlagBits::eComputeShader;
+    vk::MemoryBarrier clearBarrier{vk::AccessFlagBits::eTransferWrite,
+                                   vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite};
+    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, cullStage, vk::DependencyFlags{},
+                                  clearBarrier, nullptr, nullptr);
+    if (bUseMeshShader || instanceCount == 0) {
+        // task shaders cull while drawing
+        return;
+    }
+
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, cullPipeline.get());
+    commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, cullPipelineLayout.get(), /*firstSet*/ 1,
+                                     resources.descriptorSet, nullptr);
+    commandBuffer.pushConstants(cullPipelineLayout.get(), vk::ShaderStageFlagBits::eCompute,
+                                MeshletCullParams::OFFSET, sizeof(MeshletCullParams), &resources.params);
+    commandBuffer.dispatch(groupCount(resources.maxMeshletCount, MESHLET_CULL_GROUP_SIZE), instanceCount, 1);
+
+    vk::MemoryBarrier drawBarrier{vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eIndirectCommandRead};
+    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eDrawIndirect,
+                                  vk::DependencyFlags{}, drawBarrier, nullptr, nullptr);
+}
+
+void MeshletRenderer::recordDraw(vk::CommandBuffer commandBuffer, uint32_t frame, vk::DescriptorSet frameSet,
+                                 const ClusterParams &lightingParams, vk::Buffer vertexBuffer, vk::Buffer indexBuffer,
+                                 vk::IndexType indexType) const {
+    const FrameResources &resources = frames.at(frame);
+    if (resources.params.instanceCount == 0) {
+        return;
+    }
+    vk::PushConstantRange lightingPushConstants = ClusteredLighting::getPushConstantRange();
+    std::array<vk::DescriptorSet, 2> sets{frameSet, resources.descriptorSet};
+
+    if (bUseMeshShader) {
+        commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, meshPipeline.get());
+        commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, meshPipelineLayout.get(), 0, sets,
+                                         nullptr);
+        commandBuffer.pushConstants(meshPipelineLayout.get(), lightingPushConstants.stageFlags, 0,
+                                    sizeof(lightingParams), &lightingParams);
+        commandBuffer.pushConstants(meshPipelineLayout.get(),
+                                    vk::ShaderStageFlagBits::eTaskEXT | vk::ShaderStageFlagBits::eMeshEXT,
+                                    MeshletCullParams::OFFSET, sizeof(MeshletCullParams), &resources.params);
+        // one task workgroup per MESHLET_TASK_GROUP_SIZE meshlets of an instance
+        commandBuffer.drawMeshTasksEXT(groupCount(resources.maxMeshletCount, MESHLET_TASK_GROUP_SIZE),
+                                       resources.params.instanceCount, 1, dispatcher());
+        return;
+    }
+
+    vk::Pipeline pipeline = pPipelines->get(drawPipeline);
+    if (!pipeline) {
+        return;
+    }
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+    commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, drawPipelineLayout.get(), 0, sets, nullptr);
+    commandBuffer.pushConstants(drawPipelineLayout.get(), lightingPushConstants.stageFlags, 0, sizeof(lightingParams),
+                                &lightingParams);
+    vk::DeviceSize offset = 0;
+    commandBuffer.bindVertexBuffers(0, vertexBuffer, offset);
+    commandBuffer.bindIndexBuffer(indexBuffer, 0, indexType);
+    // the instance index of every draw is its firstInstance, the vertex shader picks the transform with it
+    if (bDrawIndirectCount) {
+        commandBuffer.drawIndexedIndirectCountKHR(resources.drawBuffer.get(), 0, resources.countBuffer.get(), 0,
+                                                  resources.params.maxDraws, sizeof(vk::DrawIndexedIndirectCommand),
+                                                  dispatcher());
+    } else {
+        commandBuffer.drawIndexedIndirect(resources.drawBuffer.get(), 0, resources.params.maxDraws,
+                                          sizeof(vk::DrawIndexedIndirectCommand));
+    }
+}
+
+void MeshletRenderer::recordReadback(vk::CommandBuffer commandBuffer) const {
+    vk::PipelineStageFlags cullStages = vk::PipelineStageFlagBits::eComputeShader;
+    if (hasMeshShader()) {
+        cullStages |= vk::PipelineStageFlagBits::eTaskShaderEXT;
+    }
+    vk::MemoryBarrier barrier{vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eHostRead};
+    commandBuffer.pipelineBarrier(cullStages, vk::PipelineStageFlagBits::eHost, vk::DependencyFlags{}, barrier,
+                                  nullptr, nullptr);
+}
+
+uint32_t MeshletRenderer::readDrawnCount(uint32_t frame) const {
+    const FrameResources &resources = frames.at(frame);
+    // the gpu counts survivors past the draw buffer too
+    return std::min(*static_cast<const uint32_t *>(resources.pCount), resources.params.maxDraws);
+}
+
+} // namespace pons
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "gpu.h"
+#include "lighting.h"
+#include "pipeline_registry.h"
+
+namespace pons {
+
+// Must match shaders/meshlet.glsl
+const uint32_t MESHLET_MAX_VERTICES = 64;
+const uint32_t MESHLET_MAX_TRIANGLES = 124;
+const uint32_t MESHLET_CULL_GROUP_SIZE = 64;
+const uint32_t MESHLET_TASK_GROUP_SIZE = 32;
+const uint32_t MAX_MESHLET_INSTANCES = 256;
+const uint32_t MAX_MESHLET_DRAWS = 16384; // surviving meshlets per frame, the rest is dropped
+
+struct Meshlet {
+    glm::vec3 center; // bounding sphere
+    float radius;
+    glm::vec3 coneAxis; // average facing of the triangles
+    float coneCutoff;   // sine of the cone's half angle, 1 for cones too wide to ever face away
+    uint32_t vertexOffset;
+    uint32_t vertexCount;
+    uint32_t triangleOffset;
+    uint32_t triangleCount;
+};
+
+// Mesh split into clusters of spatially close triangles, both in the mesh shader friendly form of a local vertex
+// list plus byte indices and as plain triangles grouped by meshlet for index buffer draws.
+struct MeshletMesh {
+    std::vector<Meshlet> meshlets;
+    std::vector<uint32_t> vertices;    // mesh vertex of every meshlet local vertex
+    std::vector<uint8_t> localIndices; // 3 per triangle, into the meshlet's vertices
+    std::vector<uint32_t> indices;     // the mesh's triangles reordered meshlet by meshlet
+};
+
+// Greedily grows each meshlet with the adjacent triangle adding the fewest new vertices, ties go to the one closest
+// to the meshlet's centroid. Meant for import time, linear in the triangle count with a small constant.
+MeshletMesh buildMeshlets(std::span<const glm::vec3> positions, std::span<const uint32_t> indices);
+
+// Where a meshlet mesh was placed in the shared vertex and index buffers. Its indices are stored from `firstIndex`
+// on with `baseVertex` already added, like every other mesh there.
+struct MeshletSource {
+    const MeshletMesh *pMesh;
+    uint32_t firstIndex;
+    uint32_t baseVertex;
+};
+
+const uint32_t NO_MESHLET_MESH = ~0u;
+
+struct MeshletInstance {
+    glm::mat4 transform; // rotation, translation and uniform scale, cones don't survive shearing
+    uint32_t mesh;       // index into the sources given to create
+};
+
+// Push constants of culling, after the lighting push constants like ObjectPushConstants
+struct MeshletCullParams {
+    static constexpr uint32_t OFFSET = 32;
+
+    alignas(16) glm::mat4 viewProj;
+    alignas(16) glm::vec4 cameraPosition;
+    uint32_t instanceCount;
+    uint32_t maxDraws;
+};
+
+// Draws large meshes cluster by cluster. A compute pass tests every meshlet of every instance against the frustum
+// and its normal cone and appends survivors as indexed indirect draws, the count goes to the gpu through
+// VK_KHR_draw_indirect_count when available, otherwise unused draws are left zeroed. With VK_EXT_mesh_shader task
+// shaders do the same tests and mesh shaders emit the surviving meshlets directly.
+class MeshletRenderer {
+public:
+    struct Features {
+        bool bDrawIndirectCount = false;
+        bool bMeshShader = false;
+    };
+
+    // Registers its layouts with `pipelines` and requests the indirect pipeline for `renderPassName`. The mesh
+    // shader pipeline is built right away for `renderPass`. The vertex buffer is read as storage by mesh shaders.
+    void create(const GpuContext &gpu, PipelineRegistry &pipelines, const std::string &renderPassName,
+                vk::RenderPass renderPass, vk::SampleCountFlagBits samples, vk::DescriptorSetLayout frameSetLayout,
+                uint32_t framesInFlight, std::span<const MeshletSource> sources, vk::Buffer vertexBuffer,
+                Features features);
+
+    // Points the mesh shaders at a vertex buffer that replaced the one given to create, no frame may be in flight.
+    void setVertexBuffer(vk::Buffer vertexBuffer);
+
+    bool hasMeshShader() const { return static_cast<bool>(meshPipeline); }
+    void setUseMeshShader(bool bUse) { bUseMeshShader = bUse && hasMeshShader(); }
+    bool usesMeshShader() const { return bUseMeshShader; }
+
+    // Uploads the instances and records culling, must be called outside of render pass. Instances past
+    // MAX_MESHLET_INSTANCES are dropped.
+    void recordCulling(vk::CommandBuffer commandBuffer, uint32_t frame, std::span<const MeshletInstance> instances,
+                       const glm::mat4 &viewProj, glm::vec3 cameraPosition);
+    // Draws what culling of `frame` kept, within the render pass given to create with viewport and scissor set.
+    // Skipped while the indirect pipeline is still compiling.
+    void recordDraw(vk::CommandBuffer commandBuffer, uint32_t frame, vk::DescriptorSet frameSet,
+                    const ClusterParams &lightingParams, vk::Buffer vertexBuffer, vk::Buffer indexBuffer,
+                    vk::IndexType indexType) const;
+    // Makes the drawn count visible to readDrawnCount, call after the render pass.
+    void recordReadback(vk::CommandBuffer commandBuffer) const;
+
+    // Meshlets drawn and tested by the last submission of `frame`, call after waiting for its fence.
+    uint32_t readDrawnCount(uint32_t frame) const;
+    uint32_t getTestedCount(uint32_t frame) const { return frames.at(frame).testedCount; }
+
+private:
+    struct FrameResources {
+        vk::UniqueBuffer instanceBuffer;
+        TrackedMemory instanceBufferMemory;
+        void *pInstances = nullptr;
+        vk::UniqueBuffer drawBuffer;
+        TrackedMemory drawBufferMemory;
+        vk::UniqueBuffer countBuffer; // host visible, read back for stats
+        TrackedMemory countBufferMemory;
+        void *pCount = nullptr;
+        vk::DescriptorSet descriptorSet; // freed with descriptorPool
+        MeshletCullParams params{};
+        uint32_t maxMeshletCount = 0; // of one instance, sizes the dispatch
+        uint32_t testedCount = 0;
+    };
+
+    void createMeshPipeline(vk::RenderPass renderPass, vk::SampleCountFlagBits samples);
+
+    GpuContext gpu;
+    PipelineRegistry *pPipelines = nullptr;
+    PipelineHandle drawPipeline = INVALID_PIPELINE;
+    bool bDrawIndirectCount = false;
+    bool bUseMeshShader = false;
+    std::vector<uint32_t> meshFirstMeshlet;
+    std::vector<uint32_t> meshMeshletCount;
+
+    vk::UniqueBuffer meshletBuffer;
+    TrackedMemory meshletBufferMemory;
+    vk::UniqueBuffer meshletVertexBuffer;
+    TrackedMemory meshletVertexBufferMemory;
+    vk::UniqueBuffer meshletIndexBuffer; // local indices packed four to a word
+    TrackedMemory meshletIndexBufferMemory;
+    std::vector<FrameResources> frames;
+
+    vk::UniqueDescriptorSetLayout descriptorSetLayout;
+    vk::UniqueDescriptorPool descriptorPool;
+    vk::UniquePipelineLayout cullPipelineLayout;
+    vk::UniquePipelineLayout drawPipelineLayout;
+    vk::UniquePipeline cullPipeline;
+    vk::UniquePipelineLayout meshPipelineLayout;
+    vk::UniquePipeline meshPipeline;
+};
+
+} // namespace pons
@@ -0,0 +1,205 @@
+#include "particles.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <tuple>
+
+namespace pons {
+
+namespace {
+
+// Must match shaders/particle.glsl
+const uint32_t SORT_BLOCKS = 0;
+const uint32_t SORT_MERGE_GLOBAL = 1;
+const uint32_t SORT_MERGE_BLOCKS = 2;
+
+// byte offsets in the argument buffer
+const vk::DeviceSize SIMULATE_ARGS_OFFSET = 0;
+const vk::DeviceSize DRAW_ARGS_OFFSET = 4 * sizeof(uint32_t);
+const vk::DeviceSize SORT_ARGS_OFFSET = 8 * sizeof(uint32_t);
+const vk::DeviceSize SORT_ARGS_STRIDE = 3 * sizeof(uint32_t);
+
+const uint32_t BUFFER_BINDING_COUNT = 6;
+const float PARTICLE_MAX_STEP = 0.05f; // seconds, longer frames slow the simulation down instead of exploding it
+
+uint32_t groupCount(uint32_t invocations, uint32_t groupSize) {
+    return (invocations + groupSize - 1) / groupSize;
+}
+
+} // namespace
+
+void ParticleSystem::create(const GpuContext &gpu, PipelineRegistry &pipelines, const std::string &renderPass) {
+    this->gpu = gpu;
+    pPipelines = &pipelines;
+
+    auto createStorage = [&gpu](vk::DeviceSize size, vk::BufferUsageFlags usage) {
+        return createBuffer(gpu, size, vk::BufferUsageFlagBits::eStorageBuffer | usage,
+                            vk::MemoryPropertyFlagBits::eDeviceLocal);
+    };
+    std::tie(particleBuffer, particleBufferMemory) = createStorage(sizeof(Particle) * MAX_PARTICLES, {});
+    std::tie(deadListBuffer, deadListBufferMemory) = createStorage(sizeof(uint32_t) * MAX_PARTICLES, {});
+    std::tie(aliveListBuffer, aliveListBufferMemory) = createStorage(2 * sizeof(uint32_t) * MAX_PARTICLES, {});
+    std::tie(sortBuffer, sortBufferMemory) = createStorage(sizeof(glm::uvec2) * MAX_PARTICLES, {});
+    std::tie(counterBuffer, counterBufferMemory) = createStorage(4 * sizeof(uint32_t), {});
+    vk::DeviceSize argumentBufferSize = SORT_ARGS_OFFSET + SORT_ARGS_STRIDE * PARTICLE_SORT_LEVELS;
+    std::tie(argumentBuffer, argumentBufferMemory) =
+        createStorage(argumentBufferSize, vk::BufferUsageFlagBits::eIndirectBuffer);
+
+    std::array<vk::DescriptorSetLayoutBinding, BUFFER_BINDING_COUNT> bindings;
+    for (uint32_t i = 0; i < BUFFER_BINDING_COUNT; ++i) {
+        bindings[i] = vk::DescriptorSetLayoutBinding{i, vk::DescriptorType::eStorageBuffer, /*descriptorCount*/ 1,
+                                                     vk::ShaderStageFlagBits::eCompute |
+                                                         vk::ShaderStageFlagBits::eVertex,
+                                                     nullptr};
+    }
+    descriptorSetLayout = gpu.device.createDescriptorSetLayoutUnique({vk::DescriptorSetLayoutCreateFlags{}, bindings});
+    vk::DescriptorPoolSize poolSize{vk::DescriptorType::eStorageBuffer, BUFFER_BINDING_COUNT};
+    descriptorPool = gpu.device.createDescriptorPoolUnique({vk::DescriptorPoolCreateFlags{}, /*maxSets*/ 1, poolSize});
+    vk::DescriptorSetLayout setLayout = descriptorSetLayout.get();
+    descriptorSet = gpu.device.allocateDescriptorSets({descriptorPool.get(), setLayout}).front();
+
+    std::array<vk::Buffer, BUFFER_BINDING_COUNT> buffers{particleBuffer.get(), deadListBuffer.get(),
+                                                         aliveListBuffer.get(), sortBuffer.get(),
+                                                         counterBuffer.get(),  argumentBuffer.get()};
+    std::array<vk::DescriptorBufferInfo, BUFFER_BINDING_COUNT> bufferInfos;
+    std::array<vk::WriteDescriptorSet, BUFFER_BINDING_COUNT> descriptorWrites;
+    for (uint32_t i = 0; i < BUFFER_BINDING_COUNT; ++i) {
+        bufferInfos[i] = vk::DescriptorBufferInfo{buffers[i], /*offset*/ 0, VK_WHOLE_SIZE};
+        descriptorWrites[i] = vk::WriteDescriptorSet{descriptorSet, /*dstBinding*/ i,     /*dstArrayElement*/ 0,
+                                                     /*descriptorCount*/ 1, vk::DescriptorType::eStorageBuffer,
+                                                     nullptr,           &bufferInfos[i], nullptr};
+    }
+    gpu.device.updateDescriptorSets(descriptorWrites, nullptr);
+
+    vk::PushConstantRange computePushConstants{vk::ShaderStageFlagBits::eCompute, /*offset*/ 0,
+                                               sizeof(ParticleParams)};
+    computePipelineLayout = gpu.device.createPipelineLayoutUnique(
+        vk::PipelineLayoutCreateInfo{vk::PipelineLayoutCreateFlags{}, setLayout, computePushConstants});
+    vk::PushConstantRange drawPushConstants{vk::ShaderStageFlagBits::eVertex, /*offset*/ 0,
+                                            sizeof(ParticleDrawParams)};
+    drawPipelineLayout = gpu.device.createPipelineLayoutUnique(
+        vk::PipelineLayoutCreateInfo{vk::PipelineLayoutCreateFlags{}, setLayout, drawPushConstants});
+
+    createComputePipeline("particle_reset.spv", resetPipeline);
+    createComputePipeline("particle_emit.spv", emitPipeline);
+    createComputePipeline("particle_prepare.spv", prepareArgsPipeline);
+    createComputePipeline("particle_simulate.spv", simulatePipeline);
+    createComputePipeline("particle_finalize.spv", finalizeArgsPipeline);
+    createComputePipeline("particle_sort.spv", sortPipeline);
+
+    // billboards are expanded from gl_VertexIndex
+    pipelines.addVertexLayout("particles", VertexLayout{});
+    pipelines.addPipelineLayout("particles", drawPipelineLayout.get());
+    drawPipeline = pipelines.request(PipelineKey{.vertexShader = "particle_vert.spv",
+                                                 .fragmentShader = "particle_frag.spv",
+                                                 .vertexLayout = "particles",
+                                                 .pipelineLayout = "particles",
+                                                 .renderPass = renderPass,
+                                                 .cullMode = vk::CullModeFlagBits::eNone,
+                                                 .blend = BlendMode::Alpha});
+}
+
+void ParticleSystem::createComputePipeline(const char *shader, vk::UniquePipeline &pipeline) {
+    vk::UniqueShaderModule shaderModule = createShaderModule(gpu.device, readShader(shader));
+    vk::PipelineShaderStageCreateInfo stageInfo{vk::PipelineShaderStageCreateFlags{},
+                                                vk::ShaderStageFlagBits::eCompute, shaderModule.get(), "main"};
+    vk::ComputePipelineCreateInfo pipelineInfo{vk::PipelineCreateFlags{}, stageInfo, computePipelineLayout.get()};
+    pipeline = gpu.device.createComputePipelineUnique(nullptr, pipelineInfo).value;
+}
+
+void ParticleSystem::recordComputeBarrier(vk::CommandBuffer commandBuffer, vk::AccessFlags dstAccess,
+                                          vk::PipelineStageFlags dstStages) const {
+    vk::MemoryBarrier barrier{vk::AccessFlagBits::eShaderWrite, dstAccess};
+    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, dstStages, vk::DependencyFlags{},
+                                  barrier, nullptr, nullptr);
+}
+
+void ParticleSystem::recordUpdate(vk::CommandBuffer commandBuffer, float deltaTime, glm::vec3 emitterPosition,
+                                  glm::vec3 cameraPosition) {
+    deltaTime = std::min(deltaTime, PARTICLE_MAX_STEP);
+    const vk::AccessFlags computeAccess = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+    const vk::AccessFlags argumentAccess = computeAccess | vk::AccessFlagBits::eIndirectCommandRead;
+    const vk::PipelineStageFlags argumentStages =
+        vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eDrawIndirect;
+
+    // the previous frame's draw reads the buffers rewritten below
+    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eVertexShader,
+                                  vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags{}, nullptr, nullptr,
+                                  nullptr);
+    commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, computePipelineLayout.get(), 0, descriptorSet,
+                                     nullptr);
+    if (bNeedsReset) {
+        commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, resetPipeline.get());
+        commandBuffer.dispatch(groupCount(MAX_PARTICLES, PARTICLE_GROUP_SIZE), 1, 1);
+        recordComputeBarrier(commandBuffer, computeAccess, vk::PipelineStageFlagBits::eComputeShader);
+        bNeedsReset = false;
+    }
+
+    emitRemainder = std::min(emitRemainder + PARTICLE_EMIT_RATE * deltaTime, static_cast<float>(MAX_PARTICLES));
+    auto emitCount = static_cast<uint32_t>(emitRemainder);
+    emitRemainder -= static_cast<float>(emitCount);
+    ParticleParams params{glm::vec4(emitterPosition, PARTICLE_SPAWN_RADIUS),
+                          glm::vec4(cameraPosition, deltaTime),
+                          emitCount,
+                          seed++ * 0x9e3779b9u,
+                          current,
+                          /*sortMode*/ 0,
+                          /*sortK*/ 0,
+                          /*sortJ*/ 0};
+    commandBuffer.pushConstants(computePipelineLayout.get(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(params),
+                                &params);
+    if (emitCount > 0) {
+        commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, emitPipeline.get());
+        commandBuffer.dispatch(groupCount(emitCount, PARTICLE_GROUP_SIZE), 1, 1);
+        recordComputeBarrier(commandBuffer, computeAccess, vk::PipelineStageFlagBits::eComputeShader);
+    }
+
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, prepareArgsPipeline.get());
+    commandBuffer.dispatch(1, 1, 1);
+    recordComputeBarrier(commandBuffer, argumentAccess, argumentStages);
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, simulatePipeline.get());
+    commandBuffer.dispatchIndirect(argumentBuffer.get(), SIMULATE_ARGS_OFFSET);
+    recordComputeBarrier(commandBuffer, computeAccess, vk::PipelineStageFlagBits::eComputeShader);
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, finalizeArgsPipeline.get());
+    commandBuffer.dispatch(1, 1, 1);
+    recordComputeBarrier(commandBuffer, argumentAccess, argumentStages);
+
+    // every level is recorded, the gpu written arguments give zero workgroups to levels above the alive count
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, sortPipeline.get());
+    auto recordSortPass = [&](uint32_t level, uint32_t mode, uint32_t k, uint32_t j) {
+        std::array<uint32_t, 3> sortParams{mode, k, j};
+        commandBuffer.pushConstants(computePipelineLayout.get(), vk::ShaderStageFlagBits::eCompute,
+                                    offsetof(ParticleParams, sortMode), sizeof(sortParams), sortParams.data());
+        commandBuffer.dispatchIndirect(argumentBuffer.get(), SORT_ARGS_OFFSET + SORT_ARGS_STRIDE * level);
+        recordComputeBarrier(commandBuffer, computeAccess, vk::PipelineStageFlagBits::eComputeShader);
+    };
+    recordSortPass(0, SORT_BLOCKS, PARTICLE_SORT_BLOCK, 0);
+    for (uint32_t level = 1; level < PARTICLE_SORT_LEVELS; ++level) {
+        uint32_t k = PARTICLE_SORT_BLOCK << level;
+        for (uint32_t j = k / 2; j >= PARTICLE_SORT_BLOCK; j /= 2) {
+            recordSortPass(level, SORT_MERGE_GLOBAL, k, j);
+        }
+        recordSortPass(level, SORT_MERGE_BLOCKS, k, 0);
+    }
+    recordComputeBarrier(commandBuffer, vk::AccessFlagBits::eShaderRead, vk::PipelineStageFlagBits::eVertexShader);
+    current = 1 - current;
+}
+
+void ParticleSystem::recordDraw(vk::CommandBuffer commandBuffer, const glm::mat4 &view, const glm::mat4 &proj) const {
+    vk::Pipeline pipeline = pPipelines->get(drawPipeline);
+    if (!pipeline) {
+        return;
+    }
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+    commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, drawPipelineLayout.get(), 0, descriptorSet,
+                                     nullptr);
+    // camera axes in world space are the rows of the view rotation
+    ParticleDrawParams params{proj * view, glm::vec4(view[0][0], view[1][0], view[2][0], 0.0f),
+                              glm::vec4(view[0][1], view[1][1], view[2][1], 0.0f)};
+    commandBuffer.pushConstants(drawPipelineLayout.get(), vk::ShaderStageFlagBits::eVertex, 0, sizeof(params),
+                                &params);
+    commandBuffer.drawIndirect(argumentBuffer.get(), DRAW_ARGS_OFFSET, 1, sizeof(vk::DrawIndirectCommand));
+}
+
+} // namespace pons
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#include "gpu.h"
+#include "pipeline_registry.h"
+
+namespace pons {
+
+// Must match shaders/particle.glsl
+const uint32_t MAX_PARTICLES = 1u << 20;
+const uint32_t PARTICLE_GROUP_SIZE = 256;
+const uint32_t PARTICLE_SORT_BLOCK = 1024; // elements sorted in shared memory by one workgroup
+// indirect sort dispatches, level 0 sorts blocks and level n merges blocks into runs of PARTICLE_SORT_BLOCK << n
+const uint32_t PARTICLE_SORT_LEVELS = 11;
+static_assert(PARTICLE_SORT_BLOCK << (PARTICLE_SORT_LEVELS - 1) == MAX_PARTICLES);
+
+const float PARTICLE_EMIT_RATE = 250000.0f; // per second
+const float PARTICLE_SPAWN_RADIUS = 0.05f;
+
+struct Particle {
+    alignas(16) glm::vec4 positionLife; // xyz - world position, w - remaining life in seconds
+    alignas(16) glm::vec4 velocitySize; // xyz - world velocity, w - billboard size
+    alignas(16) glm::vec4 color;
+};
+
+// Push constants of the compute passes
+struct ParticleParams {
+    alignas(16) glm::vec4 emitterPosition; // w - spawn radius
+    alignas(16) glm::vec4 cameraPosition;  // w - delta time
+    uint32_t emitCount;
+    uint32_t seed;
+    uint32_t current; // alive list simulated this frame
+    uint32_t sortMode;
+    uint32_t sortK;
+    uint32_t sortJ;
+};
+
+// Push constants of the billboard draw
+struct ParticleDrawParams {
+    alignas(16) glm::mat4 viewProj;
+    alignas(16) glm::vec4 cameraRight;
+    alignas(16) glm::vec4 cameraUp;
+};
+
+// Particles live entirely on the gpu. Each frame compute passes pop indices from a dead list to emit, simulate the
+// alive list into the other alive list of a ping-pong pair, write indirect arguments from the resulting counts and
+// bitonic sort alive particles back to front. The cpu only records fixed sequences of dispatches and never reads
+// anything back, dispatches past the alive count get zero workgroups from the gpu written arguments.
+class ParticleSystem {
+public:
+    // Registers its layouts with `pipelines` and requests the billboard pipeline for `renderPass`, a registered name.
+    void create(const GpuContext &gpu, PipelineRegistry &pipelines, const std::string &renderPass);
+
+    // Records emission, simulation and sorting, must be called outside of render pass.
+    void recordUpdate(vk::CommandBuffer commandBuffer, float deltaTime, glm::vec3 emitterPosition,
+                      glm::vec3 cameraPosition);
+    // Draws sorted particles with alpha blending, skipped while the pipeline is still compiling.
+    void recordDraw(vk::CommandBuffer commandBuffer, const glm::mat4 &view, const glm::mat4 &proj) const;
+
+private:
+    void createComputePipeline(const char *shader, vk::UniquePipeline &pipeline);
+    void recordComputeBarrier(vk::CommandBuffer commandBuffer, vk::AccessFlags dstAccess,
+                              vk::PipelineStageFlags dstStages) const;
+
+    GpuContext gpu;
+    PipelineRegistry *pPipelines = nullptr;
+    PipelineHandle drawPipeline = INVALID_PIPELINE;
+    bool bNeedsReset = true;
+    uint32_t current = 0;
+    uint32_t seed = 0;
+    float emitRemainder = 0.0f;
+
+    vk::UniqueBuffer particleBuffer;
+    TrackedMemory particleBufferMemory;
+    vk::UniqueBuffer deadListBuffer;
+    TrackedMemory deadListBufferMemory;
+    vk::UniqueBuffer aliveListBuffer; // both lists of the ping-pong pair
+    TrackedMemory aliveListBufferMemory;
+    vk::UniqueBuffer sortBuffer; // depth key and particle index, in draw order after sorting
+    TrackedMemory sortBufferMemory;
+    vk::UniqueBuffer counterBuffer;
+    TrackedMemory counterBufferMemory;
+    vk::UniqueBuffer argumentBuffer; // indirect dispatch and draw arguments
+    TrackedMemory argumentBufferMemory;
+
+    vk::UniqueDescriptorSetLayout descriptorSetLayout;
+    vk::UniqueDescriptorPool descriptorPool;
+    vk::DescriptorSet descriptorSet; // freed with descriptorPool
+    vk::UniquePipelineLayout computePipelineLayout;
+    vk::UniquePipelineLayout drawPipelineLayout;
+    vk::UniquePipeline resetPipeline;
+    vk::UniquePipeline emitPipeline;
+    vk::UniquePipeline prepareArgsPipeline;
+    vk::UniquePipeline simulatePipeline;
+    vk::UniquePipeline finalizeArgsPipeline;
+    vk::UniquePipeline sortPipeline;
+};
+
+} // namespace pons
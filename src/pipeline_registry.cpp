@@ -0,0 +1,403 @@
+#include "pipeline_registry.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include "archive.h"
+
+namespace pons {
+
+namespace {
+
+// stands for an empty shader name in the recorded key list
+const std::string NO_SHADER = "-";
+
+uint64_t hashCombine(uint64_t hash, uint64_t value) {
+    return (hash ^ value) * FNV_PRIME;
+}
+
+// State blocks of one key kept together, create infos point into them.
+struct PipelineStates {
+    PipelineStates(vk::Device device, const PipelineKey &key, const VertexLayout *pVertexLayout,
+                   uint32_t colorAttachmentCount, vk::SampleCountFlagBits samples, bool bVertexShader,
+                   bool bFragmentShader) {
+        if (bVertexShader) {
+            vertexShader = createShaderModule(device, readShader(key.vertexShader));
+            stages.push_back({vk::PipelineShaderStageCreateFlags{}, vk::ShaderStageFlagBits::eVertex,
+                              vertexShader.get(), "main"});
+        }
+        if (bFragmentShader && !key.fragmentShader.empty()) {
+            fragmentShader = createShaderModule(device, readShader(key.fragmentShader));
+            stages.push_back({vk::PipelineShaderStageCreateFlags{}, vk::ShaderStageFlagBits::eFragment,
+                              fragmentShader.get(), "main"});
+        }
+        if (pVertexLayout) {
+            vertexInput = vk::PipelineVertexInputStateCreateInfo{vk::PipelineVertexInputStateCreateFlags{},
+                                                                 pVertexLayout->bindings, pVertexLayout->attributes};
+        }
+        inputAssembly = vk::PipelineInputAssemblyStateCreateInfo{vk::PipelineInputAssemblyStateCreateFlags{},
+                                                                 key.topology, false};
+        rasterization = vk::PipelineRasterizationStateCreateInfo{vk::PipelineRasterizationStateCreateFlags{},
+                                                                 /*depthClamp*/ false,
+                                                                 /*rasterizeDiscard*/ false,
+                                                                 vk::PolygonMode::eFill,
+                                                                 key.cullMode,
+                                                                 vk::FrontFace::eCounterClockwise,
+                                                                 /*depthBias*/ false,
+                                                                 /*depthBiasConstantFactor*/ 0.0f,
+                                                                 /*depthBiasClamp*/ 0.0f,
+                                                                 /*depthBiasSlopeFactor*/ 0.0f,
+                                                                 /*lineWidth*/ 1.0f};
+        blendAttachment.colorWriteMask = vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
+                                         vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
+        if (key.blend == BlendMode::Alpha) {
+            blendAttachment.blendEnable = true;
+            blendAttachment.srcColorBlendFactor = vk::BlendFactor::eSrcAlpha;
+            blendAttachment.dstColorBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha;
+            blendAttachment.srcAlphaBlendFactor = vk::BlendFactor::eOne;
+            blendAttachment.dstAlphaBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha;
+        }
+        depthStencil = vk::PipelineDepthStencilStateCreateInfo{vk::PipelineDepthStencilStateCreateFlags{},
+                                                               key.bDepthTest, key.bDepthWrite,
+                                                               vk::CompareOp::eLessOrEqual};
+        colorBlend = vk::PipelineColorBlendStateCreateInfo{vk::PipelineColorBlendStateCreateFlags{},
+                                                           /*logicOpEnable*/ false, vk::LogicOp::eCopy,
+                                                           colorAttachmentCount, &blendAttachment};
+        multisample.rasterizationSamples = samples;
+        dynamicState = vk::PipelineDynamicStateCreateInfo{vk::PipelineDynamicStateCreateFlags{}, dynamicStates};
+    }
+    PipelineStates(const PipelineStates &) = delete;
+    PipelineStates &operator=(const PipelineStates &) = delete;
+
+    vk::UniqueShaderModule vertexShader;
+    vk::UniqueShaderModule fragmentShader;
+    std::vector<vk::PipelineShaderStageCreateInfo> stages;
+    vk::PipelineVertexInputStateCreateInfo vertexInput;
+    vk::PipelineInputAssemblyStateCreateInfo inputAssembly;
+    vk::PipelineViewportStateCreateInfo viewport{vk::PipelineViewportStateCreateFlags{}, 1, nullptr, 1, nullptr};
+    vk::PipelineRasterizationStateCreateInfo rasterization;
+    vk::PipelineMultisampleStateCreateInfo multisample;
+    vk::PipelineDepthStencilStateCreateInfo depthStencil;
+    vk::PipelineColorBlendAttachmentState blendAttachment;
+    vk::PipelineColorBlendStateCreateInfo colorBlend;
+    std::array<vk::DynamicState, 2> dynamicStates{vk::DynamicState::eViewport, vk::DynamicState::eScissor};
+    vk::PipelineDynamicStateCreateInfo dynamicState;
+};
+
+} // namespace
+
+uint64_t PipelineKey::hash() const {
+    uint64_t hash = FNV_OFFSET_BASIS;
+    hash = hashCombine(hash, hashName(vertexShader));
+    hash = hashCombine(hash, hashName(fragmentShader));
+    hash = hashCombine(hash, hashName(vertexLayout));
+    hash = hashCombine(hash, hashName(pipelineLayout));
+    hash = hashCombine(hash, hashName(renderPass));
+    hash = hashCombine(hash, static_cast<uint64_t>(topology));
+    hash = hashCombine(hash, static_cast<uint64_t>(cullMode));
+    hash = hashCombine(hash, static_cast<uint64_t>(blend));
+    hash = hashCombine(hash, bDepthTest);
+    return hashCombine(hash, bDepthWrite);
+}
+
+size_t PipelineRegistry::LibraryKeyHash::operator()(const LibraryKey &key) const {
+    return static_cast<size_t>(hashCombine(key.key.hash(), static_cast<uint64_t>(key.part)));
+}
+
+PipelineRegistry::~PipelineRegistry() {
+    waitIdle();
+}
+
+void PipelineRegistry::create(const GpuContext &gpu, ThreadPool &pool, bool bPipelineLibrary) {
+    this->gpu = gpu;
+    pPool = &pool;
+    this->bPipelineLibrary = bPipelineLibrary;
+    pipelineCache = gpu.device.createPipelineCacheUnique(vk::PipelineCacheCreateInfo{});
+}
+
+void PipelineRegistry::addVertexLayout(const std::string &name, VertexLayout layout) {
+    if (!vertexLayouts.emplace(name, std::move(layout)).second) {
+        throw std::runtime_error("vertex layout " + name + " is already registered");
+    }
+}
+
+void PipelineRegistry::addPipelineLayout(const std::string &name, vk::PipelineLayout layout) {
+    if (!pipelineLayouts.emplace(name, layout).second) {
+        throw std::runtime_error("pipeline layout " + name + " is already registered");
+    }
+}
+
+void PipelineRegistry::addRenderPass(const std::string &name, vk::RenderPass renderPass,
+                                     uint32_t colorAttachmentCount, vk::SampleCountFlagBits samples) {
+    if (!renderPasses.emplace(name, RenderPassInfo{renderPass, colorAttachmentCount, samples}).second) {
+        throw std::runtime_error("render pass " + name + " is already registered");
+    }
+}
+
+PipelineRegistry::Resolved PipelineRegistry::resolve(const PipelineKey &key) const {
+    auto vertexLayout = vertexLayouts.find(key.vertexLayout);
+    auto pipelineLayout = pipelineLayouts.find(key.pipelineLayout);
+    auto renderPass = renderPasses.find(key.renderPass);
+    if (vertexLayout == vertexLayouts.end() || pipelineLayout == pipelineLayouts.end() ||
+        renderPass == renderPasses.end()) {
+        throw std::runtime_error("pipeline key refers to unregistered objects");
+    }
+    return Resolved{&vertexLayout->second, pipelineLayout->second, renderPass->second.renderPass,
+                    renderPass->second.colorAttachmentCount, renderPass->second.samples};
+}
+
+PipelineHandle PipelineRegistry::addEntry(const PipelineKey &key, PipelineHandle fallback, bool bBackground) {
+    auto handle = static_cast<PipelineHandle>(entries.size());
+    Entry &entry = entries.emplace_back();
+    entry.key = key;
+    entry.fallback = fallback;
+    entry.bBackground = bBackground;
+    handles.emplace(key, handle);
+    return handle;
+}
+
+PipelineHandle PipelineRegistry::compile(const PipelineKey &key) {
+    if (auto existing = handles.find(key); existing != handles.end()) {
+        return existing->second;
+    }
+    Resolved resolved = resolve(key);
+    PipelineHandle handle = addEntry(key, INVALID_PIPELINE, false);
+    build(entries[handle], resolved);
+    return handle;
+}
+
+PipelineHandle PipelineRegistry::request(const PipelineKey &key, PipelineHandle fallback) {
+    if (auto existing = handles.find(key); existing != handles.end()) {
+        // prewarmed keys are queued before anyone knows their fallback
+        Entry &entry = entries[existing->second];
+        if (entry.fallback == INVALID_PIPELINE) {
+            entry.fallback = fallback;
+        }
+        return existing->second;
+    }
+    Resolved resolved = resolve(key);
+    PipelineHandle handle = addEntry(key, fallback, true);
+    Entry &entry = entries[handle];
+    pendingCount.fetch_add(1);
+    pPool->submit([this, &entry, resolved] {
+        try {
+            build(entry, resolved);
+        } catch (const std::exception &e) {
+            // stays on the fallback
+            std::cerr << "failed to compile pipeline " << entry.key.vertexShader << " " << entry.key.fragmentShader
+                      << ": " << e.what() << std::endl;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pendingCount.fetch_sub(1) == 1) {
+            idle.notify_all();
+        }
+    });
+    return handle;
+}
+
+vk::Pipeline PipelineRegistry::get(PipelineHandle handle) const {
+    const Entry &entry = entries.at(handle);
+    vk::Pipeline pipeline = entry.pipeline.load(std::memory_order_acquire);
+    if (!pipeline && entry.fallback != INVALID_PIPELINE) {
+        pipeline = entries.at(entry.fallback).pipeline.load(std::memory_order_acquire);
+    }
+    return pipeline;
+}
+
+void PipelineRegistry::waitIdle() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this] { return pendingCount.load() == 0; });
+}
+
+void PipelineRegistry::build(Entry &entry, const Resolved &resolved) {
+    if (!bPipelineLibrary) {
+        entry.owned = createComplete(entry.key, resolved);
+        entry.pipeline.store(entry.owned.get(), std::memory_order_release);
+        return;
+    }
+    std::array<vk::Pipeline, 4> parts{getLibrary(LibraryPart::VertexInput, entry.key, resolved),
+                                      getLibrary(LibraryPart::PreRasterization, entry.key, resolved),
+                                      getLibrary(LibraryPart::FragmentShader, entry.key, resolved),
+                                      getLibrary(LibraryPart::FragmentOutput, entry.key, resolved)};
+    // fast link is usable right away, the optimized link replaces it once done
+    entry.owned = link(parts, resolved.pipelineLayout, false);
+    entry.pipeline.store(entry.owned.get(), std::memory_order_release);
+    vk::UniquePipeline optimized = link(parts, resolved.pipelineLayout, true);
+    entry.pipeline.store(optimized.get(), std::memory_order_release);
+    std::lock_guard<std::mutex> lock(mutex);
+    retired.push_back(std::move(entry.owned));
+    entry.owned = std::move(optimized);
+}
+
+vk::UniquePipeline PipelineRegistry::createComplete(const PipelineKey &key, const Resolved &resolved) {
+    PipelineStates states(gpu.device, key, resolved.pVertexLayout, resolved.colorAttachmentCount, resolved.samples,
+                          true, true);
+    vk::GraphicsPipelineCreateInfo pipelineInfo{vk::PipelineCreateFlags{},
+                                                states.stages,
+                                                &states.vertexInput,
+                                                &states.inputAssembly,
+                                                /*pTessellationState*/ nullptr,
+                                                &states.viewport,
+                                                &states.rasterization,
+                                                &states.multisample,
+                                                &states.depthStencil,
+                                                &states.colorBlend,
+                                                &states.dynamicState,
+                                                resolved.pipelineLayout,
+                                                resolved.renderPass,
+                                                /*subpass*/ 0};
+    return gpu.device.createGraphicsPipelineUnique(pipelineCache.get(), pipelineInfo).value;
+}
+
+vk::UniquePipeline PipelineRegistry::createLibrary(LibraryPart part, const PipelineKey &key,
+                                                   const Resolved &resolved) {
+    PipelineStates states(gpu.device, key, resolved.pVertexLayout, resolved.colorAttachmentCount, resolved.samples,
+                          part == LibraryPart::PreRasterization, part == LibraryPart::FragmentShader);
+    vk::GraphicsPipelineLibraryCreateInfoEXT libraryInfo{};
+    vk::GraphicsPipelineCreateInfo pipelineInfo{};
+    pipelineInfo.pNext = &libraryInfo;
+    pipelineInfo.flags =
+        vk::PipelineCreateFlagBits::eLibraryKHR | vk::PipelineCreateFlagBits::eRetainLinkTimeOptimizationInfoEXT;
+    switch (part) {
+    case LibraryPart::VertexInput:
+        libraryInfo.flags = vk::GraphicsPipelineLibraryFlagBitsEXT::eVertexInputInterface;
+        pipelineInfo.pVertexInputState = &states.vertexInput;
+        pipelineInfo.pInputAssemblyState = &states.inputAssembly;
+        break;
+    case LibraryPart::PreRasterization:
+        libraryInfo.flags = vk::GraphicsPipelineLibraryFlagBitsEXT::ePreRasterizationShaders;
+        pipelineInfo.setStages(states.stages);
+        pipelineInfo.pViewportState = &states.viewport;
+        pipelineInfo.pRasterizationState = &states.rasterization;
+        pipelineInfo.pDynamicState = &states.dynamicState;
+        pipelineInfo.layout = resolved.pipelineLayout;
+        pipelineInfo.renderPass = resolved.renderPass;
+        break;
+    case LibraryPart::FragmentShader:
+        libraryInfo.flags = vk::GraphicsPipelineLibraryFlagBitsEXT::eFragmentShader;
+        pipelineInfo.setStages(states.stages);
+        pipelineInfo.pMultisampleState = &states.multisample;
+        pipelineInfo.pDepthStencilState = &states.depthStencil;
+        pipelineInfo.layout = resolved.pipelineLayout;
+        pipelineInfo.renderPass = resolved.renderPass;
+        break;
+    case LibraryPart::FragmentOutput:
+        libraryInfo.flags = vk::GraphicsPipelineLibraryFlagBitsEXT::eFragmentOutputInterface;
+        pipelineInfo.pColorBlendState = &states.colorBlend;
+        pipelineInfo.pMultisampleState = &states.multisample;
+        pipelineInfo.renderPass = resolved.renderPass;
+        break;
+    }
+    return gpu.device.createGraphicsPipelineUnique(pipelineCache.get(), pipelineInfo).value;
+}
+
+vk::Pipeline PipelineRegistry::getLibrary(LibraryPart part, const PipelineKey &key, const Resolved &resolved) {
+    // only the fields the part depends on take part in deduplication
+    LibraryKey libraryKey{part, PipelineKey{}};
+    switch (part) {
+    case LibraryPart::VertexInput:
+        libraryKey.key.vertexLayout = key.vertexLayout;
+        libraryKey.key.topology = key.topology;
+        break;
+    case LibraryPart::PreRasterization:
+        libraryKey.key.vertexShader = key.vertexShader;
+        libraryKey.key.pipelineLayout = key.pipelineLayout;
+        libraryKey.key.renderPass = key.renderPass;
+        libraryKey.key.cullMode = key.cullMode;
+        break;
+    case LibraryPart::FragmentShader:
+        libraryKey.key.fragmentShader = key.fragmentShader;
+        libraryKey.key.pipelineLayout = key.pipelineLayout;
+        libraryKey.key.renderPass = key.renderPass;
+        libraryKey.key.bDepthTest = key.bDepthTest;
+        libraryKey.key.bDepthWrite = key.bDepthWrite;
+        break;
+    case LibraryPart::FragmentOutput:
+        libraryKey.key.renderPass = key.renderPass;
+        libraryKey.key.blend = key.blend;
+        break;
+    }
+
+    // the first job needing a part builds it, others wait on its future
+    std::promise<vk::Pipeline> promise;
+    std::shared_future<vk::Pipeline> library;
+    bool bBuilder = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto [it, bInserted] = libraries.try_emplace(libraryKey);
+        if (bInserted) {
+            it->second = promise.get_future().share();
+            bBuilder = true;
+        }
+        library = it->second;
+    }
+    if (bBuilder) {
+        try {
+            vk::UniquePipeline created = createLibrary(part, key, resolved);
+            vk::Pipeline handle = created.get();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                ownedLibraries.push_back(std::move(created));
+            }
+            promise.set_value(handle);
+        } catch (...) {
+            promise.set_exception(std::current_exception());
+        }
+    }
+    return library.get();
+}
+
+vk::UniquePipeline PipelineRegistry::link(const std::array<vk::Pipeline, 4> &parts, vk::PipelineLayout layout,
+                                          bool bOptimize) {
+    vk::PipelineLibraryCreateInfoKHR libraryInfo{parts};
+    vk::GraphicsPipelineCreateInfo pipelineInfo{};
+    pipelineInfo.pNext = &libraryInfo;
+    if (bOptimize) {
+        pipelineInfo.flags = vk::PipelineCreateFlagBits::eLinkTimeOptimizationEXT;
+    }
+    pipelineInfo.layout = layout;
+    return gpu.device.createGraphicsPipelineUnique(pipelineCache.get(), pipelineInfo).value;
+}
+
+void PipelineRegistry::prewarm(const std::string &path) {
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        PipelineKey key;
+        uint32_t topology, cullMode, blend;
+        if (!(fields >> key.vertexShader >> key.fragmentShader >> key.vertexLayout >> key.pipelineLayout >>
+              key.renderPass >> topology >> cullMode >> blend >> key.bDepthTest >> key.bDepthWrite)) {
+            continue;
+        }
+        if (key.fragmentShader == NO_SHADER) {
+            key.fragmentShader.clear();
+        }
+        key.topology = static_cast<vk::PrimitiveTopology>(topology);
+        key.cullMode = static_cast<vk::CullModeFlagBits>(cullMode);
+        key.blend = static_cast<BlendMode>(blend);
+        if (!vertexLayouts.contains(key.vertexLayout) || !pipelineLayouts.contains(key.pipelineLayout) ||
+            !renderPasses.contains(key.renderPass)) {
+            continue;
+        }
+        request(key);
+    }
+}
+
+void PipelineRegistry::saveKeys(const std::string &path) const {
+    std::ofstream file(path, std::ios::trunc);
+    for (const Entry &entry : entries) {
+        if (!entry.bBackground) {
+            continue;
+        }
+        const PipelineKey &key = entry.key;
+        file << key.vertexShader << ' ' << (key.fragmentShader.empty() ? NO_SHADER : key.fragmentShader) << ' '
+             << key.vertexLayout << ' ' << key.pipelineLayout << ' ' << key.renderPass << ' '
+             << static_cast<uint32_t>(key.topology) << ' ' << static_cast<uint32_t>(key.cullMode) << ' '
+             << static_cast<uint32_t>(key.blend) << ' ' << key.bDepthTest << ' ' << key.bDepthWrite << '\n';
+    }
+}
+
+} // namespace pons
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "gpu.h"
+#include "thread_pool.h"
+
+namespace pons {
+
+enum class BlendMode : uint32_t { Opaque, Alpha };
+
+struct VertexLayout {
+    std::vector<vk::VertexInputBindingDescription> bindings;
+    std::vector<vk::VertexInputAttributeDescription> attributes;
+};
+
+// Everything a graphics pipeline is built from. Shaders are file names for readShader, an empty fragment shader makes
+// a depth only pipeline. Layouts and render passes are the names they were registered under, so keys can be recorded
+// and replayed by the next run. Viewport and scissor are always dynamic.
+struct PipelineKey {
+    std::string vertexShader;
+    std::string fragmentShader;
+    std::string vertexLayout;
+    std::string pipelineLayout;
+    std::string renderPass;
+    vk::PrimitiveTopology topology = vk::PrimitiveTopology::eTriangleList;
+    vk::CullModeFlagBits cullMode = vk::CullModeFlagBits::eBack;
+    BlendMode blend = BlendMode::Opaque;
+    bool bDepthTest = false; // less or equal
+    bool bDepthWrite = false;
+
+    bool operator==(const PipelineKey &) const = default;
+    uint64_t hash() const;
+};
+
+struct PipelineKeyHash {
+    size_t operator()(const PipelineKey &key) const { return static_cast<size_t>(key.hash()); }
+};
+
+using PipelineHandle = uint32_t;
+const PipelineHandle INVALID_PIPELINE = ~0u;
+
+// Deduplicated pipeline storage. Missing pipelines are compiled on the thread pool and drawn with a fallback until
+// they are ready. With VK_EXT_graphics_pipeline_library the four pipeline parts are compiled and cached separately,
+// a new combination is fast linked from cached parts first and replaced by the link time optimized pipeline later.
+// Registration, requests and lookups are meant for the render thread.
+class PipelineRegistry {
+public:
+    PipelineRegistry() = default;
+    ~PipelineRegistry();
+    PipelineRegistry(const PipelineRegistry &) = delete;
+    PipelineRegistry &operator=(const PipelineRegistry &) = delete;
+
+    // `bPipelineLibrary` when VK_EXT_graphics_pipeline_library and its feature are enabled on the device.
+    void create(const GpuContext &gpu, ThreadPool &pool, bool bPipelineLibrary);
+    bool usesPipelineLibrary() const { return bPipelineLibrary; }
+
+    // Registered objects must outlive the registry, names can't be registered twice.
+    void addVertexLayout(const std::string &name, VertexLayout layout);
+    void addPipelineLayout(const std::string &name, vk::PipelineLayout layout);
+    // Pipelines use subpass 0 and write `colorAttachmentCount` attachments rasterized with `samples`.
+    void addRenderPass(const std::string &name, vk::RenderPass renderPass, uint32_t colorAttachmentCount = 1,
+                       vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1);
+
+    // Compiles on the calling thread, for fallbacks that have to be ready before the first frame.
+    PipelineHandle compile(const PipelineKey &key);
+    // Returns the existing handle for an equal key, otherwise queues compilation. The fallback has to be compatible
+    // with the key's render pass and is used by get until the pipeline is ready.
+    PipelineHandle request(const PipelineKey &key, PipelineHandle fallback = INVALID_PIPELINE);
+    // Null while neither the pipeline nor its fallback is ready, or when compilation failed without a fallback.
+    vk::Pipeline get(PipelineHandle handle) const;
+    uint32_t getPendingCount() const { return pendingCount.load(std::memory_order_relaxed); }
+    // Blocks until background compilation is done.
+    void waitIdle();
+
+    // Requests every key recorded by saveKeys, keys referring to unregistered names are skipped. Missing file is
+    // not an error.
+    void prewarm(const std::string &path);
+    void saveKeys(const std::string &path) const;
+
+private:
+    enum class LibraryPart : uint32_t { VertexInput, PreRasterization, FragmentShader, FragmentOutput };
+
+    struct LibraryKey {
+        LibraryPart part;
+        PipelineKey key; // fields the part doesn't depend on are cleared
+        bool operator==(const LibraryKey &) const = default;
+    };
+    struct LibraryKeyHash {
+        size_t operator()(const LibraryKey &key) const;
+    };
+
+    // Registered objects a key refers to, looked up on the render thread so workers never touch the name maps.
+    struct Resolved {
+        const VertexLayout *pVertexLayout;
+        vk::PipelineLayout pipelineLayout;
+        vk::RenderPass renderPass;
+        uint32_t colorAttachmentCount;
+        vk::SampleCountFlagBits samples;
+    };
+
+    struct RenderPassInfo {
+        vk::RenderPass renderPass;
+        uint32_t colorAttachmentCount;
+        vk::SampleCountFlagBits samples;
+    };
+
+    struct Entry {
+        PipelineKey key;
+        PipelineHandle fallback = INVALID_PIPELINE;
+        bool bBackground = false; // requested rather than compiled, recorded by saveKeys
+        std::atomic<vk::Pipeline> pipeline{vk::Pipeline{}};
+        vk::UniquePipeline owned;
+    };
+
+    Resolved resolve(const PipelineKey &key) const;
+    PipelineHandle addEntry(const PipelineKey &key, PipelineHandle fallback, bool bBackground);
+    void build(Entry &entry, const Resolved &resolved);
+    vk::UniquePipeline createComplete(const PipelineKey &key, const Resolved &resolved);
+    vk::UniquePipeline createLibrary(LibraryPart part, const PipelineKey &key, const Resolved &resolved);
+    vk::Pipeline getLibrary(LibraryPart part, const PipelineKey &key, const Resolved &resolved);
+    vk::UniquePipeline link(const std::array<vk::Pipeline, 4> &parts, vk::PipelineLayout layout, bool bOptimize);
+
+    GpuContext gpu;
+    ThreadPool *pPool = nullptr;
+    bool bPipelineLibrary = false;
+    vk::UniquePipelineCache pipelineCache;
+
+    std::unordered_map<std::string, VertexLayout> vertexLayouts;
+    std::unordered_map<std::string, vk::PipelineLayout> pipelineLayouts;
+    std::unordered_map<std::string, RenderPassInfo> renderPasses;
+
+    std::deque<Entry> entries; // stable addresses, workers hold references
+    std::unordered_map<PipelineKey, PipelineHandle, PipelineKeyHash> handles;
+
+    std::mutex mutex; // guards everything below
+    std::unordered_map<LibraryKey, std::shared_future<vk::Pipeline>, LibraryKeyHash> libraries;
+    std::vector<vk::UniquePipeline> ownedLibraries;
+    std::vector<vk::UniquePipeline> retired; // fast linked pipelines that may still be referenced by command buffers
+    std::atomic<uint32_t> pendingCount{0};
+    std::condition_variable idle;
+};
+
+} // namespace pons
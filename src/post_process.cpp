@@ -0,0 +1,367 @@
+#include "post_process.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+#include <tuple>
+
+namespace pons {
+
+namespace {
+
+// Must match shaders/post_bloom.comp
+const uint32_t BLOOM_PREFILTER = 0;
+const uint32_t BLOOM_DOWNSAMPLE = 1;
+const uint32_t BLOOM_UPSAMPLE = 2;
+const uint32_t BLOOM_GROUP_SIZE = 8;
+
+struct BloomParams {
+    glm::vec2 sourceUvMax;     // valid region of the source
+    glm::vec2 sourceTexelSize; // of the whole source image
+    glm::uvec2 targetSize;     // valid region of the target
+    float threshold;
+    uint32_t mode;
+};
+
+// Must match shaders/post_resolve.comp
+const uint32_t RESOLVE_FXAA = 1;
+const uint32_t RESOLVE_ENCODE_SRGB = 2;
+
+struct ResolveParams {
+    glm::vec2 sceneUvMax;     // rendered part of the scene target
+    glm::vec2 sceneTexelSize; // of the whole scene target
+    glm::vec2 bloomUvMax;
+    glm::vec2 bloomTexelSize;
+    glm::uvec2 outputSize;
+    float exposure;
+    float bloomIntensity;
+    float saturation;
+    float contrast;
+    float sharpness; // <= 0 disables sharpening
+    uint32_t flags;
+};
+
+uint32_t groupCount(uint32_t invocations, uint32_t groupSize) {
+    return (invocations + groupSize - 1) / groupSize;
+}
+
+vk::Extent2D halfExtent(vk::Extent2D extent) {
+    return vk::Extent2D{std::max(extent.width / 2, 1u), std::max(extent.height / 2, 1u)};
+}
+
+glm::vec2 toVec2(vk::Extent2D extent) {
+    return glm::vec2{static_cast<float>(extent.width), static_cast<float>(extent.height)};
+}
+
+bool isSrgbFormat(vk::Format format) {
+    switch (format) {
+    case vk::Format::eB8G8R8A8Srgb:
+    case vk::Format::eR8G8B8A8Srgb:
+    case vk::Format::eA8B8G8R8SrgbPack32:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void recordComputeBarrier(vk::CommandBuffer commandBuffer) {
+    vk::MemoryBarrier barrier{vk::AccessFlagBits::eShaderWrite,
+                              vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite};
+    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                                  vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags{}, barrier, nullptr,
+                                  nullptr);
+}
+
+} // namespace
+
+bool PostProcessChain::supportsDirectOutput(vk::PhysicalDevice physicalDevice, vk::Format format) {
+    vk::FormatProperties properties = physicalDevice.getFormatProperties(format);
+    return static_cast<bool>(properties.optimalTilingFeatures & vk::FormatFeatureFlagBits::eStorageImage);
+}
+
+void PostProcessChain::create(const GpuContext &gpu) {
+    this->gpu = gpu;
+
+    vk::SamplerCreateInfo samplerInfo{vk::SamplerCreateFlags{},
+                                      vk::Filter::eLinear,
+                                      vk::Filter::eLinear,
+                                      vk::SamplerMipmapMode::eNearest,
+                                      vk::SamplerAddressMode::eClampToEdge,
+                                      vk::SamplerAddressMode::eClampToEdge,
+                                      vk::SamplerAddressMode::eClampToEdge};
+    sampler = gpu.device.createSamplerUnique(samplerInfo);
+
+    std::array<vk::DescriptorSetLayoutBinding, 2> bloomBindings{
+        {{/*binding*/ 0, vk::DescriptorType::eCombinedImageSampler, /*descriptorCount*/ 1,
+          vk::ShaderStageFlagBits::eCompute, nullptr},
+         {/*binding*/ 1, vk::DescriptorType::eStorageImage, /*descriptorCount*/ 1, vk::ShaderStageFlagBits::eCompute,
+          nullptr}}};
+    bloomSetLayout = gpu.device.createDescriptorSetLayoutUnique({vk::DescriptorSetLayoutCreateFlags{}, bloomBindings});
+    std::array<vk::DescriptorSetLayoutBinding, 3> resolveBindings{
+        {{/*binding*/ 0, vk::DescriptorType::eCombinedImageSampler, /*descriptorCount*/ 1,
+          vk::ShaderStageFlagBits::eCompute, nullptr},
+         {/*binding*/ 1, vk::DescriptorType::eCombinedImageSampler, /*descriptorCount*/ 1,
+          vk::ShaderStageFlagBits::eCompute, nullptr},
+         {/*binding*/ 2, vk::DescriptorType::eStorageImage, /*descriptorCount*/ 1, vk::ShaderStageFlagBits::eCompute,
+          nullptr}}};
+    resolveSetLayout =
+        gpu.device.createDescriptorSetLayoutUnique({vk::DescriptorSetLayoutCreateFlags{}, resolveBindings});
+
+    vk::DescriptorSetLayout bloomLayout = bloomSetLayout.get();
+    vk::PushConstantRange bloomPushConstants{vk::ShaderStageFlagBits::eCompute, /*offset*/ 0, sizeof(BloomParams)};
+    bloomPipelineLayout = gpu.device.createPipelineLayoutUnique(
+        vk::PipelineLayoutCreateInfo{vk::PipelineLayoutCreateFlags{}, bloomLayout, bloomPushConstants});
+    vk::DescriptorSetLayout resolveLayout = resolveSetLayout.get();
+    vk::PushConstantRange resolvePushConstants{vk::ShaderStageFlagBits::eCompute, /*offset*/ 0,
+                                               sizeof(ResolveParams)};
+    resolvePipelineLayout = gpu.device.createPipelineLayoutUnique(
+        vk::PipelineLayoutCreateInfo{vk::PipelineLayoutCreateFlags{}, resolveLayout, resolvePushConstants});
+
+    createComputePipeline("post_bloom.spv", bloomPipelineLayout.get(), bloomPipeline);
+    createComputePipeline("post_resolve.spv", resolvePipelineLayout.get(), resolvePipeline);
+}
+
+void PostProcessChain::createComputePipeline(const char *shader, vk::PipelineLayout layout,
+                                             vk::UniquePipeline &pipeline) {
+    vk::UniqueShaderModule shaderModule = createShaderModule(gpu.device, readShader(shader));
+    vk::PipelineShaderStageCreateInfo stageInfo{vk::PipelineShaderStageCreateFlags{},
+                                                vk::ShaderStageFlagBits::eCompute, shaderModule.get(), "main"};
+    vk::ComputePipelineCreateInfo pipelineInfo{vk::PipelineCreateFlags{}, stageInfo, layout};
+    pipeline = gpu.device.createComputePipelineUnique(nullptr, pipelineInfo).value;
+}
+
+void PostProcessChain::createTargets(vk::ImageView sceneView, vk::Extent2D sceneExtent,
+                                     const std::vector<vk::Image> &swapchainImages,
+                                     const std::vector<vk::UniqueImageView> &swapchainViews,
+                                     vk::Format swapchainFormat, vk::Extent2D outputExtent, bool bDirectOutput) {
+    this->sceneExtent = sceneExtent;
+    this->outputExtent = outputExtent;
+    this->swapchainImages = swapchainImages;
+    this->bDirectOutput = bDirectOutput;
+    bEncodeSrgb = !isSrgbFormat(swapchainFormat);
+    descriptorPool.reset();
+    bloomViews.clear();
+    bloomImage.reset();
+    bloomImageMemory.reset();
+    intermediateView.reset();
+    intermediateImage.reset();
+    intermediateImageMemory.reset();
+
+    if (bDirectOutput) {
+        if (!resolveDirectPipeline) {
+            createComputePipeline("post_resolve_direct.spv", resolvePipelineLayout.get(), resolveDirectPipeline);
+        }
+    } else {
+        vk::FormatProperties intermediateProperties = gpu.physicalDevice.getFormatProperties(POST_INTERMEDIATE_FORMAT);
+        vk::FormatProperties swapchainProperties = gpu.physicalDevice.getFormatProperties(swapchainFormat);
+        if (!(intermediateProperties.optimalTilingFeatures & vk::FormatFeatureFlagBits::eBlitSrc) ||
+            !(swapchainProperties.optimalTilingFeatures & vk::FormatFeatureFlagBits::eBlitDst)) {
+            throw std::runtime_error("swapchain format supports neither storage nor blit writes");
+        }
+        vk::ImageCreateInfo imageInfo{vk::ImageCreateFlags{},
+                                      vk::ImageType::e2D,
+                                      POST_INTERMEDIATE_FORMAT,
+                                      vk::Extent3D{outputExtent.width, outputExtent.height, 1},
+                                      /*mipLevels*/ 1,
+                                      /*arrayLayers*/ 1,
+                                      vk::SampleCountFlagBits::e1,
+                                      vk::ImageTiling::eOptimal,
+                                      vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eTransferSrc};
+        std::tie(intermediateImage, intermediateImageMemory) =
+            createImage(gpu, imageInfo, vk::MemoryPropertyFlagBits::eDeviceLocal);
+        intermediateView = gpu.device.createImageViewUnique(vk::ImageViewCreateInfo{
+            vk::ImageViewCreateFlags{}, intermediateImage.get(), vk::ImageViewType::e2D, POST_INTERMEDIATE_FORMAT,
+            vk::ComponentMapping{}, vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1}});
+    }
+
+    // pyramid levels down to a few pixels
+    vk::Extent2D bloomExtent = halfExtent(sceneExtent);
+    bloomLevels = 1;
+    while (bloomLevels < BLOOM_MAX_LEVELS && std::min(bloomExtent.width, bloomExtent.height) >> bloomLevels >= 4) {
+        ++bloomLevels;
+    }
+    vk::ImageCreateInfo bloomInfo{vk::ImageCreateFlags{},
+                                  vk::ImageType::e2D,
+                                  BLOOM_FORMAT,
+                                  vk::Extent3D{bloomExtent.width, bloomExtent.height, 1},
+                                  bloomLevels,
+                                  /*arrayLayers*/ 1,
+                                  vk::SampleCountFlagBits::e1,
+                                  vk::ImageTiling::eOptimal,
+                                  vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eSampled};
+    std::tie(bloomImage, bloomImageMemory) = createImage(gpu, bloomInfo, vk::MemoryPropertyFlagBits::eDeviceLocal);
+    for (uint32_t level = 0; level < bloomLevels; ++level) {
+        bloomViews.emplace_back(gpu.device.createImageViewUnique(vk::ImageViewCreateInfo{
+            vk::ImageViewCreateFlags{}, bloomImage.get(), vk::ImageViewType::e2D, BLOOM_FORMAT,
+            vk::ComponentMapping{}, vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, level, 1, 0, 1}}));
+    }
+
+    uint32_t bloomSetCount = 2 * bloomLevels - 1;
+    uint32_t resolveSetCount = bDirectOutput ? static_cast<uint32_t>(swapchainImages.size()) : 1;
+    std::array<vk::DescriptorPoolSize, 2> poolSizes{
+        {{vk::DescriptorType::eCombinedImageSampler, bloomSetCount + 2 * resolveSetCount},
+         {vk::DescriptorType::eStorageImage, bloomSetCount + resolveSetCount}}};
+    descriptorPool = gpu.device.createDescriptorPoolUnique(
+        {vk::DescriptorPoolCreateFlags{}, /*maxSets*/ bloomSetCount + resolveSetCount, poolSizes});
+    std::vector<vk::DescriptorSetLayout> bloomLayouts(bloomSetCount, bloomSetLayout.get());
+    bloomSets = gpu.device.allocateDescriptorSets({descriptorPool.get(), bloomLayouts});
+    std::vector<vk::DescriptorSetLayout> resolveLayouts(resolveSetCount, resolveSetLayout.get());
+    resolveSets = gpu.device.allocateDescriptorSets({descriptorPool.get(), resolveLayouts});
+
+    auto writeBloomSet = [this](vk::DescriptorSet set, vk::ImageView source, vk::ImageLayout sourceLayout,
+                                vk::ImageView target) {
+        vk::DescriptorImageInfo sourceInfo{sampler.get(), source, sourceLayout};
+        vk::DescriptorImageInfo targetInfo{nullptr, target, vk::ImageLayout::eGeneral};
+        std::array<vk::WriteDescriptorSet, 2> writes{
+            {{set, /*dstBinding*/ 0, /*dstArrayElement*/ 0, /*descriptorCount*/ 1,
+              vk::DescriptorType::eCombinedImageSampler, &sourceInfo},
+             {set, /*dstBinding*/ 1, /*dstArrayElement*/ 0, /*descriptorCount*/ 1, vk::DescriptorType::eStorageImage,
+              &targetInfo}}};
+        gpu.device.updateDescriptorSets(writes, nullptr);
+    };
+    writeBloomSet(bloomSets[0], sceneView, vk::ImageLayout::eShaderReadOnlyOptimal, bloomViews[0].get());
+    for (uint32_t level = 1; level < bloomLevels; ++level) {
+        writeBloomSet(bloomSets[level], bloomViews[level - 1].get(), vk::ImageLayout::eGeneral,
+                      bloomViews[level].get());
+    }
+    for (uint32_t level = 0; level + 1 < bloomLevels; ++level) {
+        writeBloomSet(bloomSets[bloomLevels + level], bloomViews[level + 1].get(), vk::ImageLayout::eGeneral,
+                      bloomViews[level].get());
+    }
+
+    for (uint32_t i = 0; i < resolveSetCount; ++i) {
+        vk::DescriptorImageInfo sceneInfo{sampler.get(), sceneView, vk::ImageLayout::eShaderReadOnlyOptimal};
+        vk::DescriptorImageInfo bloomInfo{sampler.get(), bloomViews[0].get(), vk::ImageLayout::eGeneral};
+        vk::DescriptorImageInfo outputInfo{nullptr, bDirectOutput ? swapchainViews.at(i).get() : intermediateView.get(),
+                                           vk::ImageLayout::eGeneral};
+        std::array<vk::WriteDescriptorSet, 3> writes{
+            {{resolveSets[i], /*dstBinding*/ 0, /*dstArrayElement*/ 0, /*descriptorCount*/ 1,
+              vk::DescriptorType::eCombinedImageSampler, &sceneInfo},
+             {resolveSets[i], /*dstBinding*/ 1, /*dstArrayElement*/ 0, /*descriptorCount*/ 1,
+              vk::DescriptorType::eCombinedImageSampler, &bloomInfo},
+             {resolveSets[i], /*dstBinding*/ 2, /*dstArrayElement*/ 0, /*descriptorCount*/ 1,
+              vk::DescriptorType::eStorageImage, &outputInfo}}};
+        gpu.device.updateDescriptorSets(writes, nullptr);
+    }
+}
+
+void PostProcessChain::recordBloom(vk::CommandBuffer commandBuffer, vk::Extent2D renderExtent) const {
+    // every level is rewritten, previous contents are discarded once the last frame's resolve is done reading
+    vk::ImageMemoryBarrier toGeneral{vk::AccessFlags{},
+                                     vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite,
+                                     vk::ImageLayout::eUndefined,
+                                     vk::ImageLayout::eGeneral,
+                                     VK_QUEUE_FAMILY_IGNORED,
+                                     VK_QUEUE_FAMILY_IGNORED,
+                                     bloomImage.get(),
+                                     vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, 0, bloomLevels, 0, 1}};
+    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                                  vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags{}, nullptr, nullptr,
+                                  toGeneral);
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, bloomPipeline.get());
+
+    // levels are allocated for the full scene target, only the part covering the rendered region is processed
+    std::array<vk::Extent2D, BLOOM_MAX_LEVELS> levelSizes;
+    std::array<vk::Extent2D, BLOOM_MAX_LEVELS> levelRegions;
+    vk::Extent2D sourceSize = sceneExtent;
+    vk::Extent2D sourceRegion = renderExtent;
+    for (uint32_t level = 0; level < bloomLevels; ++level) {
+        levelSizes[level] = halfExtent(sourceSize);
+        levelRegions[level] = halfExtent(sourceRegion);
+        BloomParams params{toVec2(sourceRegion) / toVec2(sourceSize), 1.0f / toVec2(sourceSize),
+                           glm::uvec2{levelRegions[level].width, levelRegions[level].height}, settings.bloomThreshold,
+                           level == 0 ? BLOOM_PREFILTER : BLOOM_DOWNSAMPLE};
+        commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, bloomPipelineLayout.get(), 0,
+                                         bloomSets[level], nullptr);
+        commandBuffer.pushConstants(bloomPipelineLayout.get(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(params),
+                                    &params);
+        commandBuffer.dispatch(groupCount(levelRegions[level].width, BLOOM_GROUP_SIZE),
+                               groupCount(levelRegions[level].height, BLOOM_GROUP_SIZE), 1);
+        recordComputeBarrier(commandBuffer);
+        sourceSize = levelSizes[level];
+        sourceRegion = levelRegions[level];
+    }
+    for (uint32_t level = bloomLevels - 1; level-- > 0;) {
+        BloomParams params{toVec2(levelRegions[level + 1]) / toVec2(levelSizes[level + 1]),
+                           1.0f / toVec2(levelSizes[level + 1]),
+                           glm::uvec2{levelRegions[level].width, levelRegions[level].height}, settings.bloomThreshold,
+                           BLOOM_UPSAMPLE};
+        commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, bloomPipelineLayout.get(), 0,
+                                         bloomSets[bloomLevels + level], nullptr);
+        commandBuffer.pushConstants(bloomPipelineLayout.get(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(params),
+                                    &params);
+        commandBuffer.dispatch(groupCount(levelRegions[level].width, BLOOM_GROUP_SIZE),
+                               groupCount(levelRegions[level].height, BLOOM_GROUP_SIZE), 1);
+        recordComputeBarrier(commandBuffer);
+    }
+}
+
+void PostProcessChain::recordPost(vk::CommandBuffer commandBuffer, uint32_t imageIndex, vk::Extent2D renderExtent) {
+    recordBloom(commandBuffer, renderExtent);
+
+    vk::ImageSubresourceRange colorRange{vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1};
+    vk::Image swapchainImage = swapchainImages.at(imageIndex);
+    // acquire semaphore waits at the compute stage for direct output, at transfer otherwise
+    vk::ImageMemoryBarrier outputBarrier{vk::AccessFlags{},
+                                         vk::AccessFlagBits::eShaderWrite,
+                                         vk::ImageLayout::eUndefined,
+                                         vk::ImageLayout::eGeneral,
+                                         VK_QUEUE_FAMILY_IGNORED,
+                                         VK_QUEUE_FAMILY_IGNORED,
+                                         bDirectOutput ? swapchainImage : intermediateImage.get(),
+                                         colorRange};
+    commandBuffer.pipelineBarrier(bDirectOutput ? vk::PipelineStageFlagBits::eComputeShader
+                                                : vk::PipelineStageFlagBits::eTransfer,
+                                  vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags{}, nullptr, nullptr,
+                                  outputBarrier);
+
+    vk::Extent2D bloomSize = halfExtent(sceneExtent);
+    vk::Extent2D bloomRegion = halfExtent(renderExtent);
+    uint32_t flags = (settings.bFxaa ? RESOLVE_FXAA : 0) | (bEncodeSrgb ? RESOLVE_ENCODE_SRGB : 0);
+    // at native resolution there is nothing to sharpen back
+    float sharpness = renderExtent != sceneExtent ? UPSCALE_SHARPNESS : 0.0f;
+    ResolveParams params{toVec2(renderExtent) / toVec2(sceneExtent),
+                         1.0f / toVec2(sceneExtent),
+                         toVec2(bloomRegion) / toVec2(bloomSize),
+                         1.0f / toVec2(bloomSize),
+                         glm::uvec2{outputExtent.width, outputExtent.height},
+                         settings.exposure,
+                         settings.bloomIntensity,
+                         settings.saturation,
+                         settings.contrast,
+                         sharpness,
+                         flags};
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                               bDirectOutput ? resolveDirectPipeline.get() : resolvePipeline.get());
+    commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, resolvePipelineLayout.get(), 0,
+                                     resolveSets.at(bDirectOutput ? imageIndex : 0), nullptr);
+    commandBuffer.pushConstants(resolvePipelineLayout.get(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(params),
+                                &params);
+    commandBuffer.dispatch(groupCount(outputExtent.width, POST_RESOLVE_TILE),
+                           groupCount(outputExtent.height, POST_RESOLVE_TILE), 1);
+    if (bDirectOutput) {
+        return;
+    }
+
+    std::array<vk::ImageMemoryBarrier, 2> blitBarriers{
+        {{vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eTransferRead, vk::ImageLayout::eGeneral,
+          vk::ImageLayout::eGeneral, VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, intermediateImage.get(),
+          colorRange},
+         {vk::AccessFlags{}, vk::AccessFlagBits::eTransferWrite, vk::ImageLayout::eUndefined,
+          vk::ImageLayout::eTransferDstOptimal, VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, swapchainImage,
+          colorRange}}};
+    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer,
+                                  vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags{}, nullptr, nullptr,
+                                  blitBarriers);
+    vk::ImageSubresourceLayers colorLayers{vk::ImageAspectFlagBits::eColor, 0, 0, 1};
+    std::array<vk::Offset3D, 2> bounds{
+        vk::Offset3D{0, 0, 0},
+        vk::Offset3D{static_cast<int32_t>(outputExtent.width), static_cast<int32_t>(outputExtent.height), 1}};
+    vk::ImageBlit blit{colorLayers, bounds, colorLayers, bounds};
+    commandBuffer.blitImage(intermediateImage.get(), vk::ImageLayout::eGeneral, swapchainImage,
+                            vk::ImageLayout::eTransferDstOptimal, blit, vk::Filter::eNearest);
+}
+
+} // namespace pons
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "gpu.h"
+
+namespace pons {
+
+const vk::Format BLOOM_FORMAT = vk::Format::eR16G16B16A16Sfloat; // must match shaders/post_bloom.comp
+const vk::Format POST_INTERMEDIATE_FORMAT = vk::Format::eR16G16B16A16Sfloat; // must match shaders/post_resolve.comp
+const uint32_t BLOOM_MAX_LEVELS = 6; // first level is half the scene size
+const uint32_t POST_RESOLVE_TILE = 16;
+const float UPSCALE_SHARPNESS = 0.5f; // 0..1, contrast adaptive sharpening strength
+
+struct PostSettings {
+    float exposure = 1.0f;
+    float bloomThreshold = 1.0f; // scene brightness where bloom starts
+    float bloomIntensity = 0.05f;
+    float saturation = 1.0f;
+    float contrast = 1.0f;
+    bool bFxaa = true;
+};
+
+// Compute post processing from the hdr scene target to the swapchain. Bloom builds a small pyramid at half
+// resolution and below, everything per pixel (upscale, bloom composite, tonemap, grading, antialiasing or sharpening
+// and srgb encoding) is fused into one dispatch over shared memory tiles that writes each output pixel once. The
+// swapchain is written as a storage image when its format allows it, otherwise an intermediate image is blitted.
+class PostProcessChain {
+public:
+    // Whether the swapchain images of `format` can be written directly, the device needs
+    // shaderStorageImageWriteWithoutFormat enabled.
+    static bool supportsDirectOutput(vk::PhysicalDevice physicalDevice, vk::Format format);
+
+    void create(const GpuContext &gpu);
+    // Called again on swapchain resize. Swapchain images are created with storage usage for `bDirectOutput`,
+    // transfer destination usage otherwise.
+    void createTargets(vk::ImageView sceneView, vk::Extent2D sceneExtent, const std::vector<vk::Image> &swapchainImages,
+                       const std::vector<vk::UniqueImageView> &swapchainViews, vk::Format swapchainFormat,
+                       vk::Extent2D outputExtent, bool bDirectOutput);
+
+    PostSettings &getSettings() { return settings; }
+
+    // Must be called outside of render pass after the scene pass. Leaves the swapchain image in General layout
+    // after compute writes for direct output, in TransferDstOptimal after a transfer write otherwise.
+    void recordPost(vk::CommandBuffer commandBuffer, uint32_t imageIndex, vk::Extent2D renderExtent);
+
+private:
+    void createComputePipeline(const char *shader, vk::PipelineLayout layout, vk::UniquePipeline &pipeline);
+    void recordBloom(vk::CommandBuffer commandBuffer, vk::Extent2D renderExtent) const;
+
+    GpuContext gpu;
+    PostSettings settings;
+    bool bDirectOutput = false;
+    bool bEncodeSrgb = false;
+    vk::Extent2D sceneExtent;
+    vk::Extent2D outputExtent;
+    uint32_t bloomLevels = 0;
+    std::vector<vk::Image> swapchainImages;
+
+    vk::UniqueSampler sampler;
+    vk::UniqueDescriptorSetLayout bloomSetLayout;
+    vk::UniqueDescriptorSetLayout resolveSetLayout;
+    vk::UniquePipelineLayout bloomPipelineLayout;
+    vk::UniquePipelineLayout resolvePipelineLayout;
+    vk::UniquePipeline bloomPipeline;
+    vk::UniquePipeline resolvePipeline;       // writes the intermediate image
+    vk::UniquePipeline resolveDirectPipeline; // writes the swapchain
+
+    vk::UniqueImage bloomImage;
+    TrackedMemory bloomImageMemory;
+    std::vector<vk::UniqueImageView> bloomViews; // one per level
+    vk::UniqueImage intermediateImage;           // only without direct output
+    TrackedMemory intermediateImageMemory;
+    vk::UniqueImageView intermediateView;
+    vk::UniqueDescriptorPool descriptorPool;
+    std::vector<vk::DescriptorSet> bloomSets;   // downsample into each level, then upsample into each but the last
+    std::vector<vk::DescriptorSet> resolveSets; // per swapchain image, or a single one for the intermediate image
+};
+
+} // namespace pons
@@ -0,0 +1,352 @@
+#include "shadows.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+namespace pons {
+
+namespace {
+
+// Push constants of shaders/shadow.vert
+struct ShadowPushConstants {
+    alignas(16) glm::mat4 viewProj;
+    alignas(16) glm::mat4 model;
+};
+
+// Rotation into light space, the light looks down -z.
+glm::mat4 lightRotation(glm::vec3 direction) {
+    glm::vec3 up = std::abs(direction.z) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 0.0f, 1.0f);
+    return glm::lookAt(glm::vec3(0.0f), direction, up);
+}
+
+} // namespace
+
+std::array<vk::DescriptorSetLayoutBinding, 2> CascadedShadows::getDescriptorSetLayoutBindings() {
+    return {{{/*binding*/ 3, vk::DescriptorType::eCombinedImageSampler, /*descriptorCount*/ 1,
+              vk::ShaderStageFlagBits::eFragment, nullptr},
+             {/*binding*/ 4, vk::DescriptorType::eUniformBuffer, /*descriptorCount*/ 1,
+              vk::ShaderStageFlagBits::eFragment, nullptr}}};
+}
+
+vk::UniqueRenderPass CascadedShadows::createRenderPass(bool bStatic) const {
+    vk::AttachmentDescription depthAttachment{vk::AttachmentDescriptionFlags{},
+                                              SHADOW_FORMAT,
+                                              vk::SampleCountFlagBits::e1,
+                                              bStatic ? vk::AttachmentLoadOp::eClear : vk::AttachmentLoadOp::eLoad,
+                                              vk::AttachmentStoreOp::eStore,
+                                              vk::AttachmentLoadOp::eDontCare,
+                                              vk::AttachmentStoreOp::eDontCare,
+                                              bStatic ? vk::ImageLayout::eUndefined
+                                                      : vk::ImageLayout::eDepthStencilAttachmentOptimal,
+                                              bStatic ? vk::ImageLayout::eTransferSrcOptimal
+                                                      : vk::ImageLayout::eShaderReadOnlyOptimal};
+    vk::AttachmentReference depthAttachmentRef{/*attachment*/ 0, vk::ImageLayout::eDepthStencilAttachmentOptimal};
+    vk::SubpassDescription subpass{vk::SubpassDescriptionFlags{}, vk::PipelineBindPoint::eGraphics,
+                                   /*inputAttachments*/ nullptr, /*colorAttachments*/ nullptr,
+                                   /*resolveAttachments*/ nullptr, &depthAttachmentRef};
+    vk::PipelineStageFlags depthStages =
+        vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests;
+    vk::AccessFlags depthAccess =
+        vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+    std::array<vk::SubpassDependency, 2> dependencies;
+    if (bStatic) {
+        // the previous copy out of the cache has to finish before it's cleared, the next copy reads the result
+        dependencies = {{{VK_SUBPASS_EXTERNAL, /*dstSubpass*/ 0, vk::PipelineStageFlagBits::eTransfer, depthStages,
+                          vk::AccessFlags{}, depthAccess},
+                         {/*srcSubpass*/ 0, VK_SUBPASS_EXTERNAL, depthStages, vk::PipelineStageFlagBits::eTransfer,
+                          vk::AccessFlagBits::eDepthStencilAttachmentWrite, vk::AccessFlagBits::eTransferRead}}};
+    } else {
+        // the layout transition after the copy is recorded as a barrier, the scene samples the result
+        dependencies = {{{VK_SUBPASS_EXTERNAL, /*dstSubpass*/ 0, depthStages, depthStages,
+                          vk::AccessFlagBits::eDepthStencilAttachmentWrite, depthAccess},
+                         {/*srcSubpass*/ 0, VK_SUBPASS_EXTERNAL, depthStages,
+                          vk::PipelineStageFlagBits::eFragmentShader,
+                          vk::AccessFlagBits::eDepthStencilAttachmentWrite, vk::AccessFlagBits::eShaderRead}}};
+    }
+    return gpu.device.createRenderPassUnique(
+        vk::RenderPassCreateInfo{vk::RenderPassCreateFlags{}, depthAttachment, subpass, dependencies});
+}
+
+CascadedShadows::~CascadedShadows() {
+    if (gpu.pMemoryBudget) {
+        for (const Cascade &cascade : cascades) {
+            gpu.pMemoryBudget->unregisterResident(cascade.staticResident);
+        }
+    }
+}
+
+void CascadedShadows::create(const GpuContext &gpu, PipelineRegistry &pipelines, uint32_t framesInFlight) {
+    this->gpu = gpu;
+    pPipelines = &pipelines;
+    staticRenderPass = createRenderPass(true);
+    dynamicRenderPass = createRenderPass(false);
+
+    vk::ImageCreateInfo shadowImageInfo{
+        vk::ImageCreateFlags{},
+        vk::ImageType::e2D,
+        SHADOW_FORMAT,
+        vk::Extent3D{SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, 1},
+        /*mipLevels*/ 1,
+        /*arrayLayers*/ SHADOW_CASCADE_COUNT,
+        vk::SampleCountFlagBits::e1,
+        vk::ImageTiling::eOptimal,
+        vk::ImageUsageFlagBits::eDepthStencilAttachment | vk::ImageUsageFlagBits::eSampled |
+            vk::ImageUsageFlagBits::eTransferDst};
+    std::tie(shadowImage, shadowImageMemory) =
+        createImage(gpu, shadowImageInfo, vk::MemoryPropertyFlagBits::eDeviceLocal);
+    shadowView = gpu.device.createImageViewUnique(vk::ImageViewCreateInfo{
+        vk::ImageViewCreateFlags{}, shadowImage.get(), vk::ImageViewType::e2DArray, SHADOW_FORMAT,
+        vk::ComponentMapping{},
+        vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eDepth, 0, 1, 0, SHADOW_CASCADE_COUNT}});
+
+    vk::ImageCreateInfo staticImageInfo = shadowImageInfo;
+    staticImageInfo.arrayLayers = 1;
+    staticImageInfo.usage = vk::ImageUsageFlagBits::eDepthStencilAttachment | vk::ImageUsageFlagBits::eTransferSrc;
+    for (uint32_t i = 0; i < SHADOW_CASCADE_COUNT; ++i) {
+        Cascade &cascade = cascades[i];
+        std::tie(cascade.staticImage, cascade.staticImageMemory) =
+            createImage(gpu, staticImageInfo, vk::MemoryPropertyFlagBits::eDeviceLocal);
+        cascade.staticView = gpu.device.createImageViewUnique(vk::ImageViewCreateInfo{
+            vk::ImageViewCreateFlags{}, cascade.staticImage.get(), vk::ImageViewType::e2D, SHADOW_FORMAT,
+            vk::ComponentMapping{}, vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eDepth, 0, 1, 0, 1}});
+        cascade.layerView = gpu.device.createImageViewUnique(vk::ImageViewCreateInfo{
+            vk::ImageViewCreateFlags{}, shadowImage.get(), vk::ImageViewType::e2D, SHADOW_FORMAT,
+            vk::ComponentMapping{}, vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eDepth, 0, 1, i, 1}});
+        vk::ImageView staticAttachment = cascade.staticView.get();
+        cascade.staticFramebuffer = gpu.device.createFramebufferUnique(
+            vk::FramebufferCreateInfo{vk::FramebufferCreateFlags{}, staticRenderPass.get(), staticAttachment,
+                                      SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, /*layers*/ 1});
+        vk::ImageView layerAttachment = cascade.layerView.get();
+        cascade.layerFramebuffer = gpu.device.createFramebufferUnique(
+            vk::FramebufferCreateInfo{vk::FramebufferCreateFlags{}, dynamicRenderPass.get(), layerAttachment,
+                                      SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, /*layers*/ 1});
+    }
+    if (gpu.pMemoryBudget) {
+        // the device is idle when the budget evicts, the next recordRender notices the missing cache
+        for (Cascade &cascade : cascades) {
+            cascade.staticResident = gpu.pMemoryBudget->registerResident(
+                cascade.staticImageMemory.getHeapIndex(), cascade.staticImageMemory.getSize(),
+                RESIDENT_PRIORITY_CACHE, [&cascade] {
+                    cascade.staticFramebuffer.reset();
+                    cascade.staticView.reset();
+                    cascade.staticImage.reset();
+                    cascade.staticImageMemory.reset();
+                });
+        }
+    }
+
+    // hardware 2x2 PCF where the format allows filtering
+    vk::FormatProperties formatProperties = gpu.physicalDevice.getFormatProperties(SHADOW_FORMAT);
+    vk::Filter filter = formatProperties.optimalTilingFeatures & vk::FormatFeatureFlagBits::eSampledImageFilterLinear
+                            ? vk::Filter::eLinear
+                            : vk::Filter::eNearest;
+    vk::SamplerCreateInfo samplerInfo{vk::SamplerCreateFlags{},
+                                      filter,
+                                      filter,
+                                      vk::SamplerMipmapMode::eNearest,
+                                      vk::SamplerAddressMode::eClampToEdge,
+                                      vk::SamplerAddressMode::eClampToEdge,
+                                      vk::SamplerAddressMode::eClampToEdge,
+                                      /*mipLodBias*/ 0.0f,
+                                      /*anisotropyEnable*/ false,
+                                      /*maxAnisotropy*/ 1.0f,
+                                      /*compareEnable*/ true,
+                                      vk::CompareOp::eLessOrEqual};
+    sampler = gpu.device.createSamplerUnique(samplerInfo);
+
+    for (uint32_t i = 0; i < framesInFlight; ++i) {
+        auto [buffer, bufferMemory] =
+            createBuffer(gpu, sizeof(ShadowUniforms), vk::BufferUsageFlagBits::eUniformBuffer,
+                         vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+        void *data;
+        vk::Result result =
+            gpu.device.mapMemory(bufferMemory.get(), 0, sizeof(ShadowUniforms), vk::MemoryMapFlags{}, &data);
+        if (result != vk::Result::eSuccess) {
+            throw std::runtime_error("failed to map memory of shadow uniform buffer");
+        }
+        uniformBuffers.emplace_back(std::move(buffer));
+        uniformBuffersMemory.emplace_back(std::move(bufferMemory));
+        uniformBuffersMapped.push_back(data);
+    }
+
+    vk::PushConstantRange pushConstantRange{vk::ShaderStageFlagBits::eVertex, /*offset*/ 0,
+                                            sizeof(ShadowPushConstants)};
+    pipelineLayout = gpu.device.createPipelineLayoutUnique(
+        vk::PipelineLayoutCreateInfo{vk::PipelineLayoutCreateFlags{}, nullptr, pushConstantRange});
+    // both passes are compatible, depth bias is applied when sampling
+    pipelines.addPipelineLayout("shadow", pipelineLayout.get());
+    pipelines.addRenderPass("shadow", staticRenderPass.get(), /*colorAttachmentCount*/ 0);
+    pipeline = pipelines.compile(PipelineKey{.vertexShader = "shadow_vert.spv",
+                                             .fragmentShader = "",
+                                             .vertexLayout = "mesh",
+                                             .pipelineLayout = "shadow",
+                                             .renderPass = "shadow",
+                                             .cullMode = vk::CullModeFlagBits::eNone,
+                                             .bDepthTest = true,
+                                             .bDepthWrite = true});
+}
+
+void CascadedShadows::writeDescriptorSet(vk::Device device, vk::DescriptorSet set, uint32_t frame) const {
+    vk::DescriptorImageInfo imageInfo{sampler.get(), shadowView.get(), vk::ImageLayout::eShaderReadOnlyOptimal};
+    vk::DescriptorBufferInfo bufferInfo{uniformBuffers.at(frame).get(), /*offset*/ 0, sizeof(ShadowUniforms)};
+    std::array<vk::WriteDescriptorSet, 2> descriptorWrites{
+        {{set, /*dstBinding*/ 3, /*dstArrayElement*/ 0, /*descriptorCount*/ 1,
+          vk::DescriptorType::eCombinedImageSampler, &imageInfo, nullptr, nullptr},
+         {set, /*dstBinding*/ 4, /*dstArrayElement*/ 0, /*descriptorCount*/ 1, vk::DescriptorType::eUniformBuffer,
+          nullptr, &bufferInfo, nullptr}}};
+    device.updateDescriptorSets(descriptorWrites, nullptr);
+}
+
+void CascadedShadows::invalidateStatic() {
+    for (Cascade &cascade : cascades) {
+        cascade.bStaticDirty = true;
+    }
+}
+
+void CascadedShadows::update(const glm::mat4 &view, const glm::mat4 &proj, float zNear, float zFar, uint32_t frame) {
+    glm::mat4 invView = glm::inverse(view);
+    glm::mat4 toLight = lightRotation(lightDirection);
+    // view space frustum slopes, projection may be flipped in y
+    float tanX = 1.0f / proj[0][0];
+    float tanY = 1.0f / std::abs(proj[1][1]);
+
+    float splitNear = zNear;
+    for (uint32_t i = 0; i < SHADOW_CASCADE_COUNT; ++i) {
+        float fraction = static_cast<float>(i + 1) / static_cast<float>(SHADOW_CASCADE_COUNT);
+        float logSplit = zNear * std::pow(zFar / zNear, fraction);
+        float uniformSplit = zNear + (zFar - zNear) * fraction;
+        float splitFar = SHADOW_SPLIT_LAMBDA * logSplit + (1.0f - SHADOW_SPLIT_LAMBDA) * uniformSplit;
+
+        // bounding sphere of the slice, its size doesn't change with camera rotation which keeps the cache valid
+        float centerDepth = 0.5f * (splitNear + splitFar);
+        glm::vec3 farCorner{splitFar * tanX, splitFar * tanY, -splitFar};
+        glm::vec3 nearCorner{splitNear * tanX, splitNear * tanY, -splitNear};
+        glm::vec3 viewCenter{0.0f, 0.0f, -centerDepth};
+        float radius = std::max(glm::length(farCorner - viewCenter), glm::length(nearCorner - viewCenter));
+        glm::vec3 center = glm::vec3(toLight * invView * glm::vec4(viewCenter, 1.0f));
+
+        Cascade &cascade = cascades[i];
+        float halfDepth = 0.5f * SHADOW_DEPTH_RANGE;
+        bool bLightMoved = glm::dot(cascade.cachedLightDirection, lightDirection) < SHADOW_LIGHT_THRESHOLD;
+        bool bOutside = std::abs(center.x - cascade.center.x) + radius > cascade.halfExtent ||
+                        std::abs(center.y - cascade.center.y) + radius > cascade.halfExtent ||
+                        std::abs(center.z - cascade.center.z) + radius > halfDepth;
+        if (bLightMoved || bOutside) {
+            // refit with a margin, snapped to texels so static depth doesn't shimmer between refits
+            cascade.halfExtent = radius * SHADOW_CACHE_MARGIN;
+            float texelSize = 2.0f * cascade.halfExtent / static_cast<float>(SHADOW_MAP_SIZE);
+            cascade.center = glm::vec3(std::floor(center.x / texelSize) * texelSize,
+                                       std::floor(center.y / texelSize) * texelSize, center.z);
+            cascade.cachedLightDirection = lightDirection;
+            // light space looks down -z, depth is the negated z
+            glm::mat4 ortho = glm::ortho(cascade.center.x - cascade.halfExtent, cascade.center.x + cascade.halfExtent,
+                                         cascade.center.y - cascade.halfExtent, cascade.center.y + cascade.halfExtent,
+                                         -cascade.center.z - halfDepth, -cascade.center.z + halfDepth);
+            cascade.viewProj = ortho * toLight;
+            cascade.bStaticDirty = true;
+        }
+        uniforms.cascadeViewProj[i] = cascade.viewProj;
+        uniforms.cascadeSplits[static_cast<int>(i)] = splitFar;
+        splitNear = splitFar;
+    }
+    uniforms.lightDirection = glm::vec4(lightDirection, 0.0f);
+    memcpy(uniformBuffersMapped.at(frame), &uniforms, sizeof(uniforms));
+}
+
+void CascadedShadows::recordCasters(vk::CommandBuffer commandBuffer, const Cascade &cascade,
+                                    std::span<const ShadowCaster> casters) const {
+    ShadowPushConstants constants{cascade.viewProj, glm::mat4(1.0f)};
+    for (const ShadowCaster &caster : casters) {
+        constants.model = caster.transform;
+        commandBuffer.pushConstants(pipelineLayout.get(), vk::ShaderStageFlagBits::eVertex, 0, sizeof(constants),
+                                    &constants);
+        commandBuffer.drawIndexed(caster.indexCount, 1, caster.firstIndex, 0, 0);
+    }
+}
+
+void CascadedShadows::recordRender(vk::CommandBuffer commandBuffer, vk::Buffer vertexBuffer, vk::Buffer indexBuffer,
+                                   std::span<const ShadowCaster> staticCasters,
+                                   std::span<const ShadowCaster> dynamicCasters) {
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pPipelines->get(pipeline));
+    vk::DeviceSize offset = 0;
+    commandBuffer.bindVertexBuffers(0, vertexBuffer, offset);
+    commandBuffer.bindIndexBuffer(indexBuffer, 0, vk::IndexType::eUint16);
+    commandBuffer.setViewport(0, vk::Viewport{0.0f, 0.0f, static_cast<float>(SHADOW_MAP_SIZE),
+                                              static_cast<float>(SHADOW_MAP_SIZE), 0.0f, 1.0f});
+    vk::Rect2D renderArea{{0, 0}, {SHADOW_MAP_SIZE, SHADOW_MAP_SIZE}};
+    commandBuffer.setScissor(0, renderArea);
+    vk::ClearValue clearDepth{vk::ClearDepthStencilValue{1.0f, 0}};
+
+    staticRedrawCount = 0;
+    for (uint32_t i = 0; i < SHADOW_CASCADE_COUNT; ++i) {
+        Cascade &cascade = cascades[i];
+        // evicted caches leave the static casters to the dynamic pass
+        bool bCached = static_cast<bool>(cascade.staticImage);
+        if (bCached && gpu.pMemoryBudget) {
+            gpu.pMemoryBudget->touch(cascade.staticResident);
+        }
+        if (bCached && cascade.bStaticDirty) {
+            commandBuffer.beginRenderPass(vk::RenderPassBeginInfo{staticRenderPass.get(),
+                                                                  cascade.staticFramebuffer.get(), renderArea,
+                                                                  clearDepth},
+                                          vk::SubpassContents::eInline);
+            recordCasters(commandBuffer, cascade, staticCasters);
+            commandBuffer.endRenderPass();
+            cascade.bStaticDirty = false;
+            ++staticRedrawCount;
+        }
+
+        // last frame's shading has to be done sampling the layer before it's overwritten by the cache
+        vk::ImageSubresourceRange layer{vk::ImageAspectFlagBits::eDepth, 0, 1, i, 1};
+        vk::ImageMemoryBarrier toTransfer{vk::AccessFlags{},
+                                          vk::AccessFlagBits::eTransferWrite,
+                                          bShadowMapInitialized ? vk::ImageLayout::eShaderReadOnlyOptimal
+                                                                : vk::ImageLayout::eUndefined,
+                                          vk::ImageLayout::eTransferDstOptimal,
+                                          VK_QUEUE_FAMILY_IGNORED,
+                                          VK_QUEUE_FAMILY_IGNORED,
+                                          shadowImage.get(),
+                                          layer};
+        commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eFragmentShader,
+                                      vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags{}, nullptr, nullptr,
+                                      toTransfer);
+        vk::ImageCopy copyRegion{vk::ImageSubresourceLayers{vk::ImageAspectFlagBits::eDepth, 0, 0, 1}, vk::Offset3D{},
+                                 vk::ImageSubresourceLayers{vk::ImageAspectFlagBits::eDepth, 0, i, 1}, vk::Offset3D{},
+                                 vk::Extent3D{SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, 1}};
+        if (bCached) {
+            commandBuffer.copyImage(cascade.staticImage.get(), vk::ImageLayout::eTransferSrcOptimal,
+                                    shadowImage.get(), vk::ImageLayout::eTransferDstOptimal, copyRegion);
+        } else {
+            commandBuffer.clearDepthStencilImage(shadowImage.get(), vk::ImageLayout::eTransferDstOptimal,
+                                                 clearDepth.depthStencil, layer);
+        }
+        vk::ImageMemoryBarrier toAttachment{
+            vk::AccessFlagBits::eTransferWrite,
+            vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite,
+            vk::ImageLayout::eTransferDstOptimal,
+            vk::ImageLayout::eDepthStencilAttachmentOptimal,
+            VK_QUEUE_FAMILY_IGNORED,
+            VK_QUEUE_FAMILY_IGNORED,
+            shadowImage.get(),
+            layer};
+        commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                                      vk::PipelineStageFlagBits::eEarlyFragmentTests, vk::DependencyFlags{}, nullptr,
+                                      nullptr, toAttachment);
+
+        commandBuffer.beginRenderPass(
+            vk::RenderPassBeginInfo{dynamicRenderPass.get(), cascade.layerFramebuffer.get(), renderArea},
+            vk::SubpassContents::eInline);
+        if (!bCached) {
+            recordCasters(commandBuffer, cascade, staticCasters);
+        }
+        recordCasters(commandBuffer, cascade, dynamicCasters);
+        commandBuffer.endRenderPass();
+    }
+    bShadowMapInitialized = true;
+}
+
+} // namespace pons
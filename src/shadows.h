@@ -0,0 +1,106 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "gpu.h"
+#include "pipeline_registry.h"
+
+namespace pons {
+
+// Must match shaders/simple.frag
+const uint32_t SHADOW_CASCADE_COUNT = 4;
+const uint32_t SHADOW_MAP_SIZE = 2048;
+const vk::Format SHADOW_FORMAT = vk::Format::eD32Sfloat;
+const float SHADOW_SPLIT_LAMBDA = 0.75f;  // blend between logarithmic and uniform cascade splits
+const float SHADOW_CACHE_MARGIN = 1.25f;  // cached cascade bounds are this much larger than the fitted sphere
+const float SHADOW_LIGHT_THRESHOLD = 0.9999f; // cosine of the light rotation that invalidates the cache, ~0.8 degrees
+const float SHADOW_DEPTH_RANGE = 40.0f;   // light space depth covered around a cascade's center
+
+struct ShadowCaster {
+    glm::mat4 transform;
+    uint32_t firstIndex;
+    uint32_t indexCount;
+};
+
+struct ShadowUniforms {
+    alignas(16) glm::mat4 cascadeViewProj[SHADOW_CASCADE_COUNT];
+    alignas(16) glm::vec4 cascadeSplits;  // view depth where each cascade ends
+    alignas(16) glm::vec4 lightDirection; // xyz - direction the light travels
+};
+
+// Cascaded shadow maps of one directional light. Static casters are rendered into a per cascade depth cache which is
+// only redrawn when the light turns or the camera moves the cascade out of its cached bounds; every frame the cache
+// is copied into the sampled shadow map and dynamic casters are drawn on top of it. Caches are registered with the
+// memory budget and dropped when it runs out, those cascades then draw their static casters every frame.
+class CascadedShadows {
+public:
+    CascadedShadows() = default;
+    ~CascadedShadows();
+    CascadedShadows(const CascadedShadows &) = delete;
+    CascadedShadows &operator=(const CascadedShadows &) = delete;
+
+    // Bindings 3 and 4 of the frame descriptor set.
+    static std::array<vk::DescriptorSetLayoutBinding, 2> getDescriptorSetLayoutBindings();
+
+    void create(const GpuContext &gpu, PipelineRegistry &pipelines, uint32_t framesInFlight);
+    void writeDescriptorSet(vk::Device device, vk::DescriptorSet set, uint32_t frame) const;
+
+    // `direction` the light travels in, normalized.
+    void setLightDirection(glm::vec3 direction) { lightDirection = direction; }
+    // Static casters changed, every cascade is redrawn.
+    void invalidateStatic();
+    // Fits cascades to the camera and uploads the matrices of given frame.
+    void update(const glm::mat4 &view, const glm::mat4 &proj, float zNear, float zFar, uint32_t frame);
+    // Must be called outside of render pass. Geometry uses 16 bit indices.
+    void recordRender(vk::CommandBuffer commandBuffer, vk::Buffer vertexBuffer, vk::Buffer indexBuffer,
+                      std::span<const ShadowCaster> staticCasters, std::span<const ShadowCaster> dynamicCasters);
+    // Cascades whose static cache was redrawn by the last recordRender.
+    uint32_t getStaticRedrawCount() const { return staticRedrawCount; }
+
+private:
+    struct Cascade {
+        glm::mat4 viewProj{1.0f};
+        glm::vec3 center{0.0f}; // light space, snapped to texels
+        float halfExtent = 0.0f;
+        glm::vec3 cachedLightDirection{0.0f};
+        bool bStaticDirty = true;
+        vk::UniqueImage staticImage;
+        TrackedMemory staticImageMemory;
+        vk::UniqueImageView staticView;
+        vk::UniqueFramebuffer staticFramebuffer;
+        MemoryBudget::ResidentId staticResident = MemoryBudget::NO_RESIDENT;
+        vk::UniqueImageView layerView; // of the sampled array
+        vk::UniqueFramebuffer layerFramebuffer;
+    };
+
+    vk::UniqueRenderPass createRenderPass(bool bStatic) const;
+    void recordCasters(vk::CommandBuffer commandBuffer, const Cascade &cascade,
+                       std::span<const ShadowCaster> casters) const;
+
+    GpuContext gpu;
+    PipelineRegistry *pPipelines = nullptr;
+    PipelineHandle pipeline = INVALID_PIPELINE;
+    glm::vec3 lightDirection{0.0f, 0.0f, -1.0f};
+    std::array<Cascade, SHADOW_CASCADE_COUNT> cascades;
+    ShadowUniforms uniforms{};
+    bool bShadowMapInitialized = false;
+    uint32_t staticRedrawCount = 0;
+
+    vk::UniqueRenderPass staticRenderPass;  // clears, leaves the cache ready to be copied
+    vk::UniqueRenderPass dynamicRenderPass; // loads the copied cache, leaves the map ready to be sampled
+    vk::UniqueImage shadowImage; // array with a layer per cascade
+    TrackedMemory shadowImageMemory;
+    vk::UniqueImageView shadowView;
+    vk::UniqueSampler sampler;
+    vk::UniquePipelineLayout pipelineLayout;
+    std::vector<vk::UniqueBuffer> uniformBuffers;
+    std::vector<TrackedMemory> uniformBuffersMemory;
+    std::vector<void *> uniformBuffersMapped;
+};
+
+} // namespace pons
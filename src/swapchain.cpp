@@ -0,0 +1,192 @@
+#include "swapchain.h"
+
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <stdexcept>
+
+#include "post_process.h"
+
+namespace pons {
+
+namespace {
+
+// Prefers a format post processing can write as a storage image.
+vk::SurfaceFormatKHR chooseSurfaceFormat(vk::PhysicalDevice physicalDevice,
+                                         const std::vector<vk::SurfaceFormatKHR> &formats, bool bStorage) {
+    if (bStorage) {
+        for (const auto &availableFormat : formats) {
+            if (availableFormat.colorSpace == vk::ColorSpaceKHR::eSrgbNonlinear &&
+                PostProcessChain::supportsDirectOutput(physicalDevice, availableFormat.format)) {
+                return availableFormat;
+            }
+        }
+    }
+    for (const auto &availableFormat : formats) {
+        if (availableFormat.format == vk::Format::eB8G8R8A8Srgb &&
+            availableFormat.colorSpace == vk::ColorSpaceKHR::eSrgbNonlinear) {
+            return availableFormat;
+        }
+    }
+
+    // default
+    return formats.at(0);
+}
+
+vk::PresentModeKHR choosePresentMode(const std::vector<vk::PresentModeKHR> &availablePresentModes) {
+    for (const auto &presentMode : availablePresentModes) {
+        if (presentMode == vk::PresentModeKHR::eMailbox) {
+            return presentMode;
+        }
+    }
+
+    // default
+    return vk::PresentModeKHR::eFifo;
+}
+
+vk::Extent2D chooseExtent(const vk::SurfaceCapabilitiesKHR &capabilities, vk::Extent2D drawableExtent) {
+    if (capabilities.currentExtent.width != std::numeric_limits<uint32_t>::max()) {
+        return capabilities.currentExtent;
+    }
+    return vk::Extent2D{
+        std::clamp(drawableExtent.width, capabilities.minImageExtent.width, capabilities.maxImageExtent.width),
+        std::clamp(drawableExtent.height, capabilities.minImageExtent.height, capabilities.maxImageExtent.height)};
+}
+
+} // namespace
+
+void Swapchain::create(const GpuContext &gpu, const Config &config, vk::Extent2D drawableExtent,
+                       uint32_t framesInFlight) {
+    this->gpu = gpu;
+    this->config = config;
+    imageAvailableSemaphores.reserve(framesInFlight);
+    for (uint32_t i = 0; i < framesInFlight; ++i) {
+        imageAvailableSemaphores.emplace_back(
+            gpu.device.createSemaphoreUnique(vk::SemaphoreCreateInfo{vk::SemaphoreCreateFlags{}}));
+    }
+    createSwapchain(drawableExtent);
+    createRenderPass();
+    createFramebuffers();
+}
+
+void Swapchain::recreate(vk::Extent2D drawableExtent) {
+    framebuffers.clear();
+    imageViews.clear();
+    createSwapchain(drawableExtent);
+    // the format may have changed with the surface
+    createRenderPass();
+    createFramebuffers();
+}
+
+vk::Result Swapchain::acquire(uint32_t frame) {
+    // the pointer overload reports out of date as a result instead of throwing
+    vk::Result result = gpu.device.acquireNextImageKHR(swapchain.get(), std::numeric_limits<uint64_t>::max(),
+                                                       imageAvailableSemaphores.at(frame).get(), nullptr, &imageIndex);
+    if (result != vk::Result::eSuccess && result != vk::Result::eSuboptimalKHR &&
+        result != vk::Result::eErrorOutOfDateKHR) {
+        throw std::runtime_error("failed to acquire swap chain image");
+    }
+    return result;
+}
+
+void Swapchain::createSwapchain(vk::Extent2D drawableExtent) {
+    vk::SurfaceCapabilitiesKHR capabilities = gpu.physicalDevice.getSurfaceCapabilitiesKHR(config.surface);
+    std::vector<vk::SurfaceFormatKHR> formats = gpu.physicalDevice.getSurfaceFormatsKHR(config.surface);
+    std::vector<vk::PresentModeKHR> presentModes = gpu.physicalDevice.getSurfacePresentModesKHR(config.surface);
+
+    bool bStorage =
+        config.bStorageWithoutFormat && capabilities.supportedUsageFlags & vk::ImageUsageFlagBits::eStorage;
+    vk::SurfaceFormatKHR surfaceFormat = chooseSurfaceFormat(gpu.physicalDevice, formats, bStorage);
+    bDirectOutput = bStorage && PostProcessChain::supportsDirectOutput(gpu.physicalDevice, surfaceFormat.format);
+
+    uint32_t imageCount = capabilities.minImageCount + 1;
+    if (capabilities.maxImageCount > 0 && imageCount > capabilities.maxImageCount) {
+        imageCount = capabilities.maxImageCount;
+    }
+
+    vk::SwapchainCreateInfoKHR createInfo{};
+    createInfo.surface = config.surface;
+    createInfo.minImageCount = imageCount;
+    createInfo.imageFormat = surfaceFormat.format;
+    createInfo.imageColorSpace = surfaceFormat.colorSpace;
+    createInfo.imageExtent = chooseExtent(capabilities, drawableExtent);
+    createInfo.imageArrayLayers = 1;
+    // post processing either stores into the image or blits into it, the overlay is drawn on top
+    createInfo.imageUsage = vk::ImageUsageFlagBits::eColorAttachment |
+                            (bDirectOutput ? vk::ImageUsageFlagBits::eStorage : vk::ImageUsageFlagBits::eTransferDst);
+
+    std::array<uint32_t, 2> queueFamilyIndices{config.graphicsFamily, config.presentFamily};
+    if (config.graphicsFamily != config.presentFamily) {
+        createInfo.imageSharingMode = vk::SharingMode::eConcurrent;
+        createInfo.setQueueFamilyIndices(queueFamilyIndices);
+    } else {
+        createInfo.imageSharingMode = vk::SharingMode::eExclusive;
+    }
+    createInfo.preTransform = capabilities.currentTransform;
+    createInfo.compositeAlpha = vk::CompositeAlphaFlagBitsKHR::eOpaque;
+    createInfo.presentMode = choosePresentMode(presentModes);
+    createInfo.clipped = VK_TRUE;
+    // lets the presentation engine hand over the images still on screen
+    createInfo.oldSwapchain = swapchain.get();
+
+    swapchain = gpu.device.createSwapchainKHRUnique(createInfo);
+    images = gpu.device.getSwapchainImagesKHR(swapchain.get());
+    format = surfaceFormat.format;
+    extent = createInfo.imageExtent;
+
+    imageViews.reserve(images.size());
+    for (vk::Image image : images) {
+        vk::ImageViewCreateInfo imageViewCreateInfo(
+            vk::ImageViewCreateFlags{}, image, vk::ImageViewType::e2D, format,
+            vk::ComponentMapping{vk::ComponentSwizzle::eR, vk::ComponentSwizzle::eG, vk::ComponentSwizzle::eB,
+                                 vk::ComponentSwizzle::eA},
+            vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1});
+        imageViews.push_back(gpu.device.createImageViewUnique(imageViewCreateInfo));
+    }
+}
+
+void Swapchain::createRenderPass() {
+    // the overlay is drawn over the post processed image
+    vk::ImageLayout initialLayout = bDirectOutput ? vk::ImageLayout::eGeneral : vk::ImageLayout::eTransferDstOptimal;
+    vk::AttachmentDescription colorAttachment{
+        vk::AttachmentDescriptionFlags{}, format,                        vk::SampleCountFlagBits::e1,
+        vk::AttachmentLoadOp::eLoad,      vk::AttachmentStoreOp::eStore, vk::AttachmentLoadOp::eDontCare,
+        vk::AttachmentStoreOp::eDontCare, initialLayout,                 vk::ImageLayout::ePresentSrcKHR};
+    vk::AttachmentReference colorAttachmentRef{/*attachment*/ 0, vk::ImageLayout::eColorAttachmentOptimal};
+    vk::SubpassDescription subpass{
+        vk::SubpassDescriptionFlags{}, vk::PipelineBindPoint::eGraphics,
+        /*inputAttachmentCount*/ 0,
+        /*pInputAttachments*/ nullptr,
+        /*colorAttachmentCount*/ 1,    &colorAttachmentRef,
+    };
+    vk::SubpassDependency dependency{
+        VK_SUBPASS_EXTERNAL,
+        /*dstSubpass*/ 0,
+        bDirectOutput ? vk::PipelineStageFlagBits::eComputeShader : vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eColorAttachmentOutput,
+        bDirectOutput ? vk::AccessFlagBits::eShaderWrite : vk::AccessFlagBits::eTransferWrite,
+        vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite,
+    };
+    vk::RenderPassCreateInfo renderPassInfo{vk::RenderPassCreateFlags{},
+                                            /*attachmentCount*/ 1,       &colorAttachment,
+                                            /*subpassCount*/ 1,          &subpass,
+                                            /*dependencyCount*/ 1,       &dependency};
+    renderPass = gpu.device.createRenderPassUnique(renderPassInfo);
+}
+
+void Swapchain::createFramebuffers() {
+    framebuffers.reserve(imageViews.size());
+    for (const auto &imageView : imageViews) {
+        vk::ImageView attachments[] = {imageView.get()};
+        vk::FramebufferCreateInfo framebufferInfo{vk::FramebufferCreateFlags{},
+                                                  renderPass.get(),
+                                                  /*attachmentCount*/ 1,
+                                                  attachments,
+                                                  extent.width,
+                                                  extent.height,
+                                                  /*layers*/ 1};
+        framebuffers.emplace_back(gpu.device.createFramebufferUnique(framebufferInfo));
+    }
+}
+
+} // namespace pons
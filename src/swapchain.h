@@ -0,0 +1,63 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#include "gpu.h"
+
+namespace pons {
+
+// Swapchain of one window surface, with the framebuffers of the overlay pass that is drawn last over the post
+// processed image and leaves it ready to present. Acquire semaphores are kept per frame in flight.
+class Swapchain {
+public:
+    struct Config {
+        vk::SurfaceKHR surface;
+        uint32_t graphicsFamily = 0;
+        uint32_t presentFamily = 0;
+        bool bStorageWithoutFormat = false; // prefer formats post processing can store into
+    };
+
+    // `drawableExtent` is used when the surface leaves the size up to the swapchain.
+    void create(const GpuContext &gpu, const Config &config, vk::Extent2D drawableExtent, uint32_t framesInFlight);
+    // Rebuilds everything but the semaphores, the old swapchain must not be in use anymore.
+    void recreate(vk::Extent2D drawableExtent);
+
+    // Acquires the next image, signalling the semaphore of `frame`. Out of date and suboptimal results are returned,
+    // other failures throw.
+    vk::Result acquire(uint32_t frame);
+    uint32_t getImageIndex() const { return imageIndex; }
+    vk::Semaphore getImageAvailable(uint32_t frame) const { return imageAvailableSemaphores.at(frame).get(); }
+
+    vk::SwapchainKHR get() const { return swapchain.get(); }
+    const std::vector<vk::Image> &getImages() const { return images; }
+    const std::vector<vk::UniqueImageView> &getImageViews() const { return imageViews; }
+    vk::Format getFormat() const { return format; }
+    vk::Extent2D getExtent() const { return extent; }
+    // Post processing stores straight into the images instead of blitting into them.
+    bool isDirectOutput() const { return bDirectOutput; }
+    vk::RenderPass getRenderPass() const { return renderPass.get(); }
+    vk::Framebuffer getFramebuffer(uint32_t image) const { return framebuffers.at(image).get(); }
+
+private:
+    void createSwapchain(vk::Extent2D drawableExtent);
+    void createRenderPass();
+    void createFramebuffers();
+
+    GpuContext gpu;
+    Config config;
+    vk::UniqueSwapchainKHR swapchain;
+    std::vector<vk::Image> images;
+    std::vector<vk::UniqueImageView> imageViews;
+    vk::Format format = vk::Format::eUndefined;
+    vk::Extent2D extent;
+    bool bDirectOutput = false;
+    uint32_t imageIndex = 0;
+    vk::UniqueRenderPass renderPass;
+    std::vector<vk::UniqueFramebuffer> framebuffers;
+    std::vector<vk::UniqueSemaphore> imageAvailableSemaphores;
+};
+
+} // namespace pons
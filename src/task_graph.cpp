@@ -0,0 +1,113 @@
+#include "task_graph.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <numeric>
+
+namespace pons {
+
+TaskId TaskGraph::add(std::string name, std::function<void()> work, std::initializer_list<TaskId> dependencies,
+                      TaskThread thread) {
+    auto id = static_cast<TaskId>(tasks.size());
+    Task &task = tasks.emplace_back();
+    task.name = std::move(name);
+    task.work = std::move(work);
+    task.thread = thread;
+    for (TaskId dependency : dependencies) {
+        // ids are handed out in order, so the graph can't have cycles
+        tasks.at(dependency).dependents.push_back(id);
+        ++task.pendingDependencies;
+    }
+    return id;
+}
+
+void TaskGraph::run(ThreadPool &pool) {
+    startTime = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(mutex);
+    remaining = tasks.size();
+    for (TaskId id = 0; id < tasks.size(); ++id) {
+        if (tasks[id].pendingDependencies == 0) {
+            schedule(id, pool);
+        }
+    }
+    while (remaining > 0) {
+        changed.wait(lock, [this] { return !mainQueue.empty() || remaining == 0; });
+        while (!mainQueue.empty()) {
+            TaskId id = mainQueue.front();
+            mainQueue.pop_front();
+            lock.unlock();
+            execute(id, pool);
+            lock.lock();
+        }
+    }
+    wallMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+    if (failure) {
+        std::rethrow_exception(failure);
+    }
+}
+
+std::string TaskGraph::formatTimings() const {
+    std::vector<TaskId> order(tasks.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(),
+              [this](TaskId a, TaskId b) { return tasks[a].timing.startMs < tasks[b].timing.startMs; });
+    std::string text;
+    float taskMs = 0.0f;
+    char line[128];
+    for (TaskId id : order) {
+        const Task &task = tasks[id];
+        std::snprintf(line, sizeof(line), "  %-24s +%8.2f ms %8.2f ms%s\n", task.name.c_str(),
+                      static_cast<double>(task.timing.startMs), static_cast<double>(task.timing.durationMs),
+                      task.thread == TaskThread::Main ? " (main)" : "");
+        text += line;
+        taskMs += task.timing.durationMs;
+    }
+    std::snprintf(line, sizeof(line), "  %zu tasks in %.2f ms, %.2f ms of work\n", tasks.size(),
+                  static_cast<double>(wallMs), static_cast<double>(taskMs));
+    text += line;
+    return text;
+}
+
+// Called with the mutex held.
+void TaskGraph::schedule(TaskId id, ThreadPool &pool) {
+    if (tasks[id].thread == TaskThread::Main) {
+        mainQueue.push_back(id);
+        changed.notify_all();
+    } else {
+        pool.submit([this, id, &pool] { execute(id, pool); });
+    }
+}
+
+void TaskGraph::execute(TaskId id, ThreadPool &pool) {
+    Task &task = tasks[id];
+    bool bSkip;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        bSkip = failure != nullptr;
+    }
+    auto begin = std::chrono::steady_clock::now();
+    if (!bSkip) {
+        try {
+            task.work();
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!failure) {
+                failure = std::current_exception();
+            }
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    task.timing.startMs = std::chrono::duration<float, std::milli>(begin - startTime).count();
+    task.timing.durationMs = std::chrono::duration<float, std::milli>(end - begin).count();
+    for (TaskId dependent : task.dependents) {
+        if (--tasks[dependent].pendingDependencies == 0) {
+            schedule(dependent, pool);
+        }
+    }
+    --remaining;
+    changed.notify_all();
+}
+
+} // namespace pons
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "thread_pool.h"
+
+namespace pons {
+
+using TaskId = uint32_t;
+
+enum class TaskThread {
+    Worker,
+    Main, // bound to the thread calling run, for SDL and anything else tied to the window thread
+};
+
+struct TaskTiming {
+    float startMs = 0.0f; // since run started
+    float durationMs = 0.0f;
+};
+
+// One-shot graph of dependent tasks. A task is handed to the pool as soon as its last dependency finishes, main
+// thread tasks are run by the thread waiting in run.
+class TaskGraph {
+public:
+    TaskId add(std::string name, std::function<void()> work, std::initializer_list<TaskId> dependencies = {},
+               TaskThread thread = TaskThread::Worker);
+
+    // Blocks until every task is done. After a failure the tasks not yet started are skipped and the first
+    // exception is rethrown once the running ones finish.
+    void run(ThreadPool &pool);
+
+    const TaskTiming &getTiming(TaskId id) const { return tasks.at(id).timing; }
+    // One line per task in start order, then the wall time against the summed task time.
+    std::string formatTimings() const;
+
+private:
+    struct Task {
+        std::string name;
+        std::function<void()> work;
+        TaskThread thread;
+        std::vector<TaskId> dependents;
+        uint32_t pendingDependencies = 0;
+        TaskTiming timing;
+    };
+
+    void schedule(TaskId id, ThreadPool &pool);
+    void execute(TaskId id, ThreadPool &pool);
+
+    std::vector<Task> tasks;
+    std::chrono::steady_clock::time_point startTime;
+    float wallMs = 0.0f;
+    std::mutex mutex; // guards the scheduling state below and the dependency counters
+    std::condition_variable changed;
+    std::deque<TaskId> mainQueue;
+    size_t remaining = 0;
+    std::exception_ptr failure;
+};
+
+} // namespace pons
@@ -0,0 +1,600 @@
+#include "text.h"
+
+#include FT_MODULE_H
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <utility>
+
+#include "archive.h"
+
+namespace pons {
+
+namespace {
+
+const char ATLAS_CACHE_MAGIC[4] = {'P', 'S', 'D', 'F'};
+const uint32_t ATLAS_CACHE_VERSION = 1;
+const uint32_t GLYPH_PADDING = 1; // keeps bilinear filtering from bleeding into neighbours
+const std::array<uint16_t, 6> QUAD_INDICES = {0, 1, 2, 2, 3, 0};
+
+struct AtlasCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t fontKey;
+    uint32_t pageCount;
+    uint32_t glyphCount;
+};
+
+struct CachedPage {
+    uint32_t penX;
+    uint32_t penY;
+    uint32_t rowHeight;
+};
+
+struct CachedGlyph {
+    uint32_t codepoint;
+    Glyph glyph;
+};
+
+// Invalid sequences decode to U+FFFD.
+uint32_t decodeUtf8(std::string_view text, size_t &i) {
+    const uint32_t replacement = 0xfffd;
+    uint8_t lead = static_cast<uint8_t>(text[i++]);
+    uint32_t length = lead < 0x80 ? 0 : lead >= 0xf0 ? 3 : lead >= 0xe0 ? 2 : lead >= 0xc0 ? 1 : 4;
+    if (length == 4) {
+        return replacement;
+    }
+    uint32_t codepoint = length == 0 ? lead : lead & (0x3fu >> length);
+    for (uint32_t k = 0; k < length; ++k) {
+        if (i >= text.size() || (static_cast<uint8_t>(text[i]) & 0xc0) != 0x80) {
+            return replacement;
+        }
+        codepoint = (codepoint << 6) | (static_cast<uint8_t>(text[i++]) & 0x3f);
+    }
+    return codepoint;
+}
+
+uint32_t packColor(glm::vec4 color) {
+    glm::vec4 scaled = glm::clamp(color, 0.0f, 1.0f) * 255.0f + 0.5f;
+    return static_cast<uint32_t>(scaled.r) | static_cast<uint32_t>(scaled.g) << 8 |
+           static_cast<uint32_t>(scaled.b) << 16 | static_cast<uint32_t>(scaled.a) << 24;
+}
+
+// Identifies the font file and rasterization settings the cached atlas was built with.
+uint64_t computeFontKey(const std::string &fontPath) {
+    std::filesystem::path path(fontPath);
+    std::string key = std::filesystem::absolute(path).string() + ":" +
+                      std::to_string(std::filesystem::file_size(path)) + ":" +
+                      std::to_string(std::filesystem::last_write_time(path).time_since_epoch().count()) + ":" +
+                      std::to_string(TEXT_GLYPH_SIZE) + ":" + std::to_string(TEXT_SDF_SPREAD) + ":" +
+                      std::to_string(TEXT_ATLAS_SIZE);
+    return hashName(key);
+}
+
+} // namespace
+
+TextRenderer::~TextRenderer() {
+    if (face) {
+        FT_Done_Face(face);
+    }
+    if (library) {
+        FT_Done_FreeType(library);
+    }
+}
+
+void TextRenderer::create(const GpuContext &gpu, vk::RenderPass renderPass, uint32_t framesInFlight,
+                          const std::string &fontPath, const std::string &cachePath) {
+    this->gpu = gpu;
+    this->cachePath = cachePath;
+    if (FT_Init_FreeType(&library) != 0) {
+        throw std::runtime_error("failed to initialize FreeType");
+    }
+    if (FT_New_Face(library, fontPath.c_str(), 0, &face) != 0) {
+        throw std::runtime_error("failed to load font " + fontPath);
+    }
+    FT_Set_Pixel_Sizes(face, 0, TEXT_GLYPH_SIZE);
+    FT_Int spread = TEXT_SDF_SPREAD;
+    FT_Property_Set(library, "sdf", "spread", &spread);
+    FT_Property_Set(library, "bsdf", "spread", &spread);
+
+    fontKey = computeFontKey(fontPath);
+    if (!loadCache()) {
+        glyphs.clear();
+        pages.clear();
+    }
+
+    vk::DeviceSize vertexBufferSize = sizeof(TextVertex) * 4 * TEXT_MAX_GLYPHS;
+    vk::DeviceSize stagingBufferSize = TEXT_ATLAS_SIZE * TEXT_ATLAS_SIZE;
+    for (uint32_t i = 0; i < framesInFlight; ++i) {
+        auto [vertexBuffer, vertexBufferMemory] =
+            createBuffer(gpu, vertexBufferSize, vk::BufferUsageFlagBits::eVertexBuffer,
+                         vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+        auto [stagingBuffer, stagingBufferMemory] =
+            createBuffer(gpu, stagingBufferSize, vk::BufferUsageFlagBits::eTransferSrc,
+                         vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+                         MemoryCategory::Staging);
+        void *vertexData;
+        void *stagingData;
+        if (gpu.device.mapMemory(vertexBufferMemory.get(), 0, vertexBufferSize, vk::MemoryMapFlags{}, &vertexData) !=
+                vk::Result::eSuccess ||
+            gpu.device.mapMemory(stagingBufferMemory.get(), 0, stagingBufferSize, vk::MemoryMapFlags{},
+                                 &stagingData) != vk::Result::eSuccess) {
+            throw std::runtime_error("failed to map memory of text buffers");
+        }
+        vertexBuffers.emplace_back(std::move(vertexBuffer));
+        vertexBuffersMemory.emplace_back(std::move(vertexBufferMemory));
+        vertexBuffersMapped.push_back(vertexData);
+        stagingBuffers.emplace_back(std::move(stagingBuffer));
+        stagingBuffersMemory.emplace_back(std::move(stagingBufferMemory));
+        stagingBuffersMapped.push_back(stagingData);
+    }
+
+    // every glyph is a quad, so one index pattern serves all draws
+    std::vector<uint16_t> indices;
+    indices.reserve(6 * TEXT_MAX_GLYPHS);
+    for (uint32_t i = 0; i < TEXT_MAX_GLYPHS; ++i) {
+        uint16_t base = static_cast<uint16_t>(4 * i);
+        for (uint16_t offset : QUAD_INDICES) {
+            indices.push_back(static_cast<uint16_t>(base + offset));
+        }
+    }
+    std::tie(indexBuffer, indexBufferMemory) = createDeviceLocalBuffer(
+        gpu, indices.data(), sizeof(indices[0]) * indices.size(), vk::BufferUsageFlagBits::eIndexBuffer);
+
+    vk::SamplerCreateInfo samplerInfo{vk::SamplerCreateFlags{},
+                                      vk::Filter::eLinear,
+                                      vk::Filter::eLinear,
+                                      vk::SamplerMipmapMode::eNearest,
+                                      vk::SamplerAddressMode::eClampToEdge,
+                                      vk::SamplerAddressMode::eClampToEdge,
+                                      vk::SamplerAddressMode::eClampToEdge};
+    sampler = gpu.device.createSamplerUnique(samplerInfo);
+
+    vk::DescriptorSetLayoutBinding atlasBinding{/*binding*/ 0, vk::DescriptorType::eCombinedImageSampler,
+                                                /*descriptorCount*/ 1, vk::ShaderStageFlagBits::eFragment, nullptr};
+    descriptorSetLayout =
+        gpu.device.createDescriptorSetLayoutUnique({vk::DescriptorSetLayoutCreateFlags{}, atlasBinding});
+    vk::DescriptorPoolSize poolSize{vk::DescriptorType::eCombinedImageSampler, TEXT_MAX_ATLAS_PAGES};
+    descriptorPool = gpu.device.createDescriptorPoolUnique(
+        {vk::DescriptorPoolCreateFlags{}, /*maxSets*/ TEXT_MAX_ATLAS_PAGES, poolSize});
+    for (AtlasPage &page : pages) {
+        createPageImage(page);
+    }
+
+    createPipeline(renderPass);
+}
+
+void TextRenderer::createPipeline(vk::RenderPass renderPass) {
+    vk::UniqueShaderModule vertShaderModule = createShaderModule(gpu.device, readShader("text_vert.spv"));
+    vk::UniqueShaderModule fragShaderModule = createShaderModule(gpu.device, readShader("text_frag.spv"));
+    std::array<vk::PipelineShaderStageCreateInfo, 2> shaderStages{
+        {{vk::PipelineShaderStageCreateFlags{}, vk::ShaderStageFlagBits::eVertex, vertShaderModule.get(), "main"},
+         {vk::PipelineShaderStageCreateFlags{}, vk::ShaderStageFlagBits::eFragment, fragShaderModule.get(), "main"}}};
+
+    auto bindingDescription = TextVertex::getBindingDescription();
+    auto attributeDescriptions = TextVertex::getAttributeDescriptions();
+    vk::PipelineVertexInputStateCreateInfo vertexInputInfo{vk::PipelineVertexInputStateCreateFlags{},
+                                                           bindingDescription, attributeDescriptions};
+    vk::PipelineInputAssemblyStateCreateInfo inputAssembly{vk::PipelineInputAssemblyStateCreateFlags{},
+                                                           vk::PrimitiveTopology::eTriangleList, false};
+    // viewport and scissor are dynamic, the pipeline only depends on the render pass
+    vk::PipelineViewportStateCreateInfo viewportState{vk::PipelineViewportStateCreateFlags{}, 1, nullptr, 1, nullptr};
+    vk::PipelineRasterizationStateCreateInfo rasterizer{vk::PipelineRasterizationStateCreateFlags{},
+                                                        /*depthClamp*/ false,
+                                                        /*rasterizeDiscard*/ false,
+                                                        vk::PolygonMode::eFill,
+                                                        vk::CullModeFlagBits::eNone,
+                                                        vk::FrontFace::eCounterClockwise,
+                                                        /*depthBias*/ false,
+                                                        /*depthBiasConstantFactor*/ 0.0f,
+                                                        /*depthBiasClamp*/ 0.0f,
+                                                        /*depthBiasSlopeFactor*/ 0.0f,
+                                                        /*lineWidth*/ 1.0f};
+    vk::PipelineMultisampleStateCreateInfo multisampling{vk::PipelineMultisampleStateCreateFlags{},
+                                                         vk::SampleCountFlagBits::e1};
+    vk::PipelineColorBlendAttachmentState colorBlendAttachment{
+        /*blend*/ true,
+        vk::BlendFactor::eSrcAlpha,
+        vk::BlendFactor::eOneMinusSrcAlpha,
+        vk::BlendOp::eAdd,
+        vk::BlendFactor::eOne,
+        vk::BlendFactor::eOneMinusSrcAlpha,
+        vk::BlendOp::eAdd,
+        vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB |
+            vk::ColorComponentFlagBits::eA};
+    vk::PipelineColorBlendStateCreateInfo colorBlending{vk::PipelineColorBlendStateCreateFlags{},
+                                                        /*logicOpEnable*/ false, vk::LogicOp::eCopy,
+                                                        colorBlendAttachment};
+    std::array<vk::DynamicState, 2> dynamicStates{vk::DynamicState::eViewport, vk::DynamicState::eScissor};
+    vk::PipelineDynamicStateCreateInfo dynamicState{vk::PipelineDynamicStateCreateFlags{}, dynamicStates};
+
+    if (!pipelineLayout) {
+        vk::PushConstantRange pushConstantRange{vk::ShaderStageFlagBits::eVertex, /*offset*/ 0, sizeof(glm::vec2)};
+        vk::DescriptorSetLayout setLayout = descriptorSetLayout.get();
+        pipelineLayout = gpu.device.createPipelineLayoutUnique(
+            vk::PipelineLayoutCreateInfo{vk::PipelineLayoutCreateFlags{}, setLayout, pushConstantRange});
+    }
+
+    vk::GraphicsPipelineCreateInfo pipelineInfo{vk::PipelineCreateFlags{},
+                                                shaderStages,
+                                                &vertexInputInfo,
+                                                &inputAssembly,
+                                                /*pTessellationState*/ nullptr,
+                                                &viewportState,
+                                                &rasterizer,
+                                                &multisampling,
+                                                /*pDepthStencilState*/ nullptr,
+                                                &colorBlending,
+                                                &dynamicState,
+                                                pipelineLayout.get(),
+                                                renderPass,
+                                                /*subpass*/ 0};
+    pipeline = gpu.device.createGraphicsPipelineUnique(nullptr, pipelineInfo).value;
+}
+
+bool TextRenderer::loadCache() {
+    std::ifstream file(cachePath, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        return false;
+    }
+    uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+    file.seekg(0);
+    AtlasCacheHeader header{};
+    file.read(reinterpret_cast<char *>(&header), sizeof(header));
+    if (!file || std::memcmp(header.magic, ATLAS_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != ATLAS_CACHE_VERSION || header.fontKey != fontKey ||
+        header.pageCount > TEXT_MAX_ATLAS_PAGES) {
+        return false;
+    }
+    // the counts come from disk, a file that can't hold them is truncated or corrupt
+    uint64_t expectedSize = sizeof(header) + uint64_t{header.glyphCount} * sizeof(CachedGlyph) +
+                            uint64_t{header.pageCount} * (sizeof(CachedPage) + TEXT_ATLAS_SIZE * TEXT_ATLAS_SIZE);
+    if (fileSize != expectedSize) {
+        return false;
+    }
+    for (uint32_t i = 0; i < header.glyphCount; ++i) {
+        CachedGlyph cached;
+        file.read(reinterpret_cast<char *>(&cached), sizeof(cached));
+        const Glyph &glyph = cached.glyph;
+        if (!file) {
+            return false;
+        }
+        // empty glyphs are never drawn, so their page isn't looked at
+        if (glyph.width > 0 && (glyph.page >= header.pageCount || uint32_t{glyph.x} + glyph.width > TEXT_ATLAS_SIZE ||
+                                uint32_t{glyph.y} + glyph.height > TEXT_ATLAS_SIZE)) {
+            return false;
+        }
+        glyphs.emplace(cached.codepoint, glyph);
+    }
+    pages.resize(header.pageCount);
+    for (AtlasPage &page : pages) {
+        CachedPage cached;
+        file.read(reinterpret_cast<char *>(&cached), sizeof(cached));
+        page.penX = cached.penX;
+        page.penY = cached.penY;
+        page.rowHeight = cached.rowHeight;
+        page.pixels.resize(TEXT_ATLAS_SIZE * TEXT_ATLAS_SIZE);
+        file.read(reinterpret_cast<char *>(page.pixels.data()), static_cast<std::streamsize>(page.pixels.size()));
+        page.dirtyBegin = 0;
+        page.dirtyEnd = TEXT_ATLAS_SIZE;
+    }
+    return static_cast<bool>(file);
+}
+
+void TextRenderer::saveCache() {
+    if (!bCacheDirty) {
+        return;
+    }
+    // write next to the cache and swap, so a crash never leaves a torn file behind
+    std::string tempPath = cachePath + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            return;
+        }
+        AtlasCacheHeader header{};
+        std::memcpy(header.magic, ATLAS_CACHE_MAGIC, sizeof(header.magic));
+        header.version = ATLAS_CACHE_VERSION;
+        header.fontKey = fontKey;
+        header.pageCount = static_cast<uint32_t>(pages.size());
+        header.glyphCount = static_cast<uint32_t>(glyphs.size());
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        for (const auto &[codepoint, glyph] : glyphs) {
+            CachedGlyph cached{codepoint, glyph};
+            file.write(reinterpret_cast<const char *>(&cached), sizeof(cached));
+        }
+        for (const AtlasPage &page : pages) {
+            CachedPage cached{page.penX, page.penY, page.rowHeight};
+            file.write(reinterpret_cast<const char *>(&cached), sizeof(cached));
+            file.write(reinterpret_cast<const char *>(page.pixels.data()),
+                       static_cast<std::streamsize>(page.pixels.size()));
+        }
+        if (!file) {
+            return;
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(tempPath, cachePath, error);
+    bCacheDirty = static_cast<bool>(error);
+}
+
+bool TextRenderer::allocateRect(uint32_t width, uint32_t height, uint32_t &page, uint32_t &x, uint32_t &y) {
+    width += GLYPH_PADDING;
+    height += GLYPH_PADDING;
+    if (width > TEXT_ATLAS_SIZE || height > TEXT_ATLAS_SIZE) {
+        return false;
+    }
+    if (!pages.empty()) {
+        AtlasPage &current = pages.back();
+        if (current.penX + width > TEXT_ATLAS_SIZE) {
+            // next shelf
+            current.penX = 0;
+            current.penY += current.rowHeight;
+            current.rowHeight = 0;
+        }
+        if (current.penY + height <= TEXT_ATLAS_SIZE) {
+            page = static_cast<uint32_t>(pages.size() - 1);
+            x = current.penX;
+            y = current.penY;
+            current.penX += width;
+            current.rowHeight = std::max(current.rowHeight, height);
+            return true;
+        }
+    }
+    if (pages.size() == TEXT_MAX_ATLAS_PAGES) {
+        return false;
+    }
+    AtlasPage &added = pages.emplace_back();
+    added.pixels.assign(TEXT_ATLAS_SIZE * TEXT_ATLAS_SIZE, 0);
+    added.dirtyBegin = 0;
+    added.dirtyEnd = TEXT_ATLAS_SIZE;
+    page = static_cast<uint32_t>(pages.size() - 1);
+    x = 0;
+    y = 0;
+    added.penX = width;
+    added.rowHeight = height;
+    return true;
+}
+
+const Glyph *TextRenderer::rasterizeGlyph(uint32_t codepoint) {
+    FT_UInt glyphIndex = FT_Get_Char_Index(face, codepoint);
+    if (FT_Load_Glyph(face, glyphIndex, FT_LOAD_DEFAULT) != 0) {
+        return nullptr;
+    }
+    Glyph glyph{};
+    glyph.glyphIndex = glyphIndex;
+    glyph.advance = static_cast<float>(face->glyph->advance.x) / 64.0f;
+    // whitespace has no outline to render and only advances the pen
+    if (face->glyph->outline.n_points > 0 || face->glyph->format == FT_GLYPH_FORMAT_BITMAP) {
+        if (FT_Render_Glyph(face->glyph, FT_RENDER_MODE_SDF) != 0) {
+            return nullptr;
+        }
+        const FT_Bitmap &bitmap = face->glyph->bitmap;
+        uint32_t page, x, y;
+        // with the atlas full the glyph is kept empty, so it isn't rasterized again on every use
+        if (bitmap.width > 0 && bitmap.rows > 0 && allocateRect(bitmap.width, bitmap.rows, page, x, y)) {
+            AtlasPage &atlasPage = pages[page];
+            for (uint32_t row = 0; row < bitmap.rows; ++row) {
+                const uint8_t *pSrc = bitmap.buffer + static_cast<std::ptrdiff_t>(row) * bitmap.pitch;
+                std::memcpy(&atlasPage.pixels[(y + row) * TEXT_ATLAS_SIZE + x], pSrc, bitmap.width);
+            }
+            atlasPage.dirtyBegin = std::min(atlasPage.dirtyBegin, y);
+            atlasPage.dirtyEnd = std::max(atlasPage.dirtyEnd, y + bitmap.rows);
+            glyph.page = page;
+            glyph.x = static_cast<uint16_t>(x);
+            glyph.y = static_cast<uint16_t>(y);
+            glyph.width = static_cast<uint16_t>(bitmap.width);
+            glyph.height = static_cast<uint16_t>(bitmap.rows);
+            glyph.bearingX = static_cast<int16_t>(face->glyph->bitmap_left);
+            glyph.bearingY = static_cast<int16_t>(face->glyph->bitmap_top);
+        }
+    }
+    bCacheDirty = true;
+    return &glyphs.emplace(codepoint, glyph).first->second;
+}
+
+const Glyph *TextRenderer::getGlyph(uint32_t codepoint) {
+    auto it = glyphs.find(codepoint);
+    if (it != glyphs.end()) {
+        return &it->second;
+    }
+    return rasterizeGlyph(codepoint);
+}
+
+float TextRenderer::getLineHeight(float pixelSize) const {
+    return static_cast<float>(face->size->metrics.height) / 64.0f * pixelSize / static_cast<float>(TEXT_GLYPH_SIZE);
+}
+
+glm::vec2 TextRenderer::addText(std::string_view text, glm::vec2 position, float pixelSize, glm::vec4 color) {
+    float scale = pixelSize / static_cast<float>(TEXT_GLYPH_SIZE);
+    float ascender = static_cast<float>(face->size->metrics.ascender) / 64.0f * scale;
+    float lineHeight = getLineHeight(pixelSize);
+    uint32_t packedColor = packColor(color);
+    bool bKerning = FT_HAS_KERNING(face);
+    float invAtlasSize = 1.0f / static_cast<float>(TEXT_ATLAS_SIZE);
+
+    glm::vec2 pen = position;
+    glm::vec2 size{0.0f, lineHeight};
+    FT_UInt previousIndex = 0;
+    size_t queuedGlyphs = 0;
+    for (const auto &quads : pageQuads) {
+        queuedGlyphs += quads.size() / 4;
+    }
+    for (size_t i = 0; i < text.size();) {
+        uint32_t codepoint = decodeUtf8(text, i);
+        if (codepoint == '\n') {
+            pen = {position.x, pen.y + lineHeight};
+            size.y += lineHeight;
+            previousIndex = 0;
+            continue;
+        }
+        const Glyph *pGlyph = getGlyph(codepoint);
+        if (!pGlyph) {
+            continue;
+        }
+        if (bKerning && previousIndex != 0) {
+            FT_Vector kerning;
+            FT_Get_Kerning(face, previousIndex, pGlyph->glyphIndex, FT_KERNING_UNFITTED, &kerning);
+            pen.x += static_cast<float>(kerning.x) / 64.0f * scale;
+        }
+        previousIndex = pGlyph->glyphIndex;
+
+        if (pGlyph->width > 0 && queuedGlyphs < TEXT_MAX_GLYPHS) {
+            glm::vec2 topLeft{pen.x + static_cast<float>(pGlyph->bearingX) * scale,
+                              pen.y + ascender - static_cast<float>(pGlyph->bearingY) * scale};
+            glm::vec2 bottomRight = topLeft + glm::vec2(pGlyph->width, pGlyph->height) * scale;
+            glm::vec2 uvTopLeft = glm::vec2(pGlyph->x, pGlyph->y) * invAtlasSize;
+            glm::vec2 uvBottomRight = glm::vec2(pGlyph->x + pGlyph->width, pGlyph->y + pGlyph->height) * invAtlasSize;
+            if (pageQuads.size() < pages.size()) {
+                pageQuads.resize(pages.size());
+            }
+            std::vector<TextVertex> &quads = pageQuads[pGlyph->page];
+            quads.push_back({topLeft, uvTopLeft, packedColor});
+            quads.push_back({{topLeft.x, bottomRight.y}, {uvTopLeft.x, uvBottomRight.y}, packedColor});
+            quads.push_back({bottomRight, uvBottomRight, packedColor});
+            quads.push_back({{bottomRight.x, topLeft.y}, {uvBottomRight.x, uvTopLeft.y}, packedColor});
+            ++queuedGlyphs;
+        }
+        pen.x += pGlyph->advance * scale;
+        size.x = std::max(size.x, pen.x - position.x);
+    }
+    return size;
+}
+
+void TextRenderer::createPageImage(AtlasPage &page) {
+    vk::ImageCreateInfo imageInfo{vk::ImageCreateFlags{},
+                                  vk::ImageType::e2D,
+                                  vk::Format::eR8Unorm,
+                                  vk::Extent3D{TEXT_ATLAS_SIZE, TEXT_ATLAS_SIZE, 1},
+                                  /*mipLevels*/ 1,
+                                  /*arrayLayers*/ 1,
+                                  vk::SampleCountFlagBits::e1,
+                                  vk::ImageTiling::eOptimal,
+                                  vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled};
+    std::tie(page.image, page.imageMemory) = createImage(gpu, imageInfo, vk::MemoryPropertyFlagBits::eDeviceLocal);
+    vk::ImageViewCreateInfo viewInfo{vk::ImageViewCreateFlags{}, page.image.get(), vk::ImageViewType::e2D,
+                                     vk::Format::eR8Unorm, vk::ComponentMapping{},
+                                     vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1}};
+    page.imageView = gpu.device.createImageViewUnique(viewInfo);
+    page.layout = vk::ImageLayout::eUndefined;
+
+    vk::DescriptorSetLayout setLayout = descriptorSetLayout.get();
+    page.descriptorSet = gpu.device.allocateDescriptorSets({descriptorPool.get(), setLayout}).front();
+    vk::DescriptorImageInfo imageDescriptor{sampler.get(), page.imageView.get(),
+                                            vk::ImageLayout::eShaderReadOnlyOptimal};
+    vk::WriteDescriptorSet descriptorWrite{page.descriptorSet, /*dstBinding*/ 0, /*dstArrayElement*/ 0,
+                                           /*descriptorCount*/ 1, vk::DescriptorType::eCombinedImageSampler,
+                                           &imageDescriptor};
+    gpu.device.updateDescriptorSets(descriptorWrite, nullptr);
+}
+
+bool TextRenderer::createPendingPages() {
+    bool bCreated = false;
+    for (AtlasPage &page : pages) {
+        if (!page.image) {
+            createPageImage(page);
+            bCreated = true;
+        }
+    }
+    return bCreated;
+}
+
+void TextRenderer::recordUploads(vk::CommandBuffer commandBuffer, uint32_t frame) {
+    auto *pStaging = static_cast<uint8_t *>(stagingBuffersMapped.at(frame));
+    vk::DeviceSize stagingOffset = 0;
+    for (AtlasPage &page : pages) {
+        if (page.dirtyBegin >= page.dirtyEnd) {
+            continue;
+        }
+        // never uploaded, previous contents don't matter and the whole page goes up
+        if (page.layout == vk::ImageLayout::eUndefined) {
+            page.dirtyBegin = 0;
+            page.dirtyEnd = TEXT_ATLAS_SIZE;
+        }
+        vk::DeviceSize size = vk::DeviceSize{page.dirtyEnd - page.dirtyBegin} * TEXT_ATLAS_SIZE;
+        if (stagingOffset + size > TEXT_ATLAS_SIZE * TEXT_ATLAS_SIZE) {
+            break; // staging is full, rest goes up next frame
+        }
+        std::memcpy(pStaging + stagingOffset, &page.pixels[page.dirtyBegin * TEXT_ATLAS_SIZE],
+                    static_cast<size_t>(size));
+
+        vk::ImageSubresourceRange range{vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1};
+        // previous frames may still sample the page, the barrier orders the copy after them
+        vk::ImageMemoryBarrier toTransfer{vk::AccessFlagBits::eShaderRead,
+                                          vk::AccessFlagBits::eTransferWrite,
+                                          page.layout,
+                                          vk::ImageLayout::eTransferDstOptimal,
+                                          VK_QUEUE_FAMILY_IGNORED,
+                                          VK_QUEUE_FAMILY_IGNORED,
+                                          page.image.get(),
+                                          range};
+        commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eFragmentShader,
+                                      vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags{}, nullptr, nullptr,
+                                      toTransfer);
+        vk::BufferImageCopy region{stagingOffset,
+                                   /*bufferRowLength*/ 0,
+                                   /*bufferImageHeight*/ 0,
+                                   vk::ImageSubresourceLayers{vk::ImageAspectFlagBits::eColor, 0, 0, 1},
+                                   vk::Offset3D{0, static_cast<int32_t>(page.dirtyBegin), 0},
+                                   vk::Extent3D{TEXT_ATLAS_SIZE, page.dirtyEnd - page.dirtyBegin, 1}};
+        commandBuffer.copyBufferToImage(stagingBuffers.at(frame).get(), page.image.get(),
+                                        vk::ImageLayout::eTransferDstOptimal, region);
+        vk::ImageMemoryBarrier toShader{vk::AccessFlagBits::eTransferWrite,
+                                        vk::AccessFlagBits::eShaderRead,
+                                        vk::ImageLayout::eTransferDstOptimal,
+                                        vk::ImageLayout::eShaderReadOnlyOptimal,
+                                        VK_QUEUE_FAMILY_IGNORED,
+                                        VK_QUEUE_FAMILY_IGNORED,
+                                        page.image.get(),
+                                        range};
+        commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eFragmentShader,
+                                      vk::DependencyFlags{}, nullptr, nullptr, toShader);
+        page.layout = vk::ImageLayout::eShaderReadOnlyOptimal;
+        page.dirtyBegin = TEXT_ATLAS_SIZE;
+        page.dirtyEnd = 0;
+        stagingOffset += size;
+    }
+}
+
+void TextRenderer::recordDraw(vk::CommandBuffer commandBuffer, uint32_t frame, vk::Extent2D extent) {
+    auto *pVertices = static_cast<TextVertex *>(vertexBuffersMapped.at(frame));
+    std::vector<std::pair<uint32_t, uint32_t>> pageRanges(pageQuads.size()); // first vertex, vertex count
+    uint32_t vertexCount = 0;
+    for (size_t i = 0; i < pageQuads.size(); ++i) {
+        uint32_t count = static_cast<uint32_t>(pageQuads[i].size());
+        std::memcpy(pVertices + vertexCount, pageQuads[i].data(), sizeof(TextVertex) * count);
+        pageRanges[i] = {vertexCount, count};
+        vertexCount += count;
+        pageQuads[i].clear();
+    }
+    if (vertexCount == 0) {
+        return;
+    }
+
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline.get());
+    vk::Viewport viewport{0.0f, 0.0f, static_cast<float>(extent.width), static_cast<float>(extent.height),
+                          0.0f, 1.0f};
+    commandBuffer.setViewport(0, viewport);
+    commandBuffer.setScissor(0, vk::Rect2D{{0, 0}, extent});
+    glm::vec2 invExtent{1.0f / static_cast<float>(extent.width), 1.0f / static_cast<float>(extent.height)};
+    commandBuffer.pushConstants(pipelineLayout.get(), vk::ShaderStageFlagBits::eVertex, 0, sizeof(invExtent),
+                                &invExtent);
+    vk::DeviceSize offset = 0;
+    commandBuffer.bindVertexBuffers(0, vertexBuffers.at(frame).get(), offset);
+    commandBuffer.bindIndexBuffer(indexBuffer.get(), 0, vk::IndexType::eUint16);
+    for (size_t i = 0; i < pageRanges.size(); ++i) {
+        auto [firstVertex, count] = pageRanges[i];
+        // a page allocated after this frame's uploads has no image yet, its glyphs show up next frame
+        if (count == 0 || pages[i].layout != vk::ImageLayout::eShaderReadOnlyOptimal) {
+            continue;
+        }
+        commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout.get(), 0,
+                                         pages[i].descriptorSet, nullptr);
+        commandBuffer.drawIndexed(count / 4 * 6, 1, 0, static_cast<int32_t>(firstVertex), 0);
+    }
+}
+
+} // namespace pons
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "gpu.h"
+
+namespace pons {
+
+const uint32_t TEXT_ATLAS_SIZE = 1024; // width and height of an atlas page, single channel
+const uint32_t TEXT_MAX_ATLAS_PAGES = 8;
+const uint32_t TEXT_GLYPH_SIZE = 48; // pixel size glyphs are rasterized at, the distance field scales to any size
+const uint32_t TEXT_SDF_SPREAD = 6;  // distance range encoded around the outline, in atlas pixels
+const uint32_t TEXT_MAX_GLYPHS = 8192; // per frame
+
+struct TextVertex {
+    glm::vec2 position; // pixels, origin in the top left corner
+    glm::vec2 uv;
+    uint32_t color; // RGBA8
+
+    static vk::VertexInputBindingDescription getBindingDescription() {
+        return vk::VertexInputBindingDescription{/*binding*/ 0, /*stride*/ sizeof(TextVertex),
+                                                 vk::VertexInputRate::eVertex};
+    }
+    static std::array<vk::VertexInputAttributeDescription, 3> getAttributeDescriptions() {
+        return {{{/*location*/ 0, /*binding*/ 0, vk::Format::eR32G32Sfloat, offsetof(TextVertex, position)},
+                 {/*location*/ 1, /*binding*/ 0, vk::Format::eR32G32Sfloat, offsetof(TextVertex, uv)},
+                 {/*location*/ 2, /*binding*/ 0, vk::Format::eR8G8B8A8Unorm, offsetof(TextVertex, color)}}};
+    }
+};
+
+struct Glyph {
+    uint32_t glyphIndex;
+    uint32_t page;
+    uint16_t x, y, width, height; // atlas rectangle, empty for whitespace
+    int16_t bearingX, bearingY;   // bitmap offset from the pen position
+    float advance;
+};
+
+// Signed distance field text. Glyphs are rasterized by FreeType once, on first use, into shelf packed atlas pages
+// which are saved to disk and reused by the next run. Queued strings are batched into one vertex buffer per frame
+// and drawn with one call per atlas page.
+class TextRenderer {
+public:
+    TextRenderer() = default;
+    ~TextRenderer();
+    TextRenderer(const TextRenderer &) = delete;
+    TextRenderer &operator=(const TextRenderer &) = delete;
+
+    // Atlas is restored from `cachePath` when it was built from the same font file.
+    void create(const GpuContext &gpu, vk::RenderPass renderPass, uint32_t framesInFlight, const std::string &fontPath,
+                const std::string &cachePath);
+    // Needs to be called again when the render pass is recreated.
+    void createPipeline(vk::RenderPass renderPass);
+    // Writes the atlas back if glyphs were added since it was loaded.
+    void saveCache();
+
+    // Queues a UTF-8 string with its top left corner at `position`, '\n' starts a new line. Returns the size of the
+    // laid out text in pixels.
+    glm::vec2 addText(std::string_view text, glm::vec2 position, float pixelSize, glm::vec4 color = glm::vec4(1.0f));
+    float getLineHeight(float pixelSize) const;
+
+    // Creates the images of atlas pages added while text was queued. Allocates device memory, so it runs before
+    // recording, returns true when it did.
+    bool createPendingPages();
+    // Copies newly rasterized glyphs into the atlas images, must be called outside of render pass and after
+    // `createPendingPages`.
+    void recordUploads(vk::CommandBuffer commandBuffer, uint32_t frame);
+    // Draws and clears the queued text.
+    void recordDraw(vk::CommandBuffer commandBuffer, uint32_t frame, vk::Extent2D extent);
+
+private:
+    struct AtlasPage {
+        std::vector<uint8_t> pixels;
+        // shelf packer state
+        uint32_t penX = 0;
+        uint32_t penY = 0;
+        uint32_t rowHeight = 0;
+        // rows changed since the last upload
+        uint32_t dirtyBegin = 0;
+        uint32_t dirtyEnd = 0;
+        vk::UniqueImage image;
+        TrackedMemory imageMemory;
+        vk::UniqueImageView imageView;
+        vk::DescriptorSet descriptorSet; // freed with descriptorPool
+        vk::ImageLayout layout = vk::ImageLayout::eUndefined;
+    };
+
+    const Glyph *getGlyph(uint32_t codepoint);
+    const Glyph *rasterizeGlyph(uint32_t codepoint);
+    bool allocateRect(uint32_t width, uint32_t height, uint32_t &page, uint32_t &x, uint32_t &y);
+    void createPageImage(AtlasPage &page);
+    bool loadCache();
+
+    GpuContext gpu;
+    FT_Library library = nullptr;
+    FT_Face face = nullptr;
+    std::string cachePath;
+    uint64_t fontKey = 0;
+    bool bCacheDirty = false;
+
+    std::unordered_map<uint32_t, Glyph> glyphs;
+    std::vector<AtlasPage> pages;
+    std::vector<std::vector<TextVertex>> pageQuads; // queued this frame, 4 vertices per glyph
+
+    std::vector<vk::UniqueBuffer> vertexBuffers;
+    std::vector<TrackedMemory> vertexBuffersMemory;
+    std::vector<void *> vertexBuffersMapped;
+    std::vector<vk::UniqueBuffer> stagingBuffers;
+    std::vector<TrackedMemory> stagingBuffersMemory;
+    std::vector<void *> stagingBuffersMapped;
+    vk::UniqueBuffer indexBuffer;
+    TrackedMemory indexBufferMemory;
+    vk::UniqueSampler sampler;
+    vk::UniqueDescriptorSetLayout descriptorSetLayout;
+    vk::UniqueDescriptorPool descriptorPool;
+    vk::UniquePipelineLayout pipelineLayout;
+    vk::UniquePipeline pipeline;
+};
+
+} // namespace pons
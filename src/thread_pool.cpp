@@ -0,0 +1,67 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace pons {
+
+ThreadPool::ThreadPool(uint32_t threadCount) {
+    workers.reserve(threadCount);
+    for (uint32_t i = 0; i < threadCount; ++i) {
+        workers.emplace_back([this] { workerLoop(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        bStopping = true;
+    }
+    taskAvailable.notify_all();
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(std::move(task));
+    }
+    taskAvailable.notify_one();
+}
+
+void ThreadPool::waitIdle() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this] { return tasks.empty() && runningTasks == 0; });
+}
+
+uint32_t ThreadPool::defaultThreadCount() {
+    uint32_t hardwareThreads = std::thread::hardware_concurrency();
+    return std::max(hardwareThreads, 2u) - 1;
+}
+
+void ThreadPool::workerLoop() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            taskAvailable.wait(lock, [this] { return bStopping || !tasks.empty(); });
+            if (tasks.empty()) {
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+            ++runningTasks;
+        }
+        task();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            --runningTasks;
+            if (tasks.empty() && runningTasks == 0) {
+                idle.notify_all();
+            }
+        }
+    }
+}
+
+} // namespace pons
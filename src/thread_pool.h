@@ -0,0 +1,41 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace pons {
+
+// Fixed set of worker threads consuming a FIFO of tasks.
+class ThreadPool {
+public:
+    explicit ThreadPool(uint32_t threadCount = defaultThreadCount());
+    ~ThreadPool();
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    void submit(std::function<void()> task);
+    // Blocks until the queue is empty and no task is running.
+    void waitIdle();
+    uint32_t getThreadCount() const { return static_cast<uint32_t>(workers.size()); }
+
+    // Leaves one hardware thread for the render loop.
+    static uint32_t defaultThreadCount();
+
+private:
+    void workerLoop();
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable taskAvailable;
+    std::condition_variable idle;
+    uint32_t runningTasks = 0;
+    bool bStopping = false;
+};
+
+} // namespace pons
@@ -0,0 +1,439 @@
+#include "block_encoders.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PONS_ENCODER_SSE 1
+#include <emmintrin.h>
+#endif
+
+namespace pons {
+
+namespace {
+
+const uint32_t POWER_ITERATIONS = 8;
+const uint32_t MAX_PALETTE_SIZE = 16;
+
+// palette positions between the endpoints, ordered from start to end
+const float BC1_POSITIONS[4] = {0.0f, 1.0f / 3.0f, 2.0f / 3.0f, 1.0f};
+const uint8_t BC7_WEIGHTS[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+// ASTC weights of the 3 bit (RGB blocks) and 2 bit (RGBA blocks) ranges after unquantization
+const uint8_t ASTC_RGB_WEIGHTS[8] = {0, 9, 18, 27, 37, 46, 55, 64};
+const uint8_t ASTC_RGBA_WEIGHTS[4] = {0, 21, 43, 64};
+// 4x4 weight grid, single plane, one partition. The weight ranges are picked so that the remaining bits fit
+// 8 bit endpoints exactly, larger ranges would move the endpoints onto trit/quint encoded ranges.
+const uint32_t ASTC_RGB_BLOCK_MODE = 0x53;  // 3 bit weights
+const uint32_t ASTC_RGBA_BLOCK_MODE = 0x42; // 2 bit weights
+const uint32_t ASTC_CEM_LDR_RGB_DIRECT = 8;
+const uint32_t ASTC_CEM_LDR_RGBA_DIRECT = 12;
+
+// Quantized endpoints and the palette indices chosen for them.
+struct Candidate {
+    uint8_t endpoints[2][4]; // per channel, in the precision of the format
+    uint8_t pBits[2];        // BC7 only
+    uint8_t indices[BLOCK_TEXELS];
+    float error;
+};
+
+using Palette = float[MAX_PALETTE_SIZE][4];
+
+class BitWriter {
+public:
+    explicit BitWriter(uint8_t *pOut) : pOut(pOut) {}
+    void put(uint32_t value, uint32_t bitCount) {
+        for (uint32_t i = 0; i < bitCount; ++i, ++position) {
+            pOut[position / 8] |= static_cast<uint8_t>(((value >> i) & 1u) << (position % 8));
+        }
+    }
+
+private:
+    uint8_t *pOut;
+    uint32_t position = 0;
+};
+
+uint8_t quantize(float value, uint32_t maxValue) {
+    return static_cast<uint8_t>(std::clamp(std::lround(value * static_cast<float>(maxValue)), 0l,
+                                           static_cast<long>(maxValue)));
+}
+
+// Picks the closest palette entry for every texel and returns the summed squared error.
+float selectIndices(const float (*channels)[BLOCK_TEXELS], uint32_t channelCount, const Palette &palette,
+                    uint32_t paletteSize, uint8_t *indices) {
+#ifdef PONS_ENCODER_SSE
+    __m128 totalError = _mm_setzero_ps();
+    for (uint32_t batch = 0; batch < BLOCK_TEXELS; batch += 4) {
+        __m128 bestError = _mm_set1_ps(FLT_MAX);
+        __m128i bestIndex = _mm_setzero_si128();
+        for (uint32_t k = 0; k < paletteSize; ++k) {
+            __m128 error = _mm_setzero_ps();
+            for (uint32_t c = 0; c < channelCount; ++c) {
+                __m128 diff = _mm_sub_ps(_mm_load_ps(channels[c] + batch), _mm_set1_ps(palette[k][c]));
+                error = _mm_add_ps(error, _mm_mul_ps(diff, diff));
+            }
+            __m128i better = _mm_castps_si128(_mm_cmplt_ps(error, bestError));
+            bestError = _mm_min_ps(error, bestError);
+            bestIndex = _mm_or_si128(_mm_and_si128(better, _mm_set1_epi32(static_cast<int>(k))),
+                                     _mm_andnot_si128(better, bestIndex));
+        }
+        totalError = _mm_add_ps(totalError, bestError);
+        alignas(16) int32_t lanes[4];
+        _mm_store_si128(reinterpret_cast<__m128i *>(lanes), bestIndex);
+        for (uint32_t i = 0; i < 4; ++i) {
+            indices[batch + i] = static_cast<uint8_t>(lanes[i]);
+        }
+    }
+    alignas(16) float errors[4];
+    _mm_store_ps(errors, totalError);
+    return errors[0] + errors[1] + errors[2] + errors[3];
+#else
+    float totalError = 0.0f;
+    for (uint32_t i = 0; i < BLOCK_TEXELS; ++i) {
+        float bestError = FLT_MAX;
+        for (uint32_t k = 0; k < paletteSize; ++k) {
+            float error = 0.0f;
+            for (uint32_t c = 0; c < channelCount; ++c) {
+                float diff = channels[c][i] - palette[k][c];
+                error += diff * diff;
+            }
+            if (error < bestError) {
+                bestError = error;
+                indices[i] = static_cast<uint8_t>(k);
+            }
+        }
+        totalError += bestError;
+    }
+    return totalError;
+#endif
+}
+
+// Endpoints spanning the texels along their principal axis, found by power iteration on the covariance.
+void fitLine(const TexelBlock &block, uint32_t channelCount, float (&start)[4], float (&end)[4]) {
+    float mean[4] = {};
+    for (uint32_t c = 0; c < channelCount; ++c) {
+        for (uint32_t i = 0; i < BLOCK_TEXELS; ++i) {
+            mean[c] += block.channels[c][i];
+        }
+        mean[c] /= static_cast<float>(BLOCK_TEXELS);
+    }
+    float covariance[4][4] = {};
+    for (uint32_t i = 0; i < BLOCK_TEXELS; ++i) {
+        for (uint32_t a = 0; a < channelCount; ++a) {
+            for (uint32_t b = 0; b < channelCount; ++b) {
+                covariance[a][b] += (block.channels[a][i] - mean[a]) * (block.channels[b][i] - mean[b]);
+            }
+        }
+    }
+    // the row of the channel with the largest variance is never orthogonal to the principal axis
+    uint32_t widest = 0;
+    for (uint32_t c = 1; c < channelCount; ++c) {
+        widest = covariance[c][c] > covariance[widest][widest] ? c : widest;
+    }
+    std::copy(std::begin(mean), std::end(mean), start);
+    std::copy(std::begin(mean), std::end(mean), end);
+    if (covariance[widest][widest] < 1e-10f) {
+        return;
+    }
+    float axis[4] = {};
+    std::copy(covariance[widest], covariance[widest] + channelCount, axis);
+    for (uint32_t iteration = 0; iteration < POWER_ITERATIONS; ++iteration) {
+        float next[4] = {};
+        float length = 0.0f;
+        for (uint32_t a = 0; a < channelCount; ++a) {
+            for (uint32_t b = 0; b < channelCount; ++b) {
+                next[a] += covariance[a][b] * axis[b];
+            }
+            length += next[a] * next[a];
+        }
+        length = std::sqrt(length);
+        if (length < 1e-20f) {
+            break;
+        }
+        for (uint32_t c = 0; c < channelCount; ++c) {
+            axis[c] = next[c] / length;
+        }
+    }
+    float minProjection = FLT_MAX;
+    float maxProjection = -FLT_MAX;
+    for (uint32_t i = 0; i < BLOCK_TEXELS; ++i) {
+        float projection = 0.0f;
+        for (uint32_t c = 0; c < channelCount; ++c) {
+            projection += (block.channels[c][i] - mean[c]) * axis[c];
+        }
+        minProjection = std::min(minProjection, projection);
+        maxProjection = std::max(maxProjection, projection);
+    }
+    for (uint32_t c = 0; c < channelCount; ++c) {
+        start[c] = std::clamp(mean[c] + axis[c] * minProjection, 0.0f, 1.0f);
+        end[c] = std::clamp(mean[c] + axis[c] * maxProjection, 0.0f, 1.0f);
+    }
+}
+
+// Least squares endpoints for the palette positions the texels were assigned to, unchanged if singular.
+void refineEndpoints(const TexelBlock &block, uint32_t channelCount, const uint8_t *indices, const float *positions,
+                     float (&start)[4], float (&end)[4]) {
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    float ax[4] = {}, bx[4] = {};
+    for (uint32_t i = 0; i < BLOCK_TEXELS; ++i) {
+        float b = positions[indices[i]];
+        float a = 1.0f - b;
+        aa += a * a;
+        ab += a * b;
+        bb += b * b;
+        for (uint32_t c = 0; c < channelCount; ++c) {
+            ax[c] += a * block.channels[c][i];
+            bx[c] += b * block.channels[c][i];
+        }
+    }
+    float determinant = aa * bb - ab * ab;
+    if (std::abs(determinant) < 1e-6f) {
+        return;
+    }
+    for (uint32_t c = 0; c < channelCount; ++c) {
+        start[c] = std::clamp((bb * ax[c] - ab * bx[c]) / determinant, 0.0f, 1.0f);
+        end[c] = std::clamp((aa * bx[c] - ab * ax[c]) / determinant, 0.0f, 1.0f);
+    }
+}
+
+// Principal axis fit followed by one least squares refinement, whichever quantizes with less error wins.
+// `evaluate(start, end)` quantizes the endpoints and selects the indices.
+template <typename Evaluate>
+Candidate fitEndpoints(const TexelBlock &block, uint32_t channelCount, const float *positions, Evaluate evaluate) {
+    float start[4], end[4];
+    fitLine(block, channelCount, start, end);
+    Candidate best = evaluate(start, end);
+    refineEndpoints(block, channelCount, best.indices, positions, start, end);
+    Candidate refined = evaluate(start, end);
+    return refined.error < best.error ? refined : best;
+}
+
+float expand5(uint8_t value) { return static_cast<float>((value << 3) | (value >> 2)) / 255.0f; }
+float expand6(uint8_t value) { return static_cast<float>((value << 2) | (value >> 4)) / 255.0f; }
+
+uint16_t packRgb565(const uint8_t (&endpoint)[4]) {
+    return static_cast<uint16_t>((endpoint[0] << 11) | (endpoint[1] << 5) | endpoint[2]);
+}
+
+void encodeBc1(const TexelBlock &block, uint8_t *pOut) {
+    Candidate candidate = fitEndpoints(block, 3, BC1_POSITIONS, [&](const float(&start)[4], const float(&end)[4]) {
+        Candidate c{};
+        Palette palette{};
+        for (int e = 0; e < 2; ++e) {
+            const float(&color)[4] = e == 0 ? start : end;
+            uint8_t(&q)[4] = c.endpoints[e];
+            q[0] = quantize(color[0], 31);
+            q[1] = quantize(color[1], 63);
+            q[2] = quantize(color[2], 31);
+            float *pEntry = palette[e == 0 ? 0 : 3];
+            pEntry[0] = expand5(q[0]);
+            pEntry[1] = expand6(q[1]);
+            pEntry[2] = expand5(q[2]);
+        }
+        for (uint32_t ch = 0; ch < 3; ++ch) {
+            palette[1][ch] = (2.0f * palette[0][ch] + palette[3][ch]) / 3.0f;
+            palette[2][ch] = (palette[0][ch] + 2.0f * palette[3][ch]) / 3.0f;
+        }
+        c.error = selectIndices(block.channels, 3, palette, 4, c.indices);
+        return c;
+    });
+
+    // four color mode needs color0 > color1, equal endpoints decode the same in either mode
+    static const uint8_t CODES[4] = {0, 2, 3, 1};
+    uint16_t color0 = packRgb565(candidate.endpoints[0]);
+    uint16_t color1 = packRgb565(candidate.endpoints[1]);
+    bool bSwap = color0 < color1;
+    if (bSwap) {
+        std::swap(color0, color1);
+    }
+    uint32_t indexBits = 0;
+    for (uint32_t i = 0; color0 != color1 && i < BLOCK_TEXELS; ++i) {
+        uint32_t ordered = bSwap ? 3u - candidate.indices[i] : candidate.indices[i];
+        indexBits |= static_cast<uint32_t>(CODES[ordered]) << (2 * i);
+    }
+    std::memcpy(pOut, &color0, 2);
+    std::memcpy(pOut + 2, &color1, 2);
+    std::memcpy(pOut + 4, &indexBits, 4);
+}
+
+// Single channel block of BC3 alpha and BC5, endpoints at the extremes in the eight value mode.
+void encodeBc4(const float (&channel)[BLOCK_TEXELS], uint8_t *pOut) {
+    auto [low, high] = std::minmax_element(std::begin(channel), std::end(channel));
+    uint8_t value0 = quantize(*high, 255);
+    uint8_t value1 = quantize(*low, 255);
+    std::memset(pOut, 0, 8);
+    pOut[0] = value0;
+    pOut[1] = value1;
+    if (value0 == value1) {
+        return;
+    }
+    Palette palette{};
+    for (uint32_t k = 0; k < 8; ++k) {
+        palette[k][0] = static_cast<float>(value0 * (7 - k) + value1 * k) / (7.0f * 255.0f);
+    }
+    uint8_t indices[BLOCK_TEXELS];
+    selectIndices(&channel, 1, palette, 8, indices);
+    uint64_t indexBits = 0;
+    for (uint32_t i = 0; i < BLOCK_TEXELS; ++i) {
+        // codes 0 and 1 are the endpoints, 2 to 7 the interpolants from value0 towards value1
+        uint32_t code = indices[i] == 0 ? 0 : indices[i] == 7 ? 1 : indices[i] + 1u;
+        indexBits |= static_cast<uint64_t>(code) << (3 * i);
+    }
+    std::memcpy(pOut + 2, &indexBits, 6);
+}
+
+// Mode 6 only: one subset, RGBA endpoints of 7 bits plus a p-bit each and 4 bit indices.
+void encodeBc7(const TexelBlock &block, uint8_t *pOut) {
+    float positions[16];
+    for (uint32_t k = 0; k < 16; ++k) {
+        positions[k] = static_cast<float>(BC7_WEIGHTS[k]) / 64.0f;
+    }
+    Candidate candidate = fitEndpoints(block, 4, positions, [&](const float(&start)[4], const float(&end)[4]) {
+        Candidate c{};
+        uint32_t decoded[2][4];
+        for (int e = 0; e < 2; ++e) {
+            const float(&color)[4] = e == 0 ? start : end;
+            float bestError = FLT_MAX;
+            for (uint8_t pBit = 0; pBit < 2; ++pBit) {
+                float error = 0.0f;
+                uint8_t q[4];
+                for (uint32_t ch = 0; ch < 4; ++ch) {
+                    q[ch] = static_cast<uint8_t>(std::clamp(std::lround((color[ch] * 255.0f - pBit) / 2.0f), 0l, 127l));
+                    float diff = static_cast<float>((q[ch] << 1) | pBit) / 255.0f - color[ch];
+                    error += diff * diff;
+                }
+                if (error < bestError) {
+                    bestError = error;
+                    std::copy(std::begin(q), std::end(q), c.endpoints[e]);
+                    c.pBits[e] = pBit;
+                }
+            }
+            for (uint32_t ch = 0; ch < 4; ++ch) {
+                decoded[e][ch] = static_cast<uint32_t>((c.endpoints[e][ch] << 1) | c.pBits[e]);
+            }
+        }
+        Palette palette{};
+        for (uint32_t k = 0; k < 16; ++k) {
+            for (uint32_t ch = 0; ch < 4; ++ch) {
+                uint32_t value = ((64u - BC7_WEIGHTS[k]) * decoded[0][ch] + BC7_WEIGHTS[k] * decoded[1][ch] + 32) >> 6;
+                palette[k][ch] = static_cast<float>(value) / 255.0f;
+            }
+        }
+        c.error = selectIndices(block.channels, 4, palette, 16, c.indices);
+        return c;
+    });
+
+    // the anchor index is stored without its top bit, which swapping the endpoints clears
+    if (candidate.indices[0] >= 8) {
+        std::swap(candidate.endpoints[0], candidate.endpoints[1]);
+        std::swap(candidate.pBits[0], candidate.pBits[1]);
+        for (uint8_t &index : candidate.indices) {
+            index = static_cast<uint8_t>(15 - index);
+        }
+    }
+    std::memset(pOut, 0, 16);
+    BitWriter writer(pOut);
+    writer.put(1u << 6, 7);
+    for (uint32_t ch = 0; ch < 4; ++ch) {
+        writer.put(candidate.endpoints[0][ch], 7);
+        writer.put(candidate.endpoints[1][ch], 7);
+    }
+    writer.put(candidate.pBits[0], 1);
+    writer.put(candidate.pBits[1], 1);
+    writer.put(candidate.indices[0], 3);
+    for (uint32_t i = 1; i < BLOCK_TEXELS; ++i) {
+        writer.put(candidate.indices[i], 4);
+    }
+}
+
+// Single partition LDR block with direct endpoints of 8 bits, RGB when the block is opaque.
+void encodeAstc(const TexelBlock &block, uint8_t *pOut) {
+    bool bOpaque = std::all_of(std::begin(block.channels[3]), std::end(block.channels[3]),
+                               [](float alpha) { return alpha >= 1.0f - 0.5f / 255.0f; });
+    uint32_t channelCount = bOpaque ? 3 : 4;
+    const uint8_t *weights = bOpaque ? ASTC_RGB_WEIGHTS : ASTC_RGBA_WEIGHTS;
+    uint32_t weightCount = bOpaque ? 8 : 4;
+    uint32_t weightBits = bOpaque ? 3 : 2;
+    float positions[8];
+    for (uint32_t k = 0; k < weightCount; ++k) {
+        positions[k] = static_cast<float>(weights[k]) / 64.0f;
+    }
+    Candidate candidate =
+        fitEndpoints(block, channelCount, positions, [&](const float(&start)[4], const float(&end)[4]) {
+            Candidate c{};
+            for (uint32_t ch = 0; ch < channelCount; ++ch) {
+                c.endpoints[0][ch] = quantize(start[ch], 255);
+                c.endpoints[1][ch] = quantize(end[ch], 255);
+            }
+            Palette palette{};
+            for (uint32_t k = 0; k < weightCount; ++k) {
+                for (uint32_t ch = 0; ch < channelCount; ++ch) {
+                    uint32_t value =
+                        ((64u - weights[k]) * c.endpoints[0][ch] + weights[k] * c.endpoints[1][ch] + 32) >> 6;
+                    palette[k][ch] = static_cast<float>(value) / 255.0f;
+                }
+            }
+            c.error = selectIndices(block.channels, channelCount, palette, weightCount, c.indices);
+            return c;
+        });
+
+    // endpoints in the other order would be decoded with blue contraction
+    uint32_t sum0 = 0, sum1 = 0;
+    for (uint32_t ch = 0; ch < 3; ++ch) {
+        sum0 += candidate.endpoints[0][ch];
+        sum1 += candidate.endpoints[1][ch];
+    }
+    if (sum1 < sum0) {
+        std::swap(candidate.endpoints[0], candidate.endpoints[1]);
+        for (uint8_t &index : candidate.indices) {
+            index = static_cast<uint8_t>(weightCount - 1 - index);
+        }
+    }
+    std::memset(pOut, 0, 16);
+    BitWriter writer(pOut);
+    writer.put(bOpaque ? ASTC_RGB_BLOCK_MODE : ASTC_RGBA_BLOCK_MODE, 11);
+    writer.put(0, 2); // one partition
+    writer.put(bOpaque ? ASTC_CEM_LDR_RGB_DIRECT : ASTC_CEM_LDR_RGBA_DIRECT, 4);
+    for (uint32_t ch = 0; ch < channelCount; ++ch) {
+        writer.put(candidate.endpoints[0][ch], 8);
+        writer.put(candidate.endpoints[1][ch], 8);
+    }
+    // weights are stored bit reversed from the top of the block down
+    for (uint32_t i = 0; i < BLOCK_TEXELS; ++i) {
+        for (uint32_t b = 0; b < weightBits; ++b) {
+            uint32_t bit = 127 - (i * weightBits + b);
+            pOut[bit / 8] |= static_cast<uint8_t>(((candidate.indices[i] >> b) & 1u) << (bit % 8));
+        }
+    }
+}
+
+} // namespace
+
+size_t getBlockBytes(BlockFormat format) { return format == BlockFormat::Bc1 ? 8 : 16; }
+
+void encodeBlock(BlockFormat format, const TexelBlock &block, uint8_t *pOut) {
+    switch (format) {
+    case BlockFormat::Bc1:
+        encodeBc1(block, pOut);
+        break;
+    case BlockFormat::Bc3:
+        encodeBc4(block.channels[3], pOut);
+        encodeBc1(block, pOut + 8);
+        break;
+    case BlockFormat::Bc5:
+        encodeBc4(block.channels[0], pOut);
+        encodeBc4(block.channels[1], pOut + 8);
+        break;
+    case BlockFormat::Bc7:
+        encodeBc7(block, pOut);
+        break;
+    case BlockFormat::Astc4x4:
+        encodeAstc(block, pOut);
+        break;
+    }
+}
+
+} // namespace pons
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace pons {
+
+enum class BlockFormat { Bc1, Bc3, Bc5, Bc7, Astc4x4 };
+
+const uint32_t BLOCK_SIZE = 4;
+const uint32_t BLOCK_TEXELS = BLOCK_SIZE * BLOCK_SIZE;
+
+// Texels of one 4x4 block in the storage color space, channels in [0, 1]. Stored channel by channel so the
+// encoders can work on four texels at a time.
+struct TexelBlock {
+    alignas(16) float channels[4][BLOCK_TEXELS];
+};
+
+// 8 for BC1, 16 for the others.
+size_t getBlockBytes(BlockFormat format);
+// BC1 ignores alpha and BC5 keeps red and green only. ASTC blocks with constant opaque alpha store RGB with finer
+// weights, the others RGBA.
+void encodeBlock(BlockFormat format, const TexelBlock &block, uint8_t *pOut);
+
+} // namespace pons
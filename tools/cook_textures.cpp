@@ -0,0 +1,478 @@
+// Cooks a source image into a block compressed texture with a full mip chain, written as DDS or KTX for gli.
+// usage: pons2_cook [--format bc1|bc3|bc5|bc7|astc] [--linear] [--normal] <input.tga|.png> <output.dds|.ktx>
+// Color is treated as sRGB unless --linear, mips are filtered in linear space either way. --normal renormalizes
+// the mips of tangent space normal maps and implies --linear, bc5 is the format meant for those.
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef PONS_HAS_ZLIB
+#include <zlib.h>
+#endif
+
+#include "../src/thread_pool.h"
+#include "block_encoders.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+struct FormatInfo {
+    const char *name;
+    pons::BlockFormat blockFormat;
+    uint32_t dxgiFormat; // 0 when DDS can't hold it
+    uint32_t dxgiSrgbFormat;
+    uint32_t glInternalFormat;
+    uint32_t glSrgbInternalFormat; // 0 when there is no sRGB variant
+    uint32_t glBaseInternalFormat;
+};
+
+const FormatInfo FORMATS[] = {
+    {"bc1", pons::BlockFormat::Bc1, 71, 72, 0x83F0, 0x8C4C, 0x1907},
+    {"bc3", pons::BlockFormat::Bc3, 77, 78, 0x83F3, 0x8C4F, 0x1908},
+    {"bc5", pons::BlockFormat::Bc5, 83, 0, 0x8DBD, 0, 0x8227},
+    {"bc7", pons::BlockFormat::Bc7, 98, 99, 0x8E8C, 0x8E8D, 0x1908},
+    {"astc", pons::BlockFormat::Astc4x4, 0, 0, 0x93B0, 0x93D0, 0x1908},
+};
+
+const uint8_t PNG_SIGNATURE[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+const uint8_t KTX_IDENTIFIER[12] = {0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n'};
+
+struct DdsPixelFormat {
+    uint32_t size, flags, fourCC, rgbBitCount, rBitMask, gBitMask, bBitMask, aBitMask;
+};
+
+struct DdsHeader {
+    uint32_t size, flags, height, width, pitchOrLinearSize, depth, mipMapCount, reserved1[11];
+    DdsPixelFormat pixelFormat;
+    uint32_t caps, caps2, caps3, caps4, reserved2;
+};
+
+struct DdsHeaderDx10 {
+    uint32_t dxgiFormat, resourceDimension, miscFlag, arraySize, miscFlags2;
+};
+
+struct KtxHeader {
+    uint8_t identifier[12];
+    uint32_t endianness, glType, glTypeSize, glFormat, glInternalFormat, glBaseInternalFormat, pixelWidth,
+        pixelHeight, pixelDepth, numberOfArrayElements, numberOfFaces, numberOfMipmapLevels, bytesOfKeyValueData;
+};
+
+static_assert(sizeof(DdsHeader) == 124 && sizeof(DdsHeaderDx10) == 20 && sizeof(KtxHeader) == 64);
+
+struct SourceImage {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<uint8_t> rgba;
+};
+
+// rgba texels, color in linear space
+struct FloatImage {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<float> texels;
+};
+
+std::vector<uint8_t> readFile(const fs::path &path) {
+    std::ifstream file(path, std::ios::ate | std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("failed to open " + path.string());
+    }
+    std::vector<uint8_t> data(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    file.read(reinterpret_cast<char *>(data.data()), static_cast<std::streamsize>(data.size()));
+    return data;
+}
+
+// Truecolor and grayscale, uncompressed or run length encoded.
+SourceImage loadTga(const std::vector<uint8_t> &file) {
+    if (file.size() < 18) {
+        throw std::runtime_error("truncated tga header");
+    }
+    uint8_t imageType = file[2];
+    uint32_t bytesPerPixel = file[16] / 8u;
+    bool bRle = imageType == 10 || imageType == 11;
+    if (file[1] != 0 || (imageType & ~8u) < 2 || (imageType & ~8u) > 3 ||
+        (bytesPerPixel != 1 && bytesPerPixel != 3 && bytesPerPixel != 4)) {
+        throw std::runtime_error("unsupported tga, expected 8 bit gray or 24/32 bit truecolor");
+    }
+    SourceImage image;
+    image.width = static_cast<uint32_t>(file[12] | (file[13] << 8));
+    image.height = static_cast<uint32_t>(file[14] | (file[15] << 8));
+    bool bTopDown = (file[17] & 0x20) != 0;
+    size_t pixelCount = size_t{image.width} * image.height;
+    std::vector<uint8_t> pixels;
+    pixels.reserve(pixelCount * bytesPerPixel);
+    size_t position = 18u + file[0];
+    while (pixels.size() < pixelCount * bytesPerPixel) {
+        uint32_t count = 1;
+        bool bRun = false;
+        if (bRle) {
+            if (position >= file.size()) {
+                throw std::runtime_error("truncated tga data");
+            }
+            bRun = (file[position] & 0x80) != 0;
+            count = (file[position] & 0x7Fu) + 1;
+            ++position;
+        }
+        size_t bytes = bRun ? bytesPerPixel : size_t{count} * bytesPerPixel;
+        if (position + bytes > file.size()) {
+            throw std::runtime_error("truncated tga data");
+        }
+        for (uint32_t i = 0; i < (bRun ? count : 1u); ++i) {
+            pixels.insert(pixels.end(), file.begin() + static_cast<ptrdiff_t>(position),
+                          file.begin() + static_cast<ptrdiff_t>(position + bytes));
+        }
+        position += bytes;
+    }
+    image.rgba.resize(pixelCount * 4);
+    for (uint32_t y = 0; y < image.height; ++y) {
+        uint32_t sourceRow = bTopDown ? y : image.height - 1 - y;
+        for (uint32_t x = 0; x < image.width; ++x) {
+            const uint8_t *pSource = &pixels[(size_t{sourceRow} * image.width + x) * bytesPerPixel];
+            uint8_t *pTarget = &image.rgba[(size_t{y} * image.width + x) * 4];
+            // stored as BGR(A)
+            pTarget[0] = pSource[bytesPerPixel == 1 ? 0 : 2];
+            pTarget[1] = pSource[bytesPerPixel == 1 ? 0 : 1];
+            pTarget[2] = pSource[0];
+            pTarget[3] = bytesPerPixel == 4 ? pSource[3] : 255;
+        }
+    }
+    return image;
+}
+
+#ifdef PONS_HAS_ZLIB
+uint32_t readBigEndian(const uint8_t *pData) {
+    return (uint32_t{pData[0]} << 24) | (uint32_t{pData[1]} << 16) | (uint32_t{pData[2]} << 8) | pData[3];
+}
+#endif
+
+// 8 bit per channel, non interlaced, any color type.
+SourceImage loadPng(const std::vector<uint8_t> &file) {
+#ifdef PONS_HAS_ZLIB
+    if (file.size() < 8 || std::memcmp(file.data(), PNG_SIGNATURE, 8) != 0) {
+        throw std::runtime_error("not a png file");
+    }
+    SourceImage image;
+    uint32_t colorType = 0;
+    std::vector<uint8_t> palette;
+    std::vector<uint8_t> paletteAlpha;
+    std::vector<uint8_t> compressed;
+    for (size_t position = 8; position + 12 <= file.size();) {
+        uint32_t length = readBigEndian(&file[position]);
+        const uint8_t *pType = &file[position + 4];
+        const uint8_t *pData = &file[position + 8];
+        if (position + 12 + length > file.size()) {
+            throw std::runtime_error("truncated png chunk");
+        }
+        if (std::memcmp(pType, "IHDR", 4) == 0) {
+            image.width = readBigEndian(pData);
+            image.height = readBigEndian(pData + 4);
+            colorType = pData[9];
+            if (pData[8] != 8 || pData[12] != 0) {
+                throw std::runtime_error("unsupported png, expected 8 bit channels without interlacing");
+            }
+        } else if (std::memcmp(pType, "PLTE", 4) == 0) {
+            palette.assign(pData, pData + length);
+        } else if (std::memcmp(pType, "tRNS", 4) == 0) {
+            paletteAlpha.assign(pData, pData + length);
+        } else if (std::memcmp(pType, "IDAT", 4) == 0) {
+            compressed.insert(compressed.end(), pData, pData + length);
+        } else if (std::memcmp(pType, "IEND", 4) == 0) {
+            break;
+        }
+        position += 12 + length;
+    }
+    const uint32_t CHANNELS[7] = {1, 0, 3, 1, 2, 0, 4};
+    uint32_t channels = colorType < 7 ? CHANNELS[colorType] : 0;
+    if (channels == 0) {
+        throw std::runtime_error("unsupported png color type");
+    }
+    size_t stride = size_t{image.width} * channels;
+    std::vector<uint8_t> raw(image.height * (stride + 1));
+    uLongf rawSize = static_cast<uLongf>(raw.size());
+    if (uncompress(raw.data(), &rawSize, compressed.data(), static_cast<uLong>(compressed.size())) != Z_OK ||
+        rawSize != raw.size()) {
+        throw std::runtime_error("failed to inflate png data");
+    }
+    // undo the per row filters in place, each row is preceded by its filter type
+    std::vector<uint8_t> previous(stride, 0);
+    std::vector<uint8_t> pixels(image.height * stride);
+    for (uint32_t y = 0; y < image.height; ++y) {
+        uint8_t filter = raw[y * (stride + 1)];
+        const uint8_t *pFiltered = &raw[y * (stride + 1) + 1];
+        uint8_t *pRow = &pixels[y * stride];
+        for (size_t x = 0; x < stride; ++x) {
+            int left = x >= channels ? pRow[x - channels] : 0;
+            int up = previous[x];
+            int upLeft = x >= channels ? previous[x - channels] : 0;
+            int predictor = 0;
+            switch (filter) {
+            case 1:
+                predictor = left;
+                break;
+            case 2:
+                predictor = up;
+                break;
+            case 3:
+                predictor = (left + up) / 2;
+                break;
+            case 4: {
+                int estimate = left + up - upLeft;
+                int distanceLeft = std::abs(estimate - left);
+                int distanceUp = std::abs(estimate - up);
+                int distanceUpLeft = std::abs(estimate - upLeft);
+                predictor = distanceLeft <= distanceUp && distanceLeft <= distanceUpLeft ? left
+                            : distanceUp <= distanceUpLeft                               ? up
+                                                                                         : upLeft;
+                break;
+            }
+            }
+            pRow[x] = static_cast<uint8_t>(pFiltered[x] + predictor);
+        }
+        std::copy(pRow, pRow + stride, previous.begin());
+    }
+    image.rgba.resize(size_t{image.width} * image.height * 4);
+    for (size_t i = 0; i < size_t{image.width} * image.height; ++i) {
+        const uint8_t *pSource = &pixels[i * channels];
+        uint8_t *pTarget = &image.rgba[i * 4];
+        if (colorType == 3) {
+            if (size_t{pSource[0]} * 3 + 3 > palette.size()) {
+                throw std::runtime_error("png palette index out of range");
+            }
+            std::copy(&palette[pSource[0] * 3u], &palette[pSource[0] * 3u] + 3, pTarget);
+            pTarget[3] = pSource[0] < paletteAlpha.size() ? paletteAlpha[pSource[0]] : 255;
+        } else {
+            bool bGray = channels < 3;
+            pTarget[0] = pSource[0];
+            pTarget[1] = pSource[bGray ? 0 : 1];
+            pTarget[2] = pSource[bGray ? 0 : 2];
+            pTarget[3] = channels == 2 || channels == 4 ? pSource[channels - 1] : 255;
+        }
+    }
+    return image;
+#else
+    (void)file;
+    throw std::runtime_error("built without zlib, png input isn't supported");
+#endif
+}
+
+float srgbToLinear(float value) {
+    return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+}
+
+float linearToSrgb(float value) {
+    return value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+}
+
+FloatImage toLinear(const SourceImage &source, bool bSrgb) {
+    FloatImage image{source.width, source.height, std::vector<float>(source.rgba.size())};
+    for (size_t i = 0; i < source.rgba.size(); ++i) {
+        float value = static_cast<float>(source.rgba[i]) / 255.0f;
+        image.texels[i] = bSrgb && i % 4 != 3 ? srgbToLinear(value) : value;
+    }
+    return image;
+}
+
+void renormalize(float *pTexel) {
+    float x = pTexel[0] * 2.0f - 1.0f, y = pTexel[1] * 2.0f - 1.0f, z = pTexel[2] * 2.0f - 1.0f;
+    float length = std::sqrt(x * x + y * y + z * z);
+    if (length > 1e-6f) {
+        pTexel[0] = x / length * 0.5f + 0.5f;
+        pTexel[1] = y / length * 0.5f + 0.5f;
+        pTexel[2] = z / length * 0.5f + 0.5f;
+    }
+}
+
+// 2x2 box filter, the last row or column is repeated for odd sizes.
+FloatImage downsample(const FloatImage &source, bool bNormalMap) {
+    FloatImage image{std::max(source.width / 2, 1u), std::max(source.height / 2, 1u), {}};
+    image.texels.resize(size_t{image.width} * image.height * 4);
+    for (uint32_t y = 0; y < image.height; ++y) {
+        uint32_t y0 = std::min(y * 2, source.height - 1), y1 = std::min(y * 2 + 1, source.height - 1);
+        for (uint32_t x = 0; x < image.width; ++x) {
+            uint32_t x0 = std::min(x * 2, source.width - 1), x1 = std::min(x * 2 + 1, source.width - 1);
+            float *pTarget = &image.texels[(size_t{y} * image.width + x) * 4];
+            for (uint32_t c = 0; c < 4; ++c) {
+                auto at = [&](uint32_t sx, uint32_t sy) {
+                    return source.texels[(size_t{sy} * source.width + sx) * 4 + c];
+                };
+                pTarget[c] = (at(x0, y0) + at(x1, y0) + at(x0, y1) + at(x1, y1)) * 0.25f;
+            }
+            if (bNormalMap) {
+                renormalize(pTarget);
+            }
+        }
+    }
+    return image;
+}
+
+// Blocks are encoded a row at a time on the pool, partial blocks at the edges repeat the last texel.
+std::vector<uint8_t> encodeLevel(pons::ThreadPool &pool, const FloatImage &level, pons::BlockFormat format,
+                                 bool bSrgb) {
+    std::vector<float> stored(level.texels.size());
+    for (size_t i = 0; i < stored.size(); ++i) {
+        stored[i] = bSrgb && i % 4 != 3 ? linearToSrgb(level.texels[i]) : level.texels[i];
+    }
+    uint32_t blocksX = (level.width + pons::BLOCK_SIZE - 1) / pons::BLOCK_SIZE;
+    uint32_t blocksY = (level.height + pons::BLOCK_SIZE - 1) / pons::BLOCK_SIZE;
+    size_t blockBytes = pons::getBlockBytes(format);
+    std::vector<uint8_t> encoded(size_t{blocksX} * blocksY * blockBytes);
+    for (uint32_t blockY = 0; blockY < blocksY; ++blockY) {
+        pool.submit([&, blockY] {
+            pons::TexelBlock block;
+            for (uint32_t blockX = 0; blockX < blocksX; ++blockX) {
+                for (uint32_t i = 0; i < pons::BLOCK_TEXELS; ++i) {
+                    uint32_t x = std::min(blockX * pons::BLOCK_SIZE + i % pons::BLOCK_SIZE, level.width - 1);
+                    uint32_t y = std::min(blockY * pons::BLOCK_SIZE + i / pons::BLOCK_SIZE, level.height - 1);
+                    for (uint32_t c = 0; c < 4; ++c) {
+                        block.channels[c][i] = stored[(size_t{y} * level.width + x) * 4 + c];
+                    }
+                }
+                pons::encodeBlock(format, block, &encoded[(size_t{blockY} * blocksX + blockX) * blockBytes]);
+            }
+        });
+    }
+    pool.waitIdle();
+    return encoded;
+}
+
+void writeDds(std::ofstream &out, const FormatInfo &format, bool bSrgb, uint32_t width, uint32_t height,
+              const std::vector<std::vector<uint8_t>> &levels) {
+    DdsHeader header{};
+    header.size = sizeof(DdsHeader);
+    header.flags = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000; // caps, size, pixel format, mips, linear size
+    header.height = height;
+    header.width = width;
+    header.pitchOrLinearSize = static_cast<uint32_t>(levels.front().size());
+    header.mipMapCount = static_cast<uint32_t>(levels.size());
+    header.pixelFormat.size = sizeof(DdsPixelFormat);
+    header.pixelFormat.flags = 0x4; // four cc
+    std::memcpy(&header.pixelFormat.fourCC, "DX10", 4);
+    header.caps = 0x1000 | 0x400000 | 0x8; // texture, mipmap, complex
+    DdsHeaderDx10 headerDx10{};
+    headerDx10.dxgiFormat = bSrgb ? format.dxgiSrgbFormat : format.dxgiFormat;
+    headerDx10.resourceDimension = 3; // texture 2d
+    headerDx10.arraySize = 1;
+    out.write("DDS ", 4);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(&headerDx10), sizeof(headerDx10));
+    for (const std::vector<uint8_t> &level : levels) {
+        out.write(reinterpret_cast<const char *>(level.data()), static_cast<std::streamsize>(level.size()));
+    }
+}
+
+void writeKtx(std::ofstream &out, const FormatInfo &format, bool bSrgb, uint32_t width, uint32_t height,
+              const std::vector<std::vector<uint8_t>> &levels) {
+    KtxHeader header{};
+    std::memcpy(header.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER));
+    header.endianness = 0x04030201;
+    header.glTypeSize = 1; // compressed formats have no type or format
+    header.glInternalFormat = bSrgb ? format.glSrgbInternalFormat : format.glInternalFormat;
+    header.glBaseInternalFormat = format.glBaseInternalFormat;
+    header.pixelWidth = width;
+    header.pixelHeight = height;
+    header.numberOfFaces = 1;
+    header.numberOfMipmapLevels = static_cast<uint32_t>(levels.size());
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    // block sizes keep every level 4 byte aligned, no mip padding needed
+    for (const std::vector<uint8_t> &level : levels) {
+        uint32_t imageSize = static_cast<uint32_t>(level.size());
+        out.write(reinterpret_cast<const char *>(&imageSize), sizeof(imageSize));
+        out.write(reinterpret_cast<const char *>(level.data()), static_cast<std::streamsize>(level.size()));
+    }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    std::vector<std::string> args(argv + 1, argv + argc);
+    const FormatInfo *pFormat = &FORMATS[3];
+    bool bLinear = false;
+    bool bNormalMap = false;
+    while (!args.empty() && args.front().starts_with("--")) {
+        if (args.front() == "--format" && args.size() > 1) {
+            auto found = std::find_if(std::begin(FORMATS), std::end(FORMATS),
+                                      [&](const FormatInfo &format) { return args[1] == format.name; });
+            if (found == std::end(FORMATS)) {
+                std::cerr << "unknown format " << args[1] << '\n';
+                return 1;
+            }
+            pFormat = found;
+            args.erase(args.begin());
+        } else if (args.front() == "--linear") {
+            bLinear = true;
+        } else if (args.front() == "--normal") {
+            bLinear = true;
+            bNormalMap = true;
+        } else {
+            break;
+        }
+        args.erase(args.begin());
+    }
+    if (args.size() != 2) {
+        std::cerr << "usage: pons2_cook [--format bc1|bc3|bc5|bc7|astc] [--linear] [--normal] <input.tga|.png> "
+                     "<output.dds|.ktx>\n";
+        return 1;
+    }
+    fs::path inputPath = args[0];
+    fs::path outputPath = args[1];
+    bool bKtx = outputPath.extension() == ".ktx";
+    if (!bKtx && outputPath.extension() != ".dds") {
+        std::cerr << "output has to be a .dds or .ktx file\n";
+        return 1;
+    }
+    if (!bKtx && pFormat->dxgiFormat == 0) {
+        std::cerr << pFormat->name << " can only be written to .ktx\n";
+        return 1;
+    }
+    bool bSrgb = !bLinear && pFormat->glSrgbInternalFormat != 0;
+
+    try {
+        std::vector<uint8_t> file = readFile(inputPath);
+        SourceImage source = inputPath.extension() == ".png" ? loadPng(file) : loadTga(file);
+        if (source.width == 0 || source.height == 0) {
+            throw std::runtime_error("empty image " + inputPath.string());
+        }
+        pons::ThreadPool pool(std::max(std::thread::hardware_concurrency(), 1u));
+        std::vector<std::vector<uint8_t>> levels;
+        FloatImage level = toLinear(source, bSrgb);
+        while (true) {
+            levels.push_back(encodeLevel(pool, level, pFormat->blockFormat, bSrgb));
+            if (level.width == 1 && level.height == 1) {
+                break;
+            }
+            level = downsample(level, bNormalMap);
+        }
+
+        std::ofstream out(outputPath, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) {
+            throw std::runtime_error("failed to create " + outputPath.string());
+        }
+        if (bKtx) {
+            writeKtx(out, *pFormat, bSrgb, source.width, source.height, levels);
+        } else {
+            writeDds(out, *pFormat, bSrgb, source.width, source.height, levels);
+        }
+        if (!out) {
+            throw std::runtime_error("failed to write " + outputPath.string());
+        }
+        size_t encodedSize = 0;
+        for (const std::vector<uint8_t> &encoded : levels) {
+            encodedSize += encoded.size();
+        }
+        std::cout << "cooked " << source.width << 'x' << source.height << ' ' << pFormat->name << (bSrgb ? " srgb" : "")
+                  << ", " << levels.size() << " mips, " << encodedSize << " bytes\n";
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,159 @@
+// Packs a directory tree into a single asset archive readable by pons::Archive.
+// usage: pons2_pack [--compress] <output.pak> <input dir>
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef PONS_HAS_ZLIB
+#include <zlib.h>
+#endif
+
+#include "../src/archive.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// compressed entries that don't save at least this much are stored as is, decoding them isn't worth it
+const double MIN_COMPRESSION_GAIN = 0.1;
+
+struct InputFile {
+    std::string name;
+    fs::path path;
+    uint64_t nameHash;
+};
+
+std::vector<std::byte> readInput(const fs::path &path) {
+    std::ifstream file(path, std::ios::ate | std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("failed to open " + path.string());
+    }
+    std::vector<std::byte> data(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    file.read(reinterpret_cast<char *>(data.data()), static_cast<std::streamsize>(data.size()));
+    return data;
+}
+
+std::vector<std::byte> compress(const std::vector<std::byte> &data) {
+#ifdef PONS_HAS_ZLIB
+    uLongf compressedSize = compressBound(static_cast<uLong>(data.size()));
+    std::vector<std::byte> compressed(compressedSize);
+    int result = compress2(reinterpret_cast<Bytef *>(compressed.data()), &compressedSize,
+                           reinterpret_cast<const Bytef *>(data.data()), static_cast<uLong>(data.size()),
+                           Z_BEST_COMPRESSION);
+    if (result != Z_OK) {
+        return {};
+    }
+    compressed.resize(compressedSize);
+    return compressed;
+#else
+    (void)data;
+    return {};
+#endif
+}
+
+void writePadding(std::ofstream &out, uint64_t alignment) {
+    uint64_t position = static_cast<uint64_t>(out.tellp());
+    uint64_t padding = (alignment - position % alignment) % alignment;
+    static const char zeros[pons::ARCHIVE_ALIGNMENT] = {};
+    out.write(zeros, static_cast<std::streamsize>(padding));
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    std::vector<std::string> args(argv + 1, argv + argc);
+    bool bCompress = false;
+    if (!args.empty() && args.front() == "--compress") {
+        bCompress = true;
+        args.erase(args.begin());
+    }
+    if (args.size() != 2) {
+        std::cerr << "usage: pons2_pack [--compress] <output.pak> <input dir>\n";
+        return 1;
+    }
+    if (bCompress && !pons::isCompressionSupported()) {
+        std::cerr << "built without zlib, storing entries uncompressed\n";
+        bCompress = false;
+    }
+    fs::path outputPath = args[0];
+    fs::path inputDir = args[1];
+
+    try {
+        std::vector<InputFile> inputs;
+        fs::path canonicalOutput = fs::weakly_canonical(outputPath);
+        for (const fs::directory_entry &dirEntry : fs::recursive_directory_iterator(inputDir)) {
+            // don't pack the previous archive into the new one
+            if (!dirEntry.is_regular_file() || fs::weakly_canonical(dirEntry.path()) == canonicalOutput) {
+                continue;
+            }
+            std::string name = fs::relative(dirEntry.path(), inputDir).generic_string();
+            inputs.push_back({name, dirEntry.path(), pons::hashName(name)});
+        }
+        std::sort(inputs.begin(), inputs.end(), [](const InputFile &a, const InputFile &b) {
+            return a.nameHash != b.nameHash ? a.nameHash < b.nameHash : a.name < b.name;
+        });
+
+        std::ofstream out(outputPath, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) {
+            throw std::runtime_error("failed to create " + outputPath.string());
+        }
+        pons::ArchiveHeader header{};
+        std::memcpy(header.magic, pons::ARCHIVE_MAGIC, sizeof(header.magic));
+        header.version = pons::ARCHIVE_VERSION;
+        header.entryCount = static_cast<uint32_t>(inputs.size());
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+        std::vector<pons::ArchiveEntry> entries;
+        std::string names;
+        uint64_t totalSize = 0;
+        uint64_t totalStored = 0;
+        for (const InputFile &input : inputs) {
+            std::vector<std::byte> data = readInput(input.path);
+            pons::ArchiveEntry entry{};
+            entry.nameHash = input.nameHash;
+            entry.size = data.size();
+            entry.contentHash = pons::hashBytes(data);
+            entry.nameOffset = static_cast<uint32_t>(names.size());
+            entry.compression = pons::EntryCompression::None;
+            names += input.name;
+            names += '\0';
+
+            std::vector<std::byte> compressed = bCompress ? compress(data) : std::vector<std::byte>{};
+            double maxCompressedSize = static_cast<double>(data.size()) * (1.0 - MIN_COMPRESSION_GAIN);
+            if (!compressed.empty() && static_cast<double>(compressed.size()) <= maxCompressedSize) {
+                entry.compression = pons::EntryCompression::Zlib;
+                data = std::move(compressed);
+            }
+            writePadding(out, pons::ARCHIVE_ALIGNMENT);
+            entry.offset = static_cast<uint64_t>(out.tellp());
+            entry.storedSize = data.size();
+            out.write(reinterpret_cast<const char *>(data.data()), static_cast<std::streamsize>(data.size()));
+            entries.push_back(entry);
+            totalSize += entry.size;
+            totalStored += entry.storedSize;
+        }
+
+        writePadding(out, alignof(pons::ArchiveEntry));
+        header.tocOffset = static_cast<uint64_t>(out.tellp());
+        header.namesSize = static_cast<uint32_t>(names.size());
+        out.write(reinterpret_cast<const char *>(entries.data()),
+                  static_cast<std::streamsize>(entries.size() * sizeof(pons::ArchiveEntry)));
+        out.write(names.data(), static_cast<std::streamsize>(names.size()));
+        out.seekp(0);
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        if (!out) {
+            throw std::runtime_error("failed to write " + outputPath.string());
+        }
+        std::cout << "packed " << entries.size() << " files, " << totalSize << " -> " << totalStored << " bytes\n";
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+    return 0;
+}